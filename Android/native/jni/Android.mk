@@ -132,6 +132,7 @@ LOCAL_SRC_FILES := \
 	../../src/client/render/plain.cpp              \
 	$(wildcard ../../src/content/*.cpp)            \
 	../../src/database/database.cpp                \
+	../../src/database/database-async.cpp          \
 	../../src/database/database-dummy.cpp          \
 	../../src/database/database-files.cpp          \
 	../../src/database/database-leveldb.cpp        \
@@ -228,6 +229,7 @@ LOCAL_SRC_FILES := \
 	../../src/map.cpp                              \
 	../../src/map_settings_manager.cpp             \
 	../../src/mapblock.cpp                         \
+	../../src/mapblockindex.cpp                    \
 	../../src/mapnode.cpp                          \
 	../../src/mapsector.cpp                        \
 	../../src/metadata.cpp                         \
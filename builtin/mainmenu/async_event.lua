@@ -1,8 +1,7 @@
 -- The main menu may be reloaded when the language is changed
 core.async_jobs = core.async_jobs or {}
 
-local function handle_job(jobid, serialized_retval)
-	local retval = core.deserialize(serialized_retval)
+local function handle_job(jobid, retval)
 	assert(type(core.async_jobs[jobid]) == "function")
 	core.async_jobs[jobid](retval)
 	core.async_jobs[jobid] = nil
@@ -16,15 +15,13 @@ function core.handle_async(func, parameter, callback)
 
 	assert(serialized_func ~= nil)
 
-	-- Serialize parameters
-	local serialized_param = core.serialize(parameter)
+	-- Parameters are packed on the C++ side and fail for unsupported types
+	local ok, jobid = pcall(core.do_async_callback, serialized_func, parameter)
 
-	if serialized_param == nil then
+	if not ok then
 		return false
 	end
 
-	local jobid = core.do_async_callback(serialized_func, serialized_param)
-
 	core.async_jobs[jobid] = callback
 
 	return true
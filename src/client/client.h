@@ -225,6 +225,7 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 	void handleCommand_PlayerSpeed(NetworkPacket *pkt);
 	void handleCommand_MediaPush(NetworkPacket *pkt);
 	void handleCommand_MinimapModes(NetworkPacket *pkt);
+	void handleCommand_ZstdDictionary(NetworkPacket *pkt);
 
 	void ProcessData(NetworkPacket *pkt);
 
@@ -17,6 +17,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <algorithm>
 #include <sstream>
 #include "clientiface.h"
 #include "network/mt_connection.h"
@@ -91,12 +92,10 @@ LuaEntitySAO *getAttachedObject(PlayerSAO *sao, ServerEnvironment *env)
 	return dynamic_cast<LuaEntitySAO *>(ao);
 }
 
-void RemoteClient::GetNextBlocks (
-		ServerEnvironment *env,
-		EmergeManager * emerge,
-		float dtime,
-		std::vector<PrioritySortedBlockTransfer> &dest)
+void RemoteClient::UpdateSendView(ServerEnvironment *env, float dtime)
 {
+	m_view.active = false;
+
 	// Increment timers
 	m_nothing_to_send_pause_timer -= dtime;
 
@@ -151,47 +150,10 @@ void RemoteClient::GetNextBlocks (
 			= LIMITED_MAX_SIMULTANEOUS_BLOCK_SENDS;
 	}
 
-	/*
-		Number of blocks sending + number of blocks selected for sending
-	*/
-	u32 num_blocks_selected = m_blocks_sending.size();
-
-	/*
-		next time d will be continued from the d from which the nearest
-		unsent block was found this time.
-
-		This is because not necessarily any of the blocks found this
-		time are actually sent.
-	*/
-	s32 new_nearest_unsent_d = -1;
-
 	// Get view range and camera fov (radians) from the client
 	s16 wanted_range = sao->getWantedRange() + 1;
 	float camera_fov = sao->getFov();
 
-	/*
-		Get the starting value of the block finder radius.
-	*/
-	if (m_last_center != center) {
-		m_nearest_unsent_d = 0;
-		m_last_center = center;
-	}
-	// reset the unsent distance if the view angle has changed more that 10% of the fov
-	// (this matches isBlockInSight which allows for an extra 10%)
-	if (camera_dir.dotProduct(m_last_camera_dir) < std::cos(camera_fov * 0.1f)) {
-		m_nearest_unsent_d = 0;
-		m_last_camera_dir = camera_dir;
-	}
-	if (m_nearest_unsent_d > 0) {
-		// make sure any blocks modified since the last time we sent blocks are resent
-		for (const v3s16 &p : m_blocks_modified) {
-			m_nearest_unsent_d = std::min(m_nearest_unsent_d, center.getDistanceFrom(p));
-		}
-	}
-	m_blocks_modified.clear();
-
-	s16 d_start = m_nearest_unsent_d;
-
 	// Distrust client-sent FOV and get server-set player object property
 	// zoom FOV (degrees) as a check to avoid hacked clients using FOV to load
 	// distant world.
@@ -202,19 +164,22 @@ void RemoteClient::GetNextBlocks (
 
 	const s16 full_d_max = std::min(adjustDist(m_max_send_distance, prop_zoom_fov),
 		wanted_range);
-	const s16 d_opt = std::min(adjustDist(m_block_optimize_distance, prop_zoom_fov),
-		wanted_range);
-	const s16 d_blocks_in_sight = full_d_max * BS * MAP_BLOCKSIZE;
 
-	s16 d_max_gen = std::min(adjustDist(m_max_gen_distance, prop_zoom_fov),
-		wanted_range);
-
-	s16 d_max = full_d_max;
-
-	// Don't loop very much at a time
-	s16 max_d_increment_at_time = 2;
-	if (d_max > d_start + max_d_increment_at_time)
-		d_max = d_start + max_d_increment_at_time;
+	/*
+		The blocks to send are rebuilt when the player enters another block,
+		the view range changes, or the view angle has changed more that 10%
+		of the fov (this matches isBlockInSight which allows for an extra 10%)
+	*/
+	if (m_last_center != center) {
+		m_frontier_valid = false;
+		m_last_center = center;
+	}
+	if (camera_dir.dotProduct(m_last_camera_dir) < std::cos(camera_fov * 0.1f)) {
+		m_frontier_valid = false;
+		m_last_camera_dir = camera_dir;
+	}
+	if (m_view.full_d_max != full_d_max)
+		m_frontier_valid = false;
 
 	// cos(angle between velocity and camera) * |velocity|
 	// Limit to 0.0f in case player moves backwards.
@@ -224,175 +189,260 @@ void RemoteClient::GetNextBlocks (
 	// limit max fov effect to 50%, 60% at 20n/s fly speed
 	camera_fov = camera_fov / (1 + dot / 300.0f);
 
-	s32 nearest_emerged_d = -1;
-	s32 nearest_emergefull_d = -1;
-	s32 nearest_sent_d = -1;
-	//bool queue_is_full = false;
+	m_view.active = true;
+	m_view.center = center;
+	m_view.camera_pos = camera_pos;
+	m_view.camera_dir = camera_dir;
+	m_view.camera_fov = camera_fov;
+	m_view.moving = playerspeed.getLength() > 1.0f * BS;
+	m_view.playerspeeddir = playerspeeddir;
+	m_view.max_simul_sends_usually = max_simul_sends_usually;
+	m_view.full_d_max = full_d_max;
+	m_view.d_opt = std::min(adjustDist(m_block_optimize_distance, prop_zoom_fov),
+		wanted_range);
+	m_view.d_max_gen = std::min(adjustDist(m_max_gen_distance, prop_zoom_fov),
+		wanted_range);
+}
+
+bool RemoteClient::isFrontierCandidate(v3s16 p) const
+{
+	/*
+		Do not go over max mapgen limit
+	*/
+	if (blockpos_over_max_limit(p))
+		return false;
+
+	/*
+		Don't generate or send if not in sight
+		FIXME This only works if the client uses a small enough
+		FOV setting. The default of 72 degrees is fine.
+		Also retrieve a smaller view cone in the direction of the player's
+		movement.
+		(0.1 is about 4 degrees)
+	*/
+	const f32 d_blocks_in_sight = m_view.full_d_max * BS * MAP_BLOCKSIZE;
+	if (!(isBlockInSight(p, m_view.camera_pos, m_view.camera_dir,
+				m_view.camera_fov, d_blocks_in_sight) ||
+			(m_view.moving &&
+			isBlockInSight(p, m_view.camera_pos, m_view.playerspeeddir, 0.1f,
+				d_blocks_in_sight))))
+		return false;
+
+	/*
+		Don't send already sent blocks
+	*/
+	return m_blocks_sent.find(p) == m_blocks_sent.end();
+}
+
+void RemoteClient::UpdateSendFrontier()
+{
+	if (!m_view.active)
+		return;
+
+	if (m_frontier_valid) {
+		// make sure any blocks modified since the last time we sent blocks are resent
+		for (const v3s16 &p : m_blocks_modified) {
+			v3s16 offset = p - m_view.center;
+			s16 d = std::max(std::abs(offset.X),
+				std::max(std::abs(offset.Y), std::abs(offset.Z)));
+			if (d > m_view.full_d_max)
+				continue;
+
+			auto by_d = [] (const FrontierBlock &a, const FrontierBlock &b) {
+				return a.d < b.d;
+			};
+			FrontierBlock block = {p, d};
+			auto range = std::equal_range(m_frontier.begin(), m_frontier.end(),
+				block, by_d);
+			auto it = std::find_if(range.first, range.second,
+				[&p] (const FrontierBlock &b) { return b.p == p; });
+			if (it == range.second) {
+				if (!isFrontierCandidate(p))
+					continue;
+				it = m_frontier.insert(range.second, block);
+			}
+			m_frontier_pos = std::min<size_t>(m_frontier_pos, it - m_frontier.begin());
+		}
+		m_blocks_modified.clear();
+		return;
+	}
 
-	const v3s16 cam_pos_nodes = floatToInt(camera_pos, BS);
+	m_blocks_modified.clear();
+	m_frontier.clear();
+	m_frontier_pos = 0;
 
-	s16 d;
-	for (d = d_start; d <= d_max; d++) {
+	for (s16 d = 0; d <= m_view.full_d_max; d++) {
 		/*
 			Get the border/face dot coordinates of a "d-radiused"
 			box
 		*/
-		std::vector<v3s16> list = FacePositionCache::getFacePositions(d);
+		const std::vector<v3s16> &list = FacePositionCache::getFacePositions(d);
+		for (const v3s16 &offset : list) {
+			v3s16 p = offset + m_view.center;
+			if (isFrontierCandidate(p))
+				m_frontier.push_back({p, d});
+		}
+	}
 
-		std::vector<v3s16>::iterator li;
-		for (li = list.begin(); li != list.end(); ++li) {
-			v3s16 p = *li + center;
+	m_frontier_valid = true;
+}
 
-			/*
-				Send throttling
-				- Don't allow too many simultaneous transfers
-				- EXCEPT when the blocks are very close
+void RemoteClient::GetNextBlocks (
+		ServerEnvironment *env,
+		EmergeManager * emerge,
+		std::vector<PrioritySortedBlockTransfer> &dest)
+{
+	if (!m_view.active)
+		return;
 
-				Also, don't send blocks that are already flying.
-			*/
+	/*
+		Number of blocks sending + number of blocks selected for sending
+	*/
+	u32 num_blocks_selected = m_blocks_sending.size();
 
-			// Start with the usual maximum
-			u16 max_simul_dynamic = max_simul_sends_usually;
+	/*
+		next time the scan will be continued from the block from which the
+		nearest unsent block was found this time.
 
-			// If block is very close, allow full maximum
-			if (d <= BLOCK_SEND_DISABLE_LIMITS_MAX_D)
-				max_simul_dynamic = m_max_simul_sends;
+		This is because not necessarily any of the blocks found this
+		time are actually sent.
+	*/
+	const size_t none = m_frontier.size();
+	size_t nearest_emerged = none;
+	size_t nearest_emergefull = none;
+	size_t nearest_sent = none;
 
-			// Don't select too many blocks for sending
-			if (num_blocks_selected >= max_simul_dynamic) {
-				//queue_is_full = true;
-				goto queue_full_break;
-			}
+	// Don't loop very much at a time
+	s16 max_d_increment_at_time = 2;
+	s16 d_max = m_frontier_pos < m_frontier.size() ?
+		m_frontier[m_frontier_pos].d + max_d_increment_at_time : 0;
 
-			// Don't send blocks that are currently being transferred
-			if (m_blocks_sending.find(p) != m_blocks_sending.end())
-				continue;
+	const v3s16 cam_pos_nodes = floatToInt(m_view.camera_pos, BS);
 
-			/*
-				Do not go over max mapgen limit
-			*/
-			if (blockpos_over_max_limit(p))
-				continue;
+	size_t i;
+	for (i = m_frontier_pos; i < m_frontier.size(); i++) {
+		const v3s16 p = m_frontier[i].p;
+		const s16 d = m_frontier[i].d;
+		if (d > d_max)
+			break;
 
-			// If this is true, inexistent block will be made from scratch
-			bool generate = d <= d_max_gen;
+		/*
+			Send throttling
+			- Don't allow too many simultaneous transfers
+			- EXCEPT when the blocks are very close
 
-			/*
-				Don't generate or send if not in sight
-				FIXME This only works if the client uses a small enough
-				FOV setting. The default of 72 degrees is fine.
-				Also retrieve a smaller view cone in the direction of the player's
-				movement.
-				(0.1 is about 4 degrees)
-			*/
-			f32 dist;
-			if (!(isBlockInSight(p, camera_pos, camera_dir, camera_fov,
-						d_blocks_in_sight, &dist) ||
-					(playerspeed.getLength() > 1.0f * BS &&
-					isBlockInSight(p, camera_pos, playerspeeddir, 0.1f,
-						d_blocks_in_sight)))) {
-				continue;
-			}
+			Also, don't send blocks that are already flying.
+		*/
 
-			/*
-				Don't send already sent blocks
-			*/
-			if (m_blocks_sent.find(p) != m_blocks_sent.end())
-				continue;
+		// Start with the usual maximum
+		u16 max_simul_dynamic = m_view.max_simul_sends_usually;
+
+		// If block is very close, allow full maximum
+		if (d <= BLOCK_SEND_DISABLE_LIMITS_MAX_D)
+			max_simul_dynamic = m_max_simul_sends;
+
+		// Don't select too many blocks for sending
+		if (num_blocks_selected >= max_simul_dynamic)
+			break;
+
+		// Don't send blocks that are currently being transferred,
+		// or that have been sent since the list was built
+		if (m_blocks_sending.find(p) != m_blocks_sending.end() ||
+				m_blocks_sent.find(p) != m_blocks_sent.end())
+			continue;
+
+		// If this is true, inexistent block will be made from scratch
+		bool generate = d <= m_view.d_max_gen;
+
+		/*
+			Check if map has this block
+		*/
+		MapBlock *block = env->getMap().getBlockNoCreateNoEx(p);
+
+		bool block_not_found = false;
+		if (block) {
+			// Reset usage timer, this block will be of use in the future.
+			block->resetUsageTimer();
+
+			// Check whether the block exists (with data)
+			if (block->isDummy() || !block->isGenerated())
+				block_not_found = true;
 
 			/*
-				Check if map has this block
+				If block is not close, don't send it unless it is near
+				ground level.
+
+				Block is near ground level if night-time mesh
+				differs from day-time mesh.
 			*/
-			MapBlock *block = env->getMap().getBlockNoCreateNoEx(p);
-
-			bool block_not_found = false;
-			if (block) {
-				// Reset usage timer, this block will be of use in the future.
-				block->resetUsageTimer();
-
-				// Check whether the block exists (with data)
-				if (block->isDummy() || !block->isGenerated())
-					block_not_found = true;
-
-				/*
-					If block is not close, don't send it unless it is near
-					ground level.
-
-					Block is near ground level if night-time mesh
-					differs from day-time mesh.
-				*/
-				if (d >= d_opt) {
-					if (!block->getIsUnderground() && !block->getDayNightDiff())
-						continue;
-				}
-
-				if (m_occ_cull && !block_not_found &&
-						env->getMap().isBlockOccluded(block, cam_pos_nodes)) {
+			if (d >= m_view.d_opt) {
+				if (!block->getIsUnderground() && !block->getDayNightDiff())
 					continue;
-				}
 			}
 
-			/*
-				If block has been marked to not exist on disk (dummy) or is
-				not generated and generating new ones is not wanted, skip block.
-			*/
-			if (!generate && block_not_found) {
-				// get next one.
+			if (m_occ_cull && !block_not_found &&
+					env->getMap().isBlockOccluded(block, cam_pos_nodes)) {
 				continue;
 			}
+		}
 
-			/*
-				Add inexistent block to emerge queue.
-			*/
-			if (block == NULL || block_not_found) {
-				if (emerge->enqueueBlockEmerge(peer_id, p, generate)) {
-					if (nearest_emerged_d == -1)
-						nearest_emerged_d = d;
-				} else {
-					if (nearest_emergefull_d == -1)
-						nearest_emergefull_d = d;
-					goto queue_full_break;
-				}
-
-				// get next one.
-				continue;
+		/*
+			If block has been marked to not exist on disk (dummy) or is
+			not generated and generating new ones is not wanted, skip block.
+		*/
+		if (!generate && block_not_found) {
+			// get next one.
+			continue;
+		}
+
+		/*
+			Add inexistent block to emerge queue.
+		*/
+		if (block == NULL || block_not_found) {
+			if (emerge->enqueueBlockEmerge(peer_id, p, generate)) {
+				if (nearest_emerged == none)
+					nearest_emerged = i;
+			} else {
+				if (nearest_emergefull == none)
+					nearest_emergefull = i;
+				break;
 			}
 
-			if (nearest_sent_d == -1)
-				nearest_sent_d = d;
+			// get next one.
+			continue;
+		}
+
+		if (nearest_sent == none)
+			nearest_sent = i;
 
-			/*
-				Add block to send queue
-			*/
-			PrioritySortedBlockTransfer q((float)dist, p, peer_id);
+		/*
+			Add block to send queue
+		*/
+		v3f blockpos_center = intToFloat(p * MAP_BLOCKSIZE +
+			v3s16(1, 1, 1) * (MAP_BLOCKSIZE / 2), BS);
+		float dist = (blockpos_center - m_view.camera_pos).getLength();
+		PrioritySortedBlockTransfer q(dist, p, peer_id);
 
-			dest.push_back(q);
+		dest.push_back(q);
 
-			num_blocks_selected += 1;
-		}
+		num_blocks_selected += 1;
 	}
-queue_full_break:
 
 	// If nothing was found for sending and nothing was queued for
 	// emerging, continue next time browsing from here
-	if (nearest_emerged_d != -1) {
-		new_nearest_unsent_d = nearest_emerged_d;
-	} else if (nearest_emergefull_d != -1) {
-		new_nearest_unsent_d = nearest_emergefull_d;
+	if (nearest_emerged != none) {
+		m_frontier_pos = nearest_emerged;
+	} else if (nearest_emergefull != none) {
+		m_frontier_pos = nearest_emergefull;
+	} else if (i >= m_frontier.size()) {
+		// Everything in sight was handled, look again in a while
+		m_frontier_valid = false;
+		m_nothing_to_send_pause_timer = 2.0f;
+	} else if (nearest_sent != none) {
+		m_frontier_pos = nearest_sent;
 	} else {
-		if (d > full_d_max) {
-			new_nearest_unsent_d = 0;
-			m_nothing_to_send_pause_timer = 2.0f;
-		} else {
-			if (nearest_sent_d != -1)
-				new_nearest_unsent_d = nearest_sent_d;
-			else
-				new_nearest_unsent_d = d;
-		}
+		m_frontier_pos = i;
 	}
-
-	if (new_nearest_unsent_d != -1)
-		m_nearest_unsent_d = new_nearest_unsent_d;
 }
 
 void RemoteClient::GotBlock(v3s16 p)
@@ -33,6 +33,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <set>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 
 class MapBlock;
 class ServerEnvironment;
@@ -253,12 +255,22 @@ class RemoteClient
 	~RemoteClient() = default;
 
 	/*
-		Finds block that should be sent next to the client.
-		Environment should be locked when this is called.
-		dtime is used for resetting send radius at slow interval
+		Finding the blocks that should be sent next to the client is done
+		in three steps:
+		- UpdateSendView() takes the player's position and view from the
+		  environment, which should be locked when this is called.
+		  dtime is used for resetting send radius at slow interval
+		- UpdateSendFrontier() rebuilds the list of unsent blocks in sight
+		  if the view changed enough. It does not touch the environment,
+		  which does not need to be locked.
+		- GetNextBlocks() continues through that list, picking blocks that
+		  are in the map and queueing the others for emerging.
+		  Environment should be locked when this is called.
 	*/
+	void UpdateSendView(ServerEnvironment *env, float dtime);
+	void UpdateSendFrontier();
 	void GetNextBlocks(ServerEnvironment *env, EmergeManager* emerge,
-			float dtime, std::vector<PrioritySortedBlockTransfer> &dest);
+			std::vector<PrioritySortedBlockTransfer> &dest);
 
 	void GotBlock(v3s16 p);
 
@@ -292,7 +304,8 @@ class RemoteClient
 		o<<"RemoteClient "<<peer_id<<": "
 				<<"m_blocks_sent.size()="<<m_blocks_sent.size()
 				<<", m_blocks_sending.size()="<<m_blocks_sending.size()
-				<<", m_nearest_unsent_d="<<m_nearest_unsent_d
+				<<", m_frontier_pos="<<m_frontier_pos
+				<<"/"<<m_frontier.size()
 				<<", m_excess_gotblocks="<<m_excess_gotblocks
 				<<std::endl;
 		m_excess_gotblocks = 0;
@@ -384,11 +397,41 @@ class RemoteClient
 		List of block positions.
 		No MapBlock* is stored here because the blocks can get deleted.
 	*/
-	std::set<v3s16> m_blocks_sent;
-	s16 m_nearest_unsent_d = 0;
+	std::unordered_set<v3s16> m_blocks_sent;
 	v3s16 m_last_center;
 	v3f m_last_camera_dir;
 
+	// The player's view as of the last UpdateSendView()
+	struct SendView {
+		// false if nothing is to be sent this time
+		bool active = false;
+		v3s16 center;
+		v3f camera_pos;
+		v3f camera_dir;
+		float camera_fov = 0.0f;
+		bool moving = false;
+		v3f playerspeeddir;
+		u16 max_simul_sends_usually = 0;
+		s16 full_d_max = 0;
+		s16 d_opt = 0;
+		s16 d_max_gen = 0;
+	} m_view;
+
+	/*
+		Unsent blocks in sight, ordered by distance ("d-radiused" box).
+		Kept between steps until the view changes enough, GetNextBlocks()
+		continues from m_frontier_pos.
+	*/
+	struct FrontierBlock {
+		v3s16 p;
+		s16 d;
+	};
+	std::vector<FrontierBlock> m_frontier;
+	size_t m_frontier_pos = 0;
+	bool m_frontier_valid = false;
+
+	bool isFrontierCandidate(v3s16 p) const;
+
 	const u16 m_max_simul_sends;
 	const float m_min_time_from_building;
 	const s16 m_max_send_distance;
@@ -404,7 +447,7 @@ class RemoteClient
 		Block is removed when GOTBLOCKS is received.
 		Value is time from sending. (not used at the moment)
 	*/
-	std::map<v3s16, float> m_blocks_sending;
+	std::unordered_map<v3s16, float> m_blocks_sending;
 
 	/*
 		Blocks that have been modified since blocks were
@@ -414,7 +457,7 @@ class RemoteClient
 
 		List of block positions.
 	*/
-	std::set<v3s16> m_blocks_modified;
+	std::unordered_set<v3s16> m_blocks_modified;
 
 	/*
 		Count of excess GotBlocks().
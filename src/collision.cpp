@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "collision.h"
+#include <algorithm>
 #include <cmath>
 #include "mapblock.h"
 #include "map.h"
@@ -285,69 +286,99 @@ collisionMoveResult collisionMoveSimple(Environment *env, IGameDef *gamedef,
 	v3s16 max = floatToInt(maxpos_f + box_0.MaxEdge, BS) + v3s16(1, 1, 1);
 
 	bool any_position_valid = false;
+	const NodeDefManager *nodedef = gamedef->getNodeDefManager();
+	const aabb3f cube(-BS / 2, -BS / 2, -BS / 2, BS / 2, BS / 2, BS / 2);
 
+	// The boxes come from the cache of the block, which is rebuilt only
+	// when the block was modified
+	v3s16 last_blockpos(S16_MAX, S16_MAX, S16_MAX);
+	const MapBlock::CollisionBoxes *block_boxes = nullptr;
+
+	std::vector<aabb3f> nodeboxes;
 	v3s16 p;
 	for (p.X = min.X; p.X <= max.X; p.X++)
 	for (p.Y = min.Y; p.Y <= max.Y; p.Y++)
 	for (p.Z = min.Z; p.Z <= max.Z; p.Z++) {
-		bool is_position_valid;
-		MapNode n = map->getNode(p, &is_position_valid);
-
-		if (is_position_valid && n.getContent() != CONTENT_IGNORE) {
-			// Object collides into walkable nodes
+		v3s16 blockpos = getNodeBlockPos(p);
+		if (blockpos != last_blockpos) {
+			last_blockpos = blockpos;
+			MapBlock *block = map->getBlockNoCreateNoEx(blockpos);
+			block_boxes = block ? &block->getCollisionBoxes(nodedef) : nullptr;
+		}
 
-			any_position_valid = true;
-			const NodeDefManager *nodedef = gamedef->getNodeDefManager();
-			const ContentFeatures &f = nodedef->get(n);
+		v3s16 relpos = p - blockpos * MAP_BLOCKSIZE;
+		u32 i = relpos.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE +
+				relpos.Y * MAP_BLOCKSIZE + relpos.X;
 
-			if (!f.walkable)
-				continue;
+		if (!block_boxes || block_boxes->ignore[i]) {
+			// Collide with unloaded nodes (position invalid) and loaded
+			// CONTENT_IGNORE nodes (position valid)
+			aabb3f box = getNodeBox(p, BS);
+			cinfo.emplace_back(true, 0, p, box);
+			continue;
+		}
 
+		// Object collides into walkable nodes
+		any_position_valid = true;
+
+		// Calculate float position only once
+		v3f posf = intToFloat(p, BS);
+
+		if (block_boxes->cube[i]) {
+			aabb3f box = cube;
+			box.MinEdge += posf;
+			box.MaxEdge += posf;
+			cinfo.emplace_back(false, 0, p, box);
+		} else if (block_boxes->shaped[i]) {
+			size_t n = std::lower_bound(block_boxes->shaped_index.begin(),
+					block_boxes->shaped_index.end(), i) -
+					block_boxes->shaped_index.begin();
+			int n_bouncy_value = block_boxes->shaped_bouncy[n];
+			for (u32 j = block_boxes->shaped_first[n];
+					j < block_boxes->shaped_first[n + 1]; j++) {
+				aabb3f box = block_boxes->boxes[j];
+				box.MinEdge += posf;
+				box.MaxEdge += posf;
+				cinfo.emplace_back(false, n_bouncy_value, p, box);
+			}
+		} else if (block_boxes->connected[i]) {
+			MapNode n = map->getNode(p);
+			const ContentFeatures &f = nodedef->get(n);
 			int n_bouncy_value = itemgroup_get(f.groups, "bouncy");
 
 			int neighbors = 0;
-			if (f.drawtype == NDT_NODEBOX &&
-				f.node_box.type == NODEBOX_CONNECTED) {
-				v3s16 p2 = p;
+			v3s16 p2 = p;
 
-				p2.Y++;
-				getNeighborConnectingFace(p2, nodedef, map, n, 1, &neighbors);
+			p2.Y++;
+			getNeighborConnectingFace(p2, nodedef, map, n, 1, &neighbors);
 
-				p2 = p;
-				p2.Y--;
-				getNeighborConnectingFace(p2, nodedef, map, n, 2, &neighbors);
+			p2 = p;
+			p2.Y--;
+			getNeighborConnectingFace(p2, nodedef, map, n, 2, &neighbors);
 
-				p2 = p;
-				p2.Z--;
-				getNeighborConnectingFace(p2, nodedef, map, n, 4, &neighbors);
+			p2 = p;
+			p2.Z--;
+			getNeighborConnectingFace(p2, nodedef, map, n, 4, &neighbors);
 
-				p2 = p;
-				p2.X--;
-				getNeighborConnectingFace(p2, nodedef, map, n, 8, &neighbors);
+			p2 = p;
+			p2.X--;
+			getNeighborConnectingFace(p2, nodedef, map, n, 8, &neighbors);
 
-				p2 = p;
-				p2.Z++;
-				getNeighborConnectingFace(p2, nodedef, map, n, 16, &neighbors);
+			p2 = p;
+			p2.Z++;
+			getNeighborConnectingFace(p2, nodedef, map, n, 16, &neighbors);
 
-				p2 = p;
-				p2.X++;
-				getNeighborConnectingFace(p2, nodedef, map, n, 32, &neighbors);
-			}
-			std::vector<aabb3f> nodeboxes;
-			n.getCollisionBoxes(gamedef->ndef(), &nodeboxes, neighbors);
+			p2 = p;
+			p2.X++;
+			getNeighborConnectingFace(p2, nodedef, map, n, 32, &neighbors);
 
-			// Calculate float position only once
-			v3f posf = intToFloat(p, BS);
+			nodeboxes.clear();
+			n.getCollisionBoxes(nodedef, &nodeboxes, neighbors);
 			for (auto box : nodeboxes) {
 				box.MinEdge += posf;
 				box.MaxEdge += posf;
 				cinfo.emplace_back(false, n_bouncy_value, p, box);
 			}
-		} else {
-			// Collide with unloaded nodes (position invalid) and loaded
-			// CONTENT_IGNORE nodes (position valid)
-			aabb3f box = getNodeBox(p, BS);
-			cinfo.emplace_back(true, 0, p, box);
 		}
 	}
 
@@ -458,6 +489,16 @@ collisionMoveResult collisionMoveSimple(Environment *env, IGameDef *gamedef,
 		f32 nearest_dtime = dtime;
 		int nearest_boxindex = -1;
 
+		// Boxes outside of the volume swept by the moving box cannot be
+		// touched in this step. The margin covers rounding errors.
+		aabb3f sweptbox = movingbox;
+		v3f movement = *speed_f * dtime;
+		sweptbox.addInternalPoint(movingbox.MinEdge + movement);
+		sweptbox.addInternalPoint(movingbox.MaxEdge + movement);
+		const f32 margin = 0.01f * BS;
+		sweptbox.MinEdge -= v3f(margin, margin, margin);
+		sweptbox.MaxEdge += v3f(margin, margin, margin);
+
 		/*
 			Go through every nodebox, find nearest collision
 		*/
@@ -467,6 +508,9 @@ collisionMoveResult collisionMoveSimple(Environment *env, IGameDef *gamedef,
 			if (box_info.is_step_up)
 				continue;
 
+			if (!box_info.box.intersectsWithBox(sweptbox))
+				continue;
+
 			// Find nearest collision of the two boxes (raytracing-like)
 			f32 dtime_tmp = nearest_dtime;
 			CollisionAxis collided = axisAlignedCollision(box_info.box,
@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <sstream>
 #include <set>
 #include <algorithm>
+#include <functional>
 #include "gamedef.h"
 #include "inventory.h"
 #include "util/serialize.h"
@@ -462,6 +463,11 @@ void CraftDefinitionShaped::initHash(IGameDef *gamedef)
 		hash_type = CRAFT_HASH_TYPE_ITEM_NAMES;
 }
 
+std::vector<std::string> CraftDefinitionShaped::getRecipeNames() const
+{
+	return recipe_names;
+}
+
 std::string CraftDefinitionShaped::dump() const
 {
 	std::ostringstream os(std::ios::binary);
@@ -581,6 +587,11 @@ void CraftDefinitionShapeless::initHash(IGameDef *gamedef)
 		hash_type = CRAFT_HASH_TYPE_ITEM_NAMES;
 }
 
+std::vector<std::string> CraftDefinitionShapeless::getRecipeNames() const
+{
+	return recipe_names;
+}
+
 std::string CraftDefinitionShapeless::dump() const
 {
 	std::ostringstream os(std::ios::binary);
@@ -783,6 +794,11 @@ void CraftDefinitionCooking::initHash(IGameDef *gamedef)
 		hash_type = CRAFT_HASH_TYPE_ITEM_NAMES;
 }
 
+std::vector<std::string> CraftDefinitionCooking::getRecipeNames() const
+{
+	return std::vector<std::string>(1, recipe_name);
+}
+
 std::string CraftDefinitionCooking::dump() const
 {
 	std::ostringstream os(std::ios::binary);
@@ -803,7 +819,7 @@ CraftDefinitionFuel::CraftDefinitionFuel(
 		const CraftReplacements &replacements_):
 	recipe(recipe_), burntime(burntime_), replacements(replacements_)
 {
-	if (isGroupRecipeStr(recipe_name))
+	if (isGroupRecipeStr(recipe))
 		priority = PRIORITY_SHAPELESS_AND_GROUPS;
 	else
 		priority = PRIORITY_SHAPELESS;
@@ -885,6 +901,11 @@ void CraftDefinitionFuel::initHash(IGameDef *gamedef)
 		hash_type = CRAFT_HASH_TYPE_ITEM_NAMES;
 }
 
+std::vector<std::string> CraftDefinitionFuel::getRecipeNames() const
+{
+	return std::vector<std::string>(1, recipe_name);
+}
+
 std::string CraftDefinitionFuel::dump() const
 {
 	std::ostringstream os(std::ios::binary);
@@ -927,7 +948,37 @@ class CCraftDefManager: public IWritableCraftDefManager
 		CraftDefinition::RecipePriority priority_best =
 			CraftDefinition::PRIORITY_NO_RECIPE;
 		CraftDefinition *def_best = nullptr;
+		auto check_def = [&] (CraftDefinition *def) {
+			/*errorstream << "Checking " << input.dump() << std::endl
+				<< " against " << def->dump() << std::endl;*/
+
+			CraftDefinition::RecipePriority priority = def->getPriority();
+			if (priority > priority_best
+					&& def->check(input, gamedef)) {
+				// Check if the crafted node/item exists
+				CraftOutput out = def->getOutput(input, gamedef);
+				ItemStack is;
+				is.deSerialize(out.item, gamedef->idef());
+				if (!is.isKnown(gamedef->idef())) {
+					infostream << "trying to craft non-existent "
+						<< out.item << ", ignoring recipe" << std::endl;
+					return;
+				}
+
+				output = out;
+				priority_best = priority;
+				def_best = def;
+			}
+		};
+
 		for (int type = 0; type <= craft_hash_type_max; type++) {
+			// Recipes with groups are tried after the ones without
+			if (type == CRAFT_HASH_TYPE_COUNT) {
+				std::vector<u32> candidates = getGroupCandidates(input_names);
+				for (u32 index : candidates)
+					check_def(m_group_defs[index]);
+			}
+
 			u64 hash = getHashForGrid((CraftHashType) type, input_names);
 
 			/*errorstream << "Checking type " << type << " with hash " << hash << std::endl;*/
@@ -944,28 +995,7 @@ class CCraftDefManager: public IWritableCraftDefManager
 			// definitions can override earlier ones.
 			for (std::vector<CraftDefinition*>::size_type
 					i = hash_collisions.size(); i > 0; i--) {
-				CraftDefinition *def = hash_collisions[i - 1];
-
-				/*errorstream << "Checking " << input.dump() << std::endl
-					<< " against " << def->dump() << std::endl;*/
-
-				CraftDefinition::RecipePriority priority = def->getPriority();
-				if (priority > priority_best
-						&& def->check(input, gamedef)) {
-					// Check if the crafted node/item exists
-					CraftOutput out = def->getOutput(input, gamedef);
-					ItemStack is;
-					is.deSerialize(out.item, gamedef->idef());
-					if (!is.isKnown(gamedef->idef())) {
-						infostream << "trying to craft non-existent "
-							<< out.item << ", ignoring recipe" << std::endl;
-						continue;
-					}
-
-					output = out;
-					priority_best = priority;
-					def_best = def;
-				}
+				check_def(hash_collisions[i - 1]);
 			}
 		}
 		if (priority_best == CraftDefinition::PRIORITY_NO_RECIPE)
@@ -1062,6 +1092,8 @@ class CCraftDefManager: public IWritableCraftDefManager
 				}
 			}
 		}
+		for (CraftDefinition *def : m_group_defs)
+			os << "groups def " << def->dump() << "\n";
 		return os.str();
 	}
 	virtual void registerCraft(CraftDefinition *def, IGameDef *gamedef)
@@ -1086,10 +1118,19 @@ class CCraftDefManager: public IWritableCraftDefManager
 			}
 			m_craft_defs[type].clear();
 		}
+		for (CraftDefinition *def : m_group_defs)
+			delete def;
+		m_group_defs.clear();
+		m_group_index.clear();
 		m_output_craft_definitions.clear();
 	}
 	virtual void initHashes(IGameDef *gamedef)
 	{
+		// Items matching each group recipe element, e.g. "group:wood"
+		std::set<std::string> all_items;
+		gamedef->idef()->getAll(all_items);
+		std::unordered_map<std::string, std::vector<std::string> > group_items;
+
 		// Move the CraftDefs from the unhashed layer into layers higher up.
 		std::vector<CraftDefinition *> &unhashed =
 			m_craft_defs[(int) CRAFT_HASH_TYPE_UNHASHED][0];
@@ -1097,6 +1138,11 @@ class CCraftDefManager: public IWritableCraftDefManager
 			// Initialize and get the definition's hash
 			def->initHash(gamedef);
 			CraftHashType type = def->getHashType();
+
+			if (type == CRAFT_HASH_TYPE_COUNT &&
+					indexGroupRecipe(def, all_items, group_items, gamedef))
+				continue;
+
 			u64 hash = def->getHash(type);
 
 			// Enter the definition
@@ -1105,10 +1151,77 @@ class CCraftDefManager: public IWritableCraftDefManager
 		unhashed.clear();
 	}
 private:
+	// Indexes a recipe with groups by the items its most specific element
+	// accepts, as any matching input contains one of them.
+	// Returns false if the recipe has no elements, e.g. tool repair.
+	bool indexGroupRecipe(CraftDefinition *def,
+			const std::set<std::string> &all_items,
+			std::unordered_map<std::string, std::vector<std::string> > &group_items,
+			IGameDef *gamedef)
+	{
+		const std::vector<std::string> *anchor = nullptr;
+		std::vector<std::string> anchor_name;
+		for (const std::string &name : def->getRecipeNames()) {
+			if (name.empty())
+				continue;
+			if (!isGroupRecipeStr(name)) {
+				// Nothing is more specific than a single item
+				anchor_name.assign(1, name);
+				anchor = &anchor_name;
+				break;
+			}
+
+			auto it = group_items.find(name);
+			if (it == group_items.end()) {
+				it = group_items.emplace(name, std::vector<std::string>()).first;
+				for (const std::string &item : all_items) {
+					if (inputItemMatchesRecipe(item, name, gamedef->idef()))
+						it->second.push_back(item);
+				}
+			}
+			if (!anchor || it->second.size() < anchor->size())
+				anchor = &it->second;
+		}
+		if (!anchor)
+			return false;
+
+		u32 index = m_group_defs.size();
+		m_group_defs.push_back(def);
+		for (const std::string &item : *anchor)
+			m_group_index[item].push_back(index);
+		return true;
+	}
+
+	// Recipes with groups that may match the sorted input names,
+	// latest registered first
+	std::vector<u32> getGroupCandidates(
+			const std::vector<std::string> &input_names) const
+	{
+		std::vector<u32> candidates;
+		for (size_t i = 0; i < input_names.size(); i++) {
+			if (input_names[i].empty() ||
+					(i > 0 && input_names[i] == input_names[i - 1]))
+				continue;
+
+			auto it = m_group_index.find(input_names[i]);
+			if (it != m_group_index.end())
+				candidates.insert(candidates.end(),
+					it->second.begin(), it->second.end());
+		}
+		std::sort(candidates.begin(), candidates.end(), std::greater<u32>());
+		candidates.erase(std::unique(candidates.begin(), candidates.end()),
+			candidates.end());
+		return candidates;
+	}
+
 	std::vector<std::unordered_map<u64, std::vector<CraftDefinition*> > >
 		m_craft_defs;
 	std::unordered_map<std::string, std::vector<CraftDefinition*> >
 		m_output_craft_definitions;
+	// Recipes with groups, in order of registration
+	std::vector<CraftDefinition *> m_group_defs;
+	// Indices into m_group_defs, by the items that can match them
+	std::unordered_map<std::string, std::vector<u32> > m_group_index;
 };
 
 IWritableCraftDefManager* createCraftDefManager()
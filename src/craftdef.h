@@ -179,6 +179,12 @@ class CraftDefinition
 	// to be called after all mods are loaded, so that we catch all aliases
 	virtual void initHash(IGameDef *gamedef) = 0;
 
+	// Item names and groups the recipe consists of, valid after initHash()
+	virtual std::vector<std::string> getRecipeNames() const
+	{
+		return std::vector<std::string>();
+	}
+
 	virtual std::string dump() const=0;
 
 protected:
@@ -215,6 +221,8 @@ class CraftDefinitionShaped: public CraftDefinition
 
 	virtual void initHash(IGameDef *gamedef);
 
+	virtual std::vector<std::string> getRecipeNames() const;
+
 	virtual std::string dump() const;
 
 private:
@@ -259,6 +267,8 @@ class CraftDefinitionShapeless: public CraftDefinition
 
 	virtual void initHash(IGameDef *gamedef);
 
+	virtual std::vector<std::string> getRecipeNames() const;
+
 	virtual std::string dump() const;
 
 private:
@@ -340,6 +350,8 @@ class CraftDefinitionCooking: public CraftDefinition
 
 	virtual void initHash(IGameDef *gamedef);
 
+	virtual std::vector<std::string> getRecipeNames() const;
+
 	virtual std::string dump() const;
 
 private:
@@ -383,6 +395,8 @@ class CraftDefinitionFuel: public CraftDefinition
 
 	virtual void initHash(IGameDef *gamedef);
 
+	virtual std::vector<std::string> getRecipeNames() const;
+
 	virtual std::string dump() const;
 
 private:
@@ -0,0 +1,203 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "database-async.h"
+#include "debug.h"
+#include "exceptions.h"
+#include "log.h"
+#include "util/thread.h"
+#include "threading/mutex_auto_lock.h"
+
+// Queued blocks after which the writer is woken without waiting for endSave()
+#define ASYNC_QUEUE_WAKEUP_SIZE 1024
+
+class Database_Async::WriterThread : public Thread
+{
+public:
+	WriterThread(Database_Async *db) :
+		Thread("MapWriter"), m_db(db)
+	{}
+
+	void *run()
+	{
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		while (!stopRequested()) {
+			m_db->m_wakeup.wait(1000);
+			// Failed blocks stay queued and are retried next time
+			m_db->writeQueue();
+		}
+
+		END_DEBUG_EXCEPTION_HANDLER
+		return nullptr;
+	}
+
+private:
+	Database_Async *m_db;
+};
+
+Database_Async::Database_Async(MapDatabase *db) :
+	m_db(db)
+{
+	m_thread = new WriterThread(this);
+	m_thread->start();
+}
+
+Database_Async::~Database_Async()
+{
+	m_thread->stop();
+	m_wakeup.post();
+	m_thread->wait();
+	delete m_thread;
+
+	if (!writeQueue()) {
+		errorstream << "Database_Async: " << m_queue.size()
+			<< " blocks could not be saved and are lost" << std::endl;
+	}
+	delete m_db;
+}
+
+bool Database_Async::writeQueue()
+{
+	MutexAutoLock db_lock(m_db_mutex);
+
+	std::unordered_map<v3s16, std::string> queue;
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		queue.swap(m_queue);
+	}
+	if (queue.empty())
+		return true;
+
+	std::vector<std::pair<v3s16, std::string>> blocks;
+	blocks.reserve(queue.size());
+	for (auto &it : queue)
+		blocks.emplace_back(it.first, std::move(it.second));
+
+	bool success = false;
+	try {
+		m_db->beginSave();
+		try {
+			success = m_db->saveBlocks(blocks);
+		} catch (DatabaseException &e) {
+			errorstream << "Database_Async: " << e.what() << std::endl;
+		}
+		// The transaction is ended even if saving failed
+		m_db->endSave();
+	} catch (DatabaseException &e) {
+		errorstream << "Database_Async: " << e.what() << std::endl;
+		success = false;
+	}
+
+	if (success)
+		return true;
+
+	errorstream << "Database_Async: failed to save some of "
+		<< blocks.size() << " blocks, keeping them queued" << std::endl;
+
+	// We don't know which ones were saved. Put all of them back, unless a
+	// newer version was queued in the meantime.
+	MutexAutoLock lock(m_queue_mutex);
+	for (auto &block : blocks)
+		m_queue.emplace(block.first, std::move(block.second));
+	return false;
+}
+
+bool Database_Async::flush()
+{
+	return writeQueue();
+}
+
+bool Database_Async::saveBlock(const v3s16 &pos, const std::string &data)
+{
+	size_t queue_size;
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		m_queue[pos] = data;
+		queue_size = m_queue.size();
+	}
+
+	if (queue_size == ASYNC_QUEUE_WAKEUP_SIZE)
+		m_wakeup.post();
+
+	return true;
+}
+
+void Database_Async::loadBlock(const v3s16 &pos, std::string *block)
+{
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		auto it = m_queue.find(pos);
+		if (it != m_queue.end()) {
+			*block = it->second;
+			return;
+		}
+	}
+
+	MutexAutoLock db_lock(m_db_mutex);
+
+	// The block may have been in a batch that was being written when we
+	// looked, and put back into the queue because the commit failed
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		auto it = m_queue.find(pos);
+		if (it != m_queue.end()) {
+			*block = it->second;
+			return;
+		}
+	}
+
+	m_db->loadBlock(pos, block);
+}
+
+bool Database_Async::deleteBlock(const v3s16 &pos)
+{
+	// Locked first, so that a failed commit can't put the block back
+	MutexAutoLock db_lock(m_db_mutex);
+
+	bool was_queued;
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		was_queued = m_queue.erase(pos) > 0;
+	}
+
+	// Blocks that were never committed are not known to the database
+	return m_db->deleteBlock(pos) || was_queued;
+}
+
+void Database_Async::listAllLoadableBlocks(std::vector<v3s16> &dst)
+{
+	flush();
+
+	MutexAutoLock db_lock(m_db_mutex);
+	m_db->listAllLoadableBlocks(dst);
+}
+
+void Database_Async::compact()
+{
+	flush();
+
+	MutexAutoLock db_lock(m_db_mutex);
+	m_db->compact();
+}
+
+void Database_Async::endSave()
+{
+	m_wakeup.post();
+}
@@ -0,0 +1,80 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "database.h"
+#include "IrrCompileConfig.h"
+#ifdef _IRR_COMPILE_WITH_SDL_DEVICE_
+#include "threading/sdl_semaphore.h"
+#else
+#include "threading/semaphore.h"
+#endif
+
+/*
+	Write-behind wrapper around another map database.
+
+	saveBlock() only queues the data; a separate thread commits the queue
+	to the wrapped database in one batch, after every endSave() and at
+	least once per second. Queued blocks are served from memory by
+	loadBlock(), so readers never see stale data. Blocks that fail to be
+	written stay queued and are retried.
+*/
+class Database_Async : public MapDatabase
+{
+public:
+	// Takes ownership of db
+	Database_Async(MapDatabase *db);
+	// Writes the remaining blocks before closing the wrapped database
+	~Database_Async();
+
+	bool saveBlock(const v3s16 &pos, const std::string &data);
+	void loadBlock(const v3s16 &pos, std::string *block);
+	bool deleteBlock(const v3s16 &pos);
+	void listAllLoadableBlocks(std::vector<v3s16> &dst);
+
+	void compact();
+
+	void beginSave() {}
+	void endSave();
+	bool initialized() const { return m_db->initialized(); }
+
+	// Commits all queued blocks before returning, false if some failed
+	bool flush();
+
+private:
+	class WriterThread;
+
+	bool writeQueue();
+
+	MapDatabase *m_db;
+	WriterThread *m_thread;
+	Semaphore m_wakeup;
+
+	// Serializes access to m_db. Held by the writer for the whole commit,
+	// including taking the queue, so a block is always either queued or
+	// readable from m_db by anyone holding it.
+	std::mutex m_db_mutex;
+
+	std::mutex m_queue_mutex;
+	std::unordered_map<v3s16, std::string> m_queue;
+};
@@ -32,6 +32,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/string.h"
 
 #include "leveldb/db.h"
+#include "leveldb/write_batch.h"
 
 
 #define ENSURE_STATUS_OK(s) \
@@ -94,6 +95,23 @@ bool Database_LevelDB::deleteBlock(const v3s16 &pos)
 	return true;
 }
 
+bool Database_LevelDB::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	// Written atomically with a single log write
+	leveldb::WriteBatch batch;
+	for (const auto &block : blocks)
+		batch.Put(i64tos(getBlockAsInteger(block.first)), block.second);
+
+	leveldb::Status status = m_database->Write(leveldb::WriteOptions(), &batch);
+	if (!status.ok()) {
+		warningstream << "saveBlocks: LevelDB error saving " << blocks.size()
+			<< " blocks: " << status.ToString() << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
 void Database_LevelDB::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
 	leveldb::Iterator* it = m_database->NewIterator(leveldb::ReadOptions());
@@ -36,6 +36,7 @@ class Database_LevelDB : public MapDatabase
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
 	bool deleteBlock(const v3s16 &pos);
+	bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
 	void compact();
@@ -67,3 +67,21 @@ v3s16 MapDatabase::getIntegerAsBlock(s64 i)
 	return pos;
 }
 
+
+
+bool MapDatabase::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	bool success = true;
+	for (const auto &block : blocks)
+		success &= saveBlock(block.first, block.second);
+	return success;
+}
+
+
+void MapDatabase::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	blocks->assign(positions.size(), std::string());
+	for (size_t i = 0; i < positions.size(); i++)
+		loadBlock(positions[i], &(*blocks)[i]);
+}
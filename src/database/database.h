@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <set>
 #include <string>
+#include <utility>
 #include <vector>
 #include "irr_v3d.h"
 #include "irrlichttypes.h"
@@ -43,6 +44,14 @@ class MapDatabase : public Database
 	virtual void loadBlock(const v3s16 &pos, std::string *block) = 0;
 	virtual bool deleteBlock(const v3s16 &pos) = 0;
 
+	// Batched variants of the above. The defaults process the blocks one
+	// by one; call them between beginSave() and endSave() like saveBlock().
+	// saveBlocks returns false if any of the blocks could not be saved.
+	virtual bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks);
+	// blocks[i] is left empty if positions[i] is not in the database
+	virtual void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
+
 	static s64 getBlockAsInteger(const v3s16 &pos);
 	static v3s16 getIntegerAsBlock(s64 i);
 
@@ -369,11 +369,13 @@ void set_default_settings()
 #if USE_PROMETHEUS
 	settings->setDefault("prometheus_listener_address", "127.0.0.1:30000");
 #endif
+	settings->setDefault("metrics_dump_interval", "0");
 
 	// Network
 	settings->setDefault("enable_ipv6", "true");
 	settings->setDefault("ipv6_server", "false");
 	settings->setDefault("max_packets_per_iteration","1024");
+	settings->setDefault("congestion_control", "legacy");
 	settings->setDefault("port", "40000");
 	settings->setDefault("strict_protocol_version_checking", "false");
 	settings->setDefault("player_transfer_distance", "0");
@@ -415,6 +417,7 @@ void set_default_settings()
 	settings->setDefault("server_unload_unused_data_timeout", "29");
 	settings->setDefault("max_objects_per_block", "64");
 	settings->setDefault("server_map_save_interval", "5.3");
+	settings->setDefault("map_save_async", "true");
 	settings->setDefault("chat_message_max_size", "500");
 	settings->setDefault("chat_message_limit_per_10sec", "5.0");
 	settings->setDefault("chat_message_limit_trigger_kick", "50");
@@ -426,7 +429,9 @@ void set_default_settings()
 	settings->setDefault("active_block_mgmt_interval", "2.0");
 	settings->setDefault("abm_interval", "1.0");
 	settings->setDefault("abm_time_budget", "0.2");
+	settings->setDefault("abm_threads", "0");
 	settings->setDefault("nodetimer_interval", "0.2");
+	settings->setDefault("pathfinder_cache_time", "5.0");
 	settings->setDefault("ignore_world_load_errors", "false");
 	settings->setDefault("remote_media", "");
 	settings->setDefault("debug_log_level", "warning");
@@ -436,6 +441,7 @@ void set_default_settings()
 	settings->setDefault("emergequeue_limit_diskonly", "128");
 	settings->setDefault("emergequeue_limit_generate", "128");
 	settings->setDefault("num_emerge_threads", "1");
+	settings->setDefault("mapgen_threads", "0");
 	settings->setDefault("log_mod_memory_usage_on_load", "false");
 	settings->setDefault("secure.enable_security", "true");
 	settings->setDefault("secure.trusted_mods", "");
@@ -459,6 +465,8 @@ void set_default_settings()
 	settings->setDefault("liquid_loop_max", "100000");
 	settings->setDefault("liquid_queue_purge_time", "0");
 	settings->setDefault("liquid_update", "1.0");
+	settings->setDefault("liquid_threads", "0");
+	settings->setDefault("deferred_lighting", "false");
 
 	// Mapgen
 	settings->setDefault("mg_name", "v7p");
@@ -21,8 +21,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "emerge.h"
 
+#include <algorithm>
+#include <cfloat>
 #include <iostream>
-#include <queue>
 
 #include "util/container.h"
 #include "util/thread.h"
@@ -57,7 +58,7 @@ class EmergeThread : public Thread {
 	void signal();
 
 	// Requires queue mutex held
-	bool pushBlock(const v3s16 &pos);
+	bool pushBlock(const v3s16 &pos, float priority);
 
 	void cancelPendingItems();
 
@@ -71,8 +72,21 @@ class EmergeThread : public Thread {
 	EmergeManager *m_emerge;
 	Mapgen *m_mapgen;
 
+	struct QueuedBlock {
+		v3s16 pos;
+		float priority;
+		u64 queued_time_ms;
+
+		// Inverted so that the heap keeps the lowest priority value on top
+		bool operator<(const QueuedBlock &other) const
+		{
+			return priority > other.priority;
+		}
+	};
+
 	Event m_queue_event;
-	std::queue<v3s16> m_block_queue;
+	// Binary heap ordered by priority
+	std::vector<QueuedBlock> m_block_queue;
 
 	bool popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata);
 
@@ -121,13 +135,14 @@ EmergeParams::~EmergeParams()
 
 EmergeParams::EmergeParams(EmergeManager *parent, const BiomeManager *biomemgr,
 	const OreManager *oremgr, const DecorationManager *decomgr,
-	const SchematicManager *schemmgr) :
+	const SchematicManager *schemmgr, WorkerPool *mapgen_pool) :
 	ndef(parent->ndef),
 	enable_mapgen_debug_info(parent->enable_mapgen_debug_info),
 	gen_notify_on(parent->gen_notify_on),
 	gen_notify_on_deco_ids(&parent->gen_notify_on_deco_ids),
 	biomemgr(biomemgr->clone()), oremgr(oremgr->clone()),
-	decomgr(decomgr->clone()), schemmgr(schemmgr->clone())
+	decomgr(decomgr->clone()), schemmgr(schemmgr->clone()),
+	mapgen_pool(mapgen_pool)
 {
 }
 
@@ -135,7 +150,7 @@ EmergeParams::EmergeParams(EmergeManager *parent, const BiomeManager *biomemgr,
 //// EmergeManager
 ////
 
-EmergeManager::EmergeManager(Server *server)
+EmergeManager::EmergeManager(Server *server, MetricsBackend *mb)
 {
 	this->ndef      = server->getNodeDefManager();
 	this->biomemgr  = new BiomeManager(server);
@@ -173,10 +188,25 @@ EmergeManager::EmergeManager(Server *server)
 	if (m_qlimit_generate < 1)
 		m_qlimit_generate = 1;
 
+	// Leave some margin for players moving back and forth
+	m_drop_distance = std::max(g_settings->getS16("max_block_send_distance"),
+		g_settings->getS16("max_block_generate_distance")) + 2;
+
+	m_queue_length_gauge = mb->addGauge(
+		"minetest_core_emerge_queue_length",
+		"Number of blocks waiting to be emerged");
+	m_dropped_counter = mb->addCounter(
+		"minetest_core_emerge_dropped",
+		"Number of emerge requests dropped because no player needed them any more");
+
 	for (s16 i = 0; i < nthreads; i++)
 		m_threads.push_back(new EmergeThread(server, i));
 
 	infostream << "EmergeManager: using " << nthreads << " threads" << std::endl;
+
+	u32 mapgen_threads = g_settings->getU32("mapgen_threads");
+	if (mapgen_threads > 0)
+		m_mapgen_pool.reset(new WorkerPool("Mapgen", mapgen_threads));
 }
 
 
@@ -241,8 +271,8 @@ void EmergeManager::initMapgens(MapgenParams *params)
 	mgparams = params;
 
 	for (u32 i = 0; i != m_threads.size(); i++) {
-		EmergeParams *p = new EmergeParams(
-			this, biomemgr, oremgr, decomgr, schemmgr);
+		EmergeParams *p = new EmergeParams(this, biomemgr, oremgr,
+			decomgr, schemmgr, m_mapgen_pool.get());
 		infostream << "EmergeManager: Created params " << p
 			<< " for thread " << i << std::endl;
 		m_mapgens.push_back(Mapgen::createMapgen(params->mgtype, params, p));
@@ -339,7 +369,8 @@ bool EmergeManager::enqueueBlockEmergeEx(
 			return true;
 
 		thread = getOptimalThread();
-		thread->pushBlock(blockpos);
+		thread->pushBlock(blockpos, getBlockPriority(blockpos, 0));
+		m_queue_length_gauge->set(m_blocks_enqueued.size());
 	}
 
 	thread->signal();
@@ -348,6 +379,43 @@ bool EmergeManager::enqueueBlockEmergeEx(
 }
 
 
+void EmergeManager::updateViewers(const std::vector<EmergeViewer> &viewers)
+{
+	MutexAutoLock queuelock(m_queue_mutex);
+
+	m_viewers = viewers;
+
+	u64 now_ms = porting::getTimeMs();
+	u32 dropped = 0;
+	for (EmergeThread *thread : m_threads) {
+		std::vector<EmergeThread::QueuedBlock> &queue = thread->m_block_queue;
+		for (size_t i = 0; i < queue.size();) {
+			EmergeThread::QueuedBlock &queued = queue[i];
+
+			auto it = m_blocks_enqueued.find(queued.pos);
+			if (it != m_blocks_enqueued.end() &&
+					!isBlockNeeded(queued.pos, it->second)) {
+				BlockEmergeData bedata;
+				popBlockEmergeData(queued.pos, &bedata);
+				queued = queue.back();
+				queue.pop_back();
+				dropped++;
+				continue;
+			}
+
+			queued.priority = getBlockPriority(queued.pos,
+				now_ms - queued.queued_time_ms);
+			i++;
+		}
+		std::make_heap(queue.begin(), queue.end());
+	}
+
+	if (dropped > 0)
+		m_dropped_counter->increment(dropped);
+	m_queue_length_gauge->set(m_blocks_enqueued.size());
+}
+
+
 //
 // Mapgen-related helper functions
 //
@@ -473,6 +541,48 @@ bool EmergeManager::popBlockEmergeData(v3s16 pos, BlockEmergeData *bedata)
 }
 
 
+float EmergeManager::getBlockPriority(v3s16 pos, u64 age_ms)
+{
+	// Every second spent in the queue counts as one block closer, so
+	// that requests far away from all players are not starved
+	float priority = -(age_ms / 1000.0f);
+	if (m_viewers.empty())
+		return priority;
+
+	v3f center = intToFloat(pos, 1) + v3f(0.5f, 0.5f, 0.5f);
+	float nearest = FLT_MAX;
+	for (const EmergeViewer &viewer : m_viewers) {
+		v3f d = center - viewer.pos;
+		float distance = d.getLength();
+		// Blocks behind the viewer count as up to twice as far away
+		if (distance > 0.0f)
+			distance *= 1.5f - 0.5f * d.dotProduct(viewer.dir) / distance;
+		nearest = std::min(nearest, distance);
+	}
+
+	return nearest + priority;
+}
+
+
+bool EmergeManager::isBlockNeeded(v3s16 pos, const BlockEmergeData &bedata)
+{
+	// Script and forced requests are always served
+	if (bedata.peer_requested == PEER_ID_INEXISTENT ||
+			!bedata.callbacks.empty() ||
+			(bedata.flags & BLOCK_EMERGE_FORCE_QUEUE))
+		return true;
+
+	v3f center = intToFloat(pos, 1) + v3f(0.5f, 0.5f, 0.5f);
+	for (const EmergeViewer &viewer : m_viewers) {
+		if (center.getDistanceFromSQ(viewer.pos) <=
+				m_drop_distance * m_drop_distance)
+			return true;
+	}
+
+	return false;
+}
+
+
 EmergeThread *EmergeManager::getOptimalThread()
 {
 	size_t nthreads = m_threads.size();
@@ -516,9 +626,10 @@ void EmergeThread::signal()
 }
 
 
-bool EmergeThread::pushBlock(const v3s16 &pos)
+bool EmergeThread::pushBlock(const v3s16 &pos, float priority)
 {
-	m_block_queue.push(pos);
+	m_block_queue.push_back({pos, priority, porting::getTimeMs()});
+	std::push_heap(m_block_queue.begin(), m_block_queue.end());
 	return true;
 }
 
@@ -527,17 +638,15 @@ void EmergeThread::cancelPendingItems()
 {
 	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
 
-	while (!m_block_queue.empty()) {
+	for (const QueuedBlock &queued : m_block_queue) {
 		BlockEmergeData bedata;
-		v3s16 pos;
-
-		pos = m_block_queue.front();
-		m_block_queue.pop();
 
-		m_emerge->popBlockEmergeData(pos, &bedata);
+		m_emerge->popBlockEmergeData(queued.pos, &bedata);
 
-		runCompletionCallbacks(pos, EMERGE_CANCELLED, bedata.callbacks);
+		runCompletionCallbacks(queued.pos, EMERGE_CANCELLED, bedata.callbacks);
 	}
+	m_block_queue.clear();
+	m_emerge->m_queue_length_gauge->set(m_emerge->m_blocks_enqueued.size());
 }
 
 
@@ -560,15 +669,22 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 {
 	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
 
-	if (m_block_queue.empty())
-		return false;
+	while (!m_block_queue.empty()) {
+		std::pop_heap(m_block_queue.begin(), m_block_queue.end());
+		*pos = m_block_queue.back().pos;
+		m_block_queue.pop_back();
 
-	*pos = m_block_queue.front();
-	m_block_queue.pop();
+		m_emerge->popBlockEmergeData(*pos, bedata);
+		m_emerge->m_queue_length_gauge->set(m_emerge->m_blocks_enqueued.size());
 
-	m_emerge->popBlockEmergeData(*pos, bedata);
+		// The requesting player may have moved on since the last update
+		if (m_emerge->isBlockNeeded(*pos, *bedata))
+			return true;
 
-	return true;
+		m_emerge->m_dropped_counter->increment();
+	}
+
+	return false;
 }
 
 
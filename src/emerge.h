@@ -20,10 +20,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include <map>
+#include <memory>
 #include <mutex>
 #include "network/networkprotocol.h"
 #include "irr_v3d.h"
 #include "util/container.h"
+#include "util/metricsbackend.h"
+#include "util/workerpool.h"
 #include "mapgen/mapgen.h" // for MapgenParams
 #include "map.h"
 
@@ -86,6 +89,12 @@ struct BlockEmergeData {
 	EmergeCallbackList callbacks;
 };
 
+// Position and look direction of a player, used to order the emerge queue
+struct EmergeViewer {
+	v3f pos; // in blocks
+	v3f dir; // normalized
+};
+
 class EmergeParams {
 	friend class EmergeManager;
 public:
@@ -104,10 +113,12 @@ class EmergeParams {
 	DecorationManager *decomgr;
 	SchematicManager *schemmgr;
 
+	WorkerPool *mapgen_pool; // shared, may be null
+
 private:
 	EmergeParams(EmergeManager *parent, const BiomeManager *biomemgr,
 		const OreManager *oremgr, const DecorationManager *decomgr,
-		const SchematicManager *schemmgr);
+		const SchematicManager *schemmgr, WorkerPool *mapgen_pool);
 };
 
 class EmergeManager {
@@ -136,7 +147,7 @@ class EmergeManager {
 	MapSettingsManager *map_settings_mgr;
 
 	// Methods
-	EmergeManager(Server *server);
+	EmergeManager(Server *server, MetricsBackend *mb);
 	~EmergeManager();
 	DISABLE_CLASS_COPY(EmergeManager);
 
@@ -170,6 +181,10 @@ class EmergeManager {
 		EmergeCompletionCallback callback,
 		void *callback_param);
 
+	// Re-evaluates the queue for the new viewer positions and drops the
+	// player requests that are out of every viewer's range
+	void updateViewers(const std::vector<EmergeViewer> &viewers);
+
 	v3s16 getContainingChunk(v3s16 blockpos);
 
 	Mapgen *getCurrentMapgen();
@@ -194,6 +209,16 @@ class EmergeManager {
 	u16 m_qlimit_diskonly;
 	u16 m_qlimit_generate;
 
+	// Player requests farther than this from all viewers are dropped
+	float m_drop_distance;
+	std::vector<EmergeViewer> m_viewers;
+
+	MetricGaugePtr m_queue_length_gauge;
+	MetricCounterPtr m_dropped_counter;
+
+	// Runs the passes of a chunk in parallel for all emerge threads
+	std::unique_ptr<WorkerPool> m_mapgen_pool;
+
 	// Managers of various map generation-related components
 	// Note that each Mapgen gets a copy(!) of these to work with
 	BiomeManager *biomemgr;
@@ -203,6 +228,10 @@ class EmergeManager {
 
 	// Requires m_queue_mutex held
 	EmergeThread *getOptimalThread();
+	// Lower values are emerged first. Requires m_queue_mutex held
+	float getBlockPriority(v3s16 pos, u64 age_ms);
+	// Whether a queued block is still worth emerging. Requires m_queue_mutex held
+	bool isBlockNeeded(v3s16 pos, const BlockEmergeData &bedata);
 
 	bool pushBlockEmergeData(
 		v3s16 pos,
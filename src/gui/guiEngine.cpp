@@ -666,8 +666,9 @@ void GUIEngine::stopSound(s32 handle)
 }
 
 /******************************************************************************/
-unsigned int GUIEngine::queueAsync(const std::string &serialized_func,
-		const std::string &serialized_params)
+unsigned int GUIEngine::queueAsync(std::string &&serialized_func,
+		std::string &&packed_params)
 {
-	return m_script->queueAsync(serialized_func, serialized_params);
+	return m_script->queueAsync(std::move(serialized_func),
+			std::move(packed_params));
 }
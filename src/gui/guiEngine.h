@@ -149,8 +149,8 @@ class GUIEngine {
 	}
 
 	/** pass async callback to scriptengine **/
-	unsigned int queueAsync(const std::string &serialized_fct,
-			const std::string &serialized_params);
+	unsigned int queueAsync(std::string &&serialized_fct,
+			std::string &&packed_params);
 
 	ITextureSource *getTextureSource() { return m_texture_source; }
 
@@ -22,9 +22,22 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "irrlichttypes.h"
 
 #include <vector2d.h>
+#include <functional>
 
 typedef core::vector2d<f32> v2f;
 typedef core::vector2d<s16> v2s16;
 typedef core::vector2d<s32> v2s32;
 typedef core::vector2d<u32> v2u32;
 typedef core::vector2d<f32> v2f32;
+
+namespace std
+{
+	template <>
+	struct hash<v2s16>
+	{
+		std::size_t operator()(const v2s16 &p) const noexcept
+		{
+			return std::hash<u32>()(((u32)(u16)p.X << 16) | (u16)p.Y);
+		}
+	};
+}
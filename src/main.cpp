@@ -121,6 +121,7 @@ static bool determine_subgame(GameParams *game_params);
 static bool run_dedicated_server(const GameParams &game_params, const Settings &cmd_args);
 static bool migrate_map_database(const GameParams &game_params, const Settings &cmd_args);
 static bool recompress_map_database(const GameParams &game_params, const Settings &cmd_args, const Address &addr);
+static bool train_zstd_dictionary(const GameParams &game_params, const Settings &cmd_args);
 
 /**********************************************************************/
 
@@ -331,6 +332,8 @@ static void set_allowed_options(OptionList *allowed_options)
 			_("Feature an interactive terminal (Only works when using minetestserver or with --server)"))));
 	allowed_options->insert(std::make_pair("recompress", ValueSpec(VALUETYPE_FLAG,
 			_("Recompress the blocks of the given map database."))));
+	allowed_options->insert(std::make_pair("train-zstd-dictionary", ValueSpec(VALUETYPE_FLAG,
+			_("Train a zstd dictionary from the blocks of the given map database."))));
 #ifndef SERVER
 	allowed_options->insert(std::make_pair("videomodes", ValueSpec(VALUETYPE_FLAG,
 			_("Show available video modes"))));
@@ -916,6 +919,9 @@ static bool run_dedicated_server(const GameParams &game_params, const Settings &
 	if (cmd_args.getFlag("recompress"))
 		return recompress_map_database(game_params, cmd_args, bind_addr);
 
+	if (cmd_args.getFlag("train-zstd-dictionary"))
+		return train_zstd_dictionary(game_params, cmd_args);
+
 	if (cmd_args.exists("terminal")) {
 #if USE_CURSES
 		bool name_ok = true;
@@ -1032,18 +1038,33 @@ static bool migrate_map_database(const GameParams &game_params, const Settings &
 
 	std::vector<v3s16> blocks;
 	old_db->listAllLoadableBlocks(blocks);
+
+	// Blocks are copied in batches of 0xFF
+	std::vector<v3s16> positions;
+	std::vector<std::string> data;
+	std::vector<std::pair<v3s16, std::string>> batch;
 	new_db->beginSave();
-	for (std::vector<v3s16>::const_iterator it = blocks.begin(); it != blocks.end(); ++it) {
+	for (auto it = blocks.begin(); it != blocks.end();) {
 		if (kill) return false;
 
-		std::string data;
-		old_db->loadBlock(*it, &data);
-		if (!data.empty()) {
-			new_db->saveBlock(*it, data);
-		} else {
-			errorstream << "Failed to load block " << PP(*it) << ", skipping it." << std::endl;
+		auto batch_end = it + std::min<size_t>(0xFF, blocks.end() - it);
+		positions.assign(it, batch_end);
+		it = batch_end;
+
+		old_db->loadBlocks(positions, &data);
+		batch.clear();
+		for (size_t i = 0; i < positions.size(); i++) {
+			if (!data[i].empty()) {
+				batch.emplace_back(positions[i], std::move(data[i]));
+			} else {
+				errorstream << "Failed to load block " << PP(positions[i])
+					<< ", skipping it." << std::endl;
+			}
 		}
-		if (++count % 0xFF == 0 && time(NULL) - last_update_time >= 1) {
+		new_db->saveBlocks(batch);
+
+		count += positions.size();
+		if (time(NULL) - last_update_time >= 1) {
 			std::cerr << " Migrated " << count << " blocks, "
 				<< (100.0 * count / blocks.size()) << "% completed.\r";
 			new_db->endSave();
@@ -1082,7 +1103,11 @@ static bool recompress_map_database(const GameParams &game_params, const Setting
 	u32 count = 0;
 	u64 last_update_time = 0;
 	bool &kill = *porting::signal_handler_killstatus();
-	const u8 serialize_as_ver = SER_FMT_VER_HIGHEST_WRITE;
+	// Use the world's zstd dictionary if it has one
+	const u32 zstd_dictionary = ServerMap::loadZstdDictionary(game_params.world_path);
+	setActiveZstdDictionary(zstd_dictionary);
+	const u8 serialize_as_ver = zstd_dictionary ?
+			SER_FMT_VER_ZSTD_DICTIONARY : SER_FMT_VER_HIGHEST_WRITE;
 	const s16 map_compression_level = rangelim(g_settings->getS16("map_compression_level_disk"), -1, 9);
 
 	// This is ok because the server doesn't actually run
@@ -1131,3 +1156,166 @@ static bool recompress_map_database(const GameParams &game_params, const Setting
 	actionstream << "Done, " << count << " blocks were recompressed." << std::endl;
 	return true;
 }
+
+static bool train_zstd_dictionary(const GameParams &game_params, const Settings &cmd_args)
+{
+	Settings world_mt;
+	const std::string world_mt_path = game_params.world_path + DIR_DELIM + "world.mt";
+
+	if (!world_mt.readConfigFile(world_mt_path.c_str())) {
+		errorstream << "Cannot read world.mt at " << world_mt_path << std::endl;
+		return false;
+	}
+	const std::string &backend = world_mt.get("backend");
+	MapDatabase *db = ServerMap::createDatabase(backend, game_params.world_path, world_mt);
+
+	// Blocks using the current dictionary are moved to the new one below
+	const u32 old_dictionary = ServerMap::loadZstdDictionary(game_params.world_path);
+
+	std::vector<v3s16> blocks;
+	db->listAllLoadableBlocks(blocks);
+
+	// Sample blocks spread over the whole database
+	const size_t max_samples = 2000;
+	const size_t step = std::max<size_t>(1, blocks.size() / max_samples);
+	std::vector<v3s16> positions;
+	for (size_t i = 0; i < blocks.size(); i += step)
+		positions.push_back(blocks[i]);
+
+	std::vector<std::string> data;
+	db->loadBlocks(positions, &data);
+
+	// The dictionary is trained on the uncompressed block data
+	std::vector<std::string> samples;
+	for (const std::string &blob : data) {
+		if (blob.empty())
+			continue;
+		std::istringstream iss(blob, std::ios_base::binary);
+		u8 ver = readU8(iss);
+		if (ver < 29 || !ser_ver_supported(ver))
+			continue;
+		std::ostringstream oss(std::ios_base::binary);
+		try {
+			decompress(iss, oss, ver);
+		} catch (SerializationError &e) {
+			continue;
+		}
+		samples.push_back(oss.str());
+	}
+	data.clear();
+
+	std::string dict;
+	try {
+		dict = trainZstdDictionary(samples, 112640);
+	} catch (SerializationError &e) {
+		errorstream << "Failed to train a zstd dictionary from " << samples.size()
+			<< " blocks, the map may be too small" << std::endl;
+		delete db;
+		return false;
+	}
+
+	const std::string dict_path = ServerMap::getZstdDictionaryPath(game_params.world_path);
+	const u32 new_dictionary = registerZstdDictionary(dict);
+	if (!new_dictionary) {
+		errorstream << "Failed to load the trained dictionary" << std::endl;
+		delete db;
+		return false;
+	}
+
+	// Blocks can only be read with the dictionary they were compressed
+	// with, keep the old one on disk until all of them were moved
+	if (old_dictionary && old_dictionary != new_dictionary) {
+		const std::string old_path = ServerMap::getZstdDictionaryPath(
+				game_params.world_path, old_dictionary);
+		std::string old_dict;
+		if (!getZstdDictionary(old_dictionary, &old_dict) ||
+				!fs::safeWriteToFile(old_path, old_dict)) {
+			errorstream << "Failed to write " << old_path << std::endl;
+			delete db;
+			return false;
+		}
+	}
+
+	if (!fs::safeWriteToFile(dict_path, dict)) {
+		errorstream << "Failed to write " << dict_path << std::endl;
+		delete db;
+		return false;
+	}
+	actionstream << "Trained zstd dictionary " << new_dictionary << " ("
+		<< dict.size() << " bytes) from " << samples.size() << " blocks" << std::endl;
+
+	const std::vector<std::string> replaced =
+		ServerMap::getReplacedZstdDictionaryPaths(game_params.world_path);
+	if (!replaced.empty()) {
+		setActiveZstdDictionary(new_dictionary);
+		const s16 map_compression_level = rangelim(g_settings->getS16("map_compression_level_disk"), -1, 9);
+
+		u32 count = 0;
+		bool complete = true;
+		bool &kill = *porting::signal_handler_killstatus();
+		std::vector<std::pair<v3s16, std::string>> batch;
+		db->beginSave();
+		for (auto it = blocks.begin(); it != blocks.end();) {
+			if (kill) {
+				complete = false;
+				break;
+			}
+
+			auto batch_end = it + std::min<size_t>(0xFF, blocks.end() - it);
+			positions.assign(it, batch_end);
+			it = batch_end;
+
+			db->loadBlocks(positions, &data);
+			batch.clear();
+			for (size_t i = 0; i < positions.size(); i++) {
+				if (data[i].empty() || (u8)data[i][0] != SER_FMT_VER_ZSTD_DICTIONARY)
+					continue;
+
+				// Only the compression changes, the block is not parsed
+				std::istringstream iss(data[i], std::ios_base::binary);
+				u8 ver = readU8(iss);
+				std::ostringstream raw(std::ios_base::binary);
+				try {
+					decompress(iss, raw, ver);
+				} catch (SerializationError &e) {
+					errorstream << "Failed to decompress block " << PP(positions[i])
+						<< ", skipping it." << std::endl;
+					complete = false;
+					continue;
+				}
+
+				std::ostringstream oss(std::ios_base::binary);
+				writeU8(oss, ver);
+				compress(raw.str(), oss, ver, map_compression_level);
+				batch.emplace_back(positions[i], oss.str());
+			}
+			if (!db->saveBlocks(batch)) {
+				errorstream << "Failed to save some of " << batch.size()
+					<< " blocks" << std::endl;
+				complete = false;
+				continue;
+			}
+			count += batch.size();
+		}
+		db->endSave();
+		actionstream << "Moved " << count << " blocks to the new dictionary" << std::endl;
+
+		if (complete) {
+			for (const std::string &path : replaced)
+				fs::DeleteSingleFileOrEmptyDirectory(path);
+		} else {
+			errorstream << "Not all blocks were moved, the replaced dictionaries "
+				"are kept. Run this again to finish." << std::endl;
+		}
+
+		if (kill) {
+			delete db;
+			return false;
+		}
+	}
+
+	delete db;
+	actionstream << "New blocks will use the dictionary, run --recompress "
+		"to convert the existing ones" << std::endl;
+	return true;
+}
@@ -33,6 +33,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "gamedef.h"
 #include "util/directiontables.h"
 #include "util/basic_macros.h"
+#include "util/string.h"
 #include "rollback_interface.h"
 #include "environment.h"
 #include "reflowscan.h"
@@ -42,6 +43,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "config.h"
 #include "server.h"
 #include "database/database.h"
+#include "database/database-async.h"
 #include "database/database-dummy.h"
 #if USE_SQLITE
 #include "database/database-sqlite3.h"
@@ -49,6 +51,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "script/scripting_server.h"
 #include <deque>
 #include <queue>
+#include <unordered_set>
 #if USE_LEVELDB
 #include "database/database-leveldb.h"
 #endif
@@ -105,7 +108,7 @@ MapSector * Map::getSectorNoGenerateNoLock(v2s16 p)
 		return sector;
 	}
 
-	std::map<v2s16, MapSector*>::iterator n = m_sectors.find(p);
+	auto n = m_sectors.find(p);
 
 	if (n == m_sectors.end())
 		return NULL;
@@ -126,12 +129,7 @@ MapSector * Map::getSectorNoGenerate(v2s16 p)
 
 MapBlock * Map::getBlockNoCreateNoEx(v3s16 p3d)
 {
-	v2s16 p2d(p3d.X, p3d.Z);
-	MapSector * sector = getSectorNoGenerate(p2d);
-	if(sector == NULL)
-		return NULL;
-	MapBlock *block = sector->getBlockNoCreateNoEx(p3d.Y);
-	return block;
+	return m_block_index.get(p3d);
 }
 
 MapBlock * Map::getBlockNoCreate(v3s16 p3d)
@@ -240,13 +238,25 @@ void Map::addNodeAndUpdate(v3s16 p, MapNode n,
 		n.setLight(LIGHTBANK_NIGHT, 0, cf);
 		set_node_in_block(block, relpos, n);
 
-		// Update lighting
-		std::vector<std::pair<v3s16, MapNode> > oldnodes;
-		oldnodes.emplace_back(p, oldnode);
-		voxalgo::update_lighting_nodes(this, oldnodes, modified_blocks);
+		if (m_deferred_lighting) {
+			// Only the first change of a node matters for the light
+			PendingLighting &pending = m_pending_lighting[blockpos];
+			u32 i = relpos.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE +
+					relpos.Y * MAP_BLOCKSIZE + relpos.X;
+			if (!pending.changed[i]) {
+				pending.changed[i] = true;
+				pending.oldnodes.emplace_back(p, oldnode);
+			}
+			modified_blocks[blockpos] = block;
+		} else {
+			// Update lighting
+			std::vector<std::pair<v3s16, MapNode> > oldnodes;
+			oldnodes.emplace_back(p, oldnode);
+			voxalgo::update_lighting_nodes(this, oldnodes, modified_blocks);
 
-		for (auto &modified_block : modified_blocks) {
-			modified_block.second->expireDayNightDiff();
+			for (auto &modified_block : modified_blocks) {
+				modified_block.second->expireDayNightDiff();
+			}
 		}
 	}
 
@@ -284,6 +294,37 @@ void Map::removeNodeAndUpdate(v3s16 p,
 	addNodeAndUpdate(p, MapNode(CONTENT_AIR), modified_blocks, true);
 }
 
+void Map::setDeferredLighting(bool enabled)
+{
+	if (!enabled)
+		updatePendingLighting();
+	m_deferred_lighting = enabled;
+}
+
+void Map::updatePendingLighting()
+{
+	if (m_pending_lighting.empty())
+		return;
+
+	std::vector<std::pair<v3s16, MapNode> > oldnodes;
+	for (auto &it : m_pending_lighting) {
+		oldnodes.insert(oldnodes.end(), it.second.oldnodes.begin(),
+				it.second.oldnodes.end());
+	}
+	m_pending_lighting.clear();
+
+	std::map<v3s16, MapBlock*> modified_blocks;
+	voxalgo::update_lighting_nodes(this, oldnodes, modified_blocks);
+
+	MapEditEvent event;
+	event.type = MEET_OTHER;
+	for (auto &modified_block : modified_blocks) {
+		modified_block.second->expireDayNightDiff();
+		event.modified_blocks.insert(modified_block.first);
+	}
+	dispatchEvent(event);
+}
+
 bool Map::addNodeWithEvent(v3s16 p, MapNode n, bool remove_metadata)
 {
 	MapEditEvent event;
@@ -358,6 +399,9 @@ void Map::timerUpdate(float dtime, float unload_timeout, u32 max_loaded_blocks,
 {
 	bool save_before_unloading = (mapType() == MAPTYPE_SERVER);
 
+	// The blocks must not be unloaded without their light
+	updatePendingLighting();
+
 	// Profile modified reasons
 	Profiler modprofiler;
 
@@ -541,322 +585,503 @@ struct NodeNeighbor {
 	{ }
 };
 
-void Map::transforming_liquid_add(v3s16 p) {
-        m_transforming_liquid.push_back(p);
-}
+/*
+	Outcome of the flowing rules for one queued node. It only depends on
+	the node and its six neighbors, so it can be computed without touching
+	the map and applied later.
+*/
+struct LiquidUpdate {
+	v3s16 p;
+	MapNode n_old;
+	MapNode n_new;
+	// The node which will be placed there if liquid can't flow into it
+	content_t floodable_node = CONTENT_AIR;
+	bool changed = false;
+	// Viscosity kept the node from reaching its level, look at it again
+	bool reflow = false;
+	// Neighbors which are enqueued whether the node changes or not
+	v3s16 queue_always[6];
+	u8 num_queue_always = 0;
+	NodeNeighbor flows[6]; // surrounding flowing liquid nodes
+	u8 num_flows = 0;
+	NodeNeighbor airs[6]; // surrounding air
+	u8 num_airs = 0;
+};
 
-void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
-		ServerEnvironment *env)
+/*
+	Decides the new state of the liquid node at p0. get_node is called
+	for p0 and its neighbors and must not modify anything.
+	Returns false if the node is neither a liquid nor floodable.
+*/
+template <typename GetNode>
+static bool evaluateLiquid(const NodeDefManager *ndef, v3s16 p0,
+		GetNode &get_node, LiquidUpdate &u)
 {
-	u32 loopcount = 0;
-	u32 initial_size = m_transforming_liquid.size();
-
-	/*if(initial_size != 0)
-		infostream<<"transformLiquids(): initial_size="<<initial_size<<std::endl;*/
-
-	// list of nodes that due to viscosity have not reached their max level height
-	std::deque<v3s16> must_reflow;
-
-	std::vector<std::pair<v3s16, MapNode> > changed_nodes;
-
-	u32 liquid_loop_max = g_settings->getS32("liquid_loop_max");
-	u32 loop_max = liquid_loop_max;
+	u.p = p0;
+	MapNode n0 = get_node(p0);
+	u.n_old = n0;
 
-	while (m_transforming_liquid.size() != 0)
-	{
-		// This should be done here so that it is done when continue is used
-		if (loopcount >= initial_size || loopcount >= loop_max)
+	/*
+		Collect information about current node
+	 */
+	s8 liquid_level = -1;
+	// The liquid node which will be placed there if
+	// the liquid flows into this node.
+	content_t liquid_kind = CONTENT_IGNORE;
+	// The node which will be placed there if liquid
+	// can't flow into this node.
+	content_t floodable_node = CONTENT_AIR;
+	const ContentFeatures &cf = ndef->get(n0);
+	LiquidType liquid_type = cf.liquid_type;
+	switch (liquid_type) {
+		case LIQUID_SOURCE:
+			liquid_level = LIQUID_LEVEL_SOURCE;
+			liquid_kind = cf.liquid_alternative_flowing_id;
 			break;
-		loopcount++;
-
-		/*
-			Get a queued transforming liquid node
-		*/
-		v3s16 p0 = m_transforming_liquid.front();
-		m_transforming_liquid.pop_front();
-
-		MapNode n0 = getNode(p0);
+		case LIQUID_FLOWING:
+			liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
+			liquid_kind = n0.getContent();
+			break;
+		case LIQUID_NONE:
+			// if this node is 'floodable', it *could* be transformed
+			// into a liquid, otherwise, continue with the next node.
+			if (!cf.floodable)
+				return false;
+			floodable_node = n0.getContent();
+			liquid_kind = CONTENT_AIR;
+			break;
+	}
+	u.floodable_node = floodable_node;
 
-		/*
-			Collect information about current node
-		 */
-		s8 liquid_level = -1;
-		// The liquid node which will be placed there if
-		// the liquid flows into this node.
-		content_t liquid_kind = CONTENT_IGNORE;
-		// The node which will be placed there if liquid
-		// can't flow into this node.
-		content_t floodable_node = CONTENT_AIR;
-		const ContentFeatures &cf = m_nodedef->get(n0);
-		LiquidType liquid_type = cf.liquid_type;
-		switch (liquid_type) {
-			case LIQUID_SOURCE:
-				liquid_level = LIQUID_LEVEL_SOURCE;
-				liquid_kind = cf.liquid_alternative_flowing_id;
+	/*
+		Collect information about the environment
+	 */
+	NodeNeighbor sources[6]; // surrounding sources
+	int num_sources = 0;
+	NodeNeighbor *flows = u.flows;
+	NodeNeighbor *airs = u.airs;
+	NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
+	int num_neutrals = 0;
+	bool flowing_down = false;
+	bool ignored_sources = false;
+	for (u16 i = 0; i < 6; i++) {
+		NeighborType nt = NEIGHBOR_SAME_LEVEL;
+		switch (i) {
+			case 0:
+				nt = NEIGHBOR_UPPER;
 				break;
-			case LIQUID_FLOWING:
-				liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
-				liquid_kind = n0.getContent();
+			case 5:
+				nt = NEIGHBOR_LOWER;
 				break;
-			case LIQUID_NONE:
-				// if this node is 'floodable', it *could* be transformed
-				// into a liquid, otherwise, continue with the next node.
-				if (!cf.floodable)
-					continue;
-				floodable_node = n0.getContent();
-				liquid_kind = CONTENT_AIR;
+			default:
 				break;
 		}
-
-		/*
-			Collect information about the environment
-		 */
-		NodeNeighbor sources[6]; // surrounding sources
-		int num_sources = 0;
-		NodeNeighbor flows[6]; // surrounding flowing liquid nodes
-		int num_flows = 0;
-		NodeNeighbor airs[6]; // surrounding air
-		int num_airs = 0;
-		NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
-		int num_neutrals = 0;
-		bool flowing_down = false;
-		bool ignored_sources = false;
-		for (u16 i = 0; i < 6; i++) {
-			NeighborType nt = NEIGHBOR_SAME_LEVEL;
-			switch (i) {
-				case 0:
-					nt = NEIGHBOR_UPPER;
-					break;
-				case 5:
-					nt = NEIGHBOR_LOWER;
-					break;
-				default:
-					break;
-			}
-			v3s16 npos = p0 + liquid_6dirs[i];
-			NodeNeighbor nb(getNode(npos), nt, npos);
-			const ContentFeatures &cfnb = m_nodedef->get(nb.n);
-			switch (m_nodedef->get(nb.n.getContent()).liquid_type) {
-				case LIQUID_NONE:
-					if (cfnb.floodable) {
-						airs[num_airs++] = nb;
-						// if the current node is a water source the neighbor
-						// should be enqueded for transformation regardless of whether the
-						// current node changes or not.
-						if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
-							m_transforming_liquid.push_back(npos);
-						// if the current node happens to be a flowing node, it will start to flow down here.
+		v3s16 npos = p0 + liquid_6dirs[i];
+		NodeNeighbor nb(get_node(npos), nt, npos);
+		const ContentFeatures &cfnb = ndef->get(nb.n);
+		switch (ndef->get(nb.n.getContent()).liquid_type) {
+			case LIQUID_NONE:
+				if (cfnb.floodable) {
+					airs[u.num_airs++] = nb;
+					// if the current node is a water source the neighbor
+					// should be enqueded for transformation regardless of whether the
+					// current node changes or not.
+					if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
+						u.queue_always[u.num_queue_always++] = npos;
+					// if the current node happens to be a flowing node, it will start to flow down here.
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				} else {
+					neutrals[num_neutrals++] = nb;
+					if (nb.n.getContent() == CONTENT_IGNORE) {
+						// If node below is ignore prevent water from
+						// spreading outwards and otherwise prevent from
+						// flowing away as ignore node might be the source
 						if (nb.t == NEIGHBOR_LOWER)
 							flowing_down = true;
-					} else {
-						neutrals[num_neutrals++] = nb;
-						if (nb.n.getContent() == CONTENT_IGNORE) {
-							// If node below is ignore prevent water from
-							// spreading outwards and otherwise prevent from
-							// flowing away as ignore node might be the source
-							if (nb.t == NEIGHBOR_LOWER)
-								flowing_down = true;
-							else
-								ignored_sources = true;
-						}
+						else
+							ignored_sources = true;
 					}
-					break;
-				case LIQUID_SOURCE:
+				}
+				break;
+			case LIQUID_SOURCE:
+				// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+				if (liquid_kind == CONTENT_AIR)
+					liquid_kind = cfnb.liquid_alternative_flowing_id;
+				if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					// Do not count bottom source, it will screw things up
+					if(nt != NEIGHBOR_LOWER)
+						sources[num_sources++] = nb;
+				}
+				break;
+			case LIQUID_FLOWING:
+				if (nb.t != NEIGHBOR_SAME_LEVEL ||
+					(nb.n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK) {
 					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+					// but exclude falling liquids on the same level, they cannot flow here anyway
 					if (liquid_kind == CONTENT_AIR)
 						liquid_kind = cfnb.liquid_alternative_flowing_id;
-					if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						// Do not count bottom source, it will screw things up
-						if(nt != NEIGHBOR_LOWER)
-							sources[num_sources++] = nb;
+				}
+				if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					flows[u.num_flows++] = nb;
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				}
+				break;
+		}
+	}
+
+	/*
+		decide on the type (and possibly level) of the current node
+	 */
+	content_t new_node_content;
+	s8 new_node_level = -1;
+	s8 max_node_level = -1;
+
+	u8 range = ndef->get(liquid_kind).liquid_range;
+	if (range > LIQUID_LEVEL_MAX + 1)
+		range = LIQUID_LEVEL_MAX + 1;
+
+	if ((num_sources >= 2 && ndef->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
+		// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
+		// or the flowing alternative of the first of the surrounding sources (if it's air), so
+		// it's perfectly safe to use liquid_kind here to determine the new node content.
+		new_node_content = ndef->get(liquid_kind).liquid_alternative_source_id;
+	} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
+		// liquid_kind is set properly, see above
+		max_node_level = new_node_level = LIQUID_LEVEL_MAX;
+		if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
+	} else if (ignored_sources && liquid_level >= 0) {
+		// Maybe there are neighbouring sources that aren't loaded yet
+		// so prevent flowing away.
+		new_node_level = liquid_level;
+		new_node_content = liquid_kind;
+	} else {
+		// no surrounding sources, so get the maximum level that can flow into this node
+		for (u16 i = 0; i < u.num_flows; i++) {
+			u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
+			switch (flows[i].t) {
+				case NEIGHBOR_UPPER:
+					if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
+						max_node_level = LIQUID_LEVEL_MAX;
+						if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
+							max_node_level = nb_liquid_level + WATER_DROP_BOOST;
+					} else if (nb_liquid_level > max_node_level) {
+						max_node_level = nb_liquid_level;
 					}
 					break;
-				case LIQUID_FLOWING:
-					if (nb.t != NEIGHBOR_SAME_LEVEL ||
-						(nb.n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK) {
-						// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-						// but exclude falling liquids on the same level, they cannot flow here anyway
-						if (liquid_kind == CONTENT_AIR)
-							liquid_kind = cfnb.liquid_alternative_flowing_id;
-					}
-					if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						flows[num_flows++] = nb;
-						if (nb.t == NEIGHBOR_LOWER)
-							flowing_down = true;
-					}
+				case NEIGHBOR_LOWER:
+					break;
+				case NEIGHBOR_SAME_LEVEL:
+					if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
+							nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
+						max_node_level = nb_liquid_level - 1;
 					break;
 			}
 		}
 
-		/*
-			decide on the type (and possibly level) of the current node
-		 */
-		content_t new_node_content;
-		s8 new_node_level = -1;
-		s8 max_node_level = -1;
-
-		u8 range = m_nodedef->get(liquid_kind).liquid_range;
-		if (range > LIQUID_LEVEL_MAX + 1)
-			range = LIQUID_LEVEL_MAX + 1;
-
-		if ((num_sources >= 2 && m_nodedef->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
-			// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
-			// or the flowing alternative of the first of the surrounding sources (if it's air), so
-			// it's perfectly safe to use liquid_kind here to determine the new node content.
-			new_node_content = m_nodedef->get(liquid_kind).liquid_alternative_source_id;
-		} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
-			// liquid_kind is set properly, see above
-			max_node_level = new_node_level = LIQUID_LEVEL_MAX;
-			if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = floodable_node;
-		} else if (ignored_sources && liquid_level >= 0) {
-			// Maybe there are neighbouring sources that aren't loaded yet
-			// so prevent flowing away.
-			new_node_level = liquid_level;
-			new_node_content = liquid_kind;
+		u8 viscosity = ndef->get(liquid_kind).liquid_viscosity;
+		if (viscosity > 1 && max_node_level != liquid_level) {
+			// amount to gain, limited by viscosity
+			// must be at least 1 in absolute value
+			s8 level_inc = max_node_level - liquid_level;
+			if (level_inc < -viscosity || level_inc > viscosity)
+				new_node_level = liquid_level + level_inc/viscosity;
+			else if (level_inc < 0)
+				new_node_level = liquid_level - 1;
+			else if (level_inc > 0)
+				new_node_level = liquid_level + 1;
+			if (new_node_level != max_node_level)
+				u.reflow = true;
 		} else {
-			// no surrounding sources, so get the maximum level that can flow into this node
-			for (u16 i = 0; i < num_flows; i++) {
-				u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
-				switch (flows[i].t) {
-					case NEIGHBOR_UPPER:
-						if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
-							max_node_level = LIQUID_LEVEL_MAX;
-							if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
-								max_node_level = nb_liquid_level + WATER_DROP_BOOST;
-						} else if (nb_liquid_level > max_node_level) {
-							max_node_level = nb_liquid_level;
-						}
-						break;
-					case NEIGHBOR_LOWER:
-						break;
-					case NEIGHBOR_SAME_LEVEL:
-						if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
-								nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
-							max_node_level = nb_liquid_level - 1;
-						break;
-				}
-			}
+			new_node_level = max_node_level;
+		}
 
-			u8 viscosity = m_nodedef->get(liquid_kind).liquid_viscosity;
-			if (viscosity > 1 && max_node_level != liquid_level) {
-				// amount to gain, limited by viscosity
-				// must be at least 1 in absolute value
-				s8 level_inc = max_node_level - liquid_level;
-				if (level_inc < -viscosity || level_inc > viscosity)
-					new_node_level = liquid_level + level_inc/viscosity;
-				else if (level_inc < 0)
-					new_node_level = liquid_level - 1;
-				else if (level_inc > 0)
-					new_node_level = liquid_level + 1;
-				if (new_node_level != max_node_level)
-					must_reflow.push_back(p0);
-			} else {
-				new_node_level = max_node_level;
-			}
+		if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
 
-			if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = floodable_node;
+	}
 
-		}
+	/*
+		check if anything has changed. if not, just continue with the next node.
+	 */
+	if (new_node_content == n0.getContent() &&
+			(ndef->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
+			((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
+			((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
+			== flowing_down)))
+		return true;
 
-		/*
-			check if anything has changed. if not, just continue with the next node.
-		 */
-		if (new_node_content == n0.getContent() &&
-				(m_nodedef->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
-				((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
-				((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
-				== flowing_down)))
-			continue;
+	/*
+		compute the new node
+	 */
+	//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
+	if (ndef->get(new_node_content).liquid_type == LIQUID_FLOWING) {
+		// set level to last 3 bits, flowing down bit to 4th bit
+		n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
+	} else {
+		// set the liquid level and flow bits to 0
+		n0.param2 &= ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
+	}
 
+	// change the node.
+	n0.setContent(new_node_content);
 
-		/*
-			update the current node
-		 */
-		MapNode n00 = n0;
-		//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
-		if (m_nodedef->get(new_node_content).liquid_type == LIQUID_FLOWING) {
-			// set level to last 3 bits, flowing down bit to 4th bit
-			n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
-		} else {
-			// set the liquid level and flow bits to 0
-			n0.param2 &= ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
-		}
+	u.n_new = n0;
+	u.changed = true;
+	return true;
+}
 
-		// change the node.
-		n0.setContent(new_node_content);
+/*
+	The blocks around one block, used to read nodes from worker threads
+	without going through the sector cache of the map.
+*/
+struct LiquidRegion {
+	v3s16 blockpos;
+	MapBlock *blocks[27];
+	// Indices of the queued nodes inside the center block
+	std::vector<size_t> entries;
 
-		// on_flood() the node
-		if (floodable_node != CONTENT_AIR) {
-			if (env->getScriptIface()->node_on_flood(p0, n00, n0))
-				continue;
-		}
+	MapNode getNode(v3s16 p) const
+	{
+		v3s16 bp = getNodeBlockPos(p) - blockpos + v3s16(1, 1, 1);
+		MapBlock *block = blocks[bp.Z * 9 + bp.Y * 3 + bp.X];
+		if (!block)
+			return MapNode(CONTENT_IGNORE);
+		bool is_valid;
+		return block->getNodeNoCheck(p - block->getPosRelative(), &is_valid);
+	}
+};
 
-		// Ignore light (because calling voxalgo::update_lighting_nodes)
-		n0.setLight(LIGHTBANK_DAY, 0, m_nodedef);
-		n0.setLight(LIGHTBANK_NIGHT, 0, m_nodedef);
+void Map::transforming_liquid_add(v3s16 p) {
+        m_transforming_liquid.push_back(p);
+}
+
+void Map::setLiquidThreads(u32 num_threads)
+{
+	if (num_threads == 0)
+		m_liquid_pool.reset();
+	else
+		m_liquid_pool.reset(new WorkerPool("Liquid", num_threads));
+}
+
+void Map::applyLiquidUpdate(const LiquidUpdate &u,
+		std::map<v3s16, MapBlock*> &modified_blocks,
+		std::vector<std::pair<v3s16, MapNode> > &changed_nodes,
+		ServerEnvironment *env)
+{
+	v3s16 p0 = u.p;
+	MapNode n0 = u.n_new;
+
+	// on_flood() the node
+	if (u.floodable_node != CONTENT_AIR) {
+		if (env->getScriptIface()->node_on_flood(p0, u.n_old, n0))
+			return;
+	}
+
+	// Ignore light (because calling voxalgo::update_lighting_nodes)
+	n0.setLight(LIGHTBANK_DAY, 0, m_nodedef);
+	n0.setLight(LIGHTBANK_NIGHT, 0, m_nodedef);
 
 #if USE_SQLITE
-		// Find out whether there is a suspect for this action
-		std::string suspect;
-		if (m_gamedef->rollback())
-			suspect = m_gamedef->rollback()->getSuspect(p0, 83, 1);
-
-		if (m_gamedef->rollback() && !suspect.empty()) {
-			// Blame suspect
-			RollbackScopeActor rollback_scope(m_gamedef->rollback(), suspect, true);
-			// Get old node for rollback
-			RollbackNode rollback_oldnode(this, p0, m_gamedef);
-			// Set node
-			setNode(p0, n0);
-			// Report
-			RollbackNode rollback_newnode(this, p0, m_gamedef);
-			RollbackAction action;
-			action.setSetNode(p0, rollback_oldnode, rollback_newnode);
-			m_gamedef->rollback()->reportAction(action);
-		} else
+	// Find out whether there is a suspect for this action
+	std::string suspect;
+	if (m_gamedef->rollback())
+		suspect = m_gamedef->rollback()->getSuspect(p0, 83, 1);
+
+	if (m_gamedef->rollback() && !suspect.empty()) {
+		// Blame suspect
+		RollbackScopeActor rollback_scope(m_gamedef->rollback(), suspect, true);
+		// Get old node for rollback
+		RollbackNode rollback_oldnode(this, p0, m_gamedef);
+		// Set node
+		setNode(p0, n0);
+		// Report
+		RollbackNode rollback_newnode(this, p0, m_gamedef);
+		RollbackAction action;
+		action.setSetNode(p0, rollback_oldnode, rollback_newnode);
+		m_gamedef->rollback()->reportAction(action);
+	} else
 #endif
-		{
-			// Set node
-			setNode(p0, n0);
+	{
+		// Set node
+		setNode(p0, n0);
+	}
+
+	v3s16 blockpos = getNodeBlockPos(p0);
+	MapBlock *block = getBlockNoCreateNoEx(blockpos);
+	if (block != NULL) {
+		modified_blocks[blockpos] =  block;
+		changed_nodes.emplace_back(p0, u.n_old);
+	}
+
+	/*
+		enqueue neighbors for update if neccessary
+	 */
+	switch (m_nodedef->get(n0.getContent()).liquid_type) {
+		case LIQUID_SOURCE:
+		case LIQUID_FLOWING:
+			// make sure source flows into all neighboring nodes
+			for (u16 i = 0; i < u.num_flows; i++)
+				if (u.flows[i].t != NEIGHBOR_UPPER)
+					m_transforming_liquid.push_back(u.flows[i].p);
+			for (u16 i = 0; i < u.num_airs; i++)
+				if (u.airs[i].t != NEIGHBOR_UPPER)
+					m_transforming_liquid.push_back(u.airs[i].p);
+			break;
+		case LIQUID_NONE:
+			// this flow has turned to air; neighboring flows might need to do the same
+			for (u16 i = 0; i < u.num_flows; i++)
+				m_transforming_liquid.push_back(u.flows[i].p);
+			break;
+	}
+}
+
+void Map::transformLiquidsParallel(u32 count,
+		std::map<v3s16, MapBlock*> &modified_blocks,
+		std::vector<std::pair<v3s16, MapNode> > &changed_nodes,
+		std::deque<v3s16> &must_reflow, ServerEnvironment *env)
+{
+	// The nodes of this step stay queued until they are applied, like in
+	// the serial loop, so that re-queueing them behaves the same
+	std::vector<v3s16> positions;
+	positions.reserve(count);
+	for (u32 i = 0; i < count; i++)
+		positions.push_back(m_transforming_liquid[i]);
+
+	// Group them by block in order of first appearance
+	std::vector<LiquidRegion> regions;
+	std::unordered_map<v3s16, size_t> region_index;
+	for (size_t i = 0; i < positions.size(); i++) {
+		v3s16 blockpos = getNodeBlockPos(positions[i]);
+		auto it = region_index.emplace(blockpos, regions.size());
+		if (it.second) {
+			regions.emplace_back();
+			LiquidRegion &region = regions.back();
+			region.blockpos = blockpos;
+			v3s16 d;
+			for (d.Z = -1; d.Z <= 1; d.Z++)
+			for (d.Y = -1; d.Y <= 1; d.Y++)
+			for (d.X = -1; d.X <= 1; d.X++)
+				region.blocks[(d.Z + 1) * 9 + (d.Y + 1) * 3 + d.X + 1] =
+						getBlockNoCreateNoEx(blockpos + d);
 		}
+		regions[it.first->second].entries.push_back(i);
+	}
 
-		v3s16 blockpos = getNodeBlockPos(p0);
-		MapBlock *block = getBlockNoCreateNoEx(blockpos);
-		if (block != NULL) {
-			modified_blocks[blockpos] =  block;
-			changed_nodes.emplace_back(p0, n00);
+	// Every node is evaluated against the map as it was at the start of
+	// the step, nothing is written until all of them are done
+	std::vector<LiquidUpdate> updates(positions.size());
+	std::vector<u8> evaluated(positions.size(), 0);
+	const NodeDefManager *ndef = m_nodedef;
+	m_liquid_pool->parallelFor(regions.size(), [&] (size_t r) {
+		const LiquidRegion &region = regions[r];
+		auto get_node = [&region] (v3s16 p) { return region.getNode(p); };
+		for (size_t i : region.entries)
+			evaluated[i] = evaluateLiquid(ndef, positions[i], get_node, updates[i]);
+	});
+
+	/*
+		Apply in queue order. The serial loop would have seen the updates
+		before a node, so a node is evaluated again if one of them changed
+		it or a neighbor. on_flood callbacks may change any node, after
+		one ran the rest of the step is evaluated like in the serial loop.
+		This gives the same result as without threads.
+	*/
+	std::unordered_set<v3s16> written;
+	bool callback_ran = false;
+	auto get_node = [this] (v3s16 p) { return getNode(p); };
+	auto is_written = [&written] (v3s16 p) {
+		if (written.count(p))
+			return true;
+		for (const v3s16 &dir : liquid_6dirs)
+			if (written.count(p + dir))
+				return true;
+		return false;
+	};
+	for (size_t i = 0; i < positions.size(); i++) {
+		m_transforming_liquid.pop_front();
+		if (callback_ran || is_written(positions[i])) {
+			updates[i] = LiquidUpdate();
+			evaluated[i] = evaluateLiquid(ndef, positions[i], get_node, updates[i]);
 		}
+		if (!evaluated[i])
+			continue;
+
+		const LiquidUpdate &u = updates[i];
+		for (u8 j = 0; j < u.num_queue_always; j++)
+			m_transforming_liquid.push_back(u.queue_always[j]);
+		if (u.reflow)
+			must_reflow.push_back(u.p);
+		if (!u.changed)
+			continue;
+
+		if (u.floodable_node != CONTENT_AIR)
+			callback_ran = true;
+		written.insert(u.p);
+		applyLiquidUpdate(u, modified_blocks, changed_nodes, env);
+	}
+}
+
+void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
+		ServerEnvironment *env)
+{
+	u32 loopcount = 0;
+	u32 initial_size = m_transforming_liquid.size();
+
+	/*if(initial_size != 0)
+		infostream<<"transformLiquids(): initial_size="<<initial_size<<std::endl;*/
+
+	// list of nodes that due to viscosity have not reached their max level height
+	std::deque<v3s16> must_reflow;
+
+	std::vector<std::pair<v3s16, MapNode> > changed_nodes;
+
+	u32 liquid_loop_max = g_settings->getS32("liquid_loop_max");
+	u32 loop_max = liquid_loop_max;
+
+	if (m_liquid_pool) {
+		transformLiquidsParallel(std::min(initial_size, loop_max),
+				modified_blocks, changed_nodes, must_reflow, env);
+		// Nothing is left for the serial loop in this step
+		loopcount = std::min(initial_size, loop_max);
+	}
+
+	auto get_node = [this] (v3s16 p) { return getNode(p); };
+	while (m_transforming_liquid.size() != 0)
+	{
+		// This should be done here so that it is done when continue is used
+		if (loopcount >= initial_size || loopcount >= loop_max)
+			break;
+		loopcount++;
 
 		/*
-			enqueue neighbors for update if neccessary
-		 */
-		switch (m_nodedef->get(n0.getContent()).liquid_type) {
-			case LIQUID_SOURCE:
-			case LIQUID_FLOWING:
-				// make sure source flows into all neighboring nodes
-				for (u16 i = 0; i < num_flows; i++)
-					if (flows[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(flows[i].p);
-				for (u16 i = 0; i < num_airs; i++)
-					if (airs[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(airs[i].p);
-				break;
-			case LIQUID_NONE:
-				// this flow has turned to air; neighboring flows might need to do the same
-				for (u16 i = 0; i < num_flows; i++)
-					m_transforming_liquid.push_back(flows[i].p);
-				break;
-		}
+			Get a queued transforming liquid node
+		*/
+		v3s16 p0 = m_transforming_liquid.front();
+		m_transforming_liquid.pop_front();
+
+		LiquidUpdate u;
+		if (!evaluateLiquid(m_nodedef, p0, get_node, u))
+			continue;
+
+		for (u8 i = 0; i < u.num_queue_always; i++)
+			m_transforming_liquid.push_back(u.queue_always[i]);
+		if (u.reflow)
+			must_reflow.push_back(p0);
+		if (!u.changed)
+			continue;
+
+		applyLiquidUpdate(u, modified_blocks, changed_nodes, env);
 	}
 	//infostream<<"Map::transformLiquids(): loopcount="<<loopcount<<std::endl;
 
@@ -1246,6 +1471,8 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 	}
 	std::string backend = conf.get("backend");
 	dbase = createDatabase(backend, savedir, conf);
+	if (g_settings->getBool("map_save_async"))
+		dbase = new Database_Async(dbase);
 	if (conf.exists("readonly_backend")) {
 		std::string readonly_dir = savedir + DIR_DELIM + "readonly";
 		dbase_ro = createDatabase(conf.get("readonly_backend"), readonly_dir, conf);
@@ -1261,6 +1488,15 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 	m_map_compression_level = rangelim(g_settings->getS16("map_compression_level_disk"),
 			ZSTD_minCLevel(), ZSTD_maxCLevel());
 
+	setLiquidThreads(rangelim(g_settings->getS32("liquid_threads"), 0, 32));
+	setDeferredLighting(g_settings->getBool("deferred_lighting"));
+
+	m_zstd_dictionary = loadZstdDictionary(savedir);
+	if (m_zstd_dictionary) {
+		setActiveZstdDictionary(m_zstd_dictionary);
+		m_block_ser_ver = SER_FMT_VER_ZSTD_DICTIONARY;
+	}
+
 	try {
 		// If directory exists, check contents and load if possible
 		if (fs::PathExists(m_savedir)) {
@@ -1326,6 +1562,9 @@ ServerMap::~ServerMap()
 	*/
 	delete dbase;
 	delete dbase_ro;
+
+	if (m_zstd_dictionary)
+		setActiveZstdDictionary(0);
 }
 
 MapgenParams *ServerMap::getMapgenParams()
@@ -1619,6 +1858,8 @@ void ServerMap::save(ModifiedState save_level)
 		return;
 	}
 
+	updatePendingLighting();
+
 	u64 start_time = porting::getTimeNs();
 
 	if(save_level == MOD_STATE_CLEAN)
@@ -1748,10 +1989,11 @@ void ServerMap::endSave()
 
 bool ServerMap::saveBlock(MapBlock *block)
 {
-	return saveBlock(block, dbase, m_map_compression_level);
+	return saveBlock(block, dbase, m_map_compression_level, m_block_ser_ver);
 }
 
-bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_level)
+bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_level,
+		u8 version)
 {
 	v3s16 p3d = block->getPos();
 
@@ -1762,9 +2004,6 @@ bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_leve
 		return true;
 	}
 
-	// Format used for writing
-	u8 version = SER_FMT_VER_HIGHEST_WRITE;
-
 	/*
 		[0] u8 serialization version
 		[1] data
@@ -1781,6 +2020,53 @@ bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_leve
 	return ret;
 }
 
+std::string ServerMap::getZstdDictionaryPath(const std::string &savedir,
+		u32 replaced_id)
+{
+	if (replaced_id == 0)
+		return savedir + DIR_DELIM + "map_dictionary.zstd";
+	return savedir + DIR_DELIM + "map_dictionary_" +
+			std::to_string(replaced_id) + ".zstd";
+}
+
+std::vector<std::string> ServerMap::getReplacedZstdDictionaryPaths(
+		const std::string &savedir)
+{
+	std::vector<std::string> paths;
+	for (const fs::DirListNode &node : fs::GetDirListing(savedir)) {
+		if (!node.dir && str_starts_with(node.name, "map_dictionary_") &&
+				str_ends_with(node.name, ".zstd"))
+			paths.push_back(savedir + DIR_DELIM + node.name);
+	}
+	return paths;
+}
+
+u32 ServerMap::loadZstdDictionary(const std::string &savedir)
+{
+	// Kept by --train-zstd-dictionary until no block uses them any more
+	for (const std::string &path : getReplacedZstdDictionaryPaths(savedir)) {
+		std::string dict;
+		if (!fs::ReadFile(path, dict) || registerZstdDictionary(dict) == 0) {
+			errorstream << "ServerMap: " << path << " is not a zstd dictionary"
+					<< std::endl;
+		}
+	}
+
+	std::string path = getZstdDictionaryPath(savedir);
+	std::string dict;
+	if (!fs::PathExists(path) || !fs::ReadFile(path, dict))
+		return 0;
+
+	u32 id = registerZstdDictionary(dict);
+	if (id == 0) {
+		errorstream << "ServerMap: " << path << " is not a zstd dictionary"
+				<< std::endl;
+		return 0;
+	}
+	infostream << "ServerMap: Using zstd dictionary " << id << std::endl;
+	return id;
+}
+
 void ServerMap::loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load)
 {
 	try {
@@ -24,16 +24,23 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <set>
 #include <map>
 #include <list>
+#include <deque>
+#include <bitset>
+#include <unordered_map>
+#include <memory>
 
 #include "irrlichttypes_bloated.h"
+#include "mapblockindex.h"
 #include "mapnode.h"
 #include "constants.h"
 #include "voxel.h"
 #include "modifiedstate.h"
 #include "util/container.h"
 #include "util/metricsbackend.h"
+#include "util/workerpool.h"
 #include "nodetimer.h"
 #include "map_settings_manager.h"
+#include "serialization.h"
 #include "debug.h"
 
 class Settings;
@@ -49,6 +56,7 @@ class EmergeManager;
 class MetricsBackend;
 class ServerEnvironment;
 struct BlockMakeData;
+struct LiquidUpdate;
 
 /*
 	MapEditEvent
@@ -189,6 +197,16 @@ class Map /*: public NodeContainer*/
 	void removeNodeAndUpdate(v3s16 p,
 			std::map<v3s16, MapBlock*> &modified_blocks);
 
+	/*
+		Deferred lighting: addNodeAndUpdate() only records the nodes whose
+		light has to change, per block. updatePendingLighting() lights all
+		of them in one batch and emits a MEET_OTHER event for the blocks it
+		modified. It runs before blocks are sent, saved or unloaded.
+	*/
+	void setDeferredLighting(bool enabled);
+	bool hasPendingLighting() const { return !m_pending_lighting.empty(); }
+	void updatePendingLighting();
+
 	/*
 		Wrappers for the latter ones.
 		These emit events.
@@ -232,6 +250,12 @@ class Map /*: public NodeContainer*/
 	void transformLiquids(std::map<v3s16, MapBlock*> & modified_blocks,
 			ServerEnvironment *env);
 
+	/*
+		Evaluates queued liquid nodes on num_threads workers, 0 keeps
+		the node by node transformation on the calling thread.
+	*/
+	void setLiquidThreads(u32 num_threads);
+
 	/*
 		Node metadata
 		These are basically coordinate wrappers to MapBlock
@@ -275,17 +299,22 @@ class Map /*: public NodeContainer*/
 	bool isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes);
 protected:
 	friend class LuaVoxelManip;
+	// Keeps m_block_index in sync with its blocks
+	friend class MapSector;
 
 	IGameDef *m_gamedef;
 
 	std::set<MapEventReceiver*> m_event_receivers;
 
-	std::map<v2s16, MapSector*> m_sectors;
+	std::unordered_map<v2s16, MapSector*> m_sectors;
 
 	// Be sure to set this to NULL when the cached sector is deleted
 	MapSector *m_sector_cache = nullptr;
 	v2s16 m_sector_cache_p;
 
+	// Every block of every sector, for lookups with a single probe
+	MapBlockIndex m_block_index;
+
 	// Queued transforming water nodes
 	UniqueQueue<v3s16> m_transforming_liquid;
 
@@ -299,6 +328,26 @@ class Map /*: public NodeContainer*/
 		u32 needed_count);
 
 private:
+	void transformLiquidsParallel(u32 count,
+			std::map<v3s16, MapBlock*> &modified_blocks,
+			std::vector<std::pair<v3s16, MapNode> > &changed_nodes,
+			std::deque<v3s16> &must_reflow, ServerEnvironment *env);
+	void applyLiquidUpdate(const LiquidUpdate &u,
+			std::map<v3s16, MapBlock*> &modified_blocks,
+			std::vector<std::pair<v3s16, MapNode> > &changed_nodes,
+			ServerEnvironment *env);
+
+	// Nodes changed since the last lighting update of a block
+	struct PendingLighting {
+		std::bitset<MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE> changed;
+		// Positions and nodes before the first change
+		std::vector<std::pair<v3s16, MapNode> > oldnodes;
+	};
+
+	bool m_deferred_lighting = false;
+	std::unordered_map<v3s16, PendingLighting> m_pending_lighting;
+
+	std::unique_ptr<WorkerPool> m_liquid_pool;
 	f32 m_transforming_liquid_loop_count_multiplier = 1.0f;
 	u32 m_unprocessed_count = 0;
 	u64 m_inc_trending_up_start_time = 0; // milliseconds
@@ -381,7 +430,8 @@ class ServerMap : public Map
 	MapgenParams *getMapgenParams();
 
 	bool saveBlock(MapBlock *block);
-	static bool saveBlock(MapBlock *block, MapDatabase *db, int compression_level = -1);
+	static bool saveBlock(MapBlock *block, MapDatabase *db, int compression_level = -1,
+			u8 version = SER_FMT_VER_HIGHEST_WRITE);
 	MapBlock* loadBlock(v3s16 p);
 	// Database version
 	void loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load=false);
@@ -395,6 +445,19 @@ class ServerMap : public Map
 
 	bool isSavingEnabled(){ return m_map_saving_enabled; }
 
+	/*
+		Shared zstd dictionary of the world, stored in the world directory.
+		Registers it and returns its ID, or 0 if the world has none.
+		Replaced dictionaries that blocks may still use are registered too.
+	*/
+	static u32 loadZstdDictionary(const std::string &savedir);
+	// Path of the dictionary, or of the replaced one with the given ID
+	static std::string getZstdDictionaryPath(const std::string &savedir,
+			u32 replaced_id = 0);
+	static std::vector<std::string> getReplacedZstdDictionaryPaths(
+			const std::string &savedir);
+	u32 getZstdDictionary() const { return m_zstd_dictionary; }
+
 	u64 getSeed();
 
 	/*!
@@ -418,6 +481,10 @@ class ServerMap : public Map
 
 	int m_map_compression_level;
 
+	u32 m_zstd_dictionary = 0;
+	// Format used for writing blocks to disk
+	u8 m_block_ser_ver = SER_FMT_VER_HIGHEST_WRITE;
+
 	std::set<v3s16> m_chunks_in_progress;
 
 	/*
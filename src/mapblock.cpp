@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "mapblock.h"
 
+#include <atomic>
 #include <sstream>
 #include "map.h"
 #include "light.h"
@@ -66,12 +67,15 @@ static const char *modified_reason_strings[] = {
 	MapBlock
 */
 
+static std::atomic<u64> s_next_instance_id{1};
+
 MapBlock::MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef, bool dummy):
 		m_parent(parent),
 		m_pos(pos),
 		m_pos_relative(pos * MAP_BLOCKSIZE),
 		m_gamedef(gamedef)
 {
+	m_instance_id = s_next_instance_id.fetch_add(1, std::memory_order_relaxed);
 	if (!dummy)
 		reallocate();
 }
@@ -474,6 +478,131 @@ void MapBlock::serializeNetworkSpecific(std::ostream &os)
 	writeU8(os, 2); // version
 }
 
+const std::string &MapBlock::getNetworkSerialization(u8 version,
+		int compression_level)
+{
+	// Drop what was serialized before the last modification
+	for (auto it = m_network_cache.begin(); it != m_network_cache.end();) {
+		if (it->modification_count != m_modification_count)
+			it = m_network_cache.erase(it);
+		else if (it->version == version &&
+				it->compression_level == compression_level)
+			return it->data;
+		else
+			++it;
+	}
+
+	std::ostringstream os(std::ios_base::binary);
+	serialize(os, version, false, compression_level);
+	serializeNetworkSpecific(os);
+
+	m_network_cache.push_back({version, compression_level,
+			m_modification_count, os.str()});
+	return m_network_cache.back().data;
+}
+
+const MapBlock::Walkability &MapBlock::getWalkability(const NodeDefManager *ndef)
+{
+	if (m_walkability &&
+			m_walkability->modification_count == m_modification_count)
+		return *m_walkability;
+
+	if (!m_walkability)
+		m_walkability.reset(new Walkability());
+	Walkability &w = *m_walkability;
+	w.modification_count = m_modification_count;
+	w.walkable.reset();
+	w.ignore.reset();
+
+	// Dummy blocks are treated like unloaded ones
+	if (!data) {
+		w.ignore.set();
+		return w;
+	}
+
+	for (u32 i = 0; i < nodecount; i++) {
+		content_t c = data[i].getContent();
+		if (c == CONTENT_IGNORE)
+			w.ignore[i] = true;
+		else if (ndef->get(c).walkable)
+			w.walkable[i] = true;
+	}
+	return w;
+}
+
+const MapBlock::CollisionBoxes &MapBlock::getCollisionBoxes(
+		const NodeDefManager *ndef)
+{
+	if (m_collision_boxes &&
+			m_collision_boxes->modification_count == m_modification_count)
+		return *m_collision_boxes;
+
+	if (!m_collision_boxes)
+		m_collision_boxes.reset(new CollisionBoxes());
+	CollisionBoxes &cb = *m_collision_boxes;
+	cb.modification_count = m_modification_count;
+	cb.ignore.reset();
+	cb.cube.reset();
+	cb.shaped.reset();
+	cb.connected.reset();
+	cb.shaped_index.clear();
+	cb.shaped_first.clear();
+	cb.shaped_bouncy.clear();
+	cb.boxes.clear();
+
+	// Dummy blocks are treated like unloaded ones
+	if (!data) {
+		cb.ignore.set();
+		cb.shaped_first.push_back(0);
+		return cb;
+	}
+
+	// Looking up the bouncy group for every node would dominate the rebuild
+	content_t last_content = CONTENT_IGNORE;
+	int bouncy = 0;
+	const aabb3f cube(-BS / 2, -BS / 2, -BS / 2, BS / 2, BS / 2, BS / 2);
+	std::vector<aabb3f> nodeboxes;
+	for (u32 i = 0; i < nodecount; i++) {
+		const MapNode &n = data[i];
+		content_t c = n.getContent();
+		if (c == CONTENT_IGNORE) {
+			cb.ignore[i] = true;
+			continue;
+		}
+		const ContentFeatures &f = ndef->get(c);
+		if (!f.walkable)
+			continue;
+		if (f.drawtype == NDT_NODEBOX &&
+				f.node_box.type == NODEBOX_CONNECTED) {
+			cb.connected[i] = true;
+			continue;
+		}
+		if (c != last_content) {
+			last_content = c;
+			bouncy = itemgroup_get(f.groups, "bouncy");
+		}
+
+		nodeboxes.clear();
+		if (f.collision_box.fixed.empty() &&
+				f.node_box.type == NODEBOX_REGULAR)
+			nodeboxes.push_back(cube);
+		else
+			n.getCollisionBoxes(ndef, &nodeboxes);
+
+		if (bouncy == 0 && nodeboxes.size() == 1 && nodeboxes[0] == cube) {
+			cb.cube[i] = true;
+			continue;
+		}
+		cb.shaped[i] = true;
+		cb.shaped_index.push_back(i);
+		cb.shaped_first.push_back(cb.boxes.size());
+		cb.shaped_bouncy.push_back(bouncy);
+		cb.boxes.insert(cb.boxes.end(), nodeboxes.begin(), nodeboxes.end());
+	}
+	cb.shaped_first.push_back(cb.boxes.size());
+	return cb;
+}
+
 void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 {
 	if(!ser_ver_supported(version))
@@ -482,6 +611,7 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())<<std::endl);
 
 	m_day_night_differs_expired = false;
+	m_modification_count++;
 
 	if(version <= 21)
 	{
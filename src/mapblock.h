@@ -19,7 +19,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <bitset>
+#include <memory>
 #include <set>
+#include <string>
+#include <vector>
 #include "irr_v3d.h"
 #include "mapnode.h"
 #include "exceptions.h"
@@ -33,6 +37,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapgen/mapgen.h"
 
 class Map;
+class NodeDefManager;
 class NodeMetadataList;
 class IGameDef;
 class MapBlockMesh;
@@ -114,8 +119,23 @@ class MapBlock
 		} else if (mod == m_modified) {
 			m_modified_reason |= reason;
 		}
-		if (mod == MOD_STATE_WRITE_NEEDED)
+		if (mod == MOD_STATE_WRITE_NEEDED) {
 			contents_cached = false;
+			m_modification_count++;
+		}
+	}
+
+	// Incremented on every change that affects the serialized block
+	inline u32 getModificationCount() const
+	{
+		return m_modification_count;
+	}
+
+	// Unique among all blocks ever created. Unlike the address of a block,
+	// it doesn't repeat when a block is unloaded and loaded again.
+	inline u64 getInstanceId() const
+	{
+		return m_instance_id;
 	}
 
 	inline u32 getModified()
@@ -480,6 +500,53 @@ class MapBlock
 
 	void serializeNetworkSpecific(std::ostream &os);
 	void deSerializeNetworkSpecific(std::istream &is);
+
+	// Returns the over-the-network serialization (including the network
+	// specific part), reusing the previous result while the block is unchanged
+	const std::string &getNetworkSerialization(u8 version, int compression_level);
+
+	////
+	//// Pathfinding
+	////
+
+	// Which nodes can be stood on and which ones are not loaded,
+	// indexed like the node data
+	struct Walkability {
+		u32 modification_count;
+		std::bitset<MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE> walkable;
+		std::bitset<MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE> ignore;
+	};
+
+	// Returns the walkability of the nodes, rebuilding it on the first
+	// call after the block was modified
+	const Walkability &getWalkability(const NodeDefManager *ndef);
+
+	////
+	//// Collision
+	////
+
+	// The collision boxes of the nodes, relative to the node position.
+	// Walkable full cubes that do not bounce are only flagged, the boxes of
+	// other walkable nodes are kept in ascending node index order.
+	// Connected nodeboxes depend on the neighbouring blocks and are left to
+	// the caller.
+	struct CollisionBoxes {
+		u32 modification_count;
+		std::bitset<MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE> ignore;
+		std::bitset<MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE> cube;
+		std::bitset<MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE> shaped;
+		std::bitset<MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE> connected;
+		std::vector<u16> shaped_index;
+		// One more entry than shaped_index, boxes of the n-th shaped node
+		// are boxes[shaped_first[n]] to boxes[shaped_first[n + 1] - 1]
+		std::vector<u32> shaped_first;
+		std::vector<int> shaped_bouncy;
+		std::vector<aabb3f> boxes;
+	};
+
+	// Returns the collision boxes of the nodes, rebuilding them on the first
+	// call after the block was modified
+	const CollisionBoxes &getCollisionBoxes(const NodeDefManager *ndef);
 private:
 	/*
 		Private methods
@@ -590,6 +657,27 @@ class MapBlock
 
 	bool m_generated = false;
 
+	u32 m_modification_count = 0;
+	u64 m_instance_id;
+
+	/*
+		Compressed network serializations, one per format version and
+		compression level that was requested while the block was unchanged.
+	*/
+	struct NetworkCacheEntry {
+		u8 version;
+		int compression_level;
+		u32 modification_count;
+		std::string data;
+	};
+	std::vector<NetworkCacheEntry> m_network_cache;
+
+	// Allocated when the pathfinder first looks at the block
+	std::unique_ptr<Walkability> m_walkability;
+
+	// Allocated when something first collides with the block
+	std::unique_ptr<CollisionBoxes> m_collision_boxes;
+
 	/*
 		When block is removed from active blocks, this is set to gametime.
 		Value BLOCK_TIMESTAMP_UNDEFINED=0xffffffff means there is no timestamp.
@@ -0,0 +1,117 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "mapblockindex.h"
+#include "mapblock.h"
+
+// Start with room for a few sectors worth of blocks
+#define MAPBLOCKINDEX_INITIAL_BITS 8
+
+MapBlockIndex::MapBlockIndex()
+{
+	resize(MAPBLOCKINDEX_INITIAL_BITS);
+}
+
+void MapBlockIndex::resize(u32 bits)
+{
+	std::vector<Slot> old_slots;
+	old_slots.swap(m_slots);
+
+	m_slots.resize((size_t)1 << bits);
+	m_mask = (1U << bits) - 1;
+	m_shift = 64 - bits;
+	m_count = 0;
+
+	for (const Slot &slot : old_slots) {
+		if (slot.block)
+			insertNoGrow(slot.pos, slot.block);
+	}
+}
+
+void MapBlockIndex::insertNoGrow(const v3s16 &p, MapBlock *block)
+{
+	for (u32 i = slotFor(p); ; i = (i + 1) & m_mask) {
+		Slot &slot = m_slots[i];
+		if (!slot.block) {
+			slot.pos = p;
+			slot.block = block;
+			m_count++;
+			return;
+		}
+		if (slot.pos == p) {
+			slot.block = block;
+			return;
+		}
+	}
+}
+
+void MapBlockIndex::insert(MapBlock *block)
+{
+	// Keep the load factor at or below 1/2
+	if ((m_count + 1) * 2 > m_slots.size())
+		resize(64 - m_shift + 1);
+
+	const v3s16 p = block->getPos();
+	insertNoGrow(p, block);
+
+	if (m_cache_pos == p)
+		m_cache_block = nullptr;
+}
+
+bool MapBlockIndex::remove(v3s16 p)
+{
+	if (m_cache_pos == p)
+		m_cache_block = nullptr;
+
+	u32 i = slotFor(p);
+	for (; ; i = (i + 1) & m_mask) {
+		if (!m_slots[i].block)
+			return false;
+		if (m_slots[i].pos == p)
+			break;
+	}
+
+	m_slots[i].block = nullptr;
+	m_count--;
+
+	/*
+		Shift back the following entries of the probe sequence which
+		would otherwise become unreachable through the hole at i.
+	*/
+	for (u32 j = (i + 1) & m_mask; m_slots[j].block; j = (j + 1) & m_mask) {
+		u32 home = slotFor(m_slots[j].pos);
+		// Entry stays if its home slot is cyclically within (i, j]
+		bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+		if (stays)
+			continue;
+
+		m_slots[i] = m_slots[j];
+		m_slots[j].block = nullptr;
+		i = j;
+	}
+
+	return true;
+}
+
+void MapBlockIndex::clear()
+{
+	m_slots.clear();
+	m_cache_block = nullptr;
+	resize(MAPBLOCKINDEX_INITIAL_BITS);
+}
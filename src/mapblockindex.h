@@ -0,0 +1,91 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <vector>
+#include "irrlichttypes.h"
+#include "irr_v3d.h"
+
+class MapBlock;
+
+/*
+	Flat, open-addressed hash table from block position to MapBlock.
+
+	Uses linear probing with backward-shift deletion, so that there are no
+	tombstones and probe sequences stay short across many loads and
+	unloads. The last successful lookup is cached, since consecutive
+	accesses tend to hit the same block.
+
+	Not thread-safe, just like Map itself.
+*/
+class MapBlockIndex
+{
+public:
+	MapBlockIndex();
+
+	MapBlock *get(v3s16 p)
+	{
+		if (m_cache_block && p == m_cache_pos)
+			return m_cache_block;
+
+		for (u32 i = slotFor(p); ; i = (i + 1) & m_mask) {
+			const Slot &slot = m_slots[i];
+			if (!slot.block)
+				return nullptr;
+			if (slot.pos == p) {
+				m_cache_pos = p;
+				m_cache_block = slot.block;
+				return slot.block;
+			}
+		}
+	}
+
+	// Adds the block, replacing any block already at the same position
+	void insert(MapBlock *block);
+	// Returns false if there was no block at p
+	bool remove(v3s16 p);
+	void clear();
+
+	size_t size() const { return m_count; }
+
+private:
+	struct Slot {
+		v3s16 pos;
+		MapBlock *block = nullptr;
+	};
+
+	u32 slotFor(v3s16 p) const
+	{
+		u64 key = ((u64)(u16)p.X << 32) | ((u64)(u16)p.Y << 16) | (u16)p.Z;
+		// Fibonacci hashing, so that neighbouring blocks are spread out
+		return (u32)((key * 0x9E3779B97F4A7C15ULL) >> m_shift);
+	}
+
+	void resize(u32 bits);
+	void insertNoGrow(const v3s16 &p, MapBlock *block);
+
+	std::vector<Slot> m_slots;
+	u32 m_mask;
+	u32 m_shift;
+	size_t m_count = 0;
+
+	v3s16 m_cache_pos;
+	MapBlock *m_cache_block = nullptr;
+};
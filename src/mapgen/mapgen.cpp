@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <algorithm>
 #include <cmath>
 #include "mapgen.h"
 #include "voxel.h"
@@ -39,6 +40,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/serialize.h"
 #include "util/numeric.h"
 #include "util/directiontables.h"
+#include "util/workerpool.h"
 #include "filesys.h"
 #include "log.h"
 #include "mapgen_carpathian.h"
@@ -134,6 +136,7 @@ Mapgen::Mapgen(int mapgenid, MapgenParams *params, EmergeParams *emerge) :
 	seed = (s32)params->seed;
 
 	ndef      = emerge->ndef;
+	pool      = emerge->mapgen_pool;
 }
 
 
@@ -568,6 +571,44 @@ void Mapgen::spreadLight(const v3s16 &nmin, const v3s16 &nmax)
 }
 
 
+void Mapgen::runPasses(const std::vector<std::pair<s32, s32>> &yranges,
+	const std::function<void(size_t)> &pass)
+{
+	if (!pool) {
+		for (size_t i = 0; i < yranges.size(); i++)
+			pass(i);
+		return;
+	}
+
+	// Each pass goes to the wave after the last earlier pass that it
+	// overlaps, so the passes of one wave touch disjoint nodes.
+	std::vector<size_t> wave_of(yranges.size());
+	std::vector<std::vector<size_t>> waves;
+	for (size_t i = 0; i < yranges.size(); i++) {
+		size_t wave = 0;
+		for (size_t j = 0; j < i; j++) {
+			if (yranges[j].first <= yranges[i].second &&
+					yranges[i].first <= yranges[j].second)
+				wave = std::max(wave, wave_of[j] + 1);
+		}
+		wave_of[i] = wave;
+		if (wave == waves.size())
+			waves.emplace_back();
+		waves[wave].push_back(i);
+	}
+
+	for (const std::vector<size_t> &passes : waves) {
+		if (passes.size() == 1) {
+			pass(passes[0]);
+			continue;
+		}
+		pool->parallelFor(passes.size(), [&] (size_t i) {
+			pass(passes[i]);
+		});
+	}
+}
+
+
 ////
 //// MapgenBasic
 ////
@@ -603,6 +644,7 @@ MapgenBasic::MapgenBasic(int mapgenid, MapgenParams *params, EmergeParams *emerg
 	//// Initialize biome generator
 	biomegen = m_bmgr->createBiomeGen(BIOMEGEN_ORIGINAL, params->bparams, csize);
 	biomemap = biomegen->biomemap;
+	biomegen->pool = pool;
 
 	//// Look up some commonly used content
 	c_stone              = ndef->getId("mapgen_stone");
@@ -641,132 +683,146 @@ void MapgenBasic::generateBiomes()
 	assert(biomemap);
 
 	const v3s16 &em = vm->m_area.getExtent();
-	u32 index = 0;
+	const s16 sizex = node_max.X - node_min.X + 1;
 
 	noise_filler_depth->perlinMap2D(node_min.X, node_min.Z);
 
-	for (s16 z = node_min.Z; z <= node_max.Z; z++)
-	for (s16 x = node_min.X; x <= node_max.X; x++, index++) {
-		Biome *biome = NULL;
-		biome_t water_biome_index = 0;
-		u16 depth_top = 0;
-		u16 base_filler = 0;
-		u16 depth_water_top = 0;
-		u16 depth_riverbed = 0;
-		s16 biome_y_min = -MAX_MAP_GENERATION_LIMIT;
-		u32 vi = vm->m_area.index(x, node_max.Y, z);
-
-		// Check node at base of mapchunk above, either a node of a previously
-		// generated mapchunk or if not, a node of overgenerated base terrain.
-		content_t c_above = vm->m_data[vi + em.X].getContent();
-		bool air_above = c_above == CONTENT_AIR;
-		bool river_water_above = c_above == c_river_water_source;
-		bool water_above = c_above == c_water_source || river_water_above;
-
-		biomemap[index] = BIOME_NONE;
-
-		// If there is air or water above enable top/filler placement, otherwise force
-		// nplaced to stone level by setting a number exceeding any possible filler depth.
-		u16 nplaced = (air_above || water_above) ? 0 : U16_MAX;
-
-		for (s16 y = node_max.Y; y >= node_min.Y; y--) {
-			content_t c = vm->m_data[vi].getContent();
-			// Biome is (re)calculated:
-			// 1. At the surface of stone below air or water.
-			// 2. At the surface of water below air.
-			// 3. When stone or water is detected but biome has not yet been calculated.
-			// 4. When stone or water is detected just below a biome's lower limit.
-			bool is_stone_surface = (c == c_stone) &&
-				(air_above || water_above || !biome || y < biome_y_min); // 1, 3, 4
-
-			bool is_water_surface =
-				(c == c_water_source || c == c_river_water_source) &&
-				(air_above || !biome || y < biome_y_min); // 2, 3, 4
-
-			if (is_stone_surface || is_water_surface) {
-				// (Re)calculate biome
-				biome = biomegen->getBiomeAtIndex(index, v3s16(x, y, z));
-
-				// Add biome to biomemap at first stone surface detected
-				if (biomemap[index] == BIOME_NONE && is_stone_surface)
-					biomemap[index] = biome->index;
-
-				// Store biome of first water surface detected, as a fallback
-				// entry for the biomemap.
-				if (water_biome_index == 0 && is_water_surface)
-					water_biome_index = biome->index;
-
-				depth_top = biome->depth_top;
-				base_filler = MYMAX(depth_top +
-					biome->depth_filler +
-					noise_filler_depth->result[index], 0.0f);
-				depth_water_top = biome->depth_water_top;
-				depth_riverbed = biome->depth_riverbed;
-				biome_y_min = biome->min_pos.Y;
-			}
+	// Every column only depends on itself, so the rows can be done in any
+	// order
+	auto generate_row = [&] (size_t row) {
+		s16 z = node_min.Z + row;
+		u32 index = row * sizex;
+		for (s16 x = node_min.X; x <= node_max.X; x++, index++) {
+			Biome *biome = NULL;
+			biome_t water_biome_index = 0;
+			u16 depth_top = 0;
+			u16 base_filler = 0;
+			u16 depth_water_top = 0;
+			u16 depth_riverbed = 0;
+			s16 biome_y_min = -MAX_MAP_GENERATION_LIMIT;
+			u32 vi = vm->m_area.index(x, node_max.Y, z);
+
+			// Check node at base of mapchunk above, either a node of a previously
+			// generated mapchunk or if not, a node of overgenerated base terrain.
+			content_t c_above = vm->m_data[vi + em.X].getContent();
+			bool air_above = c_above == CONTENT_AIR;
+			bool river_water_above = c_above == c_river_water_source;
+			bool water_above = c_above == c_water_source || river_water_above;
+
+			biomemap[index] = BIOME_NONE;
+
+			// If there is air or water above enable top/filler placement, otherwise force
+			// nplaced to stone level by setting a number exceeding any possible filler depth.
+			u16 nplaced = (air_above || water_above) ? 0 : U16_MAX;
+
+			for (s16 y = node_max.Y; y >= node_min.Y; y--) {
+				content_t c = vm->m_data[vi].getContent();
+				// Biome is (re)calculated:
+				// 1. At the surface of stone below air or water.
+				// 2. At the surface of water below air.
+				// 3. When stone or water is detected but biome has not yet been calculated.
+				// 4. When stone or water is detected just below a biome's lower limit.
+				bool is_stone_surface = (c == c_stone) &&
+					(air_above || water_above || !biome || y < biome_y_min); // 1, 3, 4
+
+				bool is_water_surface =
+					(c == c_water_source || c == c_river_water_source) &&
+					(air_above || !biome || y < biome_y_min); // 2, 3, 4
+
+				if (is_stone_surface || is_water_surface) {
+					// (Re)calculate biome
+					biome = biomegen->getBiomeAtIndex(index, v3s16(x, y, z));
+
+					// Add biome to biomemap at first stone surface detected
+					if (biomemap[index] == BIOME_NONE && is_stone_surface)
+						biomemap[index] = biome->index;
+
+					// Store biome of first water surface detected, as a fallback
+					// entry for the biomemap.
+					if (water_biome_index == 0 && is_water_surface)
+						water_biome_index = biome->index;
+
+					depth_top = biome->depth_top;
+					base_filler = MYMAX(depth_top +
+						biome->depth_filler +
+						noise_filler_depth->result[index], 0.0f);
+					depth_water_top = biome->depth_water_top;
+					depth_riverbed = biome->depth_riverbed;
+					biome_y_min = biome->min_pos.Y;
+				}
 
-			if (c == c_stone) {
-				content_t c_below = vm->m_data[vi - em.X].getContent();
-
-				// If the node below isn't solid, make this node stone, so that
-				// any top/filler nodes above are structurally supported.
-				// This is done by aborting the cycle of top/filler placement
-				// immediately by forcing nplaced to stone level.
-				if (c_below == CONTENT_AIR
-						|| c_below == c_water_source
-						|| c_below == c_river_water_source)
-					nplaced = U16_MAX;
-
-				if (river_water_above) {
-					if (nplaced < depth_riverbed) {
-						vm->m_data[vi] = MapNode(biome->c_riverbed);
+				if (c == c_stone) {
+					content_t c_below = vm->m_data[vi - em.X].getContent();
+
+					// If the node below isn't solid, make this node stone, so that
+					// any top/filler nodes above are structurally supported.
+					// This is done by aborting the cycle of top/filler placement
+					// immediately by forcing nplaced to stone level.
+					if (c_below == CONTENT_AIR
+							|| c_below == c_water_source
+							|| c_below == c_river_water_source)
+						nplaced = U16_MAX;
+
+					if (river_water_above) {
+						if (nplaced < depth_riverbed) {
+							vm->m_data[vi] = MapNode(biome->c_riverbed);
+							nplaced++;
+						} else {
+							nplaced = U16_MAX;  // Disable top/filler placement
+							river_water_above = false;
+						}
+					} else if (nplaced < depth_top) {
+						vm->m_data[vi] = MapNode(biome->c_top);
+						nplaced++;
+					} else if (nplaced < base_filler) {
+						vm->m_data[vi] = MapNode(biome->c_filler);
 						nplaced++;
 					} else {
+						vm->m_data[vi] = MapNode(biome->c_stone);
 						nplaced = U16_MAX;  // Disable top/filler placement
-						river_water_above = false;
 					}
-				} else if (nplaced < depth_top) {
-					vm->m_data[vi] = MapNode(biome->c_top);
-					nplaced++;
-				} else if (nplaced < base_filler) {
-					vm->m_data[vi] = MapNode(biome->c_filler);
-					nplaced++;
-				} else {
-					vm->m_data[vi] = MapNode(biome->c_stone);
+
+					air_above = false;
+					water_above = false;
+				} else if (c == c_water_source) {
+					vm->m_data[vi] = MapNode((y > (s32)(water_level - depth_water_top))
+							? biome->c_water_top : biome->c_water);
+					nplaced = 0;  // Enable top/filler placement for next surface
+					air_above = false;
+					water_above = true;
+				} else if (c == c_river_water_source) {
+					vm->m_data[vi] = MapNode(biome->c_river_water);
+					nplaced = 0;  // Enable riverbed placement for next surface
+					air_above = false;
+					water_above = true;
+					river_water_above = true;
+				} else if (c == CONTENT_AIR) {
+					nplaced = 0;  // Enable top/filler placement for next surface
+					air_above = true;
+					water_above = false;
+				} else {  // Possible various nodes overgenerated from neighbouring mapchunks
 					nplaced = U16_MAX;  // Disable top/filler placement
+					air_above = false;
+					water_above = false;
 				}
 
-				air_above = false;
-				water_above = false;
-			} else if (c == c_water_source) {
-				vm->m_data[vi] = MapNode((y > (s32)(water_level - depth_water_top))
-						? biome->c_water_top : biome->c_water);
-				nplaced = 0;  // Enable top/filler placement for next surface
-				air_above = false;
-				water_above = true;
-			} else if (c == c_river_water_source) {
-				vm->m_data[vi] = MapNode(biome->c_river_water);
-				nplaced = 0;  // Enable riverbed placement for next surface
-				air_above = false;
-				water_above = true;
-				river_water_above = true;
-			} else if (c == CONTENT_AIR) {
-				nplaced = 0;  // Enable top/filler placement for next surface
-				air_above = true;
-				water_above = false;
-			} else {  // Possible various nodes overgenerated from neighbouring mapchunks
-				nplaced = U16_MAX;  // Disable top/filler placement
-				air_above = false;
-				water_above = false;
+				VoxelArea::add_y(em, vi, -1);
 			}
+			// If no stone surface detected in mapchunk column and a water surface
+			// biome fallback exists, add it to the biomemap. This avoids water
+			// surface decorations failing in deep water.
+			if (biomemap[index] == BIOME_NONE && water_biome_index != 0)
+				biomemap[index] = water_biome_index;
 
-			VoxelArea::add_y(em, vi, -1);
 		}
-		// If no stone surface detected in mapchunk column and a water surface
-		// biome fallback exists, add it to the biomemap. This avoids water
-		// surface decorations failing in deep water.
- 		if (biomemap[index] == BIOME_NONE && water_biome_index != 0)
-			biomemap[index] = water_biome_index;
+	};
+
+	size_t rows = node_max.Z - node_min.Z + 1;
+	if (pool) {
+		pool->parallelFor(rows, generate_row);
+	} else {
+		for (size_t row = 0; row < rows; row++)
+			generate_row(row);
 	}
 }
 
@@ -1011,6 +1067,18 @@ void GenerateNotifier::clearEvents()
 }
 
 
+GenerateNotifier GenerateNotifier::fork() const
+{
+	return GenerateNotifier(m_notify_on, m_notify_on_deco_ids);
+}
+
+
+void GenerateNotifier::join(GenerateNotifier &fork)
+{
+	m_notify_events.splice(m_notify_events.end(), fork.m_notify_events);
+}
+
+
 ////
 //// MapgenParams
 ////
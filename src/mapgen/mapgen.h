@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <functional>
 #include "noise.h"
 #include "nodedef.h"
 #include "util/string.h"
@@ -57,6 +58,7 @@ class VoxelManipulator;
 struct BlockMakeData;
 class VoxelArea;
 class Map;
+class WorkerPool;
 
 enum MapgenObject {
 	MGOBJ_VMANIP,
@@ -94,6 +96,12 @@ class GenerateNotifier {
 	void getEvents(std::map<std::string, std::vector<v3s16> > &event_map);
 	void clearEvents();
 
+	// An empty notifier with the same filter, for collecting the events of
+	// a pass that runs on another thread
+	GenerateNotifier fork() const;
+	// Appends the events of a fork and clears it
+	void join(GenerateNotifier &fork);
+
 private:
 	u32 m_notify_on = 0;
 	const std::set<u32> *m_notify_on_deco_ids = nullptr;
@@ -174,6 +182,9 @@ class Mapgen {
 	BiomeGen *biomegen = nullptr;
 	GenerateNotifier gennotify;
 
+	// Shared with the other emerge threads, null to generate serially
+	WorkerPool *pool = nullptr;
+
 	Mapgen() = default;
 	Mapgen(int mapgenid, MapgenParams *params, EmergeParams *emerge);
 	virtual ~Mapgen() = default;
@@ -199,6 +210,13 @@ class Mapgen {
 	void propagateSunlight(v3s16 nmin, v3s16 nmax, bool propagate_shadow);
 	void spreadLight(const v3s16 &nmin, const v3s16 &nmax);
 
+	// Calls pass(i) for every i in [0, yranges.size()), concurrently on the
+	// worker pool if there is one. Passes whose Y ranges of touched nodes
+	// overlap run in order of i, so the result is the same as calling them
+	// one after another.
+	void runPasses(const std::vector<std::pair<s32, s32>> &yranges,
+		const std::function<void(size_t)> &pass);
+
 	virtual void makeChunk(BlockMakeData *data) {}
 	virtual int getGroundLevelAtPoint(v2s16 p) { return 0; }
 
@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodedef.h"
 #include "map.h" //for MMVManip
 #include "util/numeric.h"
+#include "util/workerpool.h"
 #include "porting.h"
 #include "settings.h"
 
@@ -242,10 +243,17 @@ void BiomeGenOriginal::calcBiomeNoise(v3s16 pmin)
 {
 	m_pmin = pmin;
 
-	noise_heat->perlinMap2D(pmin.X, pmin.Z);
-	noise_humidity->perlinMap2D(pmin.X, pmin.Z);
-	noise_heat_blend->perlinMap2D(pmin.X, pmin.Z);
-	noise_humidity_blend->perlinMap2D(pmin.X, pmin.Z);
+	Noise *noises[] = {noise_heat, noise_humidity,
+		noise_heat_blend, noise_humidity_blend};
+	auto calc_noise = [&] (size_t i) {
+		noises[i]->perlinMap2D(pmin.X, pmin.Z);
+	};
+	if (pool) {
+		pool->parallelFor(ARRLEN(noises), calc_noise);
+	} else {
+		for (size_t i = 0; i < ARRLEN(noises); i++)
+			calc_noise(i);
+	}
 
 	for (s32 i = 0; i < m_csize.X * m_csize.Z; i++) {
 		noise_heat->result[i]     += noise_heat_blend->result[i];
@@ -27,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 class Server;
 class Settings;
 class BiomeManager;
+class WorkerPool;
 
 ////
 //// Biome
@@ -122,6 +123,9 @@ class BiomeGen {
 	// Result of calcBiomes bulk computation.
 	biome_t *biomemap = nullptr;
 
+	// Used by calcBiomeNoise if set
+	WorkerPool *pool = nullptr;
+
 protected:
 	BiomeManager *m_bmgr = nullptr;
 	v3s16 m_pmin;
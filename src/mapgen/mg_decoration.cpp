@@ -26,6 +26,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "log.h"
 #include "util/numeric.h"
 #include <algorithm>
+#include <numeric>
 #include <vector>
 
 
@@ -53,18 +54,41 @@ DecorationManager::DecorationManager(IGameDef *gamedef) :
 size_t DecorationManager::placeAllDecos(Mapgen *mg, u32 blockseed,
 	v3s16 nmin, v3s16 nmax)
 {
-	size_t nplaced = 0;
+	std::vector<std::pair<Decoration *, u32>> decos;
+	std::vector<std::pair<s32, s32>> yranges;
 
 	for (size_t i = 0; i != m_objects.size(); i++) {
 		Decoration *deco = (Decoration *)m_objects[i];
 		if (!deco)
 			continue;
 
-		nplaced += deco->placeDeco(mg, blockseed, nmin, nmax);
+		s32 ymin, ymax;
+		if (deco->getAffectedRange(mg, nmin, nmax, ymin, ymax)) {
+			decos.emplace_back(deco, blockseed);
+			yranges.emplace_back(ymin, ymax);
+		}
 		blockseed++;
 	}
 
-	return nplaced;
+	if (!mg->pool) {
+		size_t nplaced = 0;
+		for (const auto &deco : decos)
+			nplaced += deco.first->placeDeco(mg, deco.second, nmin, nmax,
+				mg->gennotify);
+		return nplaced;
+	}
+
+	// Events are collected per decoration and added in the usual order
+	std::vector<GenerateNotifier> events(decos.size(), mg->gennotify.fork());
+	std::vector<size_t> nplaced(decos.size());
+	mg->runPasses(yranges, [&] (size_t i) {
+		nplaced[i] = decos[i].first->placeDeco(mg, decos[i].second,
+			nmin, nmax, events[i]);
+	});
+	for (GenerateNotifier &fork : events)
+		mg->gennotify.join(fork);
+
+	return std::accumulate(nplaced.begin(), nplaced.end(), (size_t)0);
 }
 
 DecorationManager *DecorationManager::clone() const
@@ -134,7 +158,30 @@ bool Decoration::canPlaceDecoration(MMVManip *vm, v3s16 p)
 }
 
 
-size_t Decoration::placeDeco(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax)
+bool Decoration::getAffectedRange(Mapgen *mg, v3s16 nmin, v3s16 nmax,
+	s32 &ymin, s32 &ymax) const
+{
+	// These search the whole node column for their surfaces
+	if ((flags & (DECO_ALL_FLOORS | DECO_ALL_CEILINGS | DECO_LIQUID_SURFACE)) ||
+			!mg->heightmap) {
+		ymin = S32_MIN;
+		ymax = S32_MAX;
+		return true;
+	}
+
+	if (nmin.Y > y_max || nmax.Y < y_min)
+		return false;
+
+	s16 below, above;
+	getReach(below, above);
+	ymin = MYMAX(nmin.Y, y_min) - below;
+	ymax = MYMIN(nmax.Y, y_max) + above;
+	return true;
+}
+
+
+size_t Decoration::placeDeco(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax,
+	GenerateNotifier &gennotify)
 {
 	PcgRandom ps(blockseed + 53);
 	int carea_size = nmax.X - nmin.X + 1;
@@ -228,7 +275,7 @@ size_t Decoration::placeDeco(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax)
 
 						v3s16 pos(x, y, z);
 						if (generate(mg->vm, &ps, pos, false))
-							mg->gennotify.addEvent(
+							gennotify.addEvent(
 									GENNOTIFY_DECORATION, pos, index);
 					}
 				}
@@ -241,7 +288,7 @@ size_t Decoration::placeDeco(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax)
 
 						v3s16 pos(x, y, z);
 						if (generate(mg->vm, &ps, pos, true))
-							mg->gennotify.addEvent(
+							gennotify.addEvent(
 									GENNOTIFY_DECORATION, pos, index);
 					}
 				}
@@ -265,7 +312,7 @@ size_t Decoration::placeDeco(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax)
 
 				v3s16 pos(x, y, z);
 				if (generate(mg->vm, &ps, pos, false))
-					mg->gennotify.addEvent(GENNOTIFY_DECORATION, pos, index);
+					gennotify.addEvent(GENNOTIFY_DECORATION, pos, index);
 			}
 		}
 	}
@@ -386,6 +433,15 @@ size_t DecoSimple::generate(MMVManip *vm, PcgRandom *pr, v3s16 p, bool ceiling)
 }
 
 
+void DecoSimple::getReach(s16 &below, s16 &above) const
+{
+	// The node above is checked for spawnby nodes
+	below = std::abs(place_offset_y);
+	above = std::abs(place_offset_y) + std::max<s16>(std::max(deco_height,
+		deco_height_max), 1);
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 
@@ -465,3 +521,11 @@ size_t DecoSchematic::generate(MMVManip *vm, PcgRandom *pr, v3s16 p, bool ceilin
 
 	return 1;
 }
+
+
+void DecoSchematic::getReach(s16 &below, s16 &above) const
+{
+	s16 size_y = schematic ? schematic->size.Y : 0;
+	below = std::abs(place_offset_y) + size_y;
+	above = std::abs(place_offset_y) + std::max<s16>(size_y, 1);
+}
@@ -27,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 typedef u16 biome_t;  // copy from mg_biome.h to avoid an unnecessary include
 
+class GenerateNotifier;
 class Mapgen;
 class MMVManip;
 class PcgRandom;
@@ -58,9 +59,17 @@ class Decoration : public ObjDef, public NodeResolver {
 	virtual void resolveNodeNames();
 
 	bool canPlaceDecoration(MMVManip *vm, v3s16 p);
-	size_t placeDeco(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax);
+
+	// Gets the Y range of the nodes placeDeco can read or change in the
+	// given area. Returns false if the decoration is not placed there at all.
+	bool getAffectedRange(Mapgen *mg, v3s16 nmin, v3s16 nmax,
+		s32 &ymin, s32 &ymax) const;
+	size_t placeDeco(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax,
+		GenerateNotifier &gennotify);
 
 	virtual size_t generate(MMVManip *vm, PcgRandom *pr, v3s16 p, bool ceiling) = 0;
+	// How far below and above the ground position generate() reaches
+	virtual void getReach(s16 &below, s16 &above) const = 0;
 
 	u32 flags = 0;
 	int mapseed = 0;
@@ -87,6 +96,7 @@ class DecoSimple : public Decoration {
 
 	virtual void resolveNodeNames();
 	virtual size_t generate(MMVManip *vm, PcgRandom *pr, v3s16 p, bool ceiling);
+	virtual void getReach(s16 &below, s16 &above) const;
 
 	std::vector<content_t> c_decos;
 	s16 deco_height;
@@ -104,6 +114,7 @@ class DecoSchematic : public Decoration {
 	virtual ~DecoSchematic();
 
 	virtual size_t generate(MMVManip *vm, PcgRandom *pr, v3s16 p, bool ceiling);
+	virtual void getReach(s16 &below, s16 &above) const;
 
 	Rotation rotation;
 	Schematic *schematic = nullptr;
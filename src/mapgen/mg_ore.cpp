@@ -26,6 +26,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/numeric.h"
 #include <cmath>
 #include <algorithm>
+#include <numeric>
 
 
 FlagDesc flagdesc_ore[] = {
@@ -47,18 +48,28 @@ OreManager::OreManager(IGameDef *gamedef) :
 
 size_t OreManager::placeAllOres(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax)
 {
-	size_t nplaced = 0;
+	std::vector<std::pair<Ore *, u32>> ores;
+	std::vector<std::pair<s32, s32>> yranges;
 
 	for (size_t i = 0; i != m_objects.size(); i++) {
 		Ore *ore = (Ore *)m_objects[i];
 		if (!ore)
 			continue;
 
-		nplaced += ore->placeOre(mg, blockseed, nmin, nmax);
+		s32 ymin, ymax;
+		if (ore->getAffectedRange(nmin, nmax, ymin, ymax)) {
+			ores.emplace_back(ore, blockseed);
+			yranges.emplace_back(ymin, ymax);
+		}
 		blockseed++;
 	}
 
-	return nplaced;
+	std::vector<size_t> nplaced(ores.size());
+	mg->runPasses(yranges, [&] (size_t i) {
+		nplaced[i] = ores[i].first->placeOre(mg, ores[i].second, nmin, nmax);
+	});
+
+	return std::accumulate(nplaced.begin(), nplaced.end(), (size_t)0);
 }
 
 
@@ -96,14 +107,21 @@ void Ore::resolveNodeNames()
 }
 
 
-size_t Ore::placeOre(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax)
+bool Ore::getAffectedRange(v3s16 nmin, v3s16 nmax, s32 &ymin, s32 &ymax) const
 {
 	if (nmin.Y > y_max || nmax.Y < y_min)
-		return 0;
+		return false;
+
+	ymin = MYMAX(nmin.Y, y_min);
+	ymax = MYMIN(nmax.Y, y_max);
+	return clust_size < ymax - ymin + 1;
+}
+
 
-	int actual_ymin = MYMAX(nmin.Y, y_min);
-	int actual_ymax = MYMIN(nmax.Y, y_max);
-	if (clust_size >= actual_ymax - actual_ymin + 1)
+size_t Ore::placeOre(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax)
+{
+	s32 actual_ymin, actual_ymax;
+	if (!Ore::getAffectedRange(nmin, nmax, actual_ymin, actual_ymax))
 		return 0;
 
 	nmin.Y = actual_ymin;
@@ -284,6 +302,19 @@ ObjDef *OrePuff::clone() const
 }
 
 
+bool OrePuff::getAffectedRange(v3s16 nmin, v3s16 nmax,
+	s32 &ymin, s32 &ymax) const
+{
+	if (!Ore::getAffectedRange(nmin, nmax, ymin, ymax))
+		return false;
+
+	// Puffs grow out of the ore's Y range, up to the whole voxelmanip
+	ymin = S32_MIN;
+	ymax = S32_MAX;
+	return true;
+}
+
+
 void OrePuff::generate(MMVManip *vm, int mapseed, u32 blockseed,
 	v3s16 nmin, v3s16 nmax, biome_t *biomemap)
 {
@@ -73,6 +73,11 @@ class Ore : public ObjDef, public NodeResolver {
 
 	virtual void resolveNodeNames();
 
+	// Gets the Y range of the nodes placeOre can touch in the given area.
+	// Returns false if the ore is not placed there at all.
+	virtual bool getAffectedRange(v3s16 nmin, v3s16 nmax,
+		s32 &ymin, s32 &ymax) const;
+
 	size_t placeOre(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax);
 	virtual void generate(MMVManip *vm, int mapseed, u32 blockseed,
 		v3s16 nmin, v3s16 nmax, biome_t *biomemap) = 0;
@@ -117,6 +122,9 @@ class OrePuff : public Ore {
 	OrePuff() : Ore(true) {}
 	virtual ~OrePuff();
 
+	bool getAffectedRange(v3s16 nmin, v3s16 nmax,
+			s32 &ymin, s32 &ymax) const override;
+
 	void generate(MMVManip *vm, int mapseed, u32 blockseed,
 			v3s16 nmin, v3s16 nmax, biome_t *biomemap) override;
 };
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "mapsector.h"
 #include "exceptions.h"
+#include "map.h"
 #include "mapblock.h"
 #include "serialization.h"
 
@@ -41,6 +42,8 @@ void MapSector::deleteBlocks()
 
 	// Delete all
 	for (auto &block : m_blocks) {
+		if (m_parent)
+			m_parent->m_block_index.remove(block.second->getPos());
 		delete block.second;
 	}
 
@@ -88,6 +91,8 @@ MapBlock * MapSector::createBlankBlock(s16 y)
 	MapBlock *block = createBlankBlockNoInsert(y);
 
 	m_blocks[y] = block;
+	if (m_parent)
+		m_parent->m_block_index.insert(block);
 
 	return block;
 }
@@ -106,6 +111,8 @@ void MapSector::insertBlock(MapBlock *block)
 
 	// Insert into container
 	m_blocks[block_y] = block;
+	if (m_parent)
+		m_parent->m_block_index.insert(block);
 }
 
 void MapSector::deleteBlock(MapBlock *block)
@@ -117,6 +124,8 @@ void MapSector::deleteBlock(MapBlock *block)
 
 	// Remove from container
 	m_blocks.erase(block_y);
+	if (m_parent)
+		m_parent->m_block_index.remove(block->getPos());
 
 	// Delete
 	delete block;
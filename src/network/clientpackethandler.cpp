@@ -1672,3 +1672,16 @@ void Client::handleCommand_MinimapModes(NetworkPacket *pkt)
 			showMinimap(m_minimap->getModeDef().type != MINIMAP_TYPE_OFF);
 	}
 }
+
+void Client::handleCommand_ZstdDictionary(NetworkPacket *pkt)
+{
+	std::string dict = pkt->readLongString();
+
+	u32 id = registerZstdDictionary(dict);
+	if (id == 0) {
+		errorstream << "Client: Server sent an invalid zstd dictionary"
+				<< std::endl;
+		return;
+	}
+	verbosestream << "Client: Got zstd dictionary " << id << std::endl;
+}
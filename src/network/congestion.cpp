@@ -0,0 +1,352 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "congestion.h"
+#include <algorithm>
+#include <cmath>
+#include "constants.h"
+#include "log.h"
+#include "threading/mutex_auto_lock.h"
+#include "util/numeric.h"
+
+namespace con
+{
+
+/*
+	CongestionController
+*/
+
+CongestionController *CongestionController::create(const std::string &name)
+{
+	if (name == "cubic")
+		return new CubicController();
+	if (name == "bbr")
+		return new BbrController();
+	if (name != "legacy") {
+		warningstream << "Unknown congestion_control \"" << name
+			<< "\", using legacy" << std::endl;
+	}
+	return nullptr;
+}
+
+bool CongestionController::onAck(u64 now, float rtt)
+{
+	MutexAutoLock lock(m_mutex);
+	if (rtt >= 0.0f) {
+		if (m_srtt < 0.0f) {
+			m_srtt = rtt;
+			m_rttvar = rtt / 2.0f;
+		} else {
+			m_rttvar = 0.75f * m_rttvar + 0.25f * std::fabs(m_srtt - rtt);
+			m_srtt = 0.875f * m_srtt + 0.125f * rtt;
+		}
+	}
+
+	ack(now, rtt);
+
+	// Wake the sender up once an eighth of the window is free again,
+	// not for every single ack
+	if (!m_window_blocked)
+		return false;
+	if (++m_acks_since_blocked < std::max(window() / 8.0f, 1.0f))
+		return false;
+	m_window_blocked = false;
+	return true;
+}
+
+void CongestionController::onLoss(u64 now, u32 count)
+{
+	MutexAutoLock lock(m_mutex);
+	loss(now, count);
+}
+
+void CongestionController::refill(u64 now)
+{
+	float rate = pacingRate();
+	float burst = std::max((float)PACING_BURST_MIN, rate * PACING_BURST_TIME);
+	if (m_last_refill == 0)
+		m_tokens = burst;
+	else if (now > m_last_refill)
+		m_tokens = std::min(m_tokens + (now - m_last_refill) / 1e6f * rate, burst);
+	m_last_refill = now;
+}
+
+bool CongestionController::canSend(u64 now, u32 inflight)
+{
+	MutexAutoLock lock(m_mutex);
+	m_inflight = inflight;
+	if (inflight >= (u32)window()) {
+		if (!m_window_blocked) {
+			m_window_blocked = true;
+			m_acks_since_blocked = 0;
+		}
+		m_send_limited = true;
+		return false;
+	}
+
+	if (pacingRate() <= 0.0f)
+		return true;
+	refill(now);
+	if (m_tokens < 1.0f) {
+		m_send_limited = true;
+		return false;
+	}
+	return true;
+}
+
+u32 CongestionController::getPacingBudget(u64 now)
+{
+	MutexAutoLock lock(m_mutex);
+	if (pacingRate() <= 0.0f)
+		return U32_MAX;
+	refill(now);
+	return m_tokens > 0.0f ? (u32)m_tokens : 0;
+}
+
+void CongestionController::onSend(u32 count)
+{
+	MutexAutoLock lock(m_mutex);
+	if (pacingRate() > 0.0f)
+		m_tokens -= count;
+}
+
+u32 CongestionController::getPacingDelayMs(u64 now)
+{
+	MutexAutoLock lock(m_mutex);
+	float rate = pacingRate();
+	if (rate <= 0.0f)
+		return 0;
+	refill(now);
+	if (m_tokens >= 1.0f)
+		return 0;
+	return std::max((u32)std::ceil((1.0f - m_tokens) / rate * 1000.0f), 1U);
+}
+
+u32 CongestionController::getWindow()
+{
+	MutexAutoLock lock(m_mutex);
+	return window();
+}
+
+float CongestionController::getPacingRate()
+{
+	MutexAutoLock lock(m_mutex);
+	return pacingRate();
+}
+
+float CongestionController::getResendTimeout()
+{
+	MutexAutoLock lock(m_mutex);
+	// Like the initial resend_timeout of UDPPeer
+	if (m_srtt < 0.0f)
+		return 0.5f;
+	float timeout = m_srtt + std::max(4.0f * m_rttvar, 0.01f);
+	return rangelim(timeout, RESEND_TIMEOUT_MIN, RESEND_TIMEOUT_MAX);
+}
+
+/*
+	CubicController
+*/
+
+#define CUBIC_C 0.4f
+#define CUBIC_BETA 0.7f
+
+void CubicController::ack(u64 now, float rtt)
+{
+	// Don't grow a window that isn't used, like the legacy window
+	if (m_inflight * 2.0f < m_cwnd)
+		return;
+
+	if (m_cwnd < m_ssthresh) {
+		// Slow start
+		m_cwnd = std::min(m_cwnd + 1.0f, (float)CONGESTION_WINDOW_MAX);
+		return;
+	}
+
+	if (m_epoch_start == 0) {
+		m_epoch_start = now;
+		if (m_cwnd < m_w_max) {
+			m_k = std::cbrt((m_w_max - m_cwnd) / CUBIC_C);
+		} else {
+			m_k = 0.0f;
+			m_w_max = m_cwnd;
+		}
+		m_w_est = m_cwnd;
+	}
+
+	// Where the curve is one round trip from now
+	float t = (now - m_epoch_start) / 1e6f + std::max(m_srtt, 0.0f);
+	float target = CUBIC_C * (t - m_k) * (t - m_k) * (t - m_k) + m_w_max;
+
+	m_w_est += 3.0f * (1.0f - CUBIC_BETA) / (1.0f + CUBIC_BETA) / m_cwnd;
+	target = rangelim(target, m_w_est, m_cwnd * 1.5f);
+
+	if (target > m_cwnd)
+		m_cwnd += (target - m_cwnd) / m_cwnd;
+	else
+		m_cwnd += 0.01f / m_cwnd;
+	m_cwnd = std::min(m_cwnd, (float)CONGESTION_WINDOW_MAX);
+}
+
+void CubicController::loss(u64 now, u32 count)
+{
+	// The timeouts of one round trip are one congestion event
+	float round = m_srtt > 0.0f ? m_srtt : 0.5f;
+	if (m_last_reduction != 0 && now - m_last_reduction < round * 1e6f)
+		return;
+	m_last_reduction = now;
+
+	// Fast convergence, give up some more to the other flows
+	if (m_cwnd < m_w_max)
+		m_w_max = m_cwnd * (1.0f + CUBIC_BETA) / 2.0f;
+	else
+		m_w_max = m_cwnd;
+
+	m_cwnd = std::max(m_cwnd * CUBIC_BETA, (float)CONGESTION_WINDOW_MIN);
+	m_ssthresh = m_cwnd;
+	m_epoch_start = 0;
+}
+
+float CubicController::pacingRate() const
+{
+	if (m_srtt < 0.0f)
+		return 0.0f;
+	// Pace a bit faster than the window, more in the slow start
+	float gain = m_cwnd < m_ssthresh ? 2.0f : 1.2f;
+	return gain * m_cwnd / std::max(m_srtt, 0.001f);
+}
+
+/*
+	BbrController
+*/
+
+#define BBR_HIGH_GAIN 2.885f
+// Microseconds a minimum round trip time is trusted, and how long the
+// window is kept small to measure it again after that
+#define BBR_MIN_RTT_WINDOW 10000000
+#define BBR_PROBE_RTT_TIME 200000
+
+static const float bbr_cycle_gains[BBR_CYCLE_LENGTH] = {
+	1.25f, 0.75f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f
+};
+
+void BbrController::ack(u64 now, float rtt)
+{
+	if (rtt >= 0.0f) {
+		bool expired = now - m_min_rtt_stamp > BBR_MIN_RTT_WINDOW;
+		if (m_min_rtt < 0.0f || rtt <= m_min_rtt ||
+				(expired && m_state == BBR_PROBE_RTT)) {
+			m_min_rtt = rtt;
+			m_min_rtt_stamp = now;
+		}
+	}
+
+	m_round_delivered++;
+	if (m_round_start == 0) {
+		m_round_start = now;
+		return;
+	}
+
+	// Acks are timed in milliseconds
+	float round_time = std::max(m_min_rtt > 0.0f ? m_min_rtt : m_srtt, 0.001f);
+	float elapsed = (now - m_round_start) / 1e6f;
+	if (elapsed < round_time)
+		return;
+
+	float delivery_rate = m_round_delivered / elapsed;
+	m_round_start = now;
+	m_round_delivered = 0;
+	startRound(now, delivery_rate);
+}
+
+void BbrController::startRound(u64 now, float delivery_rate)
+{
+	// A round that ran out of data only counts if it was faster
+	bool limited = m_send_limited;
+	m_send_limited = false;
+	if (limited || delivery_rate > m_btl_bw) {
+		m_bw_samples[m_bw_index] = delivery_rate;
+		m_bw_index = (m_bw_index + 1) % BBR_BW_ROUNDS;
+		m_btl_bw = *std::max_element(m_bw_samples, m_bw_samples + BBR_BW_ROUNDS);
+	}
+
+	switch (m_state) {
+	case BBR_STARTUP:
+		// Full once the bandwidth grew less than a quarter in three rounds
+		if (m_btl_bw >= m_full_bw * 1.25f) {
+			m_full_bw = m_btl_bw;
+			m_full_bw_rounds = 0;
+		} else if (limited && ++m_full_bw_rounds >= 3) {
+			m_state = BBR_DRAIN;
+			m_pacing_gain = 1.0f / BBR_HIGH_GAIN;
+		}
+		break;
+	case BBR_DRAIN:
+		// Until the queue built in the startup is gone
+		if (m_inflight > m_btl_bw * std::max(m_min_rtt, 0.001f))
+			break;
+		m_state = BBR_PROBE_BW;
+		m_cwnd_gain = 2.0f;
+		m_cycle_index = 2;
+		m_pacing_gain = bbr_cycle_gains[m_cycle_index];
+		break;
+	case BBR_PROBE_BW:
+		if (now - m_min_rtt_stamp > BBR_MIN_RTT_WINDOW) {
+			m_state = BBR_PROBE_RTT;
+			m_pacing_gain = 1.0f;
+			m_probe_rtt_done = now + BBR_PROBE_RTT_TIME;
+			break;
+		}
+		m_cycle_index = (m_cycle_index + 1) % BBR_CYCLE_LENGTH;
+		m_pacing_gain = bbr_cycle_gains[m_cycle_index];
+		break;
+	case BBR_PROBE_RTT:
+		if (now < m_probe_rtt_done)
+			break;
+		m_min_rtt_stamp = now;
+		m_state = BBR_PROBE_BW;
+		m_pacing_gain = bbr_cycle_gains[m_cycle_index];
+		break;
+	}
+}
+
+float BbrController::window() const
+{
+	if (m_state == BBR_PROBE_RTT)
+		return CONGESTION_WINDOW_MIN;
+	if (m_btl_bw <= 0.0f || m_min_rtt < 0.0f)
+		return CONGESTION_WINDOW_INITIAL;
+
+	float cwnd = m_cwnd_gain * m_btl_bw * std::max(m_min_rtt, 0.001f);
+	if (m_state == BBR_STARTUP)
+		cwnd = std::max(cwnd, (float)CONGESTION_WINDOW_INITIAL);
+	return rangelim(cwnd, (float)CONGESTION_WINDOW_MIN,
+		(float)CONGESTION_WINDOW_MAX);
+}
+
+float BbrController::pacingRate() const
+{
+	if (m_btl_bw > 0.0f)
+		return m_pacing_gain * m_btl_bw;
+	if (m_srtt < 0.0f)
+		return 0.0f;
+	return m_pacing_gain * CONGESTION_WINDOW_INITIAL / std::max(m_srtt, 0.001f);
+}
+
+}
@@ -0,0 +1,178 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes.h"
+#include <mutex>
+#include <string>
+
+namespace con
+{
+
+// Congestion windows, in reliable packets in flight over all channels
+#define CONGESTION_WINDOW_MIN 16
+#define CONGESTION_WINDOW_INITIAL 64
+#define CONGESTION_WINDOW_MAX 0x8000
+
+// Packets that may go out at once after the send thread slept
+#define PACING_BURST_MIN 4
+#define PACING_BURST_TIME 0.005f
+
+/*
+	Decides how many reliable packets a peer can have in flight and how fast
+	they are sent. Times are in microseconds, as from porting::getTimeUs().
+	The connection threads call it concurrently.
+*/
+class CongestionController
+{
+public:
+	virtual ~CongestionController() = default;
+
+	// Returns nullptr for "legacy", which keeps the per channel windows
+	static CongestionController *create(const std::string &name);
+
+	virtual const char *getName() const = 0;
+
+	// A reliable packet was acknowledged, rtt < 0 if it can't be measured.
+	// Returns true if this reopened a window that held packets back.
+	bool onAck(u64 now, float rtt);
+	// Reliable packets timed out and are going to be sent again
+	void onLoss(u64 now, u32 count);
+
+	// Whether one more reliable packet can be sent with inflight unacked
+	bool canSend(u64 now, u32 inflight);
+	// Packets that can be sent now, not counting the window
+	u32 getPacingBudget(u64 now);
+	// Reliable packets were sent, new or again
+	void onSend(u32 count = 1);
+	// Milliseconds until the pacing lets the next packet go
+	u32 getPacingDelayMs(u64 now);
+
+	u32 getWindow();
+	// Packets per second, 0 if sending is not paced
+	float getPacingRate();
+	float getResendTimeout();
+
+protected:
+	// These are called with m_mutex locked
+	virtual void ack(u64 now, float rtt) = 0;
+	virtual void loss(u64 now, u32 count) = 0;
+	virtual float window() const = 0;
+	virtual float pacingRate() const = 0;
+
+	// Smoothed round trip time and its variation as in RFC 6298, in seconds
+	float m_srtt = -1.0f;
+	float m_rttvar = 0.0f;
+	// Reliable packets in flight at the last send
+	u32 m_inflight = 0;
+	// Whether a packet was held back by the window or the pacing
+	bool m_send_limited = false;
+
+private:
+	void refill(u64 now);
+
+	float m_tokens = 0.0f;
+	u64 m_last_refill = 0;
+	bool m_window_blocked = false;
+	u32 m_acks_since_blocked = 0;
+
+	std::mutex m_mutex;
+};
+
+/*
+	CUBIC, RFC 8312. There are no duplicate acks in this protocol, so every
+	resend timeout is a congestion event, at most one per round trip.
+*/
+class CubicController : public CongestionController
+{
+public:
+	const char *getName() const { return "cubic"; }
+
+protected:
+	void ack(u64 now, float rtt);
+	void loss(u64 now, u32 count);
+	float window() const { return m_cwnd; }
+	float pacingRate() const;
+
+private:
+	float m_cwnd = CONGESTION_WINDOW_INITIAL;
+	float m_ssthresh = CONGESTION_WINDOW_MAX;
+	// Window before the last reduction
+	float m_w_max = 0.0f;
+	// Window a Reno sender would have, the lower bound of the curve
+	float m_w_est = 0.0f;
+	// Seconds to get back to m_w_max
+	float m_k = 0.0f;
+	u64 m_epoch_start = 0;
+	u64 m_last_reduction = 0;
+};
+
+/*
+	BBR-style: the window and the pacing follow the bottleneck bandwidth and
+	the minimum round trip time, which are measured once per round trip.
+	Losses are ignored, as they do not tell congestion from a bad link.
+*/
+#define BBR_BW_ROUNDS 10
+#define BBR_CYCLE_LENGTH 8
+
+class BbrController : public CongestionController
+{
+public:
+	const char *getName() const { return "bbr"; }
+
+protected:
+	void ack(u64 now, float rtt);
+	void loss(u64 now, u32 count) {}
+	float window() const;
+	float pacingRate() const;
+
+private:
+	enum State {
+		BBR_STARTUP,
+		BBR_DRAIN,
+		BBR_PROBE_BW,
+		BBR_PROBE_RTT,
+	};
+
+	void startRound(u64 now, float delivery_rate);
+
+	State m_state = BBR_STARTUP;
+	float m_pacing_gain = 2.885f;
+	float m_cwnd_gain = 2.885f;
+	u32 m_cycle_index = 0;
+
+	// Maximum of the delivery rates of the last rounds, in packets per second
+	float m_bw_samples[BBR_BW_ROUNDS] = {};
+	u32 m_bw_index = 0;
+	float m_btl_bw = 0.0f;
+
+	float m_min_rtt = -1.0f;
+	u64 m_min_rtt_stamp = 0;
+	u64 m_probe_rtt_done = 0;
+
+	u64 m_round_start = 0;
+	u32 m_round_delivered = 0;
+
+	// Bandwidth growth in the startup
+	float m_full_bw = 0.0f;
+	u32 m_full_bw_rounds = 0;
+};
+
+}
@@ -62,41 +62,47 @@ namespace con
 
 #define PING_TIMEOUT 5.0
 
-BufferedPacket makePacket(Address &address, const SharedBuffer<u8> &data,
-		u32 protocol_id, session_t sender_peer_id, u8 channel)
-{
-	u32 packet_size = data.getSize() + BASE_HEADER_SIZE;
-	BufferedPacket p(packet_size);
-	p.address = address;
+// Arenas of finished split packets kept for the next ones
+#define SPLIT_ARENAS_KEPT 4
+// Larger arenas, e.g. of a big media file, are given back
+#define SPLIT_ARENA_MAX_KEPT (1 << 20)
 
-	writeU32(&p.data[0], protocol_id);
-	writeU16(&p.data[4], sender_peer_id);
-	writeU8(&p.data[6], channel);
+static_assert(PACKET_HEADROOM >=
+		BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE + SPLIT_HEADER_SIZE,
+		"Packet buffers must have room for all headers");
 
-	memcpy(&p.data[BASE_HEADER_SIZE], *data, data.getSize());
+BufferedPacket makePacket(Address &address, PacketBuffer data,
+		u32 protocol_id, session_t sender_peer_id, u8 channel)
+{
+	u8 *header = data.pushHeader(BASE_HEADER_SIZE);
+	writeU32(&header[0], protocol_id);
+	writeU16(&header[4], sender_peer_id);
+	writeU8(&header[6], channel);
 
+	BufferedPacket p(data);
+	p.address = address;
 	return p;
 }
 
-SharedBuffer<u8> makeOriginalPacket(const SharedBuffer<u8> &data)
+BufferedPacket makePacket(Address &address, const SharedBuffer<u8> &data,
+		u32 protocol_id, session_t sender_peer_id, u8 channel)
 {
-	u32 header_size = 1;
-	u32 packet_size = data.getSize() + header_size;
-	SharedBuffer<u8> b(packet_size);
+	return makePacket(address, PacketBuffer(*data, data.getSize()),
+		protocol_id, sender_peer_id, channel);
+}
 
-	writeU8(&(b[0]), PACKET_TYPE_ORIGINAL);
-	if (data.getSize() > 0) {
-		memcpy(&(b[header_size]), *data, data.getSize());
-	}
-	return b;
+PacketBuffer makeOriginalPacket(PacketBuffer data)
+{
+	writeU8(data.pushHeader(ORIGINAL_HEADER_SIZE), PACKET_TYPE_ORIGINAL);
+	return data;
 }
 
 // Split data in chunks and add TYPE_SPLIT headers to them
-void makeSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max, u16 seqnum,
-		std::list<SharedBuffer<u8>> *chunks)
+void makeSplitPacket(const PacketBuffer &data, u32 chunksize_max, u16 seqnum,
+		std::list<PacketBuffer> *chunks)
 {
 	// Chunk packets, containing the TYPE_SPLIT header
-	u32 chunk_header_size = 7;
+	u32 chunk_header_size = SPLIT_HEADER_SIZE;
 	u32 maximum_data_size = chunksize_max - chunk_header_size;
 	u32 start = 0;
 	u32 end = 0;
@@ -110,7 +116,8 @@ void makeSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max, u16 seqnum
 		u32 payload_size = end - start + 1;
 		u32 packet_size = chunk_header_size + payload_size;
 
-		SharedBuffer<u8> chunk(packet_size);
+		// Leaves room for the reliable and base headers
+		PacketBuffer chunk(packet_size, PACKET_HEADROOM - chunk_header_size);
 
 		writeU8(&chunk[0], PACKET_TYPE_SPLIT);
 		writeU16(&chunk[1], seqnum);
@@ -126,14 +133,14 @@ void makeSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max, u16 seqnum
 	}
 	while (end != data.getSize() - 1);
 
-	for (SharedBuffer<u8> &chunk : *chunks) {
+	for (PacketBuffer &chunk : *chunks) {
 		// Write chunk_count
 		writeU16(&(chunk[3]), chunk_count);
 	}
 }
 
-void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
-		u16 &split_seqnum, std::list<SharedBuffer<u8>> *list)
+void makeAutoSplitPacket(const PacketBuffer &data, u32 chunksize_max,
+		u16 &split_seqnum, std::list<PacketBuffer> *list)
 {
 	u32 original_header_size = 1;
 
@@ -146,31 +153,34 @@ void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
 	list->push_back(makeOriginalPacket(data));
 }
 
-SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum)
+PacketBuffer makeReliablePacket(PacketBuffer data, u16 seqnum)
 {
-	u32 header_size = 3;
-	u32 packet_size = data.getSize() + header_size;
-	SharedBuffer<u8> b(packet_size);
-
-	writeU8(&b[0], PACKET_TYPE_RELIABLE);
-	writeU16(&b[1], seqnum);
-
-	memcpy(&b[header_size], *data, data.getSize());
-
-	return b;
+	u8 *header = data.pushHeader(RELIABLE_HEADER_SIZE);
+	writeU8(&header[0], PACKET_TYPE_RELIABLE);
+	writeU16(&header[1], seqnum);
+	return data;
 }
 
 /*
 	ReliablePacketBuffer
 */
 
+const u16 ReliablePacketBuffer::NO_PACKET;
+
+ReliablePacketBuffer::ReliablePacketBuffer():
+	m_slots(MIN_RELIABLE_WINDOW_SIZE, NO_PACKET)
+{
+}
+
 void ReliablePacketBuffer::print()
 {
 	MutexAutoLock listlock(m_list_mutex);
 	LOG(dout_con<<"Dump of ReliablePacketBuffer:" << std::endl);
 	unsigned int index = 0;
-	for (BufferedPacket &bufferedPacket : m_list) {
-		u16 s = readU16(&(bufferedPacket.data[BASE_HEADER_SIZE+1]));
+	for (u32 i = 0; i < m_span; i++) {
+		u16 s = m_first + i;
+		if (slot(s) == NO_PACKET)
+			continue;
 		LOG(dout_con<<index<< ":" << s << std::endl);
 		index++;
 	}
@@ -179,74 +189,105 @@ void ReliablePacketBuffer::print()
 bool ReliablePacketBuffer::empty()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	return m_list.empty();
+	return m_count == 0;
 }
 
 u32 ReliablePacketBuffer::size()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	return m_list.size();
+	return m_count;
 }
 
-RPBSearchResult ReliablePacketBuffer::findPacket(u16 seqnum)
+size_t ReliablePacketBuffer::memoryUsage()
 {
-	std::list<BufferedPacket>::iterator i = m_list.begin();
-	for(; i != m_list.end(); ++i)
-	{
-		u16 s = readU16(&(i->data[BASE_HEADER_SIZE+1]));
-		if (s == seqnum)
-			break;
-	}
-	return i;
+	MutexAutoLock listlock(m_list_mutex);
+	return m_slots.capacity() * sizeof(u16) +
+		m_packets.capacity() * sizeof(BufferedPacket) +
+		m_free.capacity() * sizeof(u16);
 }
 
 bool ReliablePacketBuffer::getFirstSeqnum(u16& result)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	if (m_list.empty())
+	if (m_count == 0)
 		return false;
-	const BufferedPacket &p = m_list.front();
-	result = readU16(&p.data[BASE_HEADER_SIZE + 1]);
+	result = m_first;
 	return true;
 }
 
-BufferedPacket ReliablePacketBuffer::popFirst()
+BufferedPacket ReliablePacketBuffer::take(u16 seqnum)
 {
-	MutexAutoLock listlock(m_list_mutex);
-	if (m_list.empty())
-		throw NotFoundException("Buffer is empty");
-	BufferedPacket p = std::move(m_list.front());
-	m_list.pop_front();
+	u16 &index = slot(seqnum);
+	BufferedPacket p = std::move(m_packets[index]);
+	m_free.push_back(index);
+	index = NO_PACKET;
+	m_count--;
 
-	if (m_list.empty()) {
+	if (m_count == 0) {
+		m_span = 0;
 		m_oldest_non_answered_ack = 0;
-	} else {
-		m_oldest_non_answered_ack =
-				readU16(&m_list.front().data[BASE_HEADER_SIZE + 1]);
+		// Give back what a burst or a far seqnum made us allocate
+		if (m_slots.size() > MIN_RELIABLE_WINDOW_SIZE)
+			std::vector<u16>(MIN_RELIABLE_WINDOW_SIZE, NO_PACKET).swap(m_slots);
+		if (m_packets.capacity() > MIN_RELIABLE_WINDOW_SIZE) {
+			std::vector<BufferedPacket>().swap(m_packets);
+			std::vector<u16>().swap(m_free);
+		} else {
+			m_packets.clear();
+			m_free.clear();
+		}
+		return p;
+	}
+
+	// Skip the gaps up to the new first or last packet
+	if (seqnum == m_first) {
+		do {
+			m_first++;
+			m_span--;
+		} while (slot(m_first) == NO_PACKET);
+	} else if ((u16)(seqnum - m_first) == m_span - 1) {
+		do {
+			m_span--;
+		} while (slot(m_first + m_span - 1) == NO_PACKET);
 	}
+	m_oldest_non_answered_ack = m_first;
 	return p;
 }
 
+void ReliablePacketBuffer::grow(u32 span)
+{
+	u32 capacity = m_slots.size();
+	while (capacity < span)
+		capacity *= 2;
+	if (capacity == m_slots.size())
+		return;
+
+	std::vector<u16> slots(capacity, NO_PACKET);
+	for (u32 i = 0; i < m_span; i++) {
+		u16 s = m_first + i;
+		slots[s & (capacity - 1)] = slot(s);
+	}
+	m_slots = std::move(slots);
+}
+
+BufferedPacket ReliablePacketBuffer::popFirst()
+{
+	MutexAutoLock listlock(m_list_mutex);
+	if (m_count == 0)
+		throw NotFoundException("Buffer is empty");
+	return take(m_first);
+}
+
 BufferedPacket ReliablePacketBuffer::popSeqnum(u16 seqnum)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	RPBSearchResult r = findPacket(seqnum);
-	if (r == notFound()) {
+	if (m_count == 0 || (u16)(seqnum - m_first) >= m_span ||
+			slot(seqnum) == NO_PACKET) {
 		LOG(dout_con<<"Sequence number: " << seqnum
 				<< " not found in reliable buffer"<<std::endl);
 		throw NotFoundException("seqnum not found in buffer");
 	}
-	BufferedPacket p = std::move(*r);
-
-	m_list.erase(r);
-
-	if (m_list.empty()) {
-		m_oldest_non_answered_ack = 0;
-	} else {
-		m_oldest_non_answered_ack =
-				readU16(&m_list.front().data[BASE_HEADER_SIZE + 1]);
-	}
-	return p;
+	return take(seqnum);
 }
 
 void ReliablePacketBuffer::insert(const BufferedPacket &p, u16 next_expected)
@@ -276,90 +317,87 @@ void ReliablePacketBuffer::insert(const BufferedPacket &p, u16 next_expected)
 		return;
 	}
 
-	sanity_check(m_list.size() <= SEQNUM_MAX); // FIXME: Handle the error?
-
-	// Find the right place for the packet and insert it there
-	// If list is empty, just add it
-	if (m_list.empty())
-	{
-		m_list.push_back(p);
-		m_oldest_non_answered_ack = seqnum;
-		// Done.
-		return;
-	}
-
-	// Otherwise find the right place
-	std::list<BufferedPacket>::iterator i = m_list.begin();
-	// Find the first packet in the list which has a higher seqnum
-	u16 s = readU16(&(i->data[BASE_HEADER_SIZE+1]));
-
-	/* case seqnum is smaller then next_expected seqnum */
-	/* this is true e.g. on wrap around */
-	if (seqnum < next_expected) {
-		while(((s < seqnum) || (s >= next_expected)) && (i != m_list.end())) {
-			++i;
-			if (i != m_list.end())
-				s = readU16(&(i->data[BASE_HEADER_SIZE+1]));
-		}
-	}
-	/* non wrap around case (at least for incoming and next_expected */
-	else
-	{
-		while(((s < seqnum) && (s >= next_expected)) && (i != m_list.end())) {
-			++i;
-			if (i != m_list.end())
-				s = readU16(&(i->data[BASE_HEADER_SIZE+1]));
+	if (m_count == 0) {
+		m_first = seqnum;
+		m_span = 1;
+	} else {
+		// Compare the distances from next_expected, as seqnums wrap around
+		u16 offset = seqnum - next_expected;
+		u16 first_offset = m_first - next_expected;
+
+		if (offset < first_offset) {
+			grow(m_span + first_offset - offset);
+			m_span += first_offset - offset;
+			m_first = seqnum;
+		} else if ((u32)(offset - first_offset) >= m_span) {
+			grow(offset - first_offset + 1);
+			m_span = offset - first_offset + 1;
+		} else if (slot(seqnum) != NO_PACKET) {
+			BufferedPacket &old = m_packets[slot(seqnum)];
+			/* nothing to do this seems to be a resent packet */
+			/* for paranoia reason data should be compared */
+			if (old.data.getSize() != p.data.getSize() ||
+					old.address != p.address) {
+				/* if this happens your maximum transfer window may be to big */
+				fprintf(stderr,
+						"Duplicated seqnum %d non matching packet detected:\n",
+						seqnum);
+				fprintf(stderr, "Old: seqnum: %05d size: %04d, address: %s\n",
+						readU16(&(old.data[BASE_HEADER_SIZE+1])),
+						old.data.getSize(),
+						old.address.serializeString().c_str());
+				fprintf(stderr, "New: seqnum: %05d size: %04u, address: %s\n",
+						readU16(&(p.data[BASE_HEADER_SIZE+1])),p.data.getSize(),
+						p.address.serializeString().c_str());
+				throw IncomingDataCorruption("duplicated packet isn't same as original one");
+			}
+			return;
 		}
 	}
 
-	if (s == seqnum) {
-		/* nothing to do this seems to be a resent packet */
-		/* for paranoia reason data should be compared */
-		if (
-			(readU16(&(i->data[BASE_HEADER_SIZE+1])) != seqnum) ||
-			(i->data.getSize() != p.data.getSize()) ||
-			(i->address != p.address)
-			)
-		{
-			/* if this happens your maximum transfer window may be to big */
-			fprintf(stderr,
-					"Duplicated seqnum %d non matching packet detected:\n",
-					seqnum);
-			fprintf(stderr, "Old: seqnum: %05d size: %04d, address: %s\n",
-					readU16(&(i->data[BASE_HEADER_SIZE+1])),i->data.getSize(),
-					i->address.serializeString().c_str());
-			fprintf(stderr, "New: seqnum: %05d size: %04u, address: %s\n",
-					readU16(&(p.data[BASE_HEADER_SIZE+1])),p.data.getSize(),
-					p.address.serializeString().c_str());
-			throw IncomingDataCorruption("duplicated packet isn't same as original one");
-		}
-	}
-	/* insert or push back */
-	else if (i != m_list.end()) {
-		m_list.insert(i, p);
+	u16 index;
+	if (m_free.empty()) {
+		index = m_packets.size();
+		m_packets.push_back(p);
 	} else {
-		m_list.push_back(p);
+		index = m_free.back();
+		m_free.pop_back();
+		m_packets[index] = p;
 	}
+	slot(seqnum) = index;
+	m_count++;
 
 	/* update last packet number */
-	m_oldest_non_answered_ack = readU16(&m_list.front().data[BASE_HEADER_SIZE+1]);
+	m_oldest_non_answered_ack = m_first;
 }
 
 void ReliablePacketBuffer::incrementTimeouts(float dtime)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	for (BufferedPacket &bufferedPacket : m_list) {
+	for (u32 i = 0; i < m_span; i++) {
+		u16 index = slot(m_first + i);
+		if (index == NO_PACKET)
+			continue;
+		BufferedPacket &bufferedPacket = m_packets[index];
 		bufferedPacket.time += dtime;
 		bufferedPacket.totaltime += dtime;
 	}
 }
 
-std::list<BufferedPacket>
+std::vector<BufferedPacket>
 	ReliablePacketBuffer::getTimedOuts(float timeout, u32 max_packets)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	std::list<BufferedPacket> timed_outs;
-	for (BufferedPacket &bufferedPacket : m_list) {
+	std::vector<BufferedPacket> timed_outs;
+	// The pacing budget is used up, nothing may be resent yet
+	if (max_packets == 0)
+		return timed_outs;
+
+	for (u32 i = 0; i < m_span; i++) {
+		u16 index = slot(m_first + i);
+		if (index == NO_PACKET)
+			continue;
+		BufferedPacket &bufferedPacket = m_packets[index];
 		if (bufferedPacket.time >= timeout) {
 			// caller will resend packet so reset time and increase counter
 			bufferedPacket.time = 0.0f;
@@ -378,18 +416,38 @@ std::list<BufferedPacket>
 	IncomingSplitPacket
 */
 
-bool IncomingSplitPacket::insert(u32 chunk_num, SharedBuffer<u8> &chunkdata)
+void IncomingSplitPacket::reset(u32 cc, bool r)
+{
+	time = 0.0f;
+	chunk_count = cc;
+	reliable = r;
+	arena.clear();
+	chunks.clear();
+	received.clear();
+	received_count = 0;
+	total_size = 0;
+}
+
+bool IncomingSplitPacket::insert(u32 chunk_num, const u8 *chunkdata, u32 size)
 {
 	sanity_check(chunk_num < chunk_count);
 
 	// If chunk already exists, ignore it.
 	// Sometimes two identical packets may arrive when there is network
 	// lag and the server re-sends stuff.
-	if (chunks.find(chunk_num) != chunks.end())
+	u32 word = chunk_num / 64;
+	u64 bit = (u64)1 << (chunk_num % 64);
+	if (word >= received.size())
+		received.resize(word + 1, 0);
+	else if (received[word] & bit)
 		return false;
+	received[word] |= bit;
 
 	// Set chunk data in buffer
-	chunks[chunk_num] = chunkdata;
+	chunks.push_back({chunk_num, (u32)arena.size(), size});
+	arena.insert(arena.end(), chunkdata, chunkdata + size);
+	received_count++;
+	total_size += size;
 
 	return true;
 }
@@ -398,36 +456,32 @@ SharedBuffer<u8> IncomingSplitPacket::reassemble()
 {
 	sanity_check(allReceived());
 
-	// Calculate total size
-	u32 totalsize = 0;
-	for (const auto &chunk : chunks)
-		totalsize += chunk.second.getSize();
+	SharedBuffer<u8> fulldata(total_size);
 
-	SharedBuffer<u8> fulldata(totalsize);
+	// Reliable chunks arrive in order, others may not
+	std::sort(chunks.begin(), chunks.end(),
+		[](const Chunk &a, const Chunk &b) { return a.num < b.num; });
 
 	// Copy chunks to data buffer
 	u32 start = 0;
-	for (u32 chunk_i = 0; chunk_i < chunk_count; chunk_i++) {
-		const SharedBuffer<u8> &buf = chunks[chunk_i];
-		memcpy(&fulldata[start], *buf, buf.getSize());
-		start += buf.getSize();
+	for (const Chunk &chunk : chunks) {
+		memcpy(&fulldata[start], arena.data() + chunk.offset, chunk.size);
+		start += chunk.size;
 	}
 
 	return fulldata;
 }
 
+size_t IncomingSplitPacket::memoryUsage() const
+{
+	return arena.capacity() + chunks.capacity() * sizeof(Chunk) +
+		received.capacity() * sizeof(u64);
+}
+
 /*
 	IncomingSplitBuffer
 */
 
-IncomingSplitBuffer::~IncomingSplitBuffer()
-{
-	MutexAutoLock listlock(m_map_mutex);
-	for (auto &i : m_buf) {
-		delete i.second;
-	}
-}
-
 SharedBuffer<u8> IncomingSplitBuffer::insert(const BufferedPacket &p, bool reliable)
 {
 	MutexAutoLock listlock(m_map_mutex);
@@ -452,67 +506,79 @@ SharedBuffer<u8> IncomingSplitBuffer::insert(const BufferedPacket &p, bool relia
 		return SharedBuffer<u8>();
 	}
 
-	// Add if doesn't exist
-	IncomingSplitPacket *sp;
-	if (m_buf.find(seqnum) == m_buf.end()) {
-		sp = new IncomingSplitPacket(chunk_count, reliable);
-		m_buf[seqnum] = sp;
-	} else {
-		sp = m_buf[seqnum];
+	// Add if doesn't exist, reusing the arena of a finished one
+	auto it = m_buf.find(seqnum);
+	if (it == m_buf.end()) {
+		it = m_buf.emplace(seqnum, IncomingSplitPacket()).first;
+		if (!m_free.empty()) {
+			it->second = std::move(m_free.back());
+			m_free.pop_back();
+		}
+		it->second.reset(chunk_count, reliable);
 	}
+	IncomingSplitPacket &sp = it->second;
 
-	if (chunk_count != sp->chunk_count) {
+	if (chunk_count != sp.chunk_count) {
 		errorstream << "IncomingSplitBuffer::insert(): chunk_count="
-				<< chunk_count << " != sp->chunk_count=" << sp->chunk_count
+				<< chunk_count << " != sp->chunk_count=" << sp.chunk_count
 				<< std::endl;
 		return SharedBuffer<u8>();
 	}
-	if (reliable != sp->reliable)
+	if (reliable != sp.reliable)
 		LOG(derr_con<<"Connection: WARNING: reliable="<<reliable
-				<<" != sp->reliable="<<sp->reliable
+				<<" != sp->reliable="<<sp.reliable
 				<<std::endl);
 
-	// Cut chunk data out of packet
+	// Copy chunk data out of packet
 	u32 chunkdatasize = p.data.getSize() - headersize;
-	SharedBuffer<u8> chunkdata(chunkdatasize);
-	memcpy(*chunkdata, &(p.data[headersize]), chunkdatasize);
-
-	if (!sp->insert(chunk_num, chunkdata))
+	if (!sp.insert(chunk_num, &p.data[headersize], chunkdatasize))
 		return SharedBuffer<u8>();
 
 	// If not all chunks are received, return empty buffer
-	if (!sp->allReceived())
+	if (!sp.allReceived())
 		return SharedBuffer<u8>();
 
-	SharedBuffer<u8> fulldata = sp->reassemble();
+	SharedBuffer<u8> fulldata = sp.reassemble();
 
 	// Remove sp from buffer
-	m_buf.erase(seqnum);
-	delete sp;
+	recycle(sp);
+	m_buf.erase(it);
 
 	return fulldata;
 }
 
+size_t IncomingSplitBuffer::memoryUsage()
+{
+	MutexAutoLock listlock(m_map_mutex);
+	size_t usage = 0;
+	for (const auto &it : m_buf)
+		usage += it.second.memoryUsage();
+	return usage;
+}
+
+void IncomingSplitBuffer::recycle(IncomingSplitPacket &sp)
+{
+	if (m_free.size() < SPLIT_ARENAS_KEPT &&
+			sp.memoryUsage() <= SPLIT_ARENA_MAX_KEPT)
+		m_free.push_back(std::move(sp));
+}
+
 void IncomingSplitBuffer::removeUnreliableTimedOuts(float dtime, float timeout)
 {
-	std::deque<u16> remove_queue;
-	{
-		MutexAutoLock listlock(m_map_mutex);
-		for (auto &i : m_buf) {
-			IncomingSplitPacket *p = i.second;
-			// Reliable ones are not removed by timeout
-			if (p->reliable)
+	MutexAutoLock listlock(m_map_mutex);
+	for (auto it = m_buf.begin(); it != m_buf.end();) {
+		IncomingSplitPacket &p = it->second;
+		// Reliable ones are not removed by timeout
+		if (!p.reliable) {
+			p.time += dtime;
+			if (p.time >= timeout) {
+				LOG(dout_con<<"NOTE: Removing timed out unreliable split packet"<<std::endl);
+				recycle(p);
+				it = m_buf.erase(it);
 				continue;
-			p->time += dtime;
-			if (p->time >= timeout)
-				remove_queue.push_back(i.first);
+			}
 		}
-	}
-	for (u16 j : remove_queue) {
-		MutexAutoLock listlock(m_map_mutex);
-		LOG(dout_con<<"NOTE: Removing timed out unreliable split packet"<<std::endl);
-		delete m_buf[j];
-		m_buf.erase(j);
+		++it;
 	}
 }
 
@@ -526,7 +592,7 @@ void ConnectionCommand::send(session_t peer_id_, u8 channelnum_, NetworkPacket *
 	type = CONNCMD_SEND;
 	peer_id = peer_id_;
 	channelnum = channelnum_;
-	data = pkt->oldForgePacket();
+	data = pkt->forgePacket();
 	reliable = reliable_;
 }
 
@@ -675,13 +741,13 @@ void Channel::UpdateTimers(float dtime)
 		}
 
 #if !(defined(__ANDROID__) && defined(__aarch64__))
-		/* dynamic window size */
+		/* dynamic window size, unless the congestion controller sizes it */
 		float successful_to_lost_ratio = 0.0f;
-		bool done = false;
+		bool done = !dynamic_window;
 
-		if (packets_successful > 0) {
+		if (!done && packets_successful > 0) {
 			successful_to_lost_ratio = packet_loss/packets_successful;
-		} else if (packet_loss > 0) {
+		} else if (!done && packet_loss > 0) {
 			window_size = std::max(
 					(window_size - 10),
 					MIN_RELIABLE_WINDOW_SIZE);
@@ -806,27 +872,24 @@ bool PeerHelper::operator!=(void* ptr)
 
 bool Peer::IncUseCount()
 {
-	MutexAutoLock lock(m_exclusive_access_mutex);
-
-	if (!m_pending_deletion) {
-		this->m_usage++;
-		return true;
-	}
+	u32 usage = m_usage.load(std::memory_order_relaxed);
+	do {
+		if (usage & PEER_PENDING_DELETION)
+			return false;
+	} while (!m_usage.compare_exchange_weak(usage, usage + 1,
+			std::memory_order_acquire, std::memory_order_relaxed));
 
-	return false;
+	return true;
 }
 
 void Peer::DecUseCount()
 {
-	{
-		MutexAutoLock lock(m_exclusive_access_mutex);
-		sanity_check(m_usage > 0);
-		m_usage--;
+	u32 usage = m_usage.fetch_sub(1, std::memory_order_acq_rel);
+	sanity_check((usage & ~PEER_PENDING_DELETION) > 0);
 
-		if (!((m_pending_deletion) && (m_usage == 0)))
-			return;
-	}
-	delete this;
+	// The last user of a dropped peer deletes it
+	if (usage == (PEER_PENDING_DELETION | 1))
+		delete this;
 }
 
 void Peer::RTTStatistics(float rtt, const std::string &profiler_id,
@@ -892,12 +955,9 @@ bool Peer::isTimedOut(float timeout)
 
 void Peer::Drop()
 {
-	{
-		MutexAutoLock usage_lock(m_exclusive_access_mutex);
-		m_pending_deletion = true;
-		if (m_usage != 0)
-			return;
-	}
+	u32 usage = m_usage.fetch_or(PEER_PENDING_DELETION, std::memory_order_acq_rel);
+	if (usage != 0)
+		return;
 
 	PROFILE(std::stringstream peerIdentifier1);
 	PROFILE(peerIdentifier1 << "runTimeouts[" << m_connection->getDesc()
@@ -914,6 +974,17 @@ void Peer::Drop()
 UDPPeer::UDPPeer(u16 a_id, Address a_address, Connection* connection) :
 	Peer(a_address,a_id,connection)
 {
+	m_congestion.reset(CongestionController::create(
+		g_settings->get("congestion_control")));
+	if (m_congestion) {
+		// Only limits the sequence numbers in flight now
+		for (Channel &channel : channels) {
+			channel.setWindowSize(MAX_RELIABLE_WINDOW_SIZE);
+			channel.dynamic_window = false;
+		}
+		return;
+	}
+
 #if !(defined(__ANDROID__) && defined(__aarch64__))
 	for (Channel &channel : channels)
 		channel.setWindowSize(START_RELIABLE_WINDOW_SIZE);
@@ -938,6 +1009,10 @@ void UDPPeer::reportRTT(float rtt)
 	}
 	RTTStatistics(rtt,"rudp",MAX_RELIABLE_WINDOW_SIZE*10);
 
+	// The congestion controller has its own timeout, see reportAck()
+	if (m_congestion)
+		return;
+
 	float timeout = getStat(AVG_RTT) * RESEND_TIMEOUT_FACTOR;
 	if (timeout < RESEND_TIMEOUT_MIN)
 		timeout = RESEND_TIMEOUT_MIN;
@@ -948,12 +1023,60 @@ void UDPPeer::reportRTT(float rtt)
 	resend_timeout = timeout;
 }
 
-bool UDPPeer::Ping(float dtime,SharedBuffer<u8>& data)
+bool UDPPeer::canSendReliable(Channel &channel)
+{
+	if (!m_congestion)
+		return channel.outgoing_reliables_sent.size() < channel.getWindowSize();
+
+	u32 inflight = 0;
+	for (Channel &c : channels)
+		inflight += c.outgoing_reliables_sent.size();
+	return m_congestion->canSend(porting::getTimeUs(), inflight);
+}
+
+u32 UDPPeer::getPacingBudget()
+{
+	if (!m_congestion)
+		return U32_MAX;
+	return m_congestion->getPacingBudget(porting::getTimeUs());
+}
+
+u32 UDPPeer::getPacingDelayMs()
+{
+	if (!m_congestion)
+		return 0;
+	return m_congestion->getPacingDelayMs(porting::getTimeUs());
+}
+
+void UDPPeer::reportSent(u32 count)
+{
+	if (m_congestion)
+		m_congestion->onSend(count);
+}
+
+bool UDPPeer::reportAck(float rtt)
+{
+	if (!m_congestion)
+		return false;
+
+	bool wake = m_congestion->onAck(porting::getTimeUs(), rtt);
+	setResendTimeout(m_congestion->getResendTimeout());
+	return wake;
+}
+
+void UDPPeer::reportLoss(u32 count)
+{
+	if (m_congestion && count > 0)
+		m_congestion->onLoss(porting::getTimeUs(), count);
+}
+
+bool UDPPeer::Ping(float dtime,PacketBuffer& data)
 {
 	m_ping_timer += dtime;
 	if (m_ping_timer >= PING_TIMEOUT)
 	{
-		// Create and send PING packet
+		// Create and send PING packet, the last one may still be queued
+		data = PacketBuffer(2);
 		writeU8(&data[0], PACKET_TYPE_CONTROL);
 		writeU8(&data[1], CONTROLTYPE_PING);
 		m_ping_timer = 0.0;
@@ -1009,7 +1132,7 @@ bool UDPPeer::processReliableSendCommand(
 
 	sanity_check(c.data.getSize() < MAX_RELIABLE_WINDOW_SIZE*512);
 
-	std::list<SharedBuffer<u8>> originals;
+	std::list<PacketBuffer> originals;
 	u16 split_sequence_number = chan.readNextSplitSeqNum();
 
 	if (c.raw) {
@@ -1024,7 +1147,7 @@ bool UDPPeer::processReliableSendCommand(
 	std::queue<BufferedPacket> toadd;
 	volatile u16 initial_sequence_number = 0;
 
-	for (SharedBuffer<u8> &original : originals) {
+	for (PacketBuffer &original : originals) {
 		u16 seqnum = chan.getOutgoingSequenceNumber(have_sequence_number);
 
 		/* oops, we don't have enough sequence numbers to send this packet */
@@ -1037,10 +1160,9 @@ bool UDPPeer::processReliableSendCommand(
 			have_initial_sequence_number = true;
 		}
 
-		SharedBuffer<u8> reliable = makeReliablePacket(original, seqnum);
-
 		// Add base headers and make a packet
-		BufferedPacket p = con::makePacket(address, reliable,
+		BufferedPacket p = con::makePacket(address,
+				makeReliablePacket(original, seqnum),
 				m_connection->GetProtocolID(), m_connection->GetPeerID(),
 				c.channelnum);
 
@@ -1195,8 +1317,9 @@ Connection::~Connection()
 	m_receiveThread->wait();
 
 	// Delete peers
-	for (auto &peer : m_peers) {
-		delete peer.second;
+	for (PeerShard &shard : m_peer_shards) {
+		for (auto &peer : shard.peers)
+			delete peer.second;
 	}
 }
 
@@ -1221,10 +1344,13 @@ void Connection::TriggerSend()
 
 PeerHelper Connection::getPeerNoEx(session_t peer_id)
 {
-	MutexAutoLock peerlock(m_peers_mutex);
-	std::map<session_t, Peer *>::iterator node = m_peers.find(peer_id);
+	// A peer is only deleted after it was removed from its shard, and the
+	// PeerHelper holds it from then on
+	PeerShard &shard = getPeerShard(peer_id);
+	MutexAutoLock shardlock(shard.mutex);
+	auto node = shard.peers.find(peer_id);
 
-	if (node == m_peers.end()) {
+	if (node == shard.peers.end()) {
 		return PeerHelper(NULL);
 	}
 
@@ -1237,27 +1363,60 @@ PeerHelper Connection::getPeerNoEx(session_t peer_id)
 /* find peer_id for address */
 u16 Connection::lookupPeer(Address& sender)
 {
-	MutexAutoLock peerlock(m_peers_mutex);
-	std::map<u16, Peer*>::iterator j;
-	j = m_peers.begin();
-	for(; j != m_peers.end(); ++j)
-	{
-		Peer *peer = j->second;
-		if (peer->isPendingDeletion())
-			continue;
+	for (PeerShard &shard : m_peer_shards) {
+		MutexAutoLock shardlock(shard.mutex);
+		for (auto &node : shard.peers) {
+			Peer *peer = node.second;
+			if (peer->isPendingDeletion())
+				continue;
 
-		Address tocheck;
+			Address tocheck;
 
-		if ((peer->getAddress(MTP_MINETEST_RELIABLE_UDP, tocheck)) && (tocheck == sender))
-			return peer->id;
+			if ((peer->getAddress(MTP_MINETEST_RELIABLE_UDP, tocheck)) && (tocheck == sender))
+				return peer->id;
 
-		if ((peer->getAddress(MTP_UDP, tocheck)) && (tocheck == sender))
-			return peer->id;
+			if ((peer->getAddress(MTP_UDP, tocheck)) && (tocheck == sender))
+				return peer->id;
+		}
 	}
 
 	return PEER_ID_INEXISTENT;
 }
 
+void Connection::insertPeer(Peer *peer)
+{
+	{
+		PeerShard &shard = getPeerShard(peer->id);
+		MutexAutoLock shardlock(shard.mutex);
+		shard.peers[peer->id] = peer;
+	}
+
+	auto peer_ids = std::make_shared<std::vector<session_t>>(*m_peer_ids);
+	peer_ids->push_back(peer->id);
+	std::atomic_store(&m_peer_ids,
+		std::shared_ptr<const std::vector<session_t>>(std::move(peer_ids)));
+}
+
+Peer *Connection::erasePeer(session_t peer_id)
+{
+	Peer *peer;
+	{
+		PeerShard &shard = getPeerShard(peer_id);
+		MutexAutoLock shardlock(shard.mutex);
+		auto node = shard.peers.find(peer_id);
+		if (node == shard.peers.end())
+			return nullptr;
+		peer = node->second;
+		shard.peers.erase(node);
+	}
+
+	auto peer_ids = std::make_shared<std::vector<session_t>>(*m_peer_ids);
+	peer_ids->erase(std::find(peer_ids->begin(), peer_ids->end(), peer_id));
+	std::atomic_store(&m_peer_ids,
+		std::shared_ptr<const std::vector<session_t>>(std::move(peer_ids)));
+	return peer;
+}
+
 bool Connection::deletePeer(session_t peer_id, bool timeout)
 {
 	Peer *peer = 0;
@@ -1265,12 +1424,9 @@ bool Connection::deletePeer(session_t peer_id, bool timeout)
 	/* lock list as short as possible */
 	{
 		MutexAutoLock peerlock(m_peers_mutex);
-		if (m_peers.find(peer_id) == m_peers.end())
+		peer = erasePeer(peer_id);
+		if (!peer)
 			return false;
-		peer = m_peers[peer_id];
-		m_peers.erase(peer_id);
-		auto it = std::find(m_peer_ids.begin(), m_peer_ids.end(), peer_id);
-		m_peer_ids.erase(it);
 	}
 
 	Address peer_address;
@@ -1331,13 +1487,10 @@ void Connection::Connect(Address address)
 
 bool Connection::Connected()
 {
-	MutexAutoLock peerlock(m_peers_mutex);
+	std::shared_ptr<const std::vector<session_t>> peer_ids =
+		std::atomic_load(&m_peer_ids);
 
-	if (m_peers.size() != 1)
-		return false;
-
-	std::map<session_t, Peer *>::iterator node = m_peers.find(PEER_ID_SERVER);
-	if (node == m_peers.end())
+	if (peer_ids->size() != 1 || peer_ids->front() != PEER_ID_SERVER)
 		return false;
 
 	if (m_peer_id == PEER_ID_INEXISTENT)
@@ -1415,8 +1568,31 @@ void Connection::Send(session_t peer_id, u8 channelnum,
 
 	ConnectionCommand c;
 
+	// Forging copies nothing, unless nothing was ever written
+	PacketBuffer::Stats before = PacketBuffer::getThreadStats();
 	c.send(peer_id, channelnum, pkt, reliable);
+	PacketBuffer::Stats stats = pkt->takeBufferStats();
+	stats += PacketBuffer::getThreadStats() - before;
+	addSendStats(stats);
+
 	putCommand(std::move(c));
+	m_packets_sent.fetch_add(1, std::memory_order_relaxed);
+}
+
+PacketBuffer::Stats Connection::getSendStats() const
+{
+	PacketBuffer::Stats stats;
+	stats.acquired = m_send_acquired.load(std::memory_order_relaxed);
+	stats.allocated = m_send_allocated.load(std::memory_order_relaxed);
+	stats.copied = m_send_copied.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void Connection::addSendStats(const PacketBuffer::Stats &stats)
+{
+	m_send_acquired.fetch_add(stats.acquired, std::memory_order_relaxed);
+	m_send_allocated.fetch_add(stats.allocated, std::memory_order_relaxed);
+	m_send_copied.fetch_add(stats.copied, std::memory_order_relaxed);
 }
 
 Address Connection::GetPeerAddress(session_t peer_id)
@@ -1487,8 +1663,9 @@ u16 Connection::createPeer(Address& sender, MTProtocols protocol, int fd)
 	bool out_of_ids = false;
 	for(;;) {
 		// Check if exists
-		if (m_peers.find(peer_id_new) == m_peers.end())
-
+		PeerShard &shard = getPeerShard(peer_id_new);
+		MutexAutoLock shardlock(shard.mutex);
+		if (shard.peers.find(peer_id_new) == shard.peers.end())
 			break;
 		// Check for overflow
 		if (peer_id_new == overflow) {
@@ -1507,8 +1684,7 @@ u16 Connection::createPeer(Address& sender, MTProtocols protocol, int fd)
 	Peer *peer = 0;
 	peer = new UDPPeer(peer_id_new, sender, this);
 
-	m_peers[peer->id] = peer;
-	m_peer_ids.push_back(peer->id);
+	insertPeer(peer);
 
 	m_next_remote_peer_id = (peer_id_new +1 ) % MAX_UDP_PEERS;
 
@@ -1516,7 +1692,7 @@ u16 Connection::createPeer(Address& sender, MTProtocols protocol, int fd)
 			<< "createPeer(): giving peer_id=" << peer_id_new << std::endl);
 
 	ConnectionCommand cmd;
-	Buffer<u8> reply(4);
+	PacketBuffer reply(4);
 	writeU8(&reply[0], PACKET_TYPE_CONTROL);
 	writeU8(&reply[1], CONTROLTYPE_SET_PEER_ID);
 	writeU16(&reply[2], peer_id_new);
@@ -1562,7 +1738,7 @@ void Connection::sendAck(session_t peer_id, u8 channelnum, u16 seqnum)
 			" seqnum: " << seqnum << std::endl);
 
 	ConnectionCommand c;
-	SharedBuffer<u8> ack(4);
+	PacketBuffer ack(4);
 	writeU8(&ack[0], PACKET_TYPE_CONTROL);
 	writeU8(&ack[1], CONTROLTYPE_ACK);
 	writeU16(&ack[2], seqnum);
@@ -1583,8 +1759,7 @@ UDPPeer* Connection::createServerPeer(Address& address)
 
 	{
 		MutexAutoLock lock(m_peers_mutex);
-		m_peers[peer->id] = peer;
-		m_peer_ids.push_back(peer->id);
+		insertPeer(peer);
 	}
 
 	return peer;
@@ -92,10 +92,14 @@ void *ConnectionSendThread::run()
 		BEGIN_DEBUG_EXCEPTION_HANDLER
 		PROFILE(ScopeProfiler sp(g_profiler, ThreadIdentifier.str(), SPT_AVG));
 
+		// This thread only sends, all of its buffers are on the send path
+		PacketBuffer::Stats buffer_stats = PacketBuffer::getThreadStats();
+
 		m_iteration_packets_avaialble = m_max_data_packets_per_iteration;
 
 		/* wait for trigger or timeout */
-		m_send_sleep_semaphore.wait(50);
+		m_send_sleep_semaphore.wait(m_send_wait_ms);
+		m_send_wait_ms = 50;
 
 		/* remove all triggers */
 		while (m_send_sleep_semaphore.wait(0)) {
@@ -126,6 +130,10 @@ void *ConnectionSendThread::run()
 
 		/* send queued packets */
 		sendPackets(dtime);
+		flushSendBatch();
+
+		m_connection->addSendStats(
+			PacketBuffer::getThreadStats() - buffer_stats);
 
 		END_DEBUG_EXCEPTION_HANDLER
 	}
@@ -171,7 +179,7 @@ void ConnectionSendThread::runTimeouts(float dtime)
 	std::vector<session_t> timeouted_peers;
 	std::vector<session_t> peerIds = m_connection->getPeerIDs();
 
-	const u32 numpeers = m_connection->m_peers.size();
+	const u32 numpeers = peerIds.size();
 
 	if (numpeers == 0)
 		return;
@@ -192,7 +200,7 @@ void ConnectionSendThread::runTimeouts(float dtime)
 		PROFILE(ScopeProfiler
 		peerprofiler(g_profiler, peerIdentifier.str(), SPT_AVG));
 
-		SharedBuffer<u8> data(2); // data for sending ping, required here because of goto
+		PacketBuffer data; // data for sending ping, required here because of goto
 
 		/*
 			Check peer timeout
@@ -217,11 +225,18 @@ void ConnectionSendThread::runTimeouts(float dtime)
 			// Increment reliable packet times
 			channel.outgoing_reliables_sent.incrementTimeouts(dtime);
 
-			// Re-send timed out outgoing reliables
+			// Re-send timed out outgoing reliables, as fast as the pacing allows.
+			// Every peer gets at least one, so that many peers don't stop all
+			// resends; only a used up pacing budget does.
+			u32 max_resends = MYMIN(
+				MYMAX(1u, m_max_data_packets_per_iteration / numpeers),
+				udpPeer->getPacingBudget());
 			auto timed_outs = channel.outgoing_reliables_sent.getTimedOuts(resend_timeout,
-				(m_max_data_packets_per_iteration / numpeers));
+				max_resends);
 
 			channel.UpdatePacketLossCounter(timed_outs.size());
+			udpPeer->reportLoss(timed_outs.size());
+			udpPeer->reportSent(timed_outs.size());
 			g_profiler->graphAdd("packets_lost", timed_outs.size());
 
 			m_iteration_packets_avaialble -= timed_outs.size();
@@ -276,17 +291,35 @@ void ConnectionSendThread::runTimeouts(float dtime)
 
 void ConnectionSendThread::rawSend(const BufferedPacket &packet)
 {
-	try {
-		m_connection->m_udpSocket.Send(packet.address, *packet.data,
-			packet.data.getSize());
-		LOG(dout_con << m_connection->getDesc()
-			<< " rawSend: " << packet.data.getSize()
-			<< " bytes sent" << std::endl);
-	} catch (SendFailedException &e) {
+	// Goes out with the other packets of this iteration
+	UDPDatagram datagram;
+	datagram.address = packet.address;
+	datagram.data = *packet.data;
+	datagram.size = packet.data.getSize();
+	m_send_batch.push_back(datagram);
+	m_send_batch_buffers.push_back(packet.data);
+
+	if (m_send_batch.size() >= UDP_BATCH_SIZE)
+		flushSendBatch();
+}
+
+void ConnectionSendThread::flushSendBatch()
+{
+	if (m_send_batch.empty())
+		return;
+
+	u32 sent = m_connection->m_udpSocket.SendBatch(m_send_batch.data(),
+		m_send_batch.size());
+	LOG(dout_con << m_connection->getDesc()
+		<< " rawSend: " << sent << " packets sent" << std::endl);
+	if (sent < m_send_batch.size()) {
 		LOG(derr_con << m_connection->getDesc()
-			<< "Connection::rawSend(): SendFailedException: "
-			<< packet.address.serializeString() << std::endl);
+			<< "Connection::rawSend(): failed to send "
+			<< m_send_batch.size() - sent << " packets" << std::endl);
 	}
+
+	m_send_batch.clear();
+	m_send_batch_buffers.clear();
 }
 
 void ConnectionSendThread::sendAsPacketReliable(BufferedPacket &p, Channel *channel)
@@ -309,7 +342,7 @@ void ConnectionSendThread::sendAsPacketReliable(BufferedPacket &p, Channel *chan
 }
 
 bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
-	const SharedBuffer<u8> &data, bool reliable)
+	const PacketBuffer &data, bool reliable)
 {
 	PeerHelper peer = m_connection->getPeerNoEx(peer_id);
 	if (!peer) {
@@ -328,23 +361,24 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 		if (!have_sequence_number_for_raw_packet)
 			return false;
 
-		SharedBuffer<u8> reliable = makeReliablePacket(data, seqnum);
 		Address peer_address;
 		peer->getAddress(MTP_MINETEST_RELIABLE_UDP, peer_address);
 
 		// Add base headers and make a packet
-		BufferedPacket p = con::makePacket(peer_address, reliable,
+		BufferedPacket p = con::makePacket(peer_address,
+			makeReliablePacket(data, seqnum),
 			m_connection->GetProtocolID(), m_connection->GetPeerID(),
 			channelnum);
 
 		// first check if our send window is already maxed out
-		if (channel->outgoing_reliables_sent.size()
-			< channel->getWindowSize()) {
+		UDPPeer *udpPeer = dynamic_cast<UDPPeer *>(&peer);
+		if (udpPeer->canSendReliable(*channel)) {
 			LOG(dout_con << m_connection->getDesc()
 				<< " INFO: sending a reliable packet to peer_id " << peer_id
 				<< " channel: " << (u32)channelnum
 				<< " seqnum: " << seqnum << std::endl);
 			sendAsPacketReliable(p, channel);
+			udpPeer->reportSent();
 			return true;
 		}
 
@@ -519,7 +553,7 @@ void ConnectionSendThread::disconnect()
 	LOG(dout_con << m_connection->getDesc() << " disconnecting" << std::endl);
 
 	// Create and send DISCO packet
-	SharedBuffer<u8> data(2);
+	PacketBuffer data(2);
 	writeU8(&data[0], PACKET_TYPE_CONTROL);
 	writeU8(&data[1], CONTROLTYPE_DISCO);
 
@@ -537,7 +571,7 @@ void ConnectionSendThread::disconnect_peer(session_t peer_id)
 	LOG(dout_con << m_connection->getDesc() << " disconnecting peer" << std::endl);
 
 	// Create and send DISCO packet
-	SharedBuffer<u8> data(2);
+	PacketBuffer data(2);
 	writeU8(&data[0], PACKET_TYPE_CONTROL);
 	writeU8(&data[1], CONTROLTYPE_DISCO);
 	sendAsPacket(peer_id, 0, data, false);
@@ -555,7 +589,7 @@ void ConnectionSendThread::disconnect_peer(session_t peer_id)
 }
 
 void ConnectionSendThread::send(session_t peer_id, u8 channelnum,
-	const SharedBuffer<u8> &data)
+	const PacketBuffer &data)
 {
 	assert(channelnum < CHANNEL_COUNT); // Pre-condition
 
@@ -575,13 +609,13 @@ void ConnectionSendThread::send(session_t peer_id, u8 channelnum,
 	u16 split_sequence_number = peer->getNextSplitSequenceNumber(channelnum);
 
 	u32 chunksize_max = m_max_packet_size - BASE_HEADER_SIZE;
-	std::list<SharedBuffer<u8>> originals;
+	std::list<PacketBuffer> originals;
 
 	makeAutoSplitPacket(data, chunksize_max, split_sequence_number, &originals);
 
 	peer->setNextSplitSequenceNumber(channelnum, split_sequence_number);
 
-	for (const SharedBuffer<u8> &original : originals) {
+	for (const PacketBuffer &original : originals) {
 		sendAsPacket(peer_id, channelnum, original);
 	}
 }
@@ -595,7 +629,7 @@ void ConnectionSendThread::sendReliable(ConnectionCommand &c)
 	peer->PutReliableSendCommand(c, m_max_packet_size);
 }
 
-void ConnectionSendThread::sendToAll(u8 channelnum, const SharedBuffer<u8> &data)
+void ConnectionSendThread::sendToAll(u8 channelnum, const PacketBuffer &data)
 {
 	std::vector<session_t> peerids = m_connection->getPeerIDs();
 
@@ -691,9 +725,8 @@ void ConnectionSendThread::sendPackets(float dtime)
 				<< std::endl);
 
 			while (!channel.queued_reliables.empty() &&
-					channel.outgoing_reliables_sent.size()
-					< channel.getWindowSize() &&
-					peer->m_increment_packets_remaining > 0) {
+					peer->m_increment_packets_remaining > 0 &&
+					udpPeer->canSendReliable(channel)) {
 				BufferedPacket p = std::move(channel.queued_reliables.front());
 				channel.queued_reliables.pop();
 
@@ -704,8 +737,16 @@ void ConnectionSendThread::sendPackets(float dtime)
 					<< std::endl);
 
 				sendAsPacketReliable(p, &channel);
+				udpPeer->reportSent();
 				peer->m_increment_packets_remaining--;
 			}
+
+			// Come back when the pacing lets the rest go
+			if (!channel.queued_reliables.empty()) {
+				u32 delay = udpPeer->getPacingDelayMs();
+				if (delay > 0)
+					m_send_wait_ms = MYMIN(m_send_wait_ms, delay);
+			}
 		}
 	}
 
@@ -767,7 +808,7 @@ void ConnectionSendThread::sendPackets(float dtime)
 }
 
 void ConnectionSendThread::sendAsPacket(session_t peer_id, u8 channelnum,
-	const SharedBuffer<u8> &data, bool ack)
+	const PacketBuffer &data, bool ack)
 {
 	OutgoingPacket packet(peer_id, channelnum, data, false, ack);
 	m_outgoing_queue.push(packet);
@@ -793,7 +834,10 @@ void *ConnectionReceiveThread::run()
 	// theoretical reliable upper boundary of a udp packet for all IPv6 enabled
 	// infrastructure
 	const unsigned int packet_maxsize = 1500;
-	SharedBuffer<u8> packetdata(packet_maxsize);
+	Buffer<u8> packetdata(packet_maxsize * UDP_BATCH_SIZE);
+	std::vector<UDPDatagram> datagrams(UDP_BATCH_SIZE);
+	for (u32 i = 0; i < UDP_BATCH_SIZE; i++)
+		datagrams[i].data = &packetdata[i * packet_maxsize];
 
 	bool packet_queued = true;
 
@@ -815,7 +859,7 @@ void *ConnectionReceiveThread::run()
 #endif
 
 		/* receive packets */
-		receive(packetdata, packet_queued);
+		receive(datagrams, packet_maxsize, packet_queued);
 
 #ifdef DEBUG_CONNECTION_KBPS
 		debug_print_timer += dtime;
@@ -875,51 +919,74 @@ void *ConnectionReceiveThread::run()
 }
 
 // Receive packets from the network and buffers and create ConnectionEvents
-void ConnectionReceiveThread::receive(SharedBuffer<u8> &packetdata,
-		bool &packet_queued)
+void ConnectionReceiveThread::receive(std::vector<UDPDatagram> &datagrams,
+		int buffer_size, bool &packet_queued)
 {
-	try {
-		// First, see if there any buffered packets we can process now
+	// First, see if there any buffered packets we can process now
+	if (packet_queued) {
+		processBufferedPackets();
+		packet_queued = false;
+	}
+
+	// Call ReceiveBatch() to wait for incoming data
+	u32 count = m_connection->m_udpSocket.ReceiveBatch(datagrams.data(),
+		datagrams.size(), buffer_size);
+
+	for (u32 i = 0; i < count; i++) {
+		// The previous packet of the batch may have made buffered ones ready
 		if (packet_queued) {
-			bool data_left = true;
-			session_t peer_id;
-			SharedBuffer<u8> resultdata;
-			while (data_left) {
-				try {
-					data_left = getFromBuffers(peer_id, resultdata);
-					if (data_left) {
-						ConnectionEvent e;
-						e.dataReceived(peer_id, resultdata);
-						m_connection->putEvent(std::move(e));
-					}
-				}
-				catch (ProcessedSilentlyException &e) {
-					/* try reading again */
-				}
-			}
+			processBufferedPackets();
 			packet_queued = false;
 		}
 
-		// Call Receive() to wait for incoming data
-		Address sender;
-		s32 received_size = m_connection->m_udpSocket.Receive(sender,
-			*packetdata, packetdata.getSize());
-		if (received_size < 0)
-			return;
+		processDatagram(datagrams[i], packet_queued);
+	}
+}
+
+void ConnectionReceiveThread::processBufferedPackets()
+{
+	try {
+		bool data_left = true;
+		session_t peer_id;
+		SharedBuffer<u8> resultdata;
+		while (data_left) {
+			try {
+				data_left = getFromBuffers(peer_id, resultdata);
+				if (data_left) {
+					ConnectionEvent e;
+					e.dataReceived(peer_id, resultdata);
+					m_connection->putEvent(std::move(e));
+				}
+			}
+			catch (ProcessedSilentlyException &e) {
+				/* try reading again */
+			}
+		}
+	}
+	catch (InvalidIncomingDataException &e) {
+	}
+}
 
+void ConnectionReceiveThread::processDatagram(const UDPDatagram &datagram,
+		bool &packet_queued)
+{
+	try {
+		Address sender = datagram.address;
+		s32 received_size = datagram.size;
+		u8 *packetdata = datagram.data;
 		if ((received_size < BASE_HEADER_SIZE) ||
-			(readU32(&packetdata[0]) != m_connection->GetProtocolID())) {
+			(readU32(packetdata) != m_connection->GetProtocolID())) {
 			LOG(derr_con << m_connection->getDesc()
 				<< "Receive(): Invalid incoming packet, "
 				<< "size: " << received_size
 				<< ", protocol: "
-				<< ((received_size >= 4) ? readU32(&packetdata[0]) : -1)
+				<< ((received_size >= 4) ? readU32(packetdata) : -1)
 				<< std::endl);
 			return;
 		}
 
-		session_t peer_id = readPeerId(*packetdata);
-		u8 channelnum = readChannel(*packetdata);
+		session_t peer_id = readPeerId(packetdata);
+		u8 channelnum = readChannel(packetdata);
 
 		if (channelnum > CHANNEL_COUNT - 1) {
 			LOG(derr_con << m_connection->getDesc()
@@ -986,7 +1053,7 @@ void ConnectionReceiveThread::receive(SharedBuffer<u8> &packetdata,
 
 		// Make a new SharedBuffer from the data without the base headers
 		SharedBuffer<u8> strippeddata(received_size - BASE_HEADER_SIZE);
-		memcpy(*strippeddata, &packetdata[BASE_HEADER_SIZE],
+		memcpy(*strippeddata, packetdata + BASE_HEADER_SIZE,
 			strippeddata.getSize());
 
 		try {
@@ -1134,6 +1201,7 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Control(Channel *chan
 			BufferedPacket p = channel->outgoing_reliables_sent.popSeqnum(seqnum);
 
 			// the rtt calculation will be a bit off for re-sent packets but that's okay
+			float rtt = -1.0f;
 			{
 				// Get round trip time
 				u64 current_time = porting::getTimeMs();
@@ -1141,13 +1209,13 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Control(Channel *chan
 				// a overflow is quite unlikely but as it'd result in major
 				// rtt miscalculation we handle it here
 				if (current_time > p.absolute_send_time) {
-					float rtt = (current_time - p.absolute_send_time) / 1000.0;
+					rtt = (current_time - p.absolute_send_time) / 1000.0;
 
 					// Let peer calculate stuff according to it
 					// (avg_rtt and resend_timeout)
 					dynamic_cast<UDPPeer *>(peer)->reportRTT(rtt);
 				} else if (p.totaltime > 0) {
-					float rtt = p.totaltime;
+					rtt = p.totaltime;
 
 					// Let peer calculate stuff according to it
 					// (avg_rtt and resend_timeout)
@@ -1157,7 +1225,13 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Control(Channel *chan
 
 			// put bytes for max bandwidth calculation
 			channel->UpdateBytesSent(p.data.getSize(), 1);
-			if (channel->outgoing_reliables_sent.size() == 0)
+
+			// The congestion controller only trusts the rtt of packets
+			// sent once, an ack of a re-sent one may be for either send
+			if (p.resend_count > 0)
+				rtt = -1.0f;
+			if (dynamic_cast<UDPPeer *>(peer)->reportAck(rtt) ||
+					channel->outgoing_reliables_sent.size() == 0)
 				m_connection->TriggerSend();
 		} catch (NotFoundException &e) {
 			LOG(derr_con << m_connection->getDesc()
@@ -57,9 +57,11 @@ class ConnectionSendThread : public Thread
 
 private:
 	void runTimeouts(float dtime);
+	// Queues the packet for flushSendBatch()
 	void rawSend(const BufferedPacket &packet);
+	void flushSendBatch();
 	bool rawSendAsPacket(session_t peer_id, u8 channelnum,
-			const SharedBuffer<u8> &data, bool reliable);
+			const PacketBuffer &data, bool reliable);
 
 	void processReliableCommand(ConnectionCommand &c);
 	void processNonReliableCommand(ConnectionCommand &c);
@@ -67,14 +69,14 @@ class ConnectionSendThread : public Thread
 	void connect(Address address);
 	void disconnect();
 	void disconnect_peer(session_t peer_id);
-	void send(session_t peer_id, u8 channelnum, const SharedBuffer<u8> &data);
+	void send(session_t peer_id, u8 channelnum, const PacketBuffer &data);
 	void sendReliable(ConnectionCommand &c);
-	void sendToAll(u8 channelnum, const SharedBuffer<u8> &data);
+	void sendToAll(u8 channelnum, const PacketBuffer &data);
 	void sendToAllReliable(ConnectionCommand &c);
 
 	void sendPackets(float dtime);
 
-	void sendAsPacket(session_t peer_id, u8 channelnum, const SharedBuffer<u8> &data,
+	void sendAsPacket(session_t peer_id, u8 channelnum, const PacketBuffer &data,
 			bool ack = false);
 
 	void sendAsPacketReliable(BufferedPacket &p, Channel *channel);
@@ -91,6 +93,13 @@ class ConnectionSendThread : public Thread
 	unsigned int m_max_commands_per_iteration = 1;
 	unsigned int m_max_data_packets_per_iteration;
 	unsigned int m_max_packets_requeued = 256;
+	// Lowered by sendPackets() when the pacing holds packets back
+	u32 m_send_wait_ms = 50;
+
+	// Packets of this iteration, sent with as few system calls as possible.
+	// The buffers keep the data of the datagrams alive until then.
+	std::vector<UDPDatagram> m_send_batch;
+	std::vector<PacketBuffer> m_send_batch_buffers;
 };
 
 class ConnectionReceiveThread : public Thread
@@ -107,7 +116,11 @@ class ConnectionReceiveThread : public Thread
 	}
 
 private:
-	void receive(SharedBuffer<u8> &packetdata, bool &packet_queued);
+	void receive(std::vector<UDPDatagram> &datagrams, int buffer_size,
+			bool &packet_queued);
+	// Creates ConnectionEvents for the buffered packets that are complete
+	void processBufferedPackets();
+	void processDatagram(const UDPDatagram &datagram, bool &packet_queued);
 
 	// Returns next data from a buffer if possible
 	// If found, returns true; if not, false.
@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include "irrlichttypes.h"
+#include "congestion.h"
 #include "peerhandler.h"
 #include "socket.h"
 #include "constants.h"
@@ -28,9 +29,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/thread.h"
 #include "util/numeric.h"
 #include "networkprotocol.h"
+#include "packetbuffer.h"
+#include <atomic>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <map>
+#include <unordered_map>
 
 class NetworkPacket;
 
@@ -48,6 +53,9 @@ typedef enum MTProtocols {
 
 #define MAX_UDP_PEERS 65535
 
+// Locks of the peer table, see Connection::getPeerNoEx()
+#define PEER_TABLE_SHARDS 16
+
 #define SEQNUM_MAX 65535
 
 inline bool seqnum_higher(u16 totest, u16 base)
@@ -87,13 +95,16 @@ static inline float CALC_DTIME(u64 lasttime, u64 curtime)
 
 struct BufferedPacket
 {
-	BufferedPacket(u8 *a_data, u32 a_size):
+	BufferedPacket(const u8 *a_data, u32 a_size):
 		data(a_data, a_size)
 	{}
 	BufferedPacket(u32 a_size):
 		data(a_size)
 	{}
-	Buffer<u8> data; // Data of the packet, including headers
+	BufferedPacket(const PacketBuffer &a_data):
+		data(a_data)
+	{}
+	PacketBuffer data; // Data of the packet, including headers
 	float time = 0.0f; // Seconds from buffering the packet or re-sending
 	float totaltime = 0.0f; // Seconds from buffering the packet
 	u64 absolute_send_time = -1;
@@ -101,39 +112,59 @@ struct BufferedPacket
 	unsigned int resend_count = 0;
 };
 
-// This adds the base headers to the data and makes a packet out of it
+// This adds the base headers to the data and makes a packet out of it.
+// The headers are written in front of the data, without copying it.
+BufferedPacket makePacket(Address &address, PacketBuffer data,
+		u32 protocol_id, session_t sender_peer_id, u8 channel);
 BufferedPacket makePacket(Address &address, const SharedBuffer<u8> &data,
 		u32 protocol_id, session_t sender_peer_id, u8 channel);
 
 // Depending on size, make a TYPE_ORIGINAL or TYPE_SPLIT packet
 // Increments split_seqnum if a split packet is made
-void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
-		u16 &split_seqnum, std::list<SharedBuffer<u8>> *list);
+void makeAutoSplitPacket(const PacketBuffer &data, u32 chunksize_max,
+		u16 &split_seqnum, std::list<PacketBuffer> *list);
 
 // Add the TYPE_RELIABLE header to the data
-SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum);
+PacketBuffer makeReliablePacket(PacketBuffer data, u16 seqnum);
 
 struct IncomingSplitPacket
 {
-	IncomingSplitPacket(u32 cc, bool r):
-		chunk_count(cc), reliable(r) {}
-
-	IncomingSplitPacket() = delete;
+	IncomingSplitPacket() = default;
 
 	float time = 0.0f; // Seconds from adding
-	u32 chunk_count;
-	bool reliable; // If true, isn't deleted on timeout
+	u32 chunk_count = 0;
+	bool reliable = false; // If true, isn't deleted on timeout
 
 	bool allReceived() const
 	{
-		return (chunks.size() == chunk_count);
+		return received_count == chunk_count;
 	}
-	bool insert(u32 chunk_num, SharedBuffer<u8> &chunkdata);
+	void reset(u32 cc, bool r);
+	bool insert(u32 chunk_num, const u8 *chunkdata, u32 size);
 	SharedBuffer<u8> reassemble();
 
+	// Bytes allocated for the chunks received so far
+	size_t memoryUsage() const;
+
 private:
-	// Key is chunk number, value is data without headers
-	std::map<u16, SharedBuffer<u8>> chunks;
+	struct Chunk
+	{
+		u32 num;
+		u32 offset; // In the arena
+		u32 size; // May be 0
+	};
+
+	// Chunks in the order they arrived, without headers. Like the other
+	// members it grows with the received data, not with chunk_count,
+	// which comes from the network.
+	std::vector<u8> arena;
+	std::vector<Chunk> chunks;
+	// Bit per chunk number up to the highest one received
+	std::vector<u64> received;
+	u32 received_count = 0;
+	u32 total_size = 0;
+
+	friend class IncomingSplitBuffer;
 };
 
 /*
@@ -203,6 +234,7 @@ data.
 	[5] u16 chunk_num
 */
 //#define TYPE_SPLIT 2
+#define SPLIT_HEADER_SIZE 7
 /*
 RELIABLE: Delivery of all RELIABLE packets shall be forced by ACKs,
 and they shall be delivered in the same order as sent. This is done
@@ -226,16 +258,16 @@ enum PacketType: u8 {
 	PACKET_TYPE_MAX
 };
 /*
-	A buffer which stores reliable packets and sorts them internally
-	for fast access to the smallest one.
+	A buffer which stores reliable packets in a ring indexed by their
+	sequence number, for fast access to the smallest one and by seqnum.
+	The ring only holds indices of the packets, so that a few packets far
+	apart do not take the space of all the packets in between.
 */
 
-typedef std::list<BufferedPacket>::iterator RPBSearchResult;
-
 class ReliablePacketBuffer
 {
 public:
-	ReliablePacketBuffer() = default;
+	ReliablePacketBuffer();
 
 	bool getFirstSeqnum(u16& result);
 
@@ -244,18 +276,35 @@ class ReliablePacketBuffer
 	void insert(const BufferedPacket &p, u16 next_expected);
 
 	void incrementTimeouts(float dtime);
-	std::list<BufferedPacket> getTimedOuts(float timeout, u32 max_packets);
+	std::vector<BufferedPacket> getTimedOuts(float timeout, u32 max_packets);
 
 	void print();
 	bool empty();
 	u32 size();
+	// Bytes allocated for the ring and the packets, without their data
+	size_t memoryUsage();
 
 
 private:
-	RPBSearchResult findPacket(u16 seqnum); // does not perform locking
-	inline RPBSearchResult notFound() { return m_list.end(); }
+	// Slot value of a seqnum without a packet
+	static const u16 NO_PACKET = U16_MAX;
 
-	std::list<BufferedPacket> m_list;
+	// These do not perform locking
+	inline u16 &slot(u16 seqnum)
+	{
+		return m_slots[seqnum & (m_slots.size() - 1)];
+	}
+	BufferedPacket take(u16 seqnum);
+	void grow(u32 span);
+
+	// Power of two slots with the index of the packet in m_packets
+	std::vector<u16> m_slots;
+	std::vector<BufferedPacket> m_packets;
+	// Indices of the unused entries of m_packets
+	std::vector<u16> m_free;
+	u16 m_first = 0; // Seqnum of the first packet
+	u32 m_span = 0; // Seqnums from the first to the last packet
+	u32 m_count = 0;
 
 	u16 m_oldest_non_answered_ack;
 
@@ -269,7 +318,6 @@ class ReliablePacketBuffer
 class IncomingSplitBuffer
 {
 public:
-	~IncomingSplitBuffer();
 	/*
 		Returns a reference counted buffer of length != 0 when a full split
 		packet is constructed. If not, returns one of length 0.
@@ -278,9 +326,17 @@ class IncomingSplitBuffer
 
 	void removeUnreliableTimedOuts(float dtime, float timeout);
 
+	// Bytes allocated for the incomplete split packets
+	size_t memoryUsage();
+
 private:
+	// Keeps the arena of sp for the next split packet
+	void recycle(IncomingSplitPacket &sp);
+
 	// Key is seqnum
-	std::map<u16, IncomingSplitPacket*> m_buf;
+	std::unordered_map<u16, IncomingSplitPacket> m_buf;
+	// Finished packets, kept for their allocated arenas
+	std::vector<IncomingSplitPacket> m_free;
 
 	std::mutex m_map_mutex;
 };
@@ -289,11 +345,11 @@ struct OutgoingPacket
 {
 	session_t peer_id;
 	u8 channelnum;
-	SharedBuffer<u8> data;
+	PacketBuffer data;
 	bool reliable;
 	bool ack;
 
-	OutgoingPacket(session_t peer_id_, u8 channelnum_, const SharedBuffer<u8> &data_,
+	OutgoingPacket(session_t peer_id_, u8 channelnum_, const PacketBuffer &data_,
 			bool reliable_,bool ack_=false):
 		peer_id(peer_id_),
 		channelnum(channelnum_),
@@ -322,7 +378,7 @@ struct ConnectionCommand
 	Address address;
 	session_t peer_id = PEER_ID_INEXISTENT;
 	u8 channelnum = 0;
-	Buffer<u8> data;
+	PacketBuffer data;
 	bool reliable = false;
 	bool raw = false;
 
@@ -350,7 +406,7 @@ struct ConnectionCommand
 
 	void send(session_t peer_id_, u8 channelnum_, NetworkPacket *pkt, bool reliable_);
 
-	void ack(session_t peer_id_, u8 channelnum_, const Buffer<u8> &data_)
+	void ack(session_t peer_id_, u8 channelnum_, const PacketBuffer &data_)
 	{
 		type = CONCMD_ACK;
 		peer_id = peer_id_;
@@ -359,7 +415,7 @@ struct ConnectionCommand
 		reliable = false;
 	}
 
-	void createPeer(session_t peer_id_, const Buffer<u8> &data_)
+	void createPeer(session_t peer_id_, const PacketBuffer &data_)
 	{
 		type = CONCMD_CREATE_PEER;
 		peer_id = peer_id_;
@@ -409,6 +465,9 @@ class Channel
 
 	IncomingSplitBuffer incoming_splits;
 
+	// Off when the congestion controller of the peer sizes the window
+	bool dynamic_window = true;
+
 	Channel() = default;
 	~Channel() = default;
 
@@ -478,6 +537,9 @@ class Channel
 
 class Peer;
 
+// Set in the usage count of a peer that is deleted once no longer used
+#define PEER_PENDING_DELETION 0x80000000U
+
 class PeerHelper
 {
 public:
@@ -519,8 +581,8 @@ class Peer {
 		};
 
 		virtual ~Peer() {
-			MutexAutoLock usage_lock(m_exclusive_access_mutex);
-			FATAL_ERROR_IF(m_usage != 0, "Reference counting failure");
+			FATAL_ERROR_IF((m_usage & ~PEER_PENDING_DELETION) != 0,
+				"Reference counting failure");
 		};
 
 		// Unique id of the peer
@@ -534,7 +596,7 @@ class Peer {
 		virtual bool getAddress(MTProtocols type, Address& toset) = 0;
 
 		bool isPendingDeletion()
-		{ MutexAutoLock lock(m_exclusive_access_mutex); return m_pending_deletion; };
+		{ return m_usage.load(std::memory_order_acquire) & PEER_PENDING_DELETION; };
 
 		void ResetTimeout()
 			{MutexAutoLock lock(m_exclusive_access_mutex); m_timeout_counter = 0.0; };
@@ -553,7 +615,7 @@ class Peer {
 			return SharedBuffer<u8>(0);
 		};
 
-		virtual bool Ping(float dtime, SharedBuffer<u8>& data) { return false; };
+		virtual bool Ping(float dtime, PacketBuffer& data) { return false; };
 
 		virtual float getStat(rtt_stat_type type) const {
 			switch (type) {
@@ -584,8 +646,6 @@ class Peer {
 
 		std::mutex m_exclusive_access_mutex;
 
-		bool m_pending_deletion = false;
-
 		Connection* m_connection;
 
 		// Address of the peer
@@ -609,8 +669,9 @@ class Peer {
 		rttstats m_rtt;
 		float m_last_rtt = -1.0f;
 
-		// current usage count
-		unsigned int m_usage = 0;
+		// Current usage count, and PEER_PENDING_DELETION once dropped.
+		// Atomic, so that taking a PeerHelper doesn't need a lock.
+		std::atomic<u32> m_usage{0};
 
 		// Seconds from last receive
 		float m_timeout_counter = 0.0f;
@@ -658,7 +719,17 @@ class UDPPeer : public Peer
 
 	void setResendTimeout(float timeout)
 		{ MutexAutoLock lock(m_exclusive_access_mutex); resend_timeout = timeout; }
-	bool Ping(float dtime,SharedBuffer<u8>& data);
+	bool Ping(float dtime,PacketBuffer& data);
+
+	// Whether a reliable packet can go out on the channel now
+	bool canSendReliable(Channel &channel);
+	u32 getPacingBudget();
+	// Milliseconds until paced packets can go out, 0 if not paced
+	u32 getPacingDelayMs();
+	void reportSent(u32 count = 1);
+	// Returns true if the send thread should be woken up
+	bool reportAck(float rtt);
+	void reportLoss(u32 count);
 
 	Channel channels[CHANNEL_COUNT];
 	bool m_pending_disconnect = false;
@@ -666,6 +737,9 @@ class UDPPeer : public Peer
 	// This is changed dynamically
 	float resend_timeout = 0.5;
 
+	// nullptr with the legacy per channel windows
+	std::unique_ptr<CongestionController> m_congestion;
+
 	bool processReliableSendCommand(
 					ConnectionCommand &c,
 					unsigned int max_packet_size);
@@ -765,6 +839,11 @@ class Connection
 	Address GetPeerAddress(session_t peer_id);
 	float getPeerStat(session_t peer_id, rtt_stat_type type);
 	float getLocalStat(rate_stat_type type);
+	// Packets handed to Send() since the start
+	u64 getPacketsSent() const { return m_packets_sent.load(std::memory_order_relaxed); }
+	// Packet buffers acquired and copied since the start to write these
+	// packets and to send them
+	PacketBuffer::Stats getSendStats() const;
 	const u32 GetProtocolID() const { return m_protocol_id; };
 	const std::string getDesc();
 	void DisconnectPeer(session_t peer_id);
@@ -785,8 +864,7 @@ class Connection
 
 	std::vector<session_t> getPeerIDs()
 	{
-		MutexAutoLock peerlock(m_peers_mutex);
-		return m_peer_ids;
+		return *std::atomic_load(&m_peer_ids);
 	}
 
 	UDPSocket m_udpSocket;
@@ -812,8 +890,29 @@ class Connection
 	session_t m_peer_id = 0;
 	u32 m_protocol_id;
 
-	std::map<session_t, Peer *> m_peers;
-	std::vector<session_t> m_peer_ids;
+	struct PeerShard
+	{
+		std::mutex mutex;
+		std::unordered_map<session_t, Peer *> peers;
+	};
+
+	PeerShard &getPeerShard(session_t peer_id)
+	{
+		return m_peer_shards[peer_id % PEER_TABLE_SHARDS];
+	}
+	// Adds or removes a peer, with m_peers_mutex locked
+	void insertPeer(Peer *peer);
+	Peer *erasePeer(session_t peer_id);
+
+	// Peers by id. A lookup only locks the shard of the peer, so that
+	// the connection threads and the server rarely wait for each other.
+	PeerShard m_peer_shards[PEER_TABLE_SHARDS];
+	// The ids of all peers. Replaced, not changed, so that readers don't
+	// wait for m_peers_mutex. std::atomic_load() and std::atomic_store()
+	// of a shared_ptr still take a short internal lock in libstdc++.
+	std::shared_ptr<const std::vector<session_t>> m_peer_ids =
+		std::make_shared<const std::vector<session_t>>();
+	// Serializes adding and removing peers
 	std::mutex m_peers_mutex;
 
 	std::unique_ptr<ConnectionSendThread> m_sendThread;
@@ -828,6 +927,13 @@ class Connection
 	bool m_shutting_down = false;
 
 	session_t m_next_remote_peer_id = 2;
+
+	std::atomic<u64> m_packets_sent{0};
+
+	void addSendStats(const PacketBuffer::Stats &stats);
+	std::atomic<u64> m_send_acquired{0};
+	std::atomic<u64> m_send_allocated{0};
+	std::atomic<u64> m_send_copied{0};
 };
 
 } // namespace
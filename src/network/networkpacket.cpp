@@ -25,20 +25,47 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/encryption.h"
 
 NetworkPacket::NetworkPacket(u16 command, u32 datasize, session_t peer_id):
-m_datasize(datasize), m_command(command), m_peer_id(peer_id)
+m_command(command), m_peer_id(peer_id)
 {
-	m_data.resize(m_datasize);
+	resizeData(datasize);
 }
 
 NetworkPacket::NetworkPacket(u16 command, u32 datasize):
-m_datasize(datasize), m_command(command)
+m_command(command)
 {
-	m_data.resize(m_datasize);
+	resizeData(datasize);
 }
 
-NetworkPacket::~NetworkPacket()
+NetworkPacket::NetworkPacket(const NetworkPacket &other):
+m_buffer(other.m_buffer), m_datasize(other.m_datasize),
+m_read_offset(other.m_read_offset), m_command(other.m_command),
+m_peer_id(other.m_peer_id), m_buffer_stats(other.m_buffer_stats)
 {
-	m_data.clear();
+	m_data = m_buffer.getSize() ? *m_buffer + 2 : nullptr;
+}
+
+NetworkPacket &NetworkPacket::operator=(const NetworkPacket &other)
+{
+	m_buffer = other.m_buffer;
+	m_data = m_buffer.getSize() ? *m_buffer + 2 : nullptr;
+	m_datasize = other.m_datasize;
+	m_read_offset = other.m_read_offset;
+	m_command = other.m_command;
+	m_peer_id = other.m_peer_id;
+	m_buffer_stats = other.m_buffer_stats;
+	return *this;
+}
+
+void NetworkPacket::resizeData(u32 datasize)
+{
+	bool empty = m_buffer.getSize() == 0;
+	PacketBuffer::Stats before = PacketBuffer::getThreadStats();
+	m_buffer.resize(datasize + 2);
+	m_buffer_stats += PacketBuffer::getThreadStats() - before;
+	if (empty)
+		writeU16(*m_buffer, m_command);
+	m_data = *m_buffer + 2;
+	m_datasize = datasize;
 }
 
 void NetworkPacket::checkReadOffset(u32 from_offset, u32 field_size)
@@ -60,20 +87,21 @@ void NetworkPacket::putRawPacket(const u8 *data, u32 datasize, session_t peer_id
 	m_datasize = datasize - 2;
 	m_peer_id = peer_id;
 
-	m_data.resize(m_datasize);
-
-	// split command and datas
+	// Keep the command in front of the data, it is sent like that
 	m_command = readU16(&data[0]);
-	memcpy(m_data.data(), &data[2], m_datasize);
+	m_buffer = PacketBuffer(data, datasize);
+	m_data = *m_buffer + 2;
 }
 
 void NetworkPacket::clear()
 {
-	m_data.clear();
+	m_buffer = PacketBuffer();
+	m_data = nullptr;
 	m_datasize = 0;
 	m_read_offset = 0;
 	m_command = 0;
 	m_peer_id = 0;
+	m_buffer_stats = PacketBuffer::Stats();
 }
 
 const char* NetworkPacket::getString(u32 from_offset)
@@ -85,10 +113,7 @@ const char* NetworkPacket::getString(u32 from_offset)
 
 void NetworkPacket::putRawString(const char* src, u32 len)
 {
-	if (m_read_offset + len > m_datasize) {
-		m_datasize = m_read_offset + len;
-		m_data.resize(m_datasize);
-	}
+	checkDataSize(len);
 
 	if (len == 0)
 		return;
@@ -550,18 +575,32 @@ NetworkPacket& NetworkPacket::operator<<(video::SColor src)
 	return *this;
 }
 
+PacketBuffer NetworkPacket::forgePacket()
+{
+	if (m_buffer.getSize() == 0)
+		resizeData(0);
+	return m_buffer;
+}
+
+PacketBuffer::Stats NetworkPacket::takeBufferStats()
+{
+	PacketBuffer::Stats stats = m_buffer_stats;
+	m_buffer_stats = PacketBuffer::Stats();
+	return stats;
+}
+
 Buffer<u8> NetworkPacket::oldForgePacket()
 {
 	Buffer<u8> sb(m_datasize + 2);
 	writeU16(&sb[0], m_command);
-	memcpy(&sb[2], m_data.data(), m_datasize);
+	memcpy(&sb[2], m_data, m_datasize);
 
 	return sb;
 }
 
 bool NetworkPacket::encrypt(std::string key)
 {
-	std::string data((const char*)(m_data.data()), m_datasize);
+	std::string data((const char*)m_data, m_datasize);
 
 	Encryption::setKey(key);
 	Encryption::EncryptedData encrypted_data;
@@ -573,16 +612,15 @@ bool NetworkPacket::encrypt(std::string key)
 	encrypted_data.toString(data_to_write);
 
 	m_read_offset = 0;
-	m_datasize = data_to_write.size();
-	m_data.resize(m_datasize);
-	memcpy(&m_data[0], data_to_write.c_str(), m_datasize);
+	resizeData(data_to_write.size());
+	memcpy(m_data, data_to_write.c_str(), m_datasize);
 
 	return true;
 }
 
 bool NetworkPacket::decrypt(std::string key)
 {
-	std::string data((const char*)(m_data.data()), m_datasize);
+	std::string data((const char*)m_data, m_datasize);
 
 	Encryption::setKey(key);
 	Encryption::EncryptedData encrypted_data;
@@ -598,9 +636,8 @@ bool NetworkPacket::decrypt(std::string key)
 		return false;
 
 	m_read_offset = 0;
-	m_datasize = data_to_write.size();
-	m_data.resize(m_datasize);
-	memcpy(&m_data[0], data_to_write.c_str(), m_datasize);
+	resizeData(data_to_write.size());
+	memcpy(m_data, data_to_write.c_str(), m_datasize);
 
 	return true;
 }
@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/pointer.h"
 #include "util/numeric.h"
 #include "networkprotocol.h"
+#include "packetbuffer.h"
 #include <SColor.h>
 
 class NetworkPacket
@@ -32,7 +33,9 @@ class NetworkPacket
 	NetworkPacket(u16 command, u32 datasize);
 	NetworkPacket() = default;
 
-	~NetworkPacket();
+	// Copies share the buffer until one of them is written to
+	NetworkPacket(const NetworkPacket &other);
+	NetworkPacket &operator=(const NetworkPacket &other);
 
 	void putRawPacket(const u8 *data, u32 datasize, session_t peer_id);
 	void clear();
@@ -114,6 +117,14 @@ class NetworkPacket
 	NetworkPacket &operator>>(video::SColor &dst);
 	NetworkPacket &operator<<(video::SColor src);
 
+	// The command and the data, ready for the connection to put its
+	// headers in front. Shares the buffer of the packet.
+	PacketBuffer forgePacket();
+
+	// Buffers acquired and copied while writing the packet, cleared so
+	// that a packet sent to several peers is counted once
+	PacketBuffer::Stats takeBufferStats();
+
 	// Temp, we remove SharedBuffer when migration finished
 	// ^ this comment has been here for 4 years
 	Buffer<u8> oldForgePacket();
@@ -123,18 +134,20 @@ class NetworkPacket
 
 private:
 	void checkReadOffset(u32 from_offset, u32 field_size);
+	void resizeData(u32 datasize);
 
 	inline void checkDataSize(u32 field_size)
 	{
-		if (m_read_offset + field_size > m_datasize) {
-			m_datasize = m_read_offset + field_size;
-			m_data.resize(m_datasize);
-		}
+		if (m_read_offset + field_size > m_datasize || m_buffer.isShared())
+			resizeData(MYMAX(m_read_offset + field_size, m_datasize));
 	}
 
-	std::vector<u8> m_data;
+	// The command followed by the data
+	PacketBuffer m_buffer;
+	u8 *m_data = nullptr;
 	u32 m_datasize = 0;
 	u32 m_read_offset = 0;
 	u16 m_command = 0;
 	session_t m_peer_id = 0;
+	PacketBuffer::Stats m_buffer_stats;
 };
@@ -766,7 +766,15 @@ enum ToClientCommand
 			std::string extra
 	*/
 
-	TOCLIENT_NUM_MSG_TYPES = 0x63,
+	TOCLIENT_ZSTD_DICTIONARY = 0x63,
+	/*
+		Sent to clients using serialization version 30 before any block.
+
+		u32 len
+		u8[len] zstd dictionary used for the blocks
+	*/
+
+	TOCLIENT_NUM_MSG_TYPES = 0x64,
 };
 
 enum ToServerCommand
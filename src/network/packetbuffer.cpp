@@ -0,0 +1,248 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "packetbuffer.h"
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "util/numeric.h"
+
+// Blocks of 64 bytes to 64 KiB are pooled, one size class per power of two
+#define POOL_MIN_SHIFT 6
+#define POOL_SIZE_CLASSES 11
+#define NO_SIZE_CLASS 0xFF
+// Bytes of free blocks kept in each size class
+#define POOL_KEPT_BYTES (1 << 20)
+
+struct PacketBuffer::Pool
+{
+	struct SizeClass
+	{
+		std::mutex mutex;
+		std::vector<Block *> free;
+	};
+
+	SizeClass classes[POOL_SIZE_CLASSES];
+
+	std::atomic<u64> acquired{0};
+	std::atomic<u64> allocated{0};
+	std::atomic<u64> copied{0};
+};
+
+thread_local PacketBuffer::Stats PacketBuffer::t_thread_stats;
+
+PacketBuffer::Pool &PacketBuffer::getPool()
+{
+	// Never destroyed, buffers may be released while exiting
+	static Pool *pool = new Pool();
+	return *pool;
+}
+
+PacketBuffer::Block *PacketBuffer::acquire(u32 capacity)
+{
+	Pool &pool = getPool();
+	pool.acquired.fetch_add(1, std::memory_order_relaxed);
+	t_thread_stats.acquired++;
+
+	u8 size_class = 0;
+	while (size_class < POOL_SIZE_CLASSES &&
+			(1U << (size_class + POOL_MIN_SHIFT)) < capacity)
+		size_class++;
+
+	Block *block = nullptr;
+	if (size_class < POOL_SIZE_CLASSES) {
+		capacity = 1U << (size_class + POOL_MIN_SHIFT);
+		Pool::SizeClass &sc = pool.classes[size_class];
+		std::lock_guard<std::mutex> lock(sc.mutex);
+		if (!sc.free.empty()) {
+			block = sc.free.back();
+			sc.free.pop_back();
+		}
+	} else {
+		// Still round up, so that a growing packet is copied rarely
+		size_class = NO_SIZE_CLASS;
+		u64 rounded = 1ULL << (POOL_SIZE_CLASSES + POOL_MIN_SHIFT);
+		while (rounded < capacity)
+			rounded *= 2;
+		capacity = MYMIN(rounded, (u64)U32_MAX - sizeof(Block));
+	}
+
+	if (!block) {
+		pool.allocated.fetch_add(1, std::memory_order_relaxed);
+		t_thread_stats.allocated++;
+		block = new (::operator new(sizeof(Block) + capacity)) Block();
+		block->capacity = capacity;
+		block->size_class = size_class;
+	}
+	block->refcount.store(1, std::memory_order_relaxed);
+	return block;
+}
+
+void PacketBuffer::release(Block *block)
+{
+	if (block->size_class != NO_SIZE_CLASS) {
+		Pool::SizeClass &sc = getPool().classes[block->size_class];
+		std::lock_guard<std::mutex> lock(sc.mutex);
+		if ((sc.free.size() + 1) * block->capacity <= POOL_KEPT_BYTES) {
+			sc.free.push_back(block);
+			return;
+		}
+	}
+	block->~Block();
+	::operator delete(block);
+}
+
+PacketBuffer::Stats PacketBuffer::getStats()
+{
+	Pool &pool = getPool();
+	Stats stats;
+	stats.acquired = pool.acquired.load(std::memory_order_relaxed);
+	stats.allocated = pool.allocated.load(std::memory_order_relaxed);
+	stats.copied = pool.copied.load(std::memory_order_relaxed);
+	return stats;
+}
+
+PacketBuffer::PacketBuffer(u32 size, u32 headroom)
+{
+	if (size == 0)
+		return;
+	m_block = acquire(headroom + size);
+	m_block->front.store(headroom, std::memory_order_relaxed);
+	m_offset = headroom;
+	m_size = size;
+}
+
+PacketBuffer::PacketBuffer(const u8 *data, u32 size, u32 headroom) :
+	PacketBuffer(size, headroom)
+{
+	if (size != 0)
+		memcpy(**this, data, size);
+}
+
+PacketBuffer::PacketBuffer(const PacketBuffer &other) :
+	m_block(other.m_block),
+	m_offset(other.m_offset),
+	m_size(other.m_size)
+{
+	if (m_block)
+		m_block->refcount.fetch_add(1, std::memory_order_relaxed);
+}
+
+PacketBuffer::PacketBuffer(PacketBuffer &&other) :
+	m_block(other.m_block),
+	m_offset(other.m_offset),
+	m_size(other.m_size)
+{
+	other.m_block = nullptr;
+	other.m_offset = 0;
+	other.m_size = 0;
+}
+
+PacketBuffer &PacketBuffer::operator=(const PacketBuffer &other)
+{
+	if (other.m_block)
+		other.m_block->refcount.fetch_add(1, std::memory_order_relaxed);
+	drop();
+	m_block = other.m_block;
+	m_offset = other.m_offset;
+	m_size = other.m_size;
+	return *this;
+}
+
+PacketBuffer &PacketBuffer::operator=(PacketBuffer &&other)
+{
+	if (this == &other)
+		return *this;
+	drop();
+	m_block = other.m_block;
+	m_offset = other.m_offset;
+	m_size = other.m_size;
+	other.m_block = nullptr;
+	other.m_offset = 0;
+	other.m_size = 0;
+	return *this;
+}
+
+void PacketBuffer::drop()
+{
+	if (m_block && m_block->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		release(m_block);
+	m_block = nullptr;
+}
+
+u8 *PacketBuffer::pushHeader(u32 size)
+{
+	if (m_block && m_offset >= size) {
+		// Nobody else sees the bytes in front if the block isn't shared
+		if (!isShared())
+			m_block->front.store(m_offset, std::memory_order_relaxed);
+
+		u32 front = m_offset;
+		if (m_block->front.compare_exchange_strong(front, m_offset - size,
+				std::memory_order_acq_rel)) {
+			m_offset -= size;
+			m_size += size;
+			return **this;
+		}
+	}
+
+	// Another copy has written its headers there, or there is no room left
+	reallocate(MYMAX(size, (u32)PACKET_HEADROOM), m_size);
+	m_offset -= size;
+	m_size += size;
+	m_block->front.store(m_offset, std::memory_order_relaxed);
+	return **this;
+}
+
+void PacketBuffer::resize(u32 size)
+{
+	if (!m_block && size == 0)
+		return;
+
+	if (!m_block || isShared() || m_offset + size > m_block->capacity) {
+		// Grow like a vector, data is usually appended bit by bit
+		u32 capacity = size;
+		if (m_block && size > m_size)
+			capacity = MYMAX(size, m_size * 2);
+		reallocate(m_block ? m_offset : PACKET_HEADROOM, capacity);
+	}
+
+	if (size > m_size)
+		memset(**this + m_size, 0, size - m_size);
+	m_size = size;
+}
+
+void PacketBuffer::reallocate(u32 headroom, u32 size)
+{
+	Block *block = acquire(headroom + size);
+	block->front.store(headroom, std::memory_order_relaxed);
+
+	u32 kept = MYMIN(m_size, size);
+	if (kept != 0) {
+		memcpy(block->bytes() + headroom, **this, kept);
+		getPool().copied.fetch_add(1, std::memory_order_relaxed);
+		t_thread_stats.copied++;
+	}
+
+	drop();
+	m_block = block;
+	m_offset = headroom;
+	m_size = kept;
+}
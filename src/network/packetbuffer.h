@@ -0,0 +1,126 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes.h"
+#include <atomic>
+
+// Room left in front of new packet data for the headers the connection
+// puts there: the base, reliable and split headers
+#define PACKET_HEADROOM (7 + 3 + 7)
+
+/*
+	Data of a packet on its way from NetworkPacket to the socket.
+
+	The memory comes from a pool and is reference counted, copies of a
+	PacketBuffer share it and can be handed to other threads. The connection
+	writes its headers in front of the data with pushHeader(), which doesn't
+	move the data as long as no other copy wrote its own headers there.
+	Only write to the data itself after resize(), which gives this copy
+	memory of its own if it is shared.
+*/
+class PacketBuffer
+{
+public:
+	struct Stats
+	{
+		u64 acquired = 0; // Memory blocks handed out, new or from the pool
+		u64 allocated = 0; // New ones, the pool had none to give
+		u64 copied = 0; // Data copied to make room or to write to it
+
+		Stats &operator+=(const Stats &other)
+		{
+			acquired += other.acquired;
+			allocated += other.allocated;
+			copied += other.copied;
+			return *this;
+		}
+
+		Stats operator-(const Stats &other) const
+		{
+			Stats diff;
+			diff.acquired = acquired - other.acquired;
+			diff.allocated = allocated - other.allocated;
+			diff.copied = copied - other.copied;
+			return diff;
+		}
+	};
+
+	PacketBuffer() = default;
+	// The data is not initialized
+	explicit PacketBuffer(u32 size, u32 headroom = PACKET_HEADROOM);
+	// Copies the data
+	PacketBuffer(const u8 *data, u32 size, u32 headroom = PACKET_HEADROOM);
+
+	PacketBuffer(const PacketBuffer &other);
+	PacketBuffer(PacketBuffer &&other);
+	PacketBuffer &operator=(const PacketBuffer &other);
+	PacketBuffer &operator=(PacketBuffer &&other);
+	~PacketBuffer() { drop(); }
+
+	u8 &operator[](u32 i) const { return m_block->bytes()[m_offset + i]; }
+	u8 *operator*() const { return m_block ? m_block->bytes() + m_offset : nullptr; }
+	u32 getSize() const { return m_size; }
+
+	// Whether other copies use the same memory
+	bool isShared() const
+	{
+		return m_block && m_block->refcount.load(std::memory_order_acquire) > 1;
+	}
+
+	// Adds size bytes in front of the data and returns them
+	u8 *pushHeader(u32 size);
+	// Makes the data size bytes long and writable, new bytes are zeroed
+	void resize(u32 size);
+
+	// Of all buffers since the start
+	static Stats getStats();
+	// Of the buffers the calling thread acquired or copied since it started
+	static const Stats &getThreadStats() { return t_thread_stats; }
+
+private:
+	struct Block
+	{
+		std::atomic<u32> refcount;
+		// Where the data of the copy that wrote the latest headers starts
+		std::atomic<u32> front;
+		u32 capacity;
+		u8 size_class;
+
+		u8 *bytes() { return reinterpret_cast<u8 *>(this + 1); }
+	};
+
+	struct Pool;
+	static Pool &getPool();
+
+	// Replaces the block with one of its own, with headroom free bytes
+	// in front of the data and room for size bytes of data
+	void reallocate(u32 headroom, u32 size);
+	void drop();
+
+	static Block *acquire(u32 capacity);
+	static void release(Block *block);
+
+	static thread_local Stats t_thread_stats;
+
+	Block *m_block = nullptr;
+	u32 m_offset = 0;
+	u32 m_size = 0;
+};
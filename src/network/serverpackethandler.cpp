@@ -110,6 +110,10 @@ void Server::handleCommand_Init(NetworkPacket* pkt)
 	// If it's lower than the lowest supported, give up.
 	if (depl_serial_v < SER_FMT_VER_LOWEST_READ)
 		depl_serial_v = SER_FMT_VER_INVALID;
+	// Blocks only need the dictionary format if there is a dictionary
+	else if (depl_serial_v >= SER_FMT_VER_ZSTD_DICTIONARY &&
+			!m_env->getServerMap().getZstdDictionary())
+		depl_serial_v = SER_FMT_VER_ZSTD_DICTIONARY - 1;
 
 	if (depl_serial_v == SER_FMT_VER_INVALID) {
 		actionstream << "Server: A mismatched client tried to connect from " <<
@@ -311,6 +315,10 @@ void Server::handleCommand_Init2(NetworkPacket* pkt)
 
 	RemoteClient *client = getClient(peer_id, CS_InitDone);
 
+	// The client needs the dictionary before it gets any block
+	if (client->serialization_version >= SER_FMT_VER_ZSTD_DICTIONARY)
+		SendZstdDictionary(peer_id);
+
 	// Keep client language for server translations
 	client->setLangCode(lang);
 
@@ -58,6 +58,11 @@ typedef int socklen_t;
 typedef int socket_t;
 #endif
 
+// recvmmsg() and sendmmsg() are in Bionic since Android 5.0
+#if defined(__linux__) && (!defined(__ANDROID__) || __ANDROID_API__ >= 21)
+#define HAVE_MMSG 1
+#endif
+
 // Set to true to enable verbose debug output
 bool socket_enable_debug_output = false; // yuck
 
@@ -83,6 +88,57 @@ void sockets_cleanup()
 #endif
 }
 
+static socklen_t toSockAddr(const Address &addr, struct sockaddr_storage *storage)
+{
+	memset(storage, 0, sizeof(*storage));
+	if (addr.getFamily() == AF_INET6) {
+		struct sockaddr_in6 *address = (struct sockaddr_in6 *)storage;
+		*address = addr.getAddress6();
+		address->sin6_port = htons(addr.getPort());
+		return sizeof(struct sockaddr_in6);
+	}
+
+	struct sockaddr_in *address = (struct sockaddr_in *)storage;
+	*address = addr.getAddress();
+	address->sin_port = htons(addr.getPort());
+	return sizeof(struct sockaddr_in);
+}
+
+static Address fromSockAddr(const struct sockaddr_storage *storage)
+{
+	if (storage->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *address =
+			(const struct sockaddr_in6 *)storage;
+		IPv6AddressBytes bytes;
+		memcpy(bytes.bytes, address->sin6_addr.s6_addr, 16);
+		return Address(&bytes, ntohs(address->sin6_port));
+	}
+
+	const struct sockaddr_in *address = (const struct sockaddr_in *)storage;
+	return Address(ntohl(address->sin_addr.s_addr), ntohs(address->sin_port));
+}
+
+static void printPacket(int handle, const char *direction, const Address &address,
+	const void *data, int size)
+{
+	// Print packet address and size
+	dstream << handle << direction;
+	address.print(&dstream);
+	dstream << ", size=" << size;
+
+	// Print packet contents
+	dstream << ", data=";
+	for (int i = 0; i < size && i < 20; i++) {
+		if (i % 2 == 0)
+			dstream << " ";
+		unsigned int a = ((const unsigned char *)data)[i];
+		dstream << std::hex << std::setw(2) << std::setfill('0') << a;
+	}
+
+	if (size > 20)
+		dstream << "...";
+}
+
 /*
 	UDPSocket
 */
@@ -205,22 +261,7 @@ void UDPSocket::Send(const Address &destination, const void *data, int size)
 		dumping_packet = myrand() % INTERNET_SIMULATOR_PACKET_LOSS == 0;
 
 	if (socket_enable_debug_output) {
-		// Print packet destination and size
-		dstream << (int)m_handle << " -> ";
-		destination.print(&dstream);
-		dstream << ", size=" << size;
-
-		// Print packet contents
-		dstream << ", data=";
-		for (int i = 0; i < size && i < 20; i++) {
-			if (i % 2 == 0)
-				dstream << " ";
-			unsigned int a = ((const unsigned char *)data)[i];
-			dstream << std::hex << std::setw(2) << std::setfill('0') << a;
-		}
-
-		if (size > 20)
-			dstream << "...";
+		printPacket(m_handle, " -> ", destination, data, size);
 
 		if (dumping_packet)
 			dstream << " (DUMPED BY INTERNET_SIMULATOR)";
@@ -238,18 +279,10 @@ void UDPSocket::Send(const Address &destination, const void *data, int size)
 	if (destination.getFamily() != m_addr_family)
 		throw SendFailedException("Address family mismatch");
 
-	int sent;
-	if (m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address = destination.getAddress6();
-		address.sin6_port = htons(destination.getPort());
-		sent = sendto(m_handle, (const char *)data, size, 0,
-				(struct sockaddr *)&address, sizeof(struct sockaddr_in6));
-	} else {
-		struct sockaddr_in address = destination.getAddress();
-		address.sin_port = htons(destination.getPort());
-		sent = sendto(m_handle, (const char *)data, size, 0,
-				(struct sockaddr *)&address, sizeof(struct sockaddr_in));
-	}
+	struct sockaddr_storage address;
+	socklen_t address_len = toSockAddr(destination, &address);
+	int sent = sendto(m_handle, (const char *)data, size, 0,
+			(struct sockaddr *)&address, address_len);
 
 	if (sent != size)
 		throw SendFailedException("Failed to send packet");
@@ -261,61 +294,133 @@ int UDPSocket::Receive(Address &sender, void *data, int size)
 	if (!WaitData(m_timeout_ms))
 		return -1;
 
-	int received;
-	if (m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address;
-		memset(&address, 0, sizeof(address));
-		socklen_t address_len = sizeof(address);
+	struct sockaddr_storage address;
+	memset(&address, 0, sizeof(address));
+	socklen_t address_len = sizeof(address);
 
-		received = recvfrom(m_handle, (char *)data, size, 0,
-				(struct sockaddr *)&address, &address_len);
+	int received = recvfrom(m_handle, (char *)data, size, 0,
+			(struct sockaddr *)&address, &address_len);
 
-		if (received < 0)
-			return -1;
+	if (received < 0)
+		return -1;
 
-		u16 address_port = ntohs(address.sin6_port);
-		IPv6AddressBytes bytes;
-		memcpy(bytes.bytes, address.sin6_addr.s6_addr, 16);
-		sender = Address(&bytes, address_port);
-	} else {
-		struct sockaddr_in address;
-		memset(&address, 0, sizeof(address));
+	sender = fromSockAddr(&address);
 
-		socklen_t address_len = sizeof(address);
+	if (socket_enable_debug_output) {
+		printPacket(m_handle, " <- ", sender, data, received);
+		dstream << std::endl;
+	}
 
-		received = recvfrom(m_handle, (char *)data, size, 0,
-				(struct sockaddr *)&address, &address_len);
+	return received;
+}
 
-		if (received < 0)
-			return -1;
+u32 UDPSocket::SendBatch(const UDPDatagram *datagrams, u32 count)
+{
+	u32 sent = 0;
+
+#ifdef HAVE_MMSG
+	// Both need every packet to go through Send()
+	if (!INTERNET_SIMULATOR && !socket_enable_debug_output) {
+		struct mmsghdr msgs[UDP_BATCH_SIZE];
+		struct iovec iovs[UDP_BATCH_SIZE];
+		struct sockaddr_storage addresses[UDP_BATCH_SIZE];
+
+		u32 i = 0;
+		while (i < count) {
+			unsigned int n = 0;
+			for (; i < count && n < UDP_BATCH_SIZE; i++) {
+				const UDPDatagram &datagram = datagrams[i];
+				if (datagram.address.getFamily() != m_addr_family)
+					continue;
+
+				iovs[n].iov_base = datagram.data;
+				iovs[n].iov_len = datagram.size;
+				memset(&msgs[n], 0, sizeof(msgs[n]));
+				msgs[n].msg_hdr.msg_name = &addresses[n];
+				msgs[n].msg_hdr.msg_namelen =
+					toSockAddr(datagram.address, &addresses[n]);
+				msgs[n].msg_hdr.msg_iov = &iovs[n];
+				msgs[n].msg_hdr.msg_iovlen = 1;
+				n++;
+			}
+
+			unsigned int done = 0;
+			while (done < n) {
+				int result = sendmmsg(m_handle, &msgs[done], n - done, 0);
+				if (result <= 0) {
+					if (errno != EINTR)
+						done++; // Skip the datagram that failed
+					continue;
+				}
+
+				for (int k = 0; k < result; k++, done++) {
+					if (msgs[done].msg_len == iovs[done].iov_len)
+						sent++;
+				}
+			}
+		}
 
-		u32 address_ip = ntohl(address.sin_addr.s_addr);
-		u16 address_port = ntohs(address.sin_port);
+		return sent;
+	}
+#endif
 
-		sender = Address(address_ip, address_port);
+	for (u32 i = 0; i < count; i++) {
+		try {
+			Send(datagrams[i].address, datagrams[i].data, datagrams[i].size);
+			sent++;
+		} catch (SendFailedException &e) {
+		}
 	}
 
-	if (socket_enable_debug_output) {
-		// Print packet sender and size
-		dstream << (int)m_handle << " <- ";
-		sender.print(&dstream);
-		dstream << ", size=" << received;
-
-		// Print packet contents
-		dstream << ", data=";
-		for (int i = 0; i < received && i < 20; i++) {
-			if (i % 2 == 0)
-				dstream << " ";
-			unsigned int a = ((const unsigned char *)data)[i];
-			dstream << std::hex << std::setw(2) << std::setfill('0') << a;
+	return sent;
+}
+
+u32 UDPSocket::ReceiveBatch(UDPDatagram *datagrams, u32 count, int buffer_size)
+{
+	if (count == 0)
+		return 0;
+
+#ifdef HAVE_MMSG
+	if (!socket_enable_debug_output) {
+		// Return on timeout
+		if (!WaitData(m_timeout_ms))
+			return 0;
+
+		struct mmsghdr msgs[UDP_BATCH_SIZE];
+		struct iovec iovs[UDP_BATCH_SIZE];
+		struct sockaddr_storage addresses[UDP_BATCH_SIZE];
+
+		count = MYMIN(count, UDP_BATCH_SIZE);
+		memset(msgs, 0, sizeof(msgs[0]) * count);
+		for (u32 i = 0; i < count; i++) {
+			iovs[i].iov_base = datagrams[i].data;
+			iovs[i].iov_len = buffer_size;
+			msgs[i].msg_hdr.msg_name = &addresses[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
 		}
-		if (received > 20)
-			dstream << "...";
 
-		dstream << std::endl;
+		// Only takes what is already there, WaitData() did the waiting
+		int received = recvmmsg(m_handle, msgs, count, MSG_DONTWAIT, nullptr);
+		if (received <= 0)
+			return 0;
+
+		for (int i = 0; i < received; i++) {
+			datagrams[i].address = fromSockAddr(&addresses[i]);
+			datagrams[i].size = msgs[i].msg_len;
+		}
+
+		return received;
 	}
+#endif
 
-	return received;
+	int received = Receive(datagrams[0].address, datagrams[0].data, buffer_size);
+	if (received < 0)
+		return 0;
+
+	datagrams[0].size = received;
+	return 1;
 }
 
 int UDPSocket::GetHandle()
@@ -39,6 +39,17 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 extern bool socket_enable_debug_output;
 
+// Most datagrams passed to the system in one call by the batch functions
+#define UDP_BATCH_SIZE 64
+
+// A datagram of UDPSocket::SendBatch or ReceiveBatch
+struct UDPDatagram
+{
+	Address address; // Destination, or sender of a received datagram
+	u8 *data = nullptr;
+	int size = 0;
+};
+
 void sockets_init();
 void sockets_cleanup();
 
@@ -58,6 +69,15 @@ class UDPSocket
 	void Send(const Address &destination, const void *data, int size);
 	// Returns -1 if there is no data
 	int Receive(Address &sender, void *data, int size);
+
+	// Sends the datagrams with as few system calls as possible: with
+	// sendmmsg() where available, else one by one.
+	// Returns how many were sent, the ones that failed are skipped.
+	u32 SendBatch(const UDPDatagram *datagrams, u32 count);
+	// Waits for data like Receive() and then reads up to count datagrams
+	// that are already there into their buffers of buffer_size bytes.
+	// Returns how many were read, 0 if there is no data.
+	u32 ReceiveBatch(UDPDatagram *datagrams, u32 count, int buffer_size);
 	int GetHandle(); // For debugging purposes only
 	void setTimeoutMs(int timeout_ms);
 	// Returns true if there is data, false if timeout occurred
@@ -18,6 +18,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "nodetimer.h"
+#include <algorithm>
+#include <cmath>
 #include "log.h"
 #include "serialization.h"
 #include "util/serialize.h"
@@ -43,31 +45,58 @@ void NodeTimer::deSerialize(std::istream &is)
 	NodeTimerList
 */
 
+// Length of a tick of the timer wheel in seconds
+static const double NODETIMER_TICK = 0.1;
+
+// The wheel is rebuilt instead of stepped through when it is advanced by
+// more ticks than this, e.g. when a block is activated after a long time
+static const u64 NODETIMER_MAX_STEP_TICKS = 4096;
+
+static inline u16 nodeIndex(v3s16 p)
+{
+	return p.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE + p.Y * MAP_BLOCKSIZE + p.X;
+}
+
+static inline s64 timeToTick(double time)
+{
+	return (s64)std::floor(time / NODETIMER_TICK);
+}
+
 void NodeTimerList::serialize(std::ostream &os, u8 map_format_version) const
 {
 	if (map_format_version == 24) {
 		// Version 0 is a placeholder for "nothing to see here; go away."
-		if (m_timers.empty()) {
+		if (m_index.empty()) {
 			writeU8(os, 0); // version
 			return;
 		}
 		writeU8(os, 1); // version
-		writeU16(os, m_timers.size());
+		writeU16(os, m_index.size());
 	}
 
 	if (map_format_version >= 25) {
 		writeU8(os, 2 + 4 + 4); // length of the data for a single timer
-		writeU16(os, m_timers.size());
+		writeU16(os, m_index.size());
 	}
 
-	for (const auto &timer : m_timers) {
-		NodeTimer t = timer.second;
+	// Write them in the order they trigger, like before the timer wheel
+	std::vector<const Entry *> entries;
+	entries.reserve(m_index.size());
+	for (const auto &it : m_index)
+		entries.push_back(&m_entries[it.second]);
+	std::sort(entries.begin(), entries.end(),
+		[] (const Entry *a, const Entry *b) {
+			if (a->trigger_time != b->trigger_time)
+				return a->trigger_time < b->trigger_time;
+			return a->order < b->order;
+		});
+
+	for (const Entry *entry : entries) {
+		const NodeTimer &t = entry->timer;
 		NodeTimer nt = NodeTimer(t.timeout,
-			t.timeout - (f32)(timer.first - m_time), t.position);
-		v3s16 p = t.position;
+			t.timeout - (f32)(entry->trigger_time - m_time), t.position);
 
-		u16 p16 = p.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE + p.Y * MAP_BLOCKSIZE + p.X;
-		writeU16(os, p16);
+		writeU16(os, nodeIndex(t.position));
 		nt.serialize(os);
 	}
 }
@@ -113,7 +142,7 @@ void NodeTimerList::deSerialize(std::istream &is, u8 map_format_version)
 			continue;
 		}
 
-		if (m_iterators.find(p) != m_iterators.end()) {
+		if (m_index.find(nodeIndex(p)) != m_index.end()) {
 			warningstream<<"NodeTimerList::deSerialize(): "
 					<<"already set data at position"
 					<<"("<<p.X<<","<<p.Y<<","<<p.Z<<"): Ignoring."
@@ -125,26 +154,178 @@ void NodeTimerList::deSerialize(std::istream &is, u8 map_format_version)
 	}
 }
 
+NodeTimer NodeTimerList::get(const v3s16 &p) const
+{
+	auto n = m_index.find(nodeIndex(p));
+	if (n == m_index.end())
+		return NodeTimer();
+	const Entry &entry = m_entries[n->second];
+	NodeTimer t = entry.timer;
+	t.elapsed = t.timeout - (entry.trigger_time - m_time);
+	return t;
+}
+
+void NodeTimerList::remove(v3s16 p)
+{
+	auto n = m_index.find(nodeIndex(p));
+	if (n == m_index.end())
+		return;
+	unlink(n->second);
+	m_free_entries.push_back(n->second);
+	m_index.erase(n);
+}
+
+void NodeTimerList::insert(NodeTimer timer)
+{
+	if (m_slots.empty())
+		m_slots.assign(FAR_SLOT + 1, -1);
+
+	u32 i;
+	if (m_free_entries.empty()) {
+		i = m_entries.size();
+		m_entries.emplace_back();
+	} else {
+		i = m_free_entries.back();
+		m_free_entries.pop_back();
+	}
+
+	Entry &entry = m_entries[i];
+	entry.timer = timer;
+	entry.trigger_time = m_time + (double)(timer.timeout - timer.elapsed);
+	entry.order = m_next_order++;
+	m_index[nodeIndex(timer.position)] = i;
+	place(i);
+}
+
+void NodeTimerList::clear()
+{
+	m_entries.clear();
+	m_free_entries.clear();
+	m_index.clear();
+	m_slots.clear();
+	m_next_order = 0;
+}
+
+void NodeTimerList::link(u32 i, u16 slot)
+{
+	Entry &entry = m_entries[i];
+	entry.slot = slot;
+	entry.prev = -1;
+	entry.next = m_slots[slot];
+	if (entry.next != -1)
+		m_entries[entry.next].prev = i;
+	m_slots[slot] = i;
+}
+
+void NodeTimerList::unlink(u32 i)
+{
+	Entry &entry = m_entries[i];
+	if (entry.prev != -1)
+		m_entries[entry.prev].next = entry.next;
+	else
+		m_slots[entry.slot] = entry.next;
+	if (entry.next != -1)
+		m_entries[entry.next].prev = entry.prev;
+}
+
+void NodeTimerList::place(u32 i)
+{
+	s64 trigger_tick = timeToTick(m_entries[i].trigger_time);
+	// Overdue timers go to the current slot, which is checked next step
+	if (trigger_tick <= (s64)m_tick) {
+		link(i, m_tick & (WHEEL_SLOTS - 1));
+		return;
+	}
+
+	u64 tick = trigger_tick;
+	for (u32 level = 0; level < WHEEL_LEVELS; level++) {
+		u32 shift = level * WHEEL_BITS;
+		if ((tick >> shift) - (m_tick >> shift) < WHEEL_SLOTS) {
+			link(i, level * WHEEL_SLOTS + ((tick >> shift) & (WHEEL_SLOTS - 1)));
+			return;
+		}
+	}
+	link(i, FAR_SLOT);
+}
+
+void NodeTimerList::replaceSlot(u16 slot)
+{
+	s32 i = m_slots[slot];
+	m_slots[slot] = -1;
+	while (i != -1) {
+		s32 next = m_entries[i].next;
+		place(i);
+		i = next;
+	}
+}
+
+void NodeTimerList::expireSlot(u16 slot, std::vector<u32> &expired)
+{
+	s32 i = m_slots[slot];
+	while (i != -1) {
+		s32 next = m_entries[i].next;
+		if (m_entries[i].trigger_time <= m_time) {
+			unlink(i);
+			expired.push_back(i);
+		}
+		i = next;
+	}
+}
+
 std::vector<NodeTimer> NodeTimerList::step(float dtime)
 {
 	std::vector<NodeTimer> elapsed_timers;
 	m_time += dtime;
-	if (m_next_trigger_time == -1. || m_time < m_next_trigger_time) {
+	u64 target_tick = std::max<s64>(timeToTick(m_time), 0);
+	if (m_index.empty()) {
+		m_tick = target_tick;
 		return elapsed_timers;
 	}
-	std::multimap<double, NodeTimer>::iterator i = m_timers.begin();
-	// Process timers
-	for (; i != m_timers.end() && i->first <= m_time; ++i) {
-		NodeTimer t = i->second;
-		t.elapsed = t.timeout + (f32)(m_time - i->first);
+
+	std::vector<u32> expired;
+	if (target_tick - m_tick > NODETIMER_MAX_STEP_TICKS) {
+		m_tick = target_tick;
+		for (u16 slot = 0; slot <= FAR_SLOT; slot++)
+			replaceSlot(slot);
+		expireSlot(m_tick & (WHEEL_SLOTS - 1), expired);
+	} else {
+		// Timers of the current tick which were not due yet stay in its slot
+		expireSlot(m_tick & (WHEEL_SLOTS - 1), expired);
+		while (m_tick < target_tick) {
+			m_tick++;
+			// Move the timers of the slots the wheel reached one level down
+			for (u32 level = WHEEL_LEVELS - 1; level > 0; level--) {
+				u32 shift = level * WHEEL_BITS;
+				if ((m_tick & ((1ULL << shift) - 1)) != 0)
+					continue;
+				if (level == WHEEL_LEVELS - 1)
+					replaceSlot(FAR_SLOT);
+				replaceSlot(level * WHEEL_SLOTS +
+					((m_tick >> shift) & (WHEEL_SLOTS - 1)));
+			}
+			expireSlot(m_tick & (WHEEL_SLOTS - 1), expired);
+		}
+	}
+
+	// Fire them in the order they were due
+	std::sort(expired.begin(), expired.end(),
+		[this] (u32 a, u32 b) {
+			const Entry &ea = m_entries[a];
+			const Entry &eb = m_entries[b];
+			if (ea.trigger_time != eb.trigger_time)
+				return ea.trigger_time < eb.trigger_time;
+			return ea.order < eb.order;
+		});
+	elapsed_timers.reserve(expired.size());
+	for (u32 i : expired) {
+		const Entry &entry = m_entries[i];
+		NodeTimer t = entry.timer;
+		t.elapsed = t.timeout + (f32)(m_time - entry.trigger_time);
 		elapsed_timers.push_back(t);
-		m_iterators.erase(t.position);
+		m_index.erase(nodeIndex(t.position));
+		m_free_entries.push_back(i);
 	}
-	// Delete elapsed timers
-	m_timers.erase(m_timers.begin(), i);
-	if (m_timers.empty())
-		m_next_trigger_time = -1.;
-	else
-		m_next_trigger_time = m_timers.begin()->first;
+	if (m_index.empty())
+		clear();
 	return elapsed_timers;
 }
@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "irr_v3d.h"
 #include <iostream>
 #include <map>
+#include <unordered_map>
 #include <vector>
 
 /*
@@ -52,6 +53,13 @@ class NodeTimer
 
 /*
 	List of timers of all the nodes of a block
+
+	The timers are kept in a hierarchical timer wheel. Time is divided
+	into ticks, and level L of the wheel has WHEEL_SLOTS slots that span
+	WHEEL_SLOTS^L ticks each. A timer is stored in the lowest level that
+	reaches its trigger time and moves down a level when the wheel gets
+	to its slot, so inserting, removing and expiring a timer take
+	constant time no matter how many timers the block has.
 */
 
 class NodeTimerList
@@ -64,65 +72,57 @@ class NodeTimerList
 	void deSerialize(std::istream &is, u8 map_format_version);
 
 	// Get timer
-	NodeTimer get(const v3s16 &p) {
-		std::map<v3s16, std::multimap<double, NodeTimer>::iterator>::iterator n =
-			m_iterators.find(p);
-		if (n == m_iterators.end())
-			return NodeTimer();
-		NodeTimer t = n->second->second;
-		t.elapsed = t.timeout - (n->second->first - m_time);
-		return t;
-	}
+	NodeTimer get(const v3s16 &p) const;
 	// Deletes timer
-	void remove(v3s16 p) {
-		std::map<v3s16, std::multimap<double, NodeTimer>::iterator>::iterator n =
-			m_iterators.find(p);
-		if(n != m_iterators.end()) {
-			double removed_time = n->second->first;
-			m_timers.erase(n->second);
-			m_iterators.erase(n);
-			// Yes, this is float equality, but it is not a problem
-			// since we only test equality of floats as an ordered type
-			// and thus we never lose precision
-			if (removed_time == m_next_trigger_time) {
-				if (m_timers.empty())
-					m_next_trigger_time = -1.;
-				else
-					m_next_trigger_time = m_timers.begin()->first;
-			}
-		}
-	}
+	void remove(v3s16 p);
 	// Undefined behaviour if there already is a timer
-	void insert(NodeTimer timer) {
-		v3s16 p = timer.position;
-		double trigger_time = m_time + (double)(timer.timeout - timer.elapsed);
-		std::multimap<double, NodeTimer>::iterator it =
-			m_timers.insert(std::pair<double, NodeTimer>(
-				trigger_time, timer
-			));
-		m_iterators.insert(
-			std::pair<v3s16, std::multimap<double, NodeTimer>::iterator>(p, it));
-		if (m_next_trigger_time == -1. || trigger_time < m_next_trigger_time)
-			m_next_trigger_time = trigger_time;
-	}
+	void insert(NodeTimer timer);
 	// Deletes old timer and sets a new one
 	inline void set(const NodeTimer &timer) {
 		remove(timer.position);
 		insert(timer);
 	}
 	// Deletes all timers
-	void clear() {
-		m_timers.clear();
-		m_iterators.clear();
-		m_next_trigger_time = -1.;
-	}
+	void clear();
 
 	// Move forward in time, returns elapsed timers
 	std::vector<NodeTimer> step(float dtime);
 
 private:
-	std::multimap<double, NodeTimer> m_timers;
-	std::map<v3s16, std::multimap<double, NodeTimer>::iterator> m_iterators;
-	double m_next_trigger_time = -1.0;
+	static const u32 WHEEL_BITS = 6;
+	static const u32 WHEEL_SLOTS = 1 << WHEEL_BITS;
+	static const u32 WHEEL_LEVELS = 4;
+	// Slot of the timers beyond the last level
+	static const u32 FAR_SLOT = WHEEL_LEVELS * WHEEL_SLOTS;
+
+	struct Entry {
+		NodeTimer timer;
+		double trigger_time;
+		// Insertion order, so timers due at the same time keep it
+		u32 order;
+		// Neighbors in the list of the slot, -1 ends the list
+		s32 prev;
+		s32 next;
+		u16 slot;
+	};
+
+	void link(u32 i, u16 slot);
+	void unlink(u32 i);
+	// Puts a timer into the slot for its trigger time
+	void place(u32 i);
+	// Moves all timers of a slot to the slots for their trigger times
+	void replaceSlot(u16 slot);
+	// Takes the timers that are due out of a slot
+	void expireSlot(u16 slot, std::vector<u32> &expired);
+
+	std::vector<Entry> m_entries;
+	std::vector<u32> m_free_entries;
+	// Entry of the timer of each node, by position inside the block
+	std::unordered_map<u16, u32> m_index;
+	// First entry of each slot, empty while there are no timers
+	std::vector<s32> m_slots;
+	// Tick the wheel has been advanced to
+	u64 m_tick = 0;
+	u32 m_next_order = 0;
 	double m_time = 0.0;
 };
@@ -25,6 +25,7 @@
 
 #include <cmath>
 #include "noise.h"
+#include <atomic>
 #include <iostream>
 #include <cstring> // memset
 #include "debug.h"
@@ -37,6 +38,16 @@
 #define NOISE_MAGIC_Z    52591
 #define NOISE_MAGIC_SEED 1013
 
+// SSE2 is part of x86-64, AVX2 is detected at runtime
+#if defined(__x86_64__) || defined(_M_X64)
+	#define HAVE_NOISE_SSE2 1
+	#include <emmintrin.h>
+	#if defined(__GNUC__)
+		#define HAVE_NOISE_AVX2 1
+		#include <immintrin.h>
+	#endif
+#endif
+
 FlagDesc flagdesc_noiseparams[] = {
 	{"defaults",    NOISE_FLAG_DEFAULTS},
 	{"eased",       NOISE_FLAG_EASED},
@@ -153,23 +164,27 @@ s32 PcgRandom::randNormalDist(s32 min, s32 max, int num_trials)
 
 ///////////////////////////////////////////////////////////////////////////////
 
-float noise2d(int x, int y, s32 seed)
+// n is the sum of the magic number products of the coordinates and seed
+static inline float noiseHash(u32 n)
 {
-	unsigned int n = (NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y
-			+ NOISE_MAGIC_SEED * seed) & 0x7fffffff;
+	n &= 0x7fffffff;
 	n = (n >> 13) ^ n;
 	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
 	return 1.f - (float)(int)n / 0x40000000;
 }
 
 
+float noise2d(int x, int y, s32 seed)
+{
+	return noiseHash(NOISE_MAGIC_X * (u32)x + NOISE_MAGIC_Y * (u32)y
+			+ NOISE_MAGIC_SEED * (u32)seed);
+}
+
+
 float noise3d(int x, int y, int z, s32 seed)
 {
-	unsigned int n = (NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y + NOISE_MAGIC_Z * z
-			+ NOISE_MAGIC_SEED * seed) & 0x7fffffff;
-	n = (n >> 13) ^ n;
-	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
-	return 1.f - (float)(int)n / 0x40000000;
+	return noiseHash(NOISE_MAGIC_X * (u32)x + NOISE_MAGIC_Y * (u32)y
+			+ NOISE_MAGIC_Z * (u32)z + NOISE_MAGIC_SEED * (u32)seed);
 }
 
 
@@ -409,6 +424,8 @@ Noise::~Noise()
 	delete[] persist_buf;
 	delete[] noise_buf;
 	delete[] result;
+	delete[] interp_x_buf;
+	delete[] interp_u_buf;
 }
 
 
@@ -427,12 +444,16 @@ void Noise::allocBuffers()
 	delete[] gradient_buf;
 	delete[] persist_buf;
 	delete[] result;
+	delete[] interp_x_buf;
+	delete[] interp_u_buf;
 
 	try {
 		size_t bufsize = sx * sy * sz;
 		this->persist_buf  = NULL;
 		this->gradient_buf = new float[bufsize];
 		this->result       = new float[bufsize];
+		this->interp_x_buf = new u32[sx];
+		this->interp_u_buf = new float[sx];
 	} catch (std::bad_alloc &e) {
 		throw InvalidNoiseParamsException();
 	}
@@ -508,6 +529,354 @@ void Noise::resizeNoiseBuf(bool is3d)
 }
 
 
+///////////////////////// [ Noise map kernels ] ////////////////////////////
+
+/*
+	The inner loops of the noise maps. Every variant gives bit-identical
+	results: the vector code does the same float operations in the same
+	order as the scalar code, and it is never compiled with FMA.
+*/
+struct NoiseKernels {
+	// out[i] = noise value of the lattice point x0 + i, base holds the
+	// magic number products of the other coordinates and the seed
+	void (*lattice_row)(float *out, u32 count, s32 x0, u32 base);
+	// Interpolates one row of a 2D map. r0 and r1 are the lattice rows
+	// below and above it, nx[i] and ux[i] are the lattice column and the
+	// (eased) position inside it for each point.
+	void (*interp_row_2d)(float *out, u32 count,
+			const float *r0, const float *r1,
+			const u32 *nx, const float *ux, float v);
+	// Same for one row of a 3D map, r<y><z> are the four lattice rows
+	// around it
+	void (*interp_row_3d)(float *out, u32 count,
+			const float *r00, const float *r10,
+			const float *r01, const float *r11,
+			const u32 *nx, const float *ux, float v, float w);
+};
+
+
+static void latticeRowScalar(float *out, u32 count, s32 x0, u32 base)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = noiseHash(NOISE_MAGIC_X * (u32)(x0 + i) + base);
+}
+
+
+static void interpRow2DScalar(float *out, u32 count,
+		const float *r0, const float *r1,
+		const u32 *nx, const float *ux, float v)
+{
+	for (u32 i = 0; i != count; i++) {
+		u32 x = nx[i];
+		out[i] = biLinearInterpolation(r0[x], r0[x + 1], r1[x], r1[x + 1],
+				ux[i], v, false);
+	}
+}
+
+
+static void interpRow3DScalar(float *out, u32 count,
+		const float *r00, const float *r10,
+		const float *r01, const float *r11,
+		const u32 *nx, const float *ux, float v, float w)
+{
+	for (u32 i = 0; i != count; i++) {
+		u32 x = nx[i];
+		out[i] = triLinearInterpolation(
+				r00[x], r00[x + 1], r10[x], r10[x + 1],
+				r01[x], r01[x + 1], r11[x], r11[x + 1],
+				ux[i], v, w, false);
+	}
+}
+
+
+#if HAVE_NOISE_SSE2
+
+// SSE2 has no 32 bit multiplication, do the even and odd lanes separately
+static inline __m128i mulloSSE2(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(
+			_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+			_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+
+static inline __m128 lerpSSE2(__m128 v0, __m128 v1, __m128 t)
+{
+	return _mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), t));
+}
+
+
+// Interpolates between the lattice points x[i] and x[i] + 1 of row r for
+// four points. They lie in one or two neighboring lattice cells unless the
+// lattice is very dense.
+static inline __m128 lerpRowSSE2(const float *r, const u32 *x, __m128 u)
+{
+	u32 c = x[0];
+	if (x[3] == c)
+		return lerpSSE2(_mm_set1_ps(r[c]), _mm_set1_ps(r[c + 1]), u);
+
+	if (x[3] == c + 1) {
+		// Points in the second cell
+		__m128 m = _mm_castsi128_ps(_mm_cmpgt_epi32(
+				_mm_loadu_si128((const __m128i *)x), _mm_set1_epi32(c)));
+		__m128 v0 = _mm_set1_ps(r[c]);
+		__m128 v1 = _mm_set1_ps(r[c + 1]);
+		__m128 v2 = _mm_set1_ps(r[c + 2]);
+		return lerpSSE2(
+				_mm_or_ps(_mm_and_ps(m, v1), _mm_andnot_ps(m, v0)),
+				_mm_or_ps(_mm_and_ps(m, v2), _mm_andnot_ps(m, v1)),
+				u);
+	}
+
+	return lerpSSE2(
+			_mm_setr_ps(r[x[0]], r[x[1]], r[x[2]], r[x[3]]),
+			_mm_setr_ps(r[x[0] + 1], r[x[1] + 1], r[x[2] + 1], r[x[3] + 1]),
+			u);
+}
+
+
+static void latticeRowSSE2(float *out, u32 count, s32 x0, u32 base)
+{
+	const __m128i mask = _mm_set1_epi32(0x7fffffff);
+	const __m128i c0 = _mm_set1_epi32(60493);
+	const __m128i c1 = _mm_set1_epi32(19990303);
+	const __m128i c2 = _mm_set1_epi32(1376312589);
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 div = _mm_set1_ps(0x40000000);
+	const __m128i step = _mm_set1_epi32(4 * NOISE_MAGIC_X);
+
+	u32 n0 = NOISE_MAGIC_X * (u32)x0 + base;
+	__m128i hash = _mm_setr_epi32(n0, n0 + NOISE_MAGIC_X,
+			n0 + 2 * NOISE_MAGIC_X, n0 + 3 * NOISE_MAGIC_X);
+
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i n = _mm_and_si128(hash, mask);
+		n = _mm_xor_si128(_mm_srli_epi32(n, 13), n);
+		__m128i t = _mm_add_epi32(mulloSSE2(mulloSSE2(n, n), c0), c1);
+		n = _mm_and_si128(_mm_add_epi32(mulloSSE2(n, t), c2), mask);
+		_mm_storeu_ps(out + i,
+				_mm_sub_ps(one, _mm_div_ps(_mm_cvtepi32_ps(n), div)));
+		hash = _mm_add_epi32(hash, step);
+	}
+	latticeRowScalar(out + i, count - i, x0 + i, base);
+}
+
+
+static void interpRow2DSSE2(float *out, u32 count,
+		const float *r0, const float *r1,
+		const u32 *nx, const float *ux, float v)
+{
+	const __m128 vv = _mm_set1_ps(v);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 u = _mm_loadu_ps(ux + i);
+		_mm_storeu_ps(out + i, lerpSSE2(lerpRowSSE2(r0, nx + i, u),
+				lerpRowSSE2(r1, nx + i, u), vv));
+	}
+	interpRow2DScalar(out + i, count - i, r0, r1, nx + i, ux + i, v);
+}
+
+
+static void interpRow3DSSE2(float *out, u32 count,
+		const float *r00, const float *r10,
+		const float *r01, const float *r11,
+		const u32 *nx, const float *ux, float v, float w)
+{
+	const __m128 vv = _mm_set1_ps(v);
+	const __m128 ww = _mm_set1_ps(w);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const u32 *x = nx + i;
+		__m128 u = _mm_loadu_ps(ux + i);
+		__m128 a = lerpSSE2(lerpRowSSE2(r00, x, u), lerpRowSSE2(r10, x, u), vv);
+		__m128 b = lerpSSE2(lerpRowSSE2(r01, x, u), lerpRowSSE2(r11, x, u), vv);
+		_mm_storeu_ps(out + i, lerpSSE2(a, b, ww));
+	}
+	interpRow3DScalar(out + i, count - i, r00, r10, r01, r11,
+			nx + i, ux + i, v, w);
+}
+
+#endif
+
+
+#if HAVE_NOISE_AVX2
+
+// Only AVX2 is enabled here, FMA would change the rounding. The functions
+// clear the upper halves of the registers before they return to SSE code.
+#define NOISE_AVX2 __attribute__((target("avx2")))
+
+NOISE_AVX2 static inline __m256 lerpAVX2(__m256 v0, __m256 v1, __m256 t)
+{
+	return _mm256_add_ps(v0, _mm256_mul_ps(_mm256_sub_ps(v1, v0), t));
+}
+
+
+// Same as lerpRowSSE2() for eight points
+NOISE_AVX2 static inline __m256 lerpRowAVX2(const float *r, const u32 *x,
+		__m256 u)
+{
+	u32 c = x[0];
+	if (x[7] == c)
+		return lerpAVX2(_mm256_set1_ps(r[c]), _mm256_set1_ps(r[c + 1]), u);
+
+	if (x[7] == c + 1) {
+		__m256 m = _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+				_mm256_loadu_si256((const __m256i *)x), _mm256_set1_epi32(c)));
+		__m256 v0 = _mm256_set1_ps(r[c]);
+		__m256 v1 = _mm256_set1_ps(r[c + 1]);
+		__m256 v2 = _mm256_set1_ps(r[c + 2]);
+		return lerpAVX2(_mm256_blendv_ps(v0, v1, m),
+				_mm256_blendv_ps(v1, v2, m), u);
+	}
+
+	return lerpAVX2(
+			_mm256_setr_ps(r[x[0]], r[x[1]], r[x[2]], r[x[3]],
+				r[x[4]], r[x[5]], r[x[6]], r[x[7]]),
+			_mm256_setr_ps(r[x[0] + 1], r[x[1] + 1], r[x[2] + 1], r[x[3] + 1],
+				r[x[4] + 1], r[x[5] + 1], r[x[6] + 1], r[x[7] + 1]),
+			u);
+}
+
+
+NOISE_AVX2 static void latticeRowAVX2(float *out, u32 count, s32 x0, u32 base)
+{
+	const __m256i mask = _mm256_set1_epi32(0x7fffffff);
+	const __m256i c0 = _mm256_set1_epi32(60493);
+	const __m256i c1 = _mm256_set1_epi32(19990303);
+	const __m256i c2 = _mm256_set1_epi32(1376312589);
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256 div = _mm256_set1_ps(0x40000000);
+	const __m256i step = _mm256_set1_epi32(8 * NOISE_MAGIC_X);
+
+	__m256i hash = _mm256_add_epi32(
+			_mm256_set1_epi32(NOISE_MAGIC_X * (u32)x0 + base),
+			_mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+				_mm256_set1_epi32(NOISE_MAGIC_X)));
+
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i n = _mm256_and_si256(hash, mask);
+		n = _mm256_xor_si256(_mm256_srli_epi32(n, 13), n);
+		__m256i t = _mm256_add_epi32(
+				_mm256_mullo_epi32(_mm256_mullo_epi32(n, n), c0), c1);
+		n = _mm256_and_si256(
+				_mm256_add_epi32(_mm256_mullo_epi32(n, t), c2), mask);
+		_mm256_storeu_ps(out + i, _mm256_sub_ps(one,
+				_mm256_div_ps(_mm256_cvtepi32_ps(n), div)));
+		hash = _mm256_add_epi32(hash, step);
+	}
+	_mm256_zeroupper();
+	latticeRowScalar(out + i, count - i, x0 + i, base);
+}
+
+
+NOISE_AVX2 static void interpRow2DAVX2(float *out, u32 count,
+		const float *r0, const float *r1,
+		const u32 *nx, const float *ux, float v)
+{
+	const __m256 vv = _mm256_set1_ps(v);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 u = _mm256_loadu_ps(ux + i);
+		_mm256_storeu_ps(out + i, lerpAVX2(lerpRowAVX2(r0, nx + i, u),
+				lerpRowAVX2(r1, nx + i, u), vv));
+	}
+	_mm256_zeroupper();
+	interpRow2DScalar(out + i, count - i, r0, r1, nx + i, ux + i, v);
+}
+
+
+NOISE_AVX2 static void interpRow3DAVX2(float *out, u32 count,
+		const float *r00, const float *r10,
+		const float *r01, const float *r11,
+		const u32 *nx, const float *ux, float v, float w)
+{
+	const __m256 vv = _mm256_set1_ps(v);
+	const __m256 ww = _mm256_set1_ps(w);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const u32 *x = nx + i;
+		__m256 u = _mm256_loadu_ps(ux + i);
+		__m256 a = lerpAVX2(lerpRowAVX2(r00, x, u), lerpRowAVX2(r10, x, u), vv);
+		__m256 b = lerpAVX2(lerpRowAVX2(r01, x, u), lerpRowAVX2(r11, x, u), vv);
+		_mm256_storeu_ps(out + i, lerpAVX2(a, b, ww));
+	}
+	_mm256_zeroupper();
+	interpRow3DScalar(out + i, count - i, r00, r10, r01, r11,
+			nx + i, ux + i, v, w);
+}
+
+#undef NOISE_AVX2
+
+#endif
+
+
+// Indexed by NoiseSimd, levels that are not built are left empty
+static const NoiseKernels g_noise_kernels[] = {
+	{latticeRowScalar, interpRow2DScalar, interpRow3DScalar},
+#if HAVE_NOISE_SSE2
+	{latticeRowSSE2, interpRow2DSSE2, interpRow3DSSE2},
+#else
+	{nullptr, nullptr, nullptr},
+#endif
+#if HAVE_NOISE_AVX2
+	{latticeRowAVX2, interpRow2DAVX2, interpRow3DAVX2},
+#else
+	{nullptr, nullptr, nullptr},
+#endif
+};
+
+
+static bool isNoiseSimdSupported(NoiseSimd level)
+{
+	switch (level) {
+	case NOISE_SIMD_SCALAR:
+		return true;
+	case NOISE_SIMD_SSE2:
+		return g_noise_kernels[level].lattice_row != nullptr;
+	case NOISE_SIMD_AVX2:
+#if HAVE_NOISE_AVX2
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#else
+		return false;
+#endif
+	}
+	return false;
+}
+
+
+static NoiseSimd getBestNoiseSimd()
+{
+	if (isNoiseSimdSupported(NOISE_SIMD_AVX2))
+		return NOISE_SIMD_AVX2;
+	if (isNoiseSimdSupported(NOISE_SIMD_SSE2))
+		return NOISE_SIMD_SSE2;
+	return NOISE_SIMD_SCALAR;
+}
+
+
+static std::atomic<NoiseSimd> g_noise_simd(getBestNoiseSimd());
+
+
+NoiseSimd getNoiseSimd()
+{
+	return g_noise_simd.load(std::memory_order_relaxed);
+}
+
+
+bool setNoiseSimd(NoiseSimd level)
+{
+	if (!isNoiseSimdSupported(level))
+		return false;
+	g_noise_simd.store(level, std::memory_order_relaxed);
+	return true;
+}
+
+
 /*
  * NB:  This algorithm is not optimal in terms of space complexity.  The entire
  * integer lattice of noise points could be done as 2 lines instead, and for 3D,
@@ -525,51 +894,44 @@ void Noise::gradientMap2D(
 		float step_x, float step_y,
 		s32 seed)
 {
-	float v00, v01, v10, v11, u, v, orig_u;
-	u32 index, i, j, noisex, noisey;
+	float u, v;
+	u32 i, j, noisex, noisey;
 	u32 nlx, nly;
 	s32 x0, y0;
 
+	const NoiseKernels &kernels = g_noise_kernels[getNoiseSimd()];
 	bool eased = np.flags & (NOISE_FLAG_DEFAULTS | NOISE_FLAG_EASED);
 	x0 = std::floor(x);
 	y0 = std::floor(y);
 	u = x - (float)x0;
 	v = y - (float)y0;
-	orig_u = u;
 
 	//calculate noise point lattice
 	nlx = (u32)(u + sx * step_x) + 2;
 	nly = (u32)(v + sy * step_y) + 2;
-	index = 0;
 	for (j = 0; j != nly; j++)
-		for (i = 0; i != nlx; i++)
-			noise_buf[index++] = noise2d(x0 + i, y0 + j, seed);
+		kernels.lattice_row(&noise_buf[idx(0, j)], nlx, x0,
+			NOISE_MAGIC_Y * (u32)(y0 + j) + NOISE_MAGIC_SEED * (u32)seed);
+
+	//the lattice column and position in it are the same for every row
+	noisex = 0;
+	for (i = 0; i != sx; i++) {
+		interp_x_buf[i] = noisex;
+		interp_u_buf[i] = eased ? easeCurve(u) : u;
+
+		u += step_x;
+		if (u >= 1.0) {
+			u -= 1.0;
+			noisex++;
+		}
+	}
 
 	//calculate interpolations
-	index  = 0;
 	noisey = 0;
 	for (j = 0; j != sy; j++) {
-		v00 = noise_buf[idx(0, noisey)];
-		v10 = noise_buf[idx(1, noisey)];
-		v01 = noise_buf[idx(0, noisey + 1)];
-		v11 = noise_buf[idx(1, noisey + 1)];
-
-		u = orig_u;
-		noisex = 0;
-		for (i = 0; i != sx; i++) {
-			gradient_buf[index++] =
-				biLinearInterpolation(v00, v10, v01, v11, u, v, eased);
-
-			u += step_x;
-			if (u >= 1.0) {
-				u -= 1.0;
-				noisex++;
-				v00 = v10;
-				v01 = v11;
-				v10 = noise_buf[idx(noisex + 1, noisey)];
-				v11 = noise_buf[idx(noisex + 1, noisey + 1)];
-			}
-		}
+		kernels.interp_row_2d(&gradient_buf[j * sx], sx,
+			&noise_buf[idx(0, noisey)], &noise_buf[idx(0, noisey + 1)],
+			interp_x_buf, interp_u_buf, eased ? easeCurve(v) : v);
 
 		v += step_y;
 		if (v >= 1.0) {
@@ -587,13 +949,12 @@ void Noise::gradientMap3D(
 		float step_x, float step_y, float step_z,
 		s32 seed)
 {
-	float v000, v010, v100, v110;
-	float v001, v011, v101, v111;
-	float u, v, w, orig_u, orig_v;
+	float u, v, w, orig_v;
 	u32 index, i, j, k, noisex, noisey, noisez;
 	u32 nlx, nly, nlz;
 	s32 x0, y0, z0;
 
+	const NoiseKernels &kernels = g_noise_kernels[getNoiseSimd()];
 	bool eased = np.flags & NOISE_FLAG_EASED;
 
 	x0 = std::floor(x);
@@ -602,59 +963,46 @@ void Noise::gradientMap3D(
 	u = x - (float)x0;
 	v = y - (float)y0;
 	w = z - (float)z0;
-	orig_u = u;
 	orig_v = v;
 
 	//calculate noise point lattice
 	nlx = (u32)(u + sx * step_x) + 2;
 	nly = (u32)(v + sy * step_y) + 2;
 	nlz = (u32)(w + sz * step_z) + 2;
-	index = 0;
 	for (k = 0; k != nlz; k++)
 		for (j = 0; j != nly; j++)
-			for (i = 0; i != nlx; i++)
-				noise_buf[index++] = noise3d(x0 + i, y0 + j, z0 + k, seed);
+			kernels.lattice_row(&noise_buf[idx(0, j, k)], nlx, x0,
+				NOISE_MAGIC_Y * (u32)(y0 + j) + NOISE_MAGIC_Z * (u32)(z0 + k) +
+				NOISE_MAGIC_SEED * (u32)seed);
+
+	//the lattice column and position in it are the same for every row
+	noisex = 0;
+	for (i = 0; i != sx; i++) {
+		interp_x_buf[i] = noisex;
+		interp_u_buf[i] = eased ? easeCurve(u) : u;
+
+		u += step_x;
+		if (u >= 1.0) {
+			u -= 1.0;
+			noisex++;
+		}
+	}
 
 	//calculate interpolations
 	index  = 0;
-	noisey = 0;
 	noisez = 0;
 	for (k = 0; k != sz; k++) {
+		float ew = eased ? easeCurve(w) : w;
 		v = orig_v;
 		noisey = 0;
 		for (j = 0; j != sy; j++) {
-			v000 = noise_buf[idx(0, noisey,     noisez)];
-			v100 = noise_buf[idx(1, noisey,     noisez)];
-			v010 = noise_buf[idx(0, noisey + 1, noisez)];
-			v110 = noise_buf[idx(1, noisey + 1, noisez)];
-			v001 = noise_buf[idx(0, noisey,     noisez + 1)];
-			v101 = noise_buf[idx(1, noisey,     noisez + 1)];
-			v011 = noise_buf[idx(0, noisey + 1, noisez + 1)];
-			v111 = noise_buf[idx(1, noisey + 1, noisez + 1)];
-
-			u = orig_u;
-			noisex = 0;
-			for (i = 0; i != sx; i++) {
-				gradient_buf[index++] = triLinearInterpolation(
-					v000, v100, v010, v110,
-					v001, v101, v011, v111,
-					u, v, w,
-					eased);
-
-				u += step_x;
-				if (u >= 1.0) {
-					u -= 1.0;
-					noisex++;
-					v000 = v100;
-					v010 = v110;
-					v100 = noise_buf[idx(noisex + 1, noisey,     noisez)];
-					v110 = noise_buf[idx(noisex + 1, noisey + 1, noisez)];
-					v001 = v101;
-					v011 = v111;
-					v101 = noise_buf[idx(noisex + 1, noisey,     noisez + 1)];
-					v111 = noise_buf[idx(noisex + 1, noisey + 1, noisez + 1)];
-				}
-			}
+			kernels.interp_row_3d(&gradient_buf[index], sx,
+				&noise_buf[idx(0, noisey,     noisez)],
+				&noise_buf[idx(0, noisey + 1, noisez)],
+				&noise_buf[idx(0, noisey,     noisez + 1)],
+				&noise_buf[idx(0, noisey + 1, noisez + 1)],
+				interp_x_buf, interp_u_buf, eased ? easeCurve(v) : v, ew);
+			index += sx;
 
 			v += step_y;
 			if (v >= 1.0) {
@@ -134,6 +134,20 @@ struct NoiseParams {
 	}
 };
 
+/*
+	Instruction set used by the noise maps. Every level gives the same
+	results, the best one supported by the CPU is selected at startup.
+*/
+enum NoiseSimd {
+	NOISE_SIMD_SCALAR,
+	NOISE_SIMD_SSE2,
+	NOISE_SIMD_AVX2,
+};
+
+NoiseSimd getNoiseSimd();
+// Returns false if the level isn't supported by this build or CPU
+bool setNoiseSimd(NoiseSimd level);
+
 class Noise {
 public:
 	NoiseParams np;
@@ -190,6 +204,9 @@ class Noise {
 	void updateResults(float g, float *gmap, const float *persistence_map,
 			size_t bufsize);
 
+	// Lattice column and interpolation position of each x in a row
+	u32 *interp_x_buf = nullptr;
+	float *interp_u_buf = nullptr;
 };
 
 float NoisePerlin2D(NoiseParams *np, float x, float y, s32 seed);
@@ -23,8 +23,17 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 /******************************************************************************/
 
 #include "pathfinder.h"
+#include <algorithm>
+#include <bitset>
+#include <cstdlib>
+#include <functional>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include "map.h"
+#include "mapblock.h"
 #include "nodedef.h"
+#include "porting.h"
 
 //#define PATHFINDER_DEBUG
 //#define PATHFINDER_CALC_TIME
@@ -59,6 +68,20 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #define PATHFINDER_MAX_WAYPOINTS 700
 
+/** jump or drop height above which paths are not cached, they depend on
+ *  too many map blocks */
+#define PATHFINDER_MAX_CACHED_REACH (4 * MAP_BLOCKSIZE)
+
+/** how a node can be moved through */
+typedef enum {
+	PNK_IGNORE,            /**< node is not loaded                           */
+	PNK_FREE,              /**< node is not walkable                         */
+	PNK_WALKABLE           /**< node is walkable                             */
+} PathNodeKind;
+
+/** one bit per node of a map block, indexed like the node data */
+typedef std::bitset<MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE> BlockNodeBits;
+
 /******************************************************************************/
 /* Class definitions                                                          */
 /******************************************************************************/
@@ -171,7 +194,22 @@ class MapGridNodeContainer : public GridNodeContainer {
 	MapGridNodeContainer(Pathfinder *pathf);
 	virtual PathGridnode &access(v3s16 p);
 private:
-	std::map<v3s16, PathGridnode> m_nodes;
+	std::unordered_map<v3s16, PathGridnode> m_nodes;
+};
+
+/** entry of the open list of the A* search */
+struct PathOpenNode {
+	int   estimated_cost;                  /**< cost estimate when it was added */
+	v3s16 pos;                             /**< real position of node           */
+	bool  valid;                           /**< node is valid                   */
+};
+
+/** surface nodes of a map block, split into the parts that can be walked
+ *  between inside the block */
+struct PathBlockRegions {
+	std::vector<u16> region;               /**< region of each node, indexed like
+	                                        *   the node data; 0 = no surface     */
+	u16   count = 0;                       /**< number of regions                */
 };
 
 /** class doing pathfinding */
@@ -179,7 +217,8 @@ class Pathfinder {
 
 public:
 	Pathfinder() = delete;
-	Pathfinder(Map *map, const NodeDefManager *ndef) : m_map(map), m_ndef(ndef) {}
+	Pathfinder(Map *map, const NodeDefManager *ndef, PathCache *cache) :
+		m_map(map), m_ndef(ndef), m_cache(cache) {}
 
 	~Pathfinder();
 
@@ -281,6 +320,77 @@ class Pathfinder {
 	 */
 	bool          updateCostHeuristic(v3s16 isource, v3s16 idestination);
 
+	/**
+	 * find a path with A* search within a corridor of map blocks, which
+	 * is found by a search on the surface regions of the map blocks first
+	 * @param isource start position (index pos)
+	 * @param idestination end position (index pos)
+	 * @return true/false path to destination has been found
+	 */
+	bool          updateCostHierarchical(v3s16 isource, v3s16 idestination);
+
+	/**
+	 * search a path of surface regions from source to destination, and set
+	 * the corridor to the map blocks of these regions and the blocks next
+	 * to them
+	 * @param source start position, on a surface region (real pos)
+	 * @param destination end position, on a surface region (real pos)
+	 * @return true/false path of regions has been found
+	 */
+	bool          buildCorridor(v3s16 source, v3s16 destination);
+
+	/**
+	 * get the surface regions of a map block, from the cache if they
+	 * are known
+	 * @param blockpos position of map block
+	 * @return regions of the nodes of the block
+	 */
+	const PathBlockRegions &getBlockRegions(v3s16 blockpos);
+
+	/**
+	 * split the surface nodes of a map block into regions
+	 * @param blockpos position of map block
+	 * @return regions of the nodes of the block
+	 */
+	std::shared_ptr<PathBlockRegions> findBlockRegions(v3s16 blockpos);
+
+	/**
+	 * get the regions of other map blocks the nodes of the surface regions
+	 * of a map block can step to
+	 * @param blockpos position of map block
+	 * @param blimits map blocks to look for linked regions in
+	 * @return keys of the linked regions, for each region of the block
+	 */
+	const std::vector<std::vector<u64> > &getRegionLinks(v3s16 blockpos,
+			const core::aabbox3d<s16> &blimits);
+
+	/**
+	 * get the surface region a node belongs to
+	 * @param pos real position
+	 * @return region within its map block, 0 if it can't be stood on
+	 */
+	u16           getRegion(v3s16 pos);
+
+	/**
+	 * check if a position may be part of the path
+	 * @param pos real position
+	 * @return true/false position is inside the corridor, or there is none
+	 */
+	bool          isInCorridor(v3s16 pos);
+
+	/**
+	 * forget the results of the last search
+	 */
+	void          clearNodes();
+
+	/**
+	 * look up if a node is walkable or not loaded, using the walkability
+	 * cached by its map block
+	 * @param pos real position
+	 * @return kind of node
+	 */
+	PathNodeKind  getNodeKind(v3s16 pos);
+
 	/**
 	 * build a vector containing all nodes from destination to source;
 	 * to be called after the node costs have been processed
@@ -325,7 +435,26 @@ class Pathfinder {
 
 	const NodeDefManager *m_ndef = nullptr;
 
-	friend class PathfinderCompareHeuristic;
+	PathCache *m_cache = nullptr;
+
+	/** map block walkability of the last position looked up */
+	const MapBlock::Walkability *m_walkability = nullptr;
+	v3s16 m_walkability_pos;
+	bool m_walkability_valid = false;
+
+	/** surface regions of the map blocks looked at by the region search,
+	 *  and the regions of other blocks they are linked to */
+	std::unordered_map<v3s16, std::shared_ptr<const PathBlockRegions> >
+			m_block_regions;
+	std::unordered_map<v3s16, std::vector<std::vector<u64> > > m_region_links;
+
+	/** regions of the last map block looked up */
+	const PathBlockRegions *m_regions = nullptr;
+	v3s16 m_regions_pos;
+
+	/** map blocks the search is limited to, if m_use_corridor is set */
+	std::unordered_set<v3s16> m_corridor;
+	bool m_use_corridor = false;
 
 #ifdef PATHFINDER_DEBUG
 
@@ -378,26 +507,16 @@ class Pathfinder {
 
 /** Helper class for the open list priority queue in the A* pathfinder
  *  to sort the pathfinder nodes by cost.
+ *  The cost is kept in the open list entry, since the estimated cost of a
+ *  node does not change after it has been added.
  */
 class PathfinderCompareHeuristic
 {
-	private:
-		Pathfinder *myPathfinder;
 	public:
-		PathfinderCompareHeuristic(Pathfinder *pf)
-		{
-			myPathfinder = pf;
-		}
-		bool operator() (v3s16 pos1, v3s16 pos2) {
-			v3s16 ipos1 = myPathfinder->getIndexPos(pos1);
-			v3s16 ipos2 = myPathfinder->getIndexPos(pos2);
-			PathGridnode &g_pos1 = myPathfinder->getIndexElement(ipos1);
-			PathGridnode &g_pos2 = myPathfinder->getIndexElement(ipos2);
-			if (!g_pos1.valid)
+		bool operator() (const PathOpenNode &n1, const PathOpenNode &n2) const {
+			if (!n1.valid || !n2.valid)
 				return false;
-			if (!g_pos2.valid)
-				return false;
-			return g_pos1.estimated_cost > g_pos2.estimated_cost;
+			return n1.estimated_cost > n2.estimated_cost;
 		}
 };
 
@@ -411,12 +530,173 @@ std::vector<v3s16> get_path(Map* map, const NodeDefManager *ndef,
 		unsigned int searchdistance,
 		unsigned int max_jump,
 		unsigned int max_drop,
-		PathAlgorithm algo)
+		PathAlgorithm algo,
+		PathCache *cache)
 {
-	return Pathfinder(map, ndef).getPath(source, destination,
+	return Pathfinder(map, ndef, cache).getPath(source, destination,
 				searchdistance, max_jump, max_drop, algo);
 }
 
+/******************************************************************************/
+PathCache::PathCache(float max_age, u32 max_paths, u32 max_regions) :
+	m_max_age(max_age * 1000.0f),
+	m_max_paths(max_paths),
+	m_max_regions(max_regions)
+{
+}
+
+/******************************************************************************/
+std::vector<v3s16> PathCache::get(Map *map, v3s16 source, v3s16 destination,
+		const core::aabbox3d<s16> &limits,
+		unsigned int max_jump, unsigned int max_drop, PathAlgorithm algo)
+{
+	u64 now = porting::getTimeMs();
+	while (!m_paths.empty() && now - m_paths.front().time > m_max_age)
+		m_paths.pop_front();
+
+	// Newest paths first, they are most likely still valid
+	for (size_t i = m_paths.size(); i-- > 0; ) {
+		const CachedPath &cached = m_paths[i];
+		if (cached.path.back() != destination ||
+				cached.max_jump != max_jump ||
+				cached.max_drop != max_drop ||
+				cached.algo != algo)
+			continue;
+
+		auto start = std::find(cached.path.begin(), cached.path.end(), source);
+		if (start == cached.path.end())
+			continue;
+
+		bool inside = std::all_of(start, cached.path.end(),
+			[&limits] (v3s16 pos) { return limits.isPointInside(pos); });
+		if (!inside)
+			continue;
+
+		if (!isValid(map, cached)) {
+			m_paths.erase(m_paths.begin() + i);
+			continue;
+		}
+
+		return std::vector<v3s16>(start, cached.path.end());
+	}
+	return std::vector<v3s16>();
+}
+
+/******************************************************************************/
+void PathCache::add(Map *map, const std::vector<v3s16> &path,
+		unsigned int max_jump, unsigned int max_drop, PathAlgorithm algo)
+{
+	if (path.empty() || m_max_age == 0 || m_max_paths == 0)
+		return;
+
+	unsigned int reach = MYMAX(max_jump, max_drop);
+	if (reach > PATHFINDER_MAX_CACHED_REACH)
+		return;
+
+	CachedPath cached;
+	cached.path = path;
+	cached.max_jump = max_jump;
+	cached.max_drop = max_drop;
+	cached.algo = algo;
+	cached.time = porting::getTimeMs();
+
+	// Moving on from a node depends on the nodes up to a jump above it
+	// and a drop below it, and on the node it stands on
+	std::unordered_set<v3s16> blocks;
+	for (v3s16 pos : path) {
+		v3s16 blockpos = getNodeBlockPos(pos);
+		s16 min_y = getContainerPos(
+			(s16)MYMAX((s32)pos.Y - (s32)reach - 1, -MAX_MAP_GENERATION_LIMIT),
+			MAP_BLOCKSIZE);
+		s16 max_y = getContainerPos(
+			(s16)MYMIN((s32)pos.Y + (s32)reach, MAX_MAP_GENERATION_LIMIT),
+			MAP_BLOCKSIZE);
+		for (s16 y = min_y; y <= max_y; y++)
+			blocks.insert(v3s16(blockpos.X, y, blockpos.Z));
+	}
+
+	cached.blocks.reserve(blocks.size());
+	for (v3s16 blockpos : blocks)
+		cached.blocks.push_back(getState(map, blockpos));
+
+	m_paths.push_back(std::move(cached));
+	while (m_paths.size() > m_max_paths)
+		m_paths.pop_front();
+}
+
+/******************************************************************************/
+std::shared_ptr<const PathBlockRegions> PathCache::getRegions(Map *map,
+		v3s16 blockpos, s16 reach)
+{
+	auto it = m_regions.find(blockpos);
+	if (it == m_regions.end() || it->second.reach != reach)
+		return nullptr;
+
+	CachedRegions &cached = it->second;
+	if (!isValid(map, cached.block) || !isValid(map, cached.below)) {
+		m_regions.erase(it);
+		return nullptr;
+	}
+	cached.time = porting::getTimeMs();
+	return cached.regions;
+}
+
+/******************************************************************************/
+void PathCache::addRegions(Map *map, v3s16 blockpos, s16 reach,
+		std::shared_ptr<const PathBlockRegions> regions)
+{
+	if (m_max_age == 0 || m_max_regions == 0)
+		return;
+
+	u64 now = porting::getTimeMs();
+	if (m_regions.size() >= m_max_regions) {
+		for (auto it = m_regions.begin(); it != m_regions.end(); ) {
+			if (now - it->second.time > m_max_age)
+				it = m_regions.erase(it);
+			else
+				++it;
+		}
+		if (m_regions.size() >= m_max_regions)
+			return;
+	}
+
+	CachedRegions &cached = m_regions[blockpos];
+	cached.regions = std::move(regions);
+	cached.reach = reach;
+	cached.block = getState(map, blockpos);
+	cached.below = getState(map, blockpos - v3s16(0, 1, 0));
+	cached.time = now;
+}
+
+/******************************************************************************/
+bool PathCache::isValid(Map *map, const CachedPath &cached)
+{
+	for (const BlockState &state : cached.blocks) {
+		if (!isValid(map, state))
+			return false;
+	}
+	return true;
+}
+
+/******************************************************************************/
+bool PathCache::isValid(Map *map, const BlockState &state)
+{
+	MapBlock *block = map->getBlockNoCreateNoEx(state.pos);
+	if (!block)
+		return state.instance_id == 0;
+	return block->getInstanceId() == state.instance_id &&
+			block->getModificationCount() == state.modification_count;
+}
+
+/******************************************************************************/
+PathCache::BlockState PathCache::getState(Map *map, v3s16 blockpos)
+{
+	MapBlock *block = map->getBlockNoCreateNoEx(blockpos);
+	if (!block)
+		return {blockpos, 0, 0};
+	return {blockpos, block->getInstanceId(), block->getModificationCount()};
+}
+
 /******************************************************************************/
 PathCost::PathCost(const PathCost &b)
 {
@@ -513,20 +793,19 @@ void PathGridnode::setCost(v3s16 dir, const PathCost &cost)
 
 void GridNodeContainer::initNode(v3s16 ipos, PathGridnode *p_node)
 {
-	const NodeDefManager *ndef = m_pathf->m_ndef;
 	PathGridnode &elem = *p_node;
 
 	v3s16 realpos = m_pathf->getRealPos(ipos);
 
-	MapNode current = m_pathf->m_map->getNode(realpos);
-	MapNode below   = m_pathf->m_map->getNode(realpos + v3s16(0, -1, 0));
+	PathNodeKind current = m_pathf->getNodeKind(realpos);
+	PathNodeKind below   = m_pathf->getNodeKind(realpos + v3s16(0, -1, 0));
 
 
-	if ((current.param0 == CONTENT_IGNORE) ||
-			(below.param0 == CONTENT_IGNORE)) {
+	if ((current == PNK_IGNORE) ||
+			(below == PNK_IGNORE)) {
 		DEBUG_OUT("Pathfinder: " << PP(realpos) <<
 			" current or below is invalid element" << std::endl);
-		if (current.param0 == CONTENT_IGNORE) {
+		if (current == PNK_IGNORE) {
 			elem.type = 'i';
 			DEBUG_OUT(PP(ipos) << ": " << 'i' << std::endl);
 		}
@@ -534,10 +813,10 @@ void GridNodeContainer::initNode(v3s16 ipos, PathGridnode *p_node)
 	}
 
 	//don't add anything if it isn't an air node
-	if (ndef->get(current).walkable || !ndef->get(below).walkable) {
+	if ((current == PNK_WALKABLE) || (below != PNK_WALKABLE)) {
 			DEBUG_OUT("Pathfinder: " << PP(realpos)
 				<< " not on surface" << std::endl);
-			if (ndef->get(current).walkable) {
+			if (current == PNK_WALKABLE) {
 				elem.type = 's';
 				DEBUG_OUT(PP(ipos) << ": " << 's' << std::endl);
 			} else {
@@ -590,7 +869,7 @@ MapGridNodeContainer::MapGridNodeContainer(Pathfinder *pathf)
 
 PathGridnode &MapGridNodeContainer::access(v3s16 p)
 {
-	std::map<v3s16, PathGridnode>::iterator it = m_nodes.find(p);
+	auto it = m_nodes.find(p);
 	if (it != m_nodes.end()) {
 		return it->second;
 	}
@@ -622,8 +901,11 @@ std::vector<v3s16> Pathfinder::getPath(v3s16 source,
 	m_destination = destination;
 	m_min_target_distance = -1;
 	m_prefetch = true;
+	m_walkability_valid = false;
 
-	if (algo == PA_PLAIN_NP) {
+	// The hierarchical search only looks at a part of the search area,
+	// so calculating costs as needed is cheaper
+	if (algo == PA_PLAIN_NP || algo == PA_HIERARCHICAL) {
 		m_prefetch = false;
 	}
 
@@ -651,12 +933,17 @@ std::vector<v3s16> Pathfinder::getPath(v3s16 source,
 	m_max_index_y = diff.Y;
 	m_max_index_z = diff.Z;
 
-	delete m_nodes_container;
-	if (diff.getLength() > 5) {
-		m_nodes_container = new MapGridNodeContainer(this);
-	} else {
-		m_nodes_container = new ArrayGridNodeContainer(this, diff);
+	//reuse a path found before if it passes through source
+	if (m_cache) {
+		retval = m_cache->get(m_map, source, destination, m_limits,
+				max_jump, max_drop, algo);
+		if (!retval.empty()) {
+			DEBUG_OUT("Pathfinder: reusing cached path" << std::endl);
+			return retval;
+		}
 	}
+
+	clearNodes();
 #ifdef PATHFINDER_DEBUG
 	printType();
 	printCost();
@@ -664,14 +951,12 @@ std::vector<v3s16> Pathfinder::getPath(v3s16 source,
 #endif
 
 	//fail if source or destination is walkable
-	MapNode node_at_pos = m_map->getNode(destination);
-	if (m_ndef->get(node_at_pos).walkable) {
+	if (getNodeKind(destination) == PNK_WALKABLE) {
 		VERBOSE_TARGET << "Destination is walkable. " <<
 				"Pos: " << PP(destination) << std::endl;
 		return retval;
 	}
-	node_at_pos = m_map->getNode(source);
-	if (m_ndef->get(node_at_pos).walkable) {
+	if (getNodeKind(source) == PNK_WALKABLE) {
 		VERBOSE_TARGET << "Source is walkable. " <<
 				"Pos: " << PP(source) << std::endl;
 		return retval;
@@ -727,6 +1012,9 @@ std::vector<v3s16> Pathfinder::getPath(v3s16 source,
 		case PA_PLAIN:
 			update_cost_retval = updateCostHeuristic(StartIndex, EndIndex);
 			break;
+		case PA_HIERARCHICAL:
+			update_cost_retval = updateCostHierarchical(StartIndex, EndIndex);
+			break;
 		default:
 			ERROR_TARGET << "Missing PathAlgorithm" << std::endl;
 			break;
@@ -798,6 +1086,8 @@ std::vector<v3s16> Pathfinder::getPath(v3s16 source,
 		std::cout << "Calculating path took: " << (ts2.tv_sec - ts.tv_sec) <<
 				"s " << ms << "ms " << us << "us " << ns << "ns " << std::endl;
 #endif
+		if (m_cache)
+			m_cache->add(m_map, full_path, max_jump, max_drop, algo);
 		return full_path;
 	}
 	else {
@@ -816,6 +1106,43 @@ Pathfinder::~Pathfinder()
 {
 	delete m_nodes_container;
 }
+
+/******************************************************************************/
+void Pathfinder::clearNodes()
+{
+	v3s16 diff = m_limits.MaxEdge - m_limits.MinEdge;
+
+	delete m_nodes_container;
+	if (diff.getLength() > 5) {
+		m_nodes_container = new MapGridNodeContainer(this);
+	} else {
+		m_nodes_container = new ArrayGridNodeContainer(this, diff);
+	}
+}
+
+/******************************************************************************/
+PathNodeKind Pathfinder::getNodeKind(v3s16 pos)
+{
+	v3s16 blockpos = getNodeBlockPos(pos);
+
+	// Consecutive lookups are mostly in the same map block
+	if (!m_walkability_valid || blockpos != m_walkability_pos) {
+		MapBlock *block = m_map->getBlockNoCreateNoEx(blockpos);
+		m_walkability = block ? &block->getWalkability(m_ndef) : nullptr;
+		m_walkability_pos = blockpos;
+		m_walkability_valid = true;
+	}
+
+	if (!m_walkability)
+		return PNK_IGNORE;
+
+	v3s16 relpos = pos - blockpos * MAP_BLOCKSIZE;
+	u32 i = relpos.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE +
+			relpos.Y * MAP_BLOCKSIZE + relpos.X;
+	if (m_walkability->ignore[i])
+		return PNK_IGNORE;
+	return m_walkability->walkable[i] ? PNK_WALKABLE : PNK_FREE;
+}
 /******************************************************************************/
 v3s16 Pathfinder::getRealPos(v3s16 ipos)
 {
@@ -838,28 +1165,28 @@ PathCost Pathfinder::calcCost(v3s16 pos, v3s16 dir)
 		return retval;
 	}
 
-	MapNode node_at_pos2 = m_map->getNode(pos2);
+	PathNodeKind node_at_pos2 = getNodeKind(pos2);
 
 	//did we get information about node?
-	if (node_at_pos2.param0 == CONTENT_IGNORE ) {
+	if (node_at_pos2 == PNK_IGNORE ) {
 			VERBOSE_TARGET << "Pathfinder: (1) area at pos: "
 					<< PP(pos2) << " not loaded";
 			return retval;
 	}
 
-	if (!m_ndef->get(node_at_pos2).walkable) {
-		MapNode node_below_pos2 =
-			m_map->getNode(pos2 + v3s16(0, -1, 0));
+	if (node_at_pos2 != PNK_WALKABLE) {
+		PathNodeKind node_below_pos2 =
+			getNodeKind(pos2 + v3s16(0, -1, 0));
 
 		//did we get information about node?
-		if (node_below_pos2.param0 == CONTENT_IGNORE ) {
+		if (node_below_pos2 == PNK_IGNORE ) {
 				VERBOSE_TARGET << "Pathfinder: (2) area at pos: "
 					<< PP((pos2 + v3s16(0, -1, 0))) << " not loaded";
 				return retval;
 		}
 
 		//test if the same-height neighbor is suitable
-		if (m_ndef->get(node_below_pos2).walkable) {
+		if (node_below_pos2 == PNK_WALKABLE) {
 			//SUCCESS!
 			retval.valid = true;
 			retval.value = 1;
@@ -870,19 +1197,17 @@ PathCost Pathfinder::calcCost(v3s16 pos, v3s16 dir)
 		else {
 			//test if we can fall a couple of nodes (m_maxdrop)
 			v3s16 testpos = pos2 + v3s16(0, -1, 0);
-			MapNode node_at_pos = m_map->getNode(testpos);
+			PathNodeKind node_at_pos = getNodeKind(testpos);
 
-			while ((node_at_pos.param0 != CONTENT_IGNORE) &&
-					(!m_ndef->get(node_at_pos).walkable) &&
+			while ((node_at_pos == PNK_FREE) &&
 					(testpos.Y > m_limits.MinEdge.Y)) {
 				testpos += v3s16(0, -1, 0);
-				node_at_pos = m_map->getNode(testpos);
+				node_at_pos = getNodeKind(testpos);
 			}
 
 			//did we find surface?
 			if ((testpos.Y >= m_limits.MinEdge.Y) &&
-					(node_at_pos.param0 != CONTENT_IGNORE) &&
-					(m_ndef->get(node_at_pos).walkable)) {
+					(node_at_pos == PNK_WALKABLE)) {
 				if ((pos2.Y - testpos.Y - 1) <= m_maxdrop) {
 					//SUCCESS!
 					retval.valid = true;
@@ -908,34 +1233,31 @@ PathCost Pathfinder::calcCost(v3s16 pos, v3s16 dir)
 
 		v3s16 targetpos = pos2; // position for jump target
 		v3s16 jumppos = pos; // position for checking if jumping space is free
-		MapNode node_target = m_map->getNode(targetpos);
-		MapNode node_jump = m_map->getNode(jumppos);
+		PathNodeKind node_target = getNodeKind(targetpos);
+		PathNodeKind node_jump = getNodeKind(jumppos);
 		bool headbanger = false; // true if anything blocks jumppath
 
-		while ((node_target.param0 != CONTENT_IGNORE) &&
-				(m_ndef->get(node_target).walkable) &&
+		while ((node_target == PNK_WALKABLE) &&
 				(targetpos.Y < m_limits.MaxEdge.Y)) {
 			//if the jump would hit any solid node, discard
-			if ((node_jump.param0 == CONTENT_IGNORE) ||
-					(m_ndef->get(node_jump).walkable)) {
+			if (node_jump != PNK_FREE) {
 					headbanger = true;
 				break;
 			}
 			targetpos += v3s16(0, 1, 0);
 			jumppos   += v3s16(0, 1, 0);
-			node_target = m_map->getNode(targetpos);
-			node_jump   = m_map->getNode(jumppos);
+			node_target = getNodeKind(targetpos);
+			node_jump   = getNodeKind(jumppos);
 
 		}
 		//check headbanger one last time
-		if ((node_jump.param0 == CONTENT_IGNORE) ||
-			(m_ndef->get(node_jump).walkable)) {
+		if (node_jump != PNK_FREE) {
 			headbanger = true;
 		}
 
 		//did we find surface without banging our head?
 		if ((!headbanger) && (targetpos.Y <= m_limits.MaxEdge.Y) &&
-				(!m_ndef->get(node_target).walkable)) {
+				(node_target != PNK_WALKABLE)) {
 
 			if (targetpos.Y - pos2.Y <= m_maxjump) {
 				//SUCCESS!
@@ -1110,15 +1432,12 @@ bool Pathfinder::updateCostHeuristic(v3s16 isource, v3s16 idestination)
 	// The open list contains the pathfinder nodes that still need to be
 	// checked. The priority queue sorts the pathfinder nodes by
 	// estimated cost, with lowest cost on the top.
-	std::priority_queue<v3s16, std::vector<v3s16>, PathfinderCompareHeuristic>
-			openList(PathfinderCompareHeuristic(this));
+	std::priority_queue<PathOpenNode, std::vector<PathOpenNode>,
+			PathfinderCompareHeuristic> openList;
 
 	v3s16 source = getRealPos(isource);
 	v3s16 destination = getRealPos(idestination);
 
-	// initial position
-	openList.push(source);
-
 	// the 4 cardinal directions
 	const static v3s16 directions[4] = {
 		v3s16(1,0, 0),
@@ -1136,10 +1455,13 @@ bool Pathfinder::updateCostHeuristic(v3s16 isource, v3s16 idestination)
 	int cur_manhattan = getXZManhattanDist(destination);
 	s_pos.estimated_cost = cur_manhattan;
 
+	// initial position
+	openList.push({s_pos.estimated_cost, source, s_pos.valid});
+
 	while (!openList.empty()) {
 		// Pick node with lowest total cost estimate.
 		// The "cheapest" node is always on top.
-		current_pos = openList.top();
+		current_pos = openList.top().pos;
 		openList.pop();
 		v3s16 ipos = getIndexPos(current_pos);
 
@@ -1182,7 +1504,8 @@ bool Pathfinder::updateCostHeuristic(v3s16 isource, v3s16 idestination)
 			v3s16 ineighbor = getIndexPos(neighbor);
 			PathGridnode &n_pos = getIndexElement(ineighbor);
 
-			if (cost.valid && !n_pos.is_closed && !n_pos.is_open) {
+			if (cost.valid && !n_pos.is_closed && !n_pos.is_open &&
+					isInCorridor(neighbor)) {
 				// heuristic function; estimate cost from neighbor to destination
 				cur_manhattan = getXZManhattanDist(neighbor);
 
@@ -1191,7 +1514,7 @@ bool Pathfinder::updateCostHeuristic(v3s16 isource, v3s16 idestination)
 				n_pos.totalcost = current_totalcost + cost.value;
 				n_pos.estimated_cost = current_totalcost + cost.value + cur_manhattan;
 				n_pos.is_open = true;
-				openList.push(neighbor);
+				openList.push({n_pos.estimated_cost, neighbor, n_pos.valid});
 			}
 		}
 	}
@@ -1199,6 +1522,297 @@ bool Pathfinder::updateCostHeuristic(v3s16 isource, v3s16 idestination)
 	return false;
 }
 
+/******************************************************************************/
+bool Pathfinder::updateCostHierarchical(v3s16 isource, v3s16 idestination)
+{
+	v3s16 source = getRealPos(isource);
+	v3s16 destination = getRealPos(idestination);
+
+	// Regions only connect map blocks next to each other
+	if (std::max(m_maxjump, m_maxdrop) < MAP_BLOCKSIZE &&
+			getRegion(source) != 0 && getRegion(destination) != 0) {
+		// Every step of a path of nodes is also one between regions,
+		// so without a path of regions there is no path at all
+		if (!buildCorridor(source, destination))
+			return false;
+
+		m_use_corridor = true;
+		bool found = updateCostHeuristic(isource, idestination);
+		m_use_corridor = false;
+		if (found)
+			return true;
+
+		// The regions may connect nodes the steps between them
+		// can't, so search the whole area before giving up
+		VERBOSE_TARGET << "No path found in corridor, searching whole area"
+				<< std::endl;
+		clearNodes();
+	}
+	return updateCostHeuristic(isource, idestination);
+}
+
+/******************************************************************************/
+static inline u64 regionKey(v3s16 blockpos, u16 region)
+{
+	return ((u64)(u16)blockpos.X << 48) | ((u64)(u16)blockpos.Y << 32) |
+			((u64)(u16)blockpos.Z << 16) | region;
+}
+
+static inline v3s16 regionBlockPos(u64 key)
+{
+	return v3s16((s16)(key >> 48), (s16)(key >> 32), (s16)(key >> 16));
+}
+
+/******************************************************************************/
+bool Pathfinder::buildCorridor(v3s16 source, v3s16 destination)
+{
+	u16 rsource = getRegion(source);
+	u16 rdestination = getRegion(destination);
+
+	v3s16 bdestination = getNodeBlockPos(destination);
+	u64 ksource = regionKey(getNodeBlockPos(source), rsource);
+	u64 kdestination = regionKey(bdestination, rdestination);
+	core::aabbox3d<s16> blimits(getNodeBlockPos(m_limits.MinEdge),
+			getNodeBlockPos(m_limits.MaxEdge));
+
+	auto blockDistance = [&bdestination] (v3s16 pos) {
+		return std::abs(pos.X - bdestination.X) +
+				std::abs(pos.Y - bdestination.Y) +
+				std::abs(pos.Z - bdestination.Z);
+	};
+
+	// A* search on the surface regions of the map blocks; all steps
+	// between regions cost the same, so of the regions with the same
+	// estimated cost the ones closer to the destination go first
+	typedef std::tuple<int, int, u64> RegionOpenNode;
+	std::unordered_map<u64, u64> came_from;
+	std::unordered_map<u64, int> region_cost;
+	std::priority_queue<RegionOpenNode, std::vector<RegionOpenNode>,
+			std::greater<RegionOpenNode> > openList;
+
+	region_cost[ksource] = 0;
+	int distance = blockDistance(getNodeBlockPos(source));
+	openList.push(RegionOpenNode(distance, distance, ksource));
+
+	bool found = false;
+	std::unordered_set<u64> closed;
+	while (!openList.empty()) {
+		u64 key = std::get<2>(openList.top());
+		openList.pop();
+		if (key == kdestination) {
+			found = true;
+			break;
+		}
+		if (!closed.insert(key).second)
+			continue;
+		int cost = region_cost[key];
+
+		const std::vector<u64> &neighbors =
+				getRegionLinks(regionBlockPos(key), blimits)[(key & 0xffff) - 1];
+		for (u64 nkey : neighbors) {
+			auto it = region_cost.find(nkey);
+			if (it != region_cost.end() && it->second <= cost + 1)
+				continue;
+			region_cost[nkey] = cost + 1;
+			came_from[nkey] = key;
+			distance = blockDistance(regionBlockPos(nkey));
+			openList.push(RegionOpenNode(cost + 1 + distance, distance, nkey));
+		}
+	}
+
+	if (!found)
+		return false;
+
+	// The path of nodes may cut corners of the path of regions
+	m_corridor.clear();
+	for (u64 key = kdestination; ; key = came_from[key]) {
+		v3s16 bpos = regionBlockPos(key);
+		for (s16 x = -1; x <= 1; x++)
+		for (s16 y = -1; y <= 1; y++)
+		for (s16 z = -1; z <= 1; z++)
+			m_corridor.insert(bpos + v3s16(x, y, z));
+		if (key == ksource)
+			break;
+	}
+	return true;
+}
+
+/******************************************************************************/
+const PathBlockRegions &Pathfinder::getBlockRegions(v3s16 blockpos)
+{
+	auto it = m_block_regions.find(blockpos);
+	if (it != m_block_regions.end())
+		return *it->second;
+
+	const s16 reach = std::max(m_maxjump, m_maxdrop);
+	std::shared_ptr<const PathBlockRegions> regions;
+	if (m_cache)
+		regions = m_cache->getRegions(m_map, blockpos, reach);
+	if (!regions) {
+		regions = findBlockRegions(blockpos);
+		if (m_cache)
+			m_cache->addRegions(m_map, blockpos, reach, regions);
+	}
+	m_block_regions[blockpos] = regions;
+	return *regions;
+}
+
+/******************************************************************************/
+std::shared_ptr<PathBlockRegions> Pathfinder::findBlockRegions(v3s16 blockpos)
+{
+	std::shared_ptr<PathBlockRegions> regions_ptr =
+			std::make_shared<PathBlockRegions>();
+	PathBlockRegions &regions = *regions_ptr;
+	MapBlock *block = m_map->getBlockNoCreateNoEx(blockpos);
+	if (!block)
+		return regions_ptr;
+
+	const MapBlock::Walkability &w = block->getWalkability(m_ndef);
+	const u32 ystride = MAP_BLOCKSIZE;
+	const u32 zstride = MAP_BLOCKSIZE * MAP_BLOCKSIZE;
+
+	// Free nodes with a walkable node below them; the bottom layer
+	// stands on the block below
+	BlockNodeBits standable = ~(w.walkable | w.ignore) & (w.walkable << ystride);
+	for (u32 i = 0; i < zstride * MAP_BLOCKSIZE; i += zstride)
+		for (u32 x = 0; x < MAP_BLOCKSIZE; x++)
+			standable[i + x] = false;
+	MapBlock *below = m_map->getBlockNoCreateNoEx(blockpos - v3s16(0, 1, 0));
+	if (below) {
+		const MapBlock::Walkability &w_below = below->getWalkability(m_ndef);
+		for (u32 i = 0; i < zstride * MAP_BLOCKSIZE; i += zstride)
+		for (u32 x = 0; x < MAP_BLOCKSIZE; x++) {
+			if (!w.walkable[i + x] && !w.ignore[i + x] &&
+					w_below.walkable[i + x + (MAP_BLOCKSIZE - 1) * ystride])
+				standable[i + x] = true;
+		}
+	}
+	if (standable.none())
+		return regions_ptr;
+
+	// Flood fill the surface nodes, stepping like calcCost does but
+	// without checking the nodes in between
+	const s16 reach = std::max(m_maxjump, m_maxdrop);
+	regions.region.assign(MapBlock::nodecount, 0);
+	std::vector<u32> stack;
+	for (u32 i = 0; i < MapBlock::nodecount; i++) {
+		if (!standable[i] || regions.region[i] != 0)
+			continue;
+		u16 region = ++regions.count;
+		regions.region[i] = region;
+		stack.push_back(i);
+		while (!stack.empty()) {
+			u32 j = stack.back();
+			stack.pop_back();
+			s16 x = j % MAP_BLOCKSIZE;
+			s16 y = (j / ystride) % MAP_BLOCKSIZE;
+			s16 z = j / zstride;
+			const s16 neighbors[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+			for (const auto &n : neighbors) {
+				s16 nx = x + n[0];
+				s16 nz = z + n[1];
+				if (nx < 0 || nx >= MAP_BLOCKSIZE || nz < 0 || nz >= MAP_BLOCKSIZE)
+					continue;
+				s16 ymin = std::max(y - reach, 0);
+				s16 ymax = std::min(y + reach, MAP_BLOCKSIZE - 1);
+				for (s16 ny = ymin; ny <= ymax; ny++) {
+					u32 k = nz * zstride + ny * ystride + nx;
+					if (standable[k] && regions.region[k] == 0) {
+						regions.region[k] = region;
+						stack.push_back(k);
+					}
+				}
+			}
+		}
+	}
+	return regions_ptr;
+}
+
+/******************************************************************************/
+const std::vector<std::vector<u64> > &Pathfinder::getRegionLinks(
+		v3s16 blockpos, const core::aabbox3d<s16> &blimits)
+{
+	// the 4 cardinal directions
+	const static v3s16 directions[4] = {
+		v3s16(1,0, 0),
+		v3s16(-1,0, 0),
+		v3s16(0,0, 1),
+		v3s16(0,0,-1)
+	};
+
+	auto it = m_region_links.find(blockpos);
+	if (it != m_region_links.end())
+		return it->second;
+
+	const PathBlockRegions &regions = getBlockRegions(blockpos);
+	std::vector<std::vector<u64> > &block_links = m_region_links[blockpos];
+	block_links.resize(regions.count);
+
+	// Look for steps leaving the block from the nodes near its border
+	const s16 reach = std::max(m_maxjump, m_maxdrop);
+	for (u32 i = 0; i < regions.region.size(); i++) {
+		u16 region = regions.region[i];
+		if (region == 0)
+			continue;
+		v3s16 relpos(i % MAP_BLOCKSIZE, (i / MAP_BLOCKSIZE) % MAP_BLOCKSIZE,
+				i / (MAP_BLOCKSIZE * MAP_BLOCKSIZE));
+		bool inside_y = relpos.Y >= reach && relpos.Y < MAP_BLOCKSIZE - reach;
+
+		std::vector<u64> &links = block_links[region - 1];
+		for (const v3s16 &dir : directions) {
+			v3s16 npos = relpos + dir;
+			bool inside_xz = npos.X >= 0 && npos.X < MAP_BLOCKSIZE &&
+					npos.Z >= 0 && npos.Z < MAP_BLOCKSIZE;
+			if (inside_xz && inside_y)
+				continue;
+
+			npos += blockpos * MAP_BLOCKSIZE;
+			for (s16 y = -reach; y <= reach; y++) {
+				if (inside_xz && relpos.Y + y >= 0 && relpos.Y + y < MAP_BLOCKSIZE)
+					continue;
+				v3s16 pos = npos + v3s16(0, y, 0);
+				v3s16 nblockpos = getNodeBlockPos(pos);
+				if (!blimits.isPointInside(nblockpos))
+					continue;
+				u16 nregion = getRegion(pos);
+				if (nregion == 0)
+					continue;
+				u64 key = regionKey(nblockpos, nregion);
+				if (std::find(links.begin(), links.end(), key) == links.end())
+					links.push_back(key);
+			}
+		}
+	}
+	return block_links;
+}
+
+/******************************************************************************/
+u16 Pathfinder::getRegion(v3s16 pos)
+{
+	v3s16 blockpos = getNodeBlockPos(pos);
+
+	// Consecutive lookups are mostly in the same map block
+	if (!m_regions || blockpos != m_regions_pos) {
+		m_regions = &getBlockRegions(blockpos);
+		m_regions_pos = blockpos;
+	}
+
+	const std::vector<u16> &regions = m_regions->region;
+	if (regions.empty())
+		return 0;
+	v3s16 relpos = pos - blockpos * MAP_BLOCKSIZE;
+	return regions[relpos.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE +
+			relpos.Y * MAP_BLOCKSIZE + relpos.X];
+}
+
+/******************************************************************************/
+bool Pathfinder::isInCorridor(v3s16 pos)
+{
+	if (!m_use_corridor)
+		return true;
+	return m_corridor.find(getNodeBlockPos(pos)) != m_corridor.end();
+}
+
 /******************************************************************************/
 bool Pathfinder::buildPath(std::vector<v3s16> &path, v3s16 ipos)
 {
@@ -1235,20 +1849,18 @@ v3s16 Pathfinder::walkDownwards(v3s16 pos, unsigned int max_down) {
 	if (max_down == 0)
 		return pos;
 	v3s16 testpos = v3s16(pos);
-	MapNode node_at_pos = m_map->getNode(testpos);
+	PathNodeKind node_at_pos = getNodeKind(testpos);
 	unsigned int down = 0;
-	while ((node_at_pos.param0 != CONTENT_IGNORE) &&
-			(!m_ndef->get(node_at_pos).walkable) &&
+	while ((node_at_pos == PNK_FREE) &&
 			(testpos.Y > m_limits.MinEdge.Y) &&
 			(down <= max_down)) {
 		testpos += v3s16(0, -1, 0);
 		down++;
-		node_at_pos = m_map->getNode(testpos);
+		node_at_pos = getNodeKind(testpos);
 	}
 	//did we find surface?
 	if ((testpos.Y >= m_limits.MinEdge.Y) &&
-			(node_at_pos.param0 != CONTENT_IGNORE) &&
-			(m_ndef->get(node_at_pos).walkable)) {
+			(node_at_pos == PNK_WALKABLE)) {
 		if (down == 0) {
 			pos = testpos;
 		} else if ((down - 1) <= max_down) {
@@ -22,8 +22,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 /******************************************************************************/
 /* Includes                                                                   */
 /******************************************************************************/
+#include <deque>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 #include "irr_v3d.h"
+#include "irr_aabb3d.h"
 
 /******************************************************************************/
 /* Forward declarations                                                       */
@@ -31,6 +35,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 class NodeDefManager;
 class Map;
+class MapBlock;
+struct PathBlockRegions;
 
 /******************************************************************************/
 /* Typedefs and macros                                                        */
@@ -47,9 +53,120 @@ typedef enum {
 typedef enum {
 	PA_DIJKSTRA,           /**< Dijkstra shortest path algorithm             */
 	PA_PLAIN,            /**< A* algorithm using heuristics to find a path */
-	PA_PLAIN_NP          /**< A* algorithm without prefetching of map data */
+	PA_PLAIN_NP,         /**< A* algorithm without prefetching of map data */
+	PA_HIERARCHICAL      /**< A* algorithm limited to the map blocks found
+	                      *   by a search on their surface regions       */
 } PathAlgorithm;
 
+/******************************************************************************/
+/* Class definitions                                                          */
+/******************************************************************************/
+
+/** Paths found before, reused by later searches towards the same destination
+ *  that start on them, as long as the map blocks along them are unchanged.
+ *  Also keeps the surface regions of map blocks for hierarchical searches. */
+class PathCache {
+public:
+	/**
+	 * @param max_age time in seconds a path is kept
+	 * @param max_paths maximum number of paths kept
+	 * @param max_regions maximum number of map blocks to keep regions of
+	 */
+	PathCache(float max_age, u32 max_paths = 256, u32 max_regions = 1024);
+
+	/**
+	 * look for a path found before that passes through source
+	 * @param map map the path was found on
+	 * @param source start position
+	 * @param destination end position
+	 * @param limits cuboid the path has to stay in
+	 * @param max_jump maximum number of blocks a path may jump up
+	 * @param max_drop maximum number of blocks a path may drop
+	 * @param algo Algorithm used for finding a path
+	 * @return part of the path from source on, empty if none is known
+	 */
+	std::vector<v3s16> get(Map *map, v3s16 source, v3s16 destination,
+			const core::aabbox3d<s16> &limits,
+			unsigned int max_jump, unsigned int max_drop, PathAlgorithm algo);
+
+	/**
+	 * remember a path that was found
+	 * @param map map the path was found on
+	 * @param path path from start to destination
+	 * @param max_jump maximum number of blocks the path may jump up
+	 * @param max_drop maximum number of blocks the path may drop
+	 * @param algo Algorithm used for finding the path
+	 */
+	void add(Map *map, const std::vector<v3s16> &path,
+			unsigned int max_jump, unsigned int max_drop, PathAlgorithm algo);
+
+	/**
+	 * look for the surface regions of a map block found before
+	 * @param map map the regions were found on
+	 * @param blockpos position of map block
+	 * @param reach greater one of jump and drop height they were found for
+	 * @return regions, null if none are known or the block or the one
+	 *         below it has changed since
+	 */
+	std::shared_ptr<const PathBlockRegions> getRegions(Map *map,
+			v3s16 blockpos, s16 reach);
+
+	/**
+	 * remember the surface regions of a map block
+	 * @param map map the regions were found on
+	 * @param blockpos position of map block
+	 * @param reach greater one of jump and drop height they were found for
+	 * @param regions regions of the block
+	 */
+	void addRegions(Map *map, v3s16 blockpos, s16 reach,
+			std::shared_ptr<const PathBlockRegions> regions);
+
+	/** forget all paths and regions */
+	void clear() { m_paths.clear(); m_regions.clear(); }
+
+private:
+	/** map block a path depends on, and its state when the path was found */
+	struct BlockState {
+		v3s16 pos;
+		u64 instance_id;                 /**< 0 if it was not loaded     */
+		u32 modification_count;
+	};
+
+	struct CachedRegions {
+		std::shared_ptr<const PathBlockRegions> regions;
+		s16 reach;
+		BlockState block;
+		BlockState below;                /**< nodes of the bottom layer
+		                                  *   stand on this block        */
+		u64 time;                        /**< when last used             */
+	};
+
+	struct CachedPath {
+		std::vector<v3s16> path;
+		std::vector<BlockState> blocks;
+		unsigned int max_jump;
+		unsigned int max_drop;
+		PathAlgorithm algo;
+		u64 time;
+	};
+
+	/** check if the map blocks a path depends on are unchanged */
+	bool isValid(Map *map, const CachedPath &cached);
+
+	/** check if a map block is unchanged */
+	static bool isValid(Map *map, const BlockState &state);
+
+	/** get the current state of a map block */
+	static BlockState getState(Map *map, v3s16 blockpos);
+
+	std::deque<CachedPath> m_paths;   /**< paths, oldest first */
+	u64 m_max_age;                    /**< in milliseconds     */
+	u32 m_max_paths;
+
+	std::unordered_map<v3s16, CachedRegions> m_regions;
+	u32 m_max_regions;
+};
+
 /******************************************************************************/
 /* declarations                                                               */
 /******************************************************************************/
@@ -61,4 +178,5 @@ std::vector<v3s16> get_path(Map *map, const NodeDefManager *ndef,
 		unsigned int searchdistance,
 		unsigned int max_jump,
 		unsigned int max_drop,
-		PathAlgorithm algo);
+		PathAlgorithm algo,
+		PathCache *cache = nullptr);
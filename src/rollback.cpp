@@ -18,9 +18,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "rollback.h"
+#include <algorithm>
 #include <fstream>
 #include <list>
 #include <sstream>
+#include "debug.h"
 #include "log.h"
 #include "mapnode.h"
 #include "gamedef.h"
@@ -31,9 +33,21 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "inventorymanager.h" // deserializing InventoryLocations
 #include "sqlite3.h"
 #include "filesys.h"
+#include "threading/mutex_auto_lock.h"
+#include "util/thread.h"
 
 #define POINTS_PER_NODE (16.0)
 
+// Journal size after which the writer is woken without waiting
+#define JOURNAL_WAKEUP_SIZE 500
+
+// Actions older than this can not make anyone a suspect, see getSuspect()
+#define SUSPECT_MAX_AGE 100
+
+// Position queries covering at most this many X-Y columns look up every
+// column through the position index instead of scanning along X
+#define MAX_COLUMN_QUERIES 256
+
 #define SQLRES(f, good) \
 	if ((f) != (good)) {\
 		throw FileNotGoodException(std::string("RollbackManager: " \
@@ -82,11 +96,33 @@ struct ActionRow {
 };
 
 
-struct Entity {
-	int         id;
-	std::string name;
-};
+class RollbackManager::WriterThread : public Thread
+{
+public:
+	WriterThread(RollbackManager *rollback) :
+		Thread("RollbackWriter"), m_rollback(rollback)
+	{}
+
+	void *run()
+	{
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		while (!stopRequested()) {
+			m_rollback->writer_wakeup.wait(1000);
+			try {
+				m_rollback->writeJournal();
+			} catch (FileNotGoodException &e) {
+				errorstream << e.what() << std::endl;
+			}
+		}
 
+		END_DEBUG_EXCEPTION_HANDLER
+		return nullptr;
+	}
+
+private:
+	RollbackManager *m_rollback;
+};
 
 
 RollbackManager::RollbackManager(const std::string & world_path,
@@ -109,17 +145,26 @@ RollbackManager::RollbackManager(const std::string & world_path,
 		migrate(txt_filename);
 		fs::DeleteSingleFileOrEmptyDirectory(migrating_flag);
 	}
+
+	writer_thread = new WriterThread(this);
+	writer_thread->start();
 }
 
 
 RollbackManager::~RollbackManager()
 {
+	writer_thread->stop();
+	writer_wakeup.post();
+	writer_thread->wait();
+	delete writer_thread;
+
 	flush();
 
 	FINALIZE_STATEMENT(stmt_insert);
 	FINALIZE_STATEMENT(stmt_replace);
 	FINALIZE_STATEMENT(stmt_select);
 	FINALIZE_STATEMENT(stmt_select_range);
+	FINALIZE_STATEMENT(stmt_select_column);
 	FINALIZE_STATEMENT(stmt_select_withActor);
 	FINALIZE_STATEMENT(stmt_knownActor_select);
 	FINALIZE_STATEMENT(stmt_knownActor_insert);
@@ -132,26 +177,23 @@ RollbackManager::~RollbackManager()
 
 void RollbackManager::registerNewActor(const int id, const std::string &name)
 {
-	Entity actor = {id, name};
-	knownActors.push_back(actor);
+	knownActorIds[name] = id;
+	knownActorNames[id] = name;
 }
 
 
 void RollbackManager::registerNewNode(const int id, const std::string &name)
 {
-	Entity node = {id, name};
-	knownNodes.push_back(node);
+	knownNodeIds[name] = id;
+	knownNodeNames[id] = name;
 }
 
 
 int RollbackManager::getActorId(const std::string &name)
 {
-	for (std::vector<Entity>::const_iterator iter = knownActors.begin();
-			iter != knownActors.end(); ++iter) {
-		if (iter->name == name) {
-			return iter->id;
-		}
-	}
+	auto it = knownActorIds.find(name);
+	if (it != knownActorIds.end())
+		return it->second;
 
 	SQLOK(sqlite3_bind_text(stmt_knownActor_insert, 1, name.c_str(), name.size(), NULL));
 	SQLRES(sqlite3_step(stmt_knownActor_insert), SQLITE_DONE);
@@ -166,12 +208,9 @@ int RollbackManager::getActorId(const std::string &name)
 
 int RollbackManager::getNodeId(const std::string &name)
 {
-	for (std::vector<Entity>::const_iterator iter = knownNodes.begin();
-			iter != knownNodes.end(); ++iter) {
-		if (iter->name == name) {
-			return iter->id;
-		}
-	}
+	auto it = knownNodeIds.find(name);
+	if (it != knownNodeIds.end())
+		return it->second;
 
 	SQLOK(sqlite3_bind_text(stmt_knownNode_insert, 1, name.c_str(), name.size(), NULL));
 	SQLRES(sqlite3_step(stmt_knownNode_insert), SQLITE_DONE);
@@ -186,12 +225,9 @@ int RollbackManager::getNodeId(const std::string &name)
 
 const char * RollbackManager::getActorName(const int id)
 {
-	for (std::vector<Entity>::const_iterator iter = knownActors.begin();
-			iter != knownActors.end(); ++iter) {
-		if (iter->id == id) {
-			return iter->name.c_str();
-		}
-	}
+	auto it = knownActorNames.find(id);
+	if (it != knownActorNames.end())
+		return it->second.c_str();
 
 	return "";
 }
@@ -199,12 +235,9 @@ const char * RollbackManager::getActorName(const int id)
 
 const char * RollbackManager::getNodeName(const int id)
 {
-	for (std::vector<Entity>::const_iterator iter = knownNodes.begin();
-			iter != knownNodes.end(); ++iter) {
-		if (iter->id == id) {
-			return iter->name.c_str();
-		}
-	}
+	auto it = knownNodeNames.find(id);
+	if (it != knownNodeNames.end())
+		return it->second.c_str();
 
 	return "";
 }
@@ -257,6 +290,17 @@ bool RollbackManager::createTables()
 }
 
 
+void RollbackManager::createIndexes()
+{
+	// Building these for an existing large database takes a while, once
+	infostream << "RollbackManager: Creating indexes" << std::endl;
+	SQLOK(sqlite3_exec(db,
+		"CREATE INDEX IF NOT EXISTS `actionTimestampIndex` ON `action`(`timestamp`);\n"
+		"CREATE INDEX IF NOT EXISTS `actionActorIndex` ON `action`(`actor`,`timestamp`);\n",
+		NULL, NULL, NULL));
+}
+
+
 bool RollbackManager::initDatabase()
 {
 	verbosestream << "RollbackManager: Database connection setup" << std::endl;
@@ -268,6 +312,7 @@ bool RollbackManager::initDatabase()
 	if (needs_create) {
 		createTables();
 	}
+	createIndexes();
 
 	SQLOK(sqlite3_prepare_v2(db,
 		"INSERT INTO `action` (\n"
@@ -312,7 +357,7 @@ bool RollbackManager::initDatabase()
 		"	`x`, `y`, `z`,\n"
 		"	`oldNode`, `oldParam1`, `oldParam2`, `oldMeta`,\n"
 		"	`newNode`, `newParam1`, `newParam2`, `newMeta`,\n"
-		"	`guessedActor`\n"
+		"	`guessedActor`, `id`\n"
 		" FROM `action`\n"
 		" WHERE `timestamp` >= ?\n"
 		" ORDER BY `timestamp` DESC, `id` DESC",
@@ -325,7 +370,7 @@ bool RollbackManager::initDatabase()
 		"	`x`, `y`, `z`,\n"
 		"	`oldNode`, `oldParam1`, `oldParam2`, `oldMeta`,\n"
 		"	`newNode`, `newParam1`, `newParam2`, `newMeta`,\n"
-		"	`guessedActor`\n"
+		"	`guessedActor`, `id`\n"
 		"FROM `action`\n"
 		"WHERE `timestamp` >= ?\n"
 		"	AND `x` IS NOT NULL\n"
@@ -345,7 +390,24 @@ bool RollbackManager::initDatabase()
 		"	`x`, `y`, `z`,\n"
 		"	`oldNode`, `oldParam1`, `oldParam2`, `oldMeta`,\n"
 		"	`newNode`, `newParam1`, `newParam2`, `newMeta`,\n"
-		"	`guessedActor`\n"
+		"	`guessedActor`, `id`\n"
+		"FROM `action`\n"
+		"WHERE `x` = ?\n"
+		"	AND `y` = ?\n"
+		"	AND `z` BETWEEN ? AND ?\n"
+		"	AND `timestamp` >= ?\n"
+		"ORDER BY `timestamp` DESC, `id` DESC\n"
+		"LIMIT 0,?",
+		-1, &stmt_select_column, NULL));
+
+	SQLOK(sqlite3_prepare_v2(db,
+		"SELECT\n"
+		"	`actor`, `timestamp`, `type`,\n"
+		"	`list`, `index`, `add`, `stackNode`, `stackQuantity`, `nodemeta`,\n"
+		"	`x`, `y`, `z`,\n"
+		"	`oldNode`, `oldParam1`, `oldParam2`, `oldMeta`,\n"
+		"	`newNode`, `newParam1`, `newParam2`, `newMeta`,\n"
+		"	`guessedActor`, `id`\n"
 		"FROM `action`\n"
 		"WHERE `timestamp` >= ?\n"
 		"	AND `actor` = ?\n"
@@ -483,6 +545,7 @@ const std::list<ActionRow> RollbackManager::actionRowsFromSelect(sqlite3_stmt* s
 		row.actor     = sqlite3_column_int  (stmt, 0);
 		row.timestamp = sqlite3_column_int64(stmt, 1);
 		row.type      = sqlite3_column_int  (stmt, 2);
+		row.id        = sqlite3_column_int  (stmt, 21);
 
 		if (row.type == RollbackAction::TYPE_MODIFY_INVENTORY_STACK) {
 			text = sqlite3_column_text (stmt, 3);
@@ -638,6 +701,33 @@ const std::list<ActionRow> RollbackManager::getRowsSince(time_t firstTime, const
 const std::list<ActionRow> RollbackManager::getRowsSince_range(
 		time_t start_time, v3s16 p, int range, int limit)
 {
+	// A range on X alone makes SQLite scan every action with X in range,
+	// whereas fixing X and Y lets it seek straight to the matching rows
+	if (range >= 0 && (2 * range + 1) * (2 * range + 1) <= MAX_COLUMN_QUERIES) {
+		std::vector<ActionRow> rows;
+		for (int x = p.X - range; x <= p.X + range; x++)
+		for (int y = p.Y - range; y <= p.Y + range; y++) {
+			sqlite3_bind_int  (stmt_select_column, 1, x);
+			sqlite3_bind_int  (stmt_select_column, 2, y);
+			sqlite3_bind_int  (stmt_select_column, 3, static_cast<int>(p.Z - range));
+			sqlite3_bind_int  (stmt_select_column, 4, static_cast<int>(p.Z + range));
+			sqlite3_bind_int64(stmt_select_column, 5, start_time);
+			sqlite3_bind_int  (stmt_select_column, 6, limit);
+
+			const std::list<ActionRow> &column = actionRowsFromSelect(stmt_select_column);
+			rows.insert(rows.end(), column.begin(), column.end());
+		}
+
+		// Same order as the single query
+		std::sort(rows.begin(), rows.end(),
+			[] (const ActionRow &a, const ActionRow &b) {
+				return a.timestamp != b.timestamp ?
+					a.timestamp > b.timestamp : a.id > b.id;
+			});
+		if (limit >= 0 && rows.size() > (size_t)limit)
+			rows.resize(limit);
+		return std::list<ActionRow>(rows.begin(), rows.end());
+	}
 
 	sqlite3_bind_int64(stmt_select_range, 1, start_time);
 	sqlite3_bind_int  (stmt_select_range, 2, static_cast<int>(p.X - range));
@@ -876,7 +966,7 @@ std::string RollbackManager::getSuspect(v3s16 p, float nearness_shortcut,
 	time_t first_time = cur_time - (100 - min_nearness);
 	RollbackAction likely_suspect;
 	float likely_suspect_nearness = 0;
-	for (std::list<RollbackAction>::const_reverse_iterator
+	for (std::deque<RollbackAction>::const_reverse_iterator
 	     i = action_latest_buffer.rbegin();
 	     i != action_latest_buffer.rend(); ++i) {
 		if (i->unix_time < first_time) {
@@ -909,41 +999,61 @@ std::string RollbackManager::getSuspect(v3s16 p, float nearness_shortcut,
 }
 
 
-void RollbackManager::flush()
+void RollbackManager::writeJournal()
 {
-	sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+	MutexAutoLock db_lock(db_mutex);
 
-	std::list<RollbackAction>::const_iterator iter;
+	std::vector<RollbackAction> actions;
+	{
+		MutexAutoLock lock(journal_mutex);
+		actions.swap(journal);
+	}
+	if (actions.empty())
+		return;
 
-	for (iter  = action_todisk_buffer.begin();
-			iter != action_todisk_buffer.end();
-			++iter) {
-		if (iter->actor.empty()) {
+	sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+
+	for (const RollbackAction &action : actions) {
+		if (action.actor.empty()) {
 			continue;
 		}
 
-		registerRow(actionRowFromRollbackAction(*iter));
+		registerRow(actionRowFromRollbackAction(action));
 	}
 
 	sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
-	action_todisk_buffer.clear();
 }
 
 
-void RollbackManager::addAction(const RollbackAction & action)
+void RollbackManager::flush()
 {
-	action_todisk_buffer.push_back(action);
-	action_latest_buffer.push_back(action);
+	writeJournal();
+}
 
-	// Flush to disk sometimes
-	if (action_todisk_buffer.size() >= 500) {
-		flush();
+
+void RollbackManager::addAction(const RollbackAction & action)
+{
+	size_t journal_size;
+	{
+		MutexAutoLock lock(journal_mutex);
+		journal.push_back(action);
+		journal_size = journal.size();
 	}
+
+	if (journal_size == JOURNAL_WAKEUP_SIZE)
+		writer_wakeup.post();
+
+	action_latest_buffer.push_back(action);
+	time_t first_time = action.unix_time - SUSPECT_MAX_AGE;
+	while (action_latest_buffer.front().unix_time < first_time)
+		action_latest_buffer.pop_front();
 }
 
 std::list<RollbackAction> RollbackManager::getEntriesSince(time_t first_time)
 {
 	flush();
+
+	MutexAutoLock db_lock(db_mutex);
 	return getActionsSince(first_time);
 }
 
@@ -954,6 +1064,7 @@ std::list<RollbackAction> RollbackManager::getNodeActors(v3s16 pos, int range,
 	time_t cur_time = time(0);
 	time_t first_time = cur_time - seconds;
 
+	MutexAutoLock db_lock(db_mutex);
 	return getActionsSince_range(first_time, pos, range, limit);
 }
 
@@ -966,6 +1077,7 @@ std::list<RollbackAction> RollbackManager::getRevertActions(
 
 	flush();
 
+	MutexAutoLock db_lock(db_mutex);
 	return getActionsSince(first_time, actor_filter);
 }
 
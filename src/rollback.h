@@ -22,14 +22,22 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <string>
 #include "irr_v3d.h"
 #include "rollback_interface.h"
+#include <deque>
 #include <list>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 #include "sqlite3.h"
+#include "IrrCompileConfig.h"
+#ifdef _IRR_COMPILE_WITH_SDL_DEVICE_
+#include "threading/sdl_semaphore.h"
+#else
+#include "threading/semaphore.h"
+#endif
 
 class IGameDef;
 
 struct ActionRow;
-struct Entity;
 
 class RollbackManager: public IRollbackManager
 {
@@ -43,6 +51,7 @@ class RollbackManager: public IRollbackManager
 	void setActor(const std::string & actor, bool is_guess);
 	std::string getSuspect(v3s16 p, float nearness_shortcut,
 			float min_nearness);
+	// Writes the journal to the database before returning
 	void flush();
 
 	void addAction(const RollbackAction & action);
@@ -53,6 +62,10 @@ class RollbackManager: public IRollbackManager
 			const std::string & actor_filter, time_t seconds);
 
 private:
+	class WriterThread;
+
+	void writeJournal();
+	void createIndexes();
 	void registerNewActor(const int id, const std::string & name);
 	void registerNewNode(const int id, const std::string & name);
 	int getActorId(const std::string & name);
@@ -84,8 +97,21 @@ class RollbackManager: public IRollbackManager
 	std::string current_actor;
 	bool current_actor_is_guess = false;
 
-	std::list<RollbackAction> action_todisk_buffer;
-	std::list<RollbackAction> action_latest_buffer;
+	/*
+		Actions waiting to be written. The writer thread takes the whole
+		journal at once and writes it in one transaction, once 500 actions
+		are waiting or at least every second.
+	*/
+	std::mutex journal_mutex;
+	std::vector<RollbackAction> journal;
+	WriterThread *writer_thread;
+	Semaphore writer_wakeup;
+
+	// Actions of the last 100 seconds, for finding suspects
+	std::deque<RollbackAction> action_latest_buffer;
+
+	// Serializes access to the database and to the known actors and nodes
+	std::mutex db_mutex;
 
 	std::string database_path;
 	sqlite3 * db;
@@ -93,12 +119,15 @@ class RollbackManager: public IRollbackManager
 	sqlite3_stmt * stmt_replace;
 	sqlite3_stmt * stmt_select;
 	sqlite3_stmt * stmt_select_range;
+	sqlite3_stmt * stmt_select_column;
 	sqlite3_stmt * stmt_select_withActor;
 	sqlite3_stmt * stmt_knownActor_select;
 	sqlite3_stmt * stmt_knownActor_insert;
 	sqlite3_stmt * stmt_knownNode_select;
 	sqlite3_stmt * stmt_knownNode_insert;
 
-	std::vector<Entity> knownActors;
-	std::vector<Entity> knownNodes;
+	std::unordered_map<std::string, int> knownActorIds;
+	std::unordered_map<int, std::string> knownActorNames;
+	std::unordered_map<std::string, int> knownNodeIds;
+	std::unordered_map<int, std::string> knownNodeNames;
 };
@@ -0,0 +1,271 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "common/c_packer.h"
+#include <cstring>
+#include <vector>
+#include "common/c_types.h"
+#include "irrlichttypes.h"
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+enum PackedType : u8 {
+	PACKED_NIL,
+	PACKED_FALSE,
+	PACKED_TRUE,
+	PACKED_NUMBER,
+	PACKED_STRING,
+	// Array and hash part counts, then the array values, then key-value pairs
+	PACKED_TABLE,
+	// Count, then the numbers
+	PACKED_NUMBER_ARRAY,
+};
+
+// Deeper nesting is almost certainly a mistake and would exhaust the C stack
+#define PACKED_MAX_DEPTH 128
+
+template <typename T>
+static inline void pack_raw(std::string &dest, const T &v)
+{
+	dest.append((const char *)&v, sizeof(v));
+}
+
+template <typename T>
+static inline T unpack_raw(const char *&p, const char *end)
+{
+	if ((size_t)(end - p) < sizeof(T))
+		throw LuaError("Truncated packed Lua value");
+	T v;
+	memcpy(&v, p, sizeof(T));
+	p += sizeof(T);
+	return v;
+}
+
+static void pack_value(lua_State *L, int index, std::string &dest,
+		std::vector<const void *> &tables);
+
+static void pack_table(lua_State *L, int index, std::string &dest,
+		std::vector<const void *> &tables)
+{
+	const void *table = lua_topointer(L, index);
+	for (const void *parent : tables)
+		if (parent == table)
+			throw LuaError("Can not pack a table that contains itself");
+	if (tables.size() >= PACKED_MAX_DEPTH)
+		throw LuaError("Can not pack tables nested this deep");
+	tables.push_back(table);
+
+	// The array part is the sequence starting at 1
+	u32 array_count = 0;
+	bool numbers_only = true;
+	for (;;) {
+		lua_rawgeti(L, index, array_count + 1);
+		int type = lua_type(L, -1);
+		lua_pop(L, 1);
+		if (type == LUA_TNIL)
+			break;
+		numbers_only &= type == LUA_TNUMBER;
+		array_count++;
+	}
+
+	u32 hash_count = 0;
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		lua_pop(L, 1);
+		if (lua_type(L, -1) == LUA_TNUMBER) {
+			lua_Number k = lua_tonumber(L, -1);
+			if (k >= 1 && k <= array_count && k == (u32)k)
+				continue;
+		}
+		hash_count++;
+	}
+
+	if (array_count > 0 && numbers_only && hash_count == 0) {
+		dest.push_back(PACKED_NUMBER_ARRAY);
+		pack_raw(dest, array_count);
+		size_t start = dest.size();
+		dest.resize(start + array_count * sizeof(lua_Number));
+		char *p = &dest[start];
+		for (u32 i = 1; i <= array_count; i++) {
+			lua_rawgeti(L, index, i);
+			lua_Number v = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+			memcpy(p, &v, sizeof(v));
+			p += sizeof(v);
+		}
+		tables.pop_back();
+		return;
+	}
+
+	dest.push_back(PACKED_TABLE);
+	pack_raw(dest, array_count);
+	pack_raw(dest, hash_count);
+	for (u32 i = 1; i <= array_count; i++) {
+		lua_rawgeti(L, index, i);
+		pack_value(L, lua_gettop(L), dest, tables);
+		lua_pop(L, 1);
+	}
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		int top = lua_gettop(L);
+		if (lua_type(L, top - 1) == LUA_TNUMBER) {
+			lua_Number k = lua_tonumber(L, top - 1);
+			if (k >= 1 && k <= array_count && k == (u32)k) {
+				lua_pop(L, 1);
+				continue;
+			}
+		}
+		pack_value(L, top - 1, dest, tables);
+		pack_value(L, top, dest, tables);
+		lua_pop(L, 1);
+	}
+	tables.pop_back();
+}
+
+static void pack_value(lua_State *L, int index, std::string &dest,
+		std::vector<const void *> &tables)
+{
+	switch (lua_type(L, index)) {
+	case LUA_TNIL:
+		dest.push_back(PACKED_NIL);
+		break;
+	case LUA_TBOOLEAN:
+		dest.push_back(lua_toboolean(L, index) ? PACKED_TRUE : PACKED_FALSE);
+		break;
+	case LUA_TNUMBER:
+		dest.push_back(PACKED_NUMBER);
+		pack_raw(dest, lua_tonumber(L, index));
+		break;
+	case LUA_TSTRING: {
+		size_t len;
+		const char *s = lua_tolstring(L, index, &len);
+		if (len > U32_MAX)
+			throw LuaError("Can not pack a string this long");
+		dest.push_back(PACKED_STRING);
+		pack_raw(dest, (u32)len);
+		dest.append(s, len);
+		break;
+	}
+	case LUA_TTABLE:
+		luaL_checkstack(L, 4, "packing a table");
+		pack_table(L, index, dest, tables);
+		break;
+	default:
+		throw LuaError(std::string("Can not pack a value of type ") +
+				lua_typename(L, lua_type(L, index)));
+	}
+}
+
+void script_pack(lua_State *L, int index, std::string &dest)
+{
+	int top = lua_gettop(L);
+	if (index < 0)
+		index = top + index + 1;
+	size_t size = dest.size();
+	std::vector<const void *> tables;
+	try {
+		pack_value(L, index, dest, tables);
+	} catch (LuaError &e) {
+		// An error inside a table leaves the lua_next key and value behind
+		lua_settop(L, top);
+		dest.resize(size);
+		throw;
+	}
+}
+
+static void unpack_value(lua_State *L, const char *&p, const char *end,
+		u32 depth)
+{
+	if (depth > PACKED_MAX_DEPTH)
+		throw LuaError("Invalid packed Lua value");
+	luaL_checkstack(L, 3, "unpacking a table");
+
+	switch (unpack_raw<u8>(p, end)) {
+	case PACKED_NIL:
+		lua_pushnil(L);
+		break;
+	case PACKED_FALSE:
+		lua_pushboolean(L, false);
+		break;
+	case PACKED_TRUE:
+		lua_pushboolean(L, true);
+		break;
+	case PACKED_NUMBER:
+		lua_pushnumber(L, unpack_raw<lua_Number>(p, end));
+		break;
+	case PACKED_STRING: {
+		u32 len = unpack_raw<u32>(p, end);
+		if ((size_t)(end - p) < len)
+			throw LuaError("Truncated packed Lua value");
+		lua_pushlstring(L, p, len);
+		p += len;
+		break;
+	}
+	case PACKED_TABLE: {
+		u32 array_count = unpack_raw<u32>(p, end);
+		u32 hash_count = unpack_raw<u32>(p, end);
+		lua_createtable(L, array_count, hash_count);
+		for (u32 i = 1; i <= array_count; i++) {
+			unpack_value(L, p, end, depth + 1);
+			lua_rawseti(L, -2, i);
+		}
+		for (u32 i = 0; i < hash_count; i++) {
+			unpack_value(L, p, end, depth + 1);
+			unpack_value(L, p, end, depth + 1);
+			lua_rawset(L, -3);
+		}
+		break;
+	}
+	case PACKED_NUMBER_ARRAY: {
+		u32 count = unpack_raw<u32>(p, end);
+		if ((size_t)(end - p) / sizeof(lua_Number) < count)
+			throw LuaError("Truncated packed Lua value");
+		lua_createtable(L, count, 0);
+		for (u32 i = 1; i <= count; i++) {
+			lua_Number v;
+			memcpy(&v, p, sizeof(v));
+			p += sizeof(v);
+			lua_pushnumber(L, v);
+			lua_rawseti(L, -2, i);
+		}
+		break;
+	}
+	default:
+		throw LuaError("Invalid packed Lua value");
+	}
+}
+
+void script_unpack(lua_State *L, const std::string &src)
+{
+	const char *p = src.data();
+	const char *end = p + src.size();
+	int top = lua_gettop(L);
+	try {
+		unpack_value(L, p, end, 0);
+	} catch (LuaError &e) {
+		lua_settop(L, top);
+		throw;
+	}
+	if (p != end) {
+		lua_settop(L, top);
+		throw LuaError("Invalid packed Lua value");
+	}
+}
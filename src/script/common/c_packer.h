@@ -0,0 +1,44 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <string>
+
+extern "C" {
+#include <lua.h>
+}
+
+/*
+	Binary format for moving Lua values between the Lua states of one
+	process, e.g. to and from the async workers. Numbers are stored in
+	native byte order, so the result must not be saved or sent anywhere.
+
+	Supported are nil, booleans, numbers, strings and tables of these.
+	Tables that hold only numbers in their array part, like the data of a
+	VoxelManip, are stored as one block of numbers.
+*/
+
+// Appends the value at index to dest, throws LuaError for values that can
+// not be packed, like functions, userdata and tables containing themselves.
+// On error the stack and dest are left as they were.
+void script_pack(lua_State *L, int index, std::string &dest);
+
+// Pushes the value that was packed into src
+void script_unpack(lua_State *L, const std::string &src);
@@ -17,6 +17,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 
@@ -32,6 +33,8 @@ extern "C" {
 #include "filesys.h"
 #include "porting.h"
 #include "common/c_internal.h"
+#include "common/c_packer.h"
+#include "threading/mutex_auto_lock.h"
 
 /******************************************************************************/
 AsyncEngine::~AsyncEngine()
@@ -59,9 +62,7 @@ AsyncEngine::~AsyncEngine()
 		delete workerThread;
 	}
 
-	jobQueueMutex.lock();
-	jobQueue.clear();
-	jobQueueMutex.unlock();
+	workerQueues.clear();
 	workerThreads.clear();
 }
 
@@ -76,84 +77,144 @@ void AsyncEngine::initialize(unsigned int numEngines)
 {
 	initDone = true;
 
+	// The queues must exist before any worker can look at them
+	for (unsigned int i = 0; i < numEngines; i++)
+		workerQueues.emplace_back(new WorkerQueue());
+
 	for (unsigned int i = 0; i < numEngines; i++) {
 		AsyncWorkerThread *toAdd = new AsyncWorkerThread(this,
-			std::string("AsyncWorker-") + itos(i));
+			std::string("AsyncWorker-") + itos(i), i);
 		workerThreads.push_back(toAdd);
 		toAdd->start();
 	}
 }
 
 /******************************************************************************/
-unsigned int AsyncEngine::queueAsyncJob(const std::string &func,
-		const std::string &params)
+unsigned int AsyncEngine::queueAsyncJob(std::string &&func,
+		std::string &&params)
 {
-	jobQueueMutex.lock();
+	sanity_check(!workerQueues.empty());
+
 	LuaJobInfo toAdd;
 	toAdd.id = jobIdCounter++;
-	toAdd.serializedFunction = func;
-	toAdd.serializedParams = params;
+	toAdd.serializedFunction = std::move(func);
+	toAdd.packedParams = std::move(params);
+	unsigned int id = toAdd.id;
+
+	{
+		MutexAutoLock lock(pendingMutex);
+		pendingJobs.insert(id);
+	}
 
-	jobQueue.push_back(toAdd);
+	WorkerQueue &queue = *workerQueues[id % workerQueues.size()];
+	{
+		MutexAutoLock lock(queue.jobMutex);
+		queue.jobs.push_back(std::move(toAdd));
+	}
 
 	jobQueueCounter.post();
 
-	jobQueueMutex.unlock();
+	return id;
+}
 
-	return toAdd.id;
+/******************************************************************************/
+bool AsyncEngine::isJobDone(unsigned int id)
+{
+	MutexAutoLock lock(pendingMutex);
+	return pendingJobs.find(id) == pendingJobs.end();
 }
 
 /******************************************************************************/
-LuaJobInfo AsyncEngine::getJob()
+bool AsyncEngine::waitForJob(unsigned int id, unsigned int timeout_ms)
+{
+	MutexAutoLock lock(pendingMutex);
+	return pendingCondition.wait_for(lock,
+			std::chrono::milliseconds(timeout_ms), [&] {
+		return pendingJobs.find(id) == pendingJobs.end();
+	});
+}
+
+/******************************************************************************/
+bool AsyncEngine::getJob(unsigned int index, LuaJobInfo *job)
 {
 	jobQueueCounter.wait();
-	jobQueueMutex.lock();
 
-	LuaJobInfo retval;
+	// Every post is preceded by a queued job, so unless this is a wake up
+	// for stopping one of the queues holds a job for us
+	size_t count = workerQueues.size();
+	for (size_t i = 0; i < count; i++) {
+		WorkerQueue &queue = *workerQueues[(index + i) % count];
+		MutexAutoLock lock(queue.jobMutex);
+		if (queue.jobs.empty())
+			continue;
 
-	if (!jobQueue.empty()) {
-		retval = jobQueue.front();
-		jobQueue.pop_front();
-		retval.valid = true;
+		if (i == 0) {
+			*job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+		} else {
+			*job = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+		}
+		return true;
 	}
-	jobQueueMutex.unlock();
-
-	return retval;
+	return false;
 }
 
 /******************************************************************************/
-void AsyncEngine::putJobResult(const LuaJobInfo &result)
+void AsyncEngine::putJobResult(unsigned int index, LuaJobInfo &&result)
 {
-	resultQueueMutex.lock();
-	resultQueue.push_back(result);
-	resultQueueMutex.unlock();
+	unsigned int id = result.id;
+	WorkerQueue &queue = *workerQueues[index];
+	{
+		MutexAutoLock lock(queue.resultMutex);
+		queue.results.push_back(std::move(result));
+	}
+	finishedJobs.fetch_add(1, std::memory_order_release);
+
+	{
+		MutexAutoLock lock(pendingMutex);
+		pendingJobs.erase(id);
+	}
+	pendingCondition.notify_all();
 }
 
 /******************************************************************************/
 void AsyncEngine::step(lua_State *L)
 {
+	if (finishedJobs.load(std::memory_order_acquire) == 0)
+		return;
+
 	int error_handler = PUSH_ERROR_HANDLER(L);
 	lua_getglobal(L, "core");
-	resultQueueMutex.lock();
-	while (!resultQueue.empty()) {
-		LuaJobInfo jobDone = resultQueue.front();
-		resultQueue.pop_front();
-
-		lua_getfield(L, -1, "async_event_handler");
 
-		if (lua_isnil(L, -1)) {
-			FATAL_ERROR("Async event handler does not exist!");
+	std::vector<LuaJobInfo> jobsDone;
+	for (std::unique_ptr<WorkerQueue> &queue : workerQueues) {
+		{
+			MutexAutoLock lock(queue->resultMutex);
+			jobsDone.swap(queue->results);
 		}
+		finishedJobs.fetch_sub(jobsDone.size(), std::memory_order_relaxed);
 
-		luaL_checktype(L, -1, LUA_TFUNCTION);
+		for (const LuaJobInfo &jobDone : jobsDone) {
+			lua_getfield(L, -1, "async_event_handler");
 
-		lua_pushinteger(L, jobDone.id);
-		lua_pushlstring(L, jobDone.serializedResult.data(),
-				jobDone.serializedResult.size());
+			if (lua_isnil(L, -1)) {
+				FATAL_ERROR("Async event handler does not exist!");
+			}
 
-		PCALL_RESL(L, lua_pcall(L, 2, 0, error_handler));
+			luaL_checktype(L, -1, LUA_TFUNCTION);
+
+			lua_pushinteger(L, jobDone.id);
+			// Failed jobs have no result
+			if (jobDone.packedResult.empty())
+				lua_pushnil(L);
+			else
+				script_unpack(L, jobDone.packedResult);
+
+			PCALL_RESL(L, lua_pcall(L, 2, 0, error_handler));
+		}
+		jobsDone.clear();
 	}
-	resultQueueMutex.unlock();
 	lua_pop(L, 2); // Pop core and error handler
 }
 
@@ -167,10 +228,11 @@ void AsyncEngine::prepareEnvironment(lua_State* L, int top)
 
 /******************************************************************************/
 AsyncWorkerThread::AsyncWorkerThread(AsyncEngine* jobDispatcher,
-		const std::string &name) :
+		const std::string &name, unsigned int index) :
 	Thread(name),
 	ScriptApiBase(ScriptingType::Async),
-	jobDispatcher(jobDispatcher)
+	jobDispatcher(jobDispatcher),
+	index(index)
 {
 	lua_State *L = getStack();
 
@@ -212,12 +274,14 @@ void* AsyncWorkerThread::run()
 		FATAL_ERROR("Unable to find core within async environment!");
 	}
 
+	// Restored after every job, whatever the job left behind
+	int top = lua_gettop(L);
+
 	// Main loop
+	LuaJobInfo toProcess;
 	while (!stopRequested()) {
 		// Wait for job
-		LuaJobInfo toProcess = jobDispatcher->getJob();
-
-		if (!toProcess.valid || stopRequested()) {
+		if (!jobDispatcher->getJob(index, &toProcess) || stopRequested()) {
 			continue;
 		}
 
@@ -232,25 +296,27 @@ void* AsyncWorkerThread::run()
 		lua_pushlstring(L,
 				toProcess.serializedFunction.data(),
 				toProcess.serializedFunction.size());
-		lua_pushlstring(L,
-				toProcess.serializedParams.data(),
-				toProcess.serializedParams.size());
+		script_unpack(L, toProcess.packedParams);
 
+		toProcess.packedResult.clear();
 		int result = lua_pcall(L, 2, 1, error_handler);
 		if (result) {
 			PCALL_RES(result);
-			toProcess.serializedResult = "";
 		} else {
 			// Fetch result
-			size_t length;
-			const char *retval = lua_tolstring(L, -1, &length);
-			toProcess.serializedResult = std::string(retval, length);
+			try {
+				script_pack(L, -1, toProcess.packedResult);
+			} catch (LuaError &e) {
+				errorstream << "Async job " << toProcess.id << ": "
+						<< e.what() << std::endl;
+				toProcess.packedResult.clear();
+			}
 		}
 
-		lua_pop(L, 1);  // Pop retval
+		lua_settop(L, top);  // Pop retval
 
 		// Put job result
-		jobDispatcher->putJobResult(toProcess);
+		jobDispatcher->putJobResult(index, std::move(toProcess));
 	}
 
 	lua_pop(L, 2);  // Pop core and error handler
@@ -21,9 +21,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "IrrCompileConfig.h"
 
-#include <vector>
+#include <atomic>
+#include <condition_variable>
 #include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
 
 #ifdef _IRR_COMPILE_WITH_SDL_DEVICE_
 #include "threading/sdl_semaphore.h"
@@ -46,28 +51,29 @@ struct LuaJobInfo
 {
 	LuaJobInfo() = default;
 
-	// Function to be called in async environment
+	// Function to be called in async environment, dumped by string.dump
 	std::string serializedFunction = "";
-	// Parameter to be passed to function
-	std::string serializedParams = "";
-	// Result of function call
-	std::string serializedResult = "";
+	// Parameter to be passed to function, packed by script_pack
+	std::string packedParams = "";
+	// Result of function call, packed by script_pack
+	std::string packedResult = "";
 	// JobID used to identify a job and match it to callback
 	unsigned int id = 0;
-
-	bool valid = false;
 };
 
 // Asynchronous working environment
 class AsyncWorkerThread : public Thread, public ScriptApiBase {
 public:
-	AsyncWorkerThread(AsyncEngine* jobDispatcher, const std::string &name);
+	AsyncWorkerThread(AsyncEngine* jobDispatcher, const std::string &name,
+			unsigned int index);
 	virtual ~AsyncWorkerThread();
 
 	void *run();
 
 private:
 	AsyncEngine *jobDispatcher = nullptr;
+	// Index of the job and result queues of this worker
+	unsigned int index;
 };
 
 // Asynchornous thread and job management
@@ -93,10 +99,25 @@ class AsyncEngine {
 	/**
 	 * Queue an async job
 	 * @param func Serialized lua function
-	 * @param params Serialized parameters
+	 * @param params Parameters packed by script_pack
 	 * @return jobid The job is queued
 	 */
-	unsigned int queueAsyncJob(const std::string &func, const std::string &params);
+	unsigned int queueAsyncJob(std::string &&func, std::string &&params);
+
+	/**
+	 * Check whether a job has finished, its result is passed back by the
+	 * next step()
+	 * @param id ID returned by queueAsyncJob
+	 */
+	bool isJobDone(unsigned int id);
+
+	/**
+	 * Wait until a job has finished
+	 * @param id ID returned by queueAsyncJob
+	 * @param timeout_ms Maximum time to wait
+	 * @return false if the job is still running after timeout_ms
+	 */
+	bool waitForJob(unsigned int id, unsigned int timeout_ms);
 
 	/**
 	 * Engine step to process finished jobs
@@ -107,17 +128,21 @@ class AsyncEngine {
 
 protected:
 	/**
-	 * Get a Job from queue to be processed
+	 * Get a Job to be processed, from the queue of the worker or else
+	 * taken from the other workers
 	 *  this function blocks until a job is ready
-	 * @return a job to be processed
+	 * @param index Index of the worker
+	 * @param job The job to be processed
+	 * @return false if woken up without a job
 	 */
-	LuaJobInfo getJob();
+	bool getJob(unsigned int index, LuaJobInfo *job);
 
 	/**
-	 * Put a Job result back to result queue
+	 * Put a Job result back to the result queue of the worker
+	 * @param index Index of the worker
 	 * @param result result of completed job
 	 */
-	void putJobResult(const LuaJobInfo &result);
+	void putJobResult(unsigned int index, LuaJobInfo &&result);
 
 	/**
 	 * Initialize environment with current registred functions
@@ -129,6 +154,18 @@ class AsyncEngine {
 	void prepareEnvironment(lua_State* L, int top);
 
 private:
+	// Jobs and results of one worker, each behind its own lock so that the
+	// workers do not wait for each other
+	struct WorkerQueue {
+		std::mutex jobMutex;
+		// Jobs are taken from the front by the owner, from the back by
+		// the other workers
+		std::deque<LuaJobInfo> jobs;
+
+		std::mutex resultMutex;
+		std::vector<LuaJobInfo> results;
+	};
+
 	// Variable locking the engine against further modification
 	bool initDone = false;
 
@@ -138,16 +175,17 @@ class AsyncEngine {
 	// Internal counter to create job IDs
 	unsigned int jobIdCounter = 0;
 
-	// Mutex to protect job queue
-	std::mutex jobQueueMutex;
+	// One queue per worker thread, jobs are spread over them by ID
+	std::vector<std::unique_ptr<WorkerQueue>> workerQueues;
 
-	// Job queue
-	std::deque<LuaJobInfo> jobQueue;
+	// Number of finished jobs not yet passed back, so that step() only
+	// takes the result locks when something is done
+	std::atomic<unsigned int> finishedJobs{0};
 
-	// Mutex to protect result queue
-	std::mutex resultQueueMutex;
-	// Result queue
-	std::deque<LuaJobInfo> resultQueue;
+	// IDs of the queued and running jobs, for isJobDone() and waitForJob()
+	std::mutex pendingMutex;
+	std::condition_variable pendingCondition;
+	std::unordered_set<unsigned int> pendingJobs;
 
 	// List of current worker threads
 	std::vector<AsyncWorkerThread*> workerThreads;
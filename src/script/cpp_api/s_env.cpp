@@ -157,12 +157,16 @@ void ScriptApiEnv::initializeEnvironment(ServerEnvironment *env)
 		s16 max_y = INT16_MAX;
 		getintfield(L, current_abm, "max_y", max_y);
 
+		std::string label = "#" + std::to_string(id);
+		getstringfield(L, current_abm, "label", label);
+
 		lua_getfield(L, current_abm, "action");
 		luaL_checktype(L, current_abm + 1, LUA_TFUNCTION);
 		lua_pop(L, 1);
 
 		LuaABM *abm = new LuaABM(L, id, trigger_contents, required_neighbors,
-			trigger_interval, trigger_chance, simple_catch_up, min_y, max_y);
+			trigger_interval, trigger_chance, simple_catch_up, min_y, max_y,
+			label);
 
 		env->addActiveBlockModifier(abm);
 
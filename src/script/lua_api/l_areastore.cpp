@@ -312,7 +312,9 @@ LuaAreaStore::LuaAreaStore(const std::string &type)
 		as = new SpatialAreaStore();
 	} else
 #endif
-	{
+	if (type == "BVH") {
+		as = new BVHAreaStore();
+	} else {
 		as = new VectorAreaStore();
 	}
 }
@@ -396,6 +396,9 @@ int ModApiEnvMod::l_get_node_light(lua_State *L)
 	time_of_day %= 24000;
 	u32 dnr = time_to_daynight_ratio(time_of_day, true);
 
+	// Mods expect the light of the nodes they just changed
+	env->getMap().updatePendingLighting();
+
 	bool is_position_ok;
 	MapNode n = env->getMap().getNode(pos, &is_position_ok);
 	if (is_position_ok) {
@@ -417,6 +420,8 @@ int ModApiEnvMod::l_get_natural_light(lua_State *L)
 
 	v3s16 pos = read_v3s16(L, 1);
 
+	env->getMap().updatePendingLighting();
+
 	bool is_position_ok;
 	MapNode n = env->getMap().getNode(pos, &is_position_ok);
 	if (!is_position_ok)
@@ -1300,10 +1305,13 @@ int ModApiEnvMod::l_find_path(lua_State *L)
 
 		if (algorithm == "Dijkstra")
 			algo = PA_DIJKSTRA;
+
+		if (algorithm == "A*_hierarchical")
+			algo = PA_HIERARCHICAL;
 	}
 
 	std::vector<v3s16> path = get_path(&env->getServerMap(), env->getGameDef()->ndef(), pos1, pos2,
-		searchdistance, max_jump, max_drop, algo);
+		searchdistance, max_jump, max_drop, algo, env->getPathCache());
 
 	if (!path.empty()) {
 		lua_createtable(L, path.size(), 0);
@@ -227,11 +227,13 @@ class LuaABM : public ActiveBlockModifier {
 	bool m_simple_catch_up;
 	s16 m_min_y;
 	s16 m_max_y;
+	std::string m_label;
 public:
 	LuaABM(lua_State *L, int id,
 			const std::vector<std::string> &trigger_contents,
 			const std::vector<std::string> &required_neighbors,
-			float trigger_interval, u32 trigger_chance, bool simple_catch_up, s16 min_y, s16 max_y):
+			float trigger_interval, u32 trigger_chance, bool simple_catch_up, s16 min_y, s16 max_y,
+			const std::string &label):
 		m_id(id),
 		m_trigger_contents(trigger_contents),
 		m_required_neighbors(required_neighbors),
@@ -239,7 +241,8 @@ class LuaABM : public ActiveBlockModifier {
 		m_trigger_chance(trigger_chance),
 		m_simple_catch_up(simple_catch_up),
 		m_min_y(min_y),
-		m_max_y(max_y)
+		m_max_y(max_y),
+		m_label(label)
 	{
 	}
 	virtual const std::vector<std::string> &getTriggerContents() const
@@ -270,6 +273,10 @@ class LuaABM : public ActiveBlockModifier {
 	{
 		return m_max_y;
 	}
+	virtual std::string getLabel()
+	{
+		return m_label;
+	}
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 			u32 active_object_count, u32 active_object_count_wider);
 };
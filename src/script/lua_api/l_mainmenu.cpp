@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "lua_api/l_internal.h"
 #include "common/c_converter.h"
 #include "common/c_content.h"
+#include "common/c_packer.h"
 #include "cpp_api/s_async.h"
 #include "gui/guiEngine.h"
 #include "gui/guiMainMenu.h"
@@ -1092,18 +1093,17 @@ int ModApiMainMenu::l_do_async_callback(lua_State *L)
 {
 	GUIEngine* engine = getGuiEngine(L);
 
-	size_t func_length, param_length;
+	size_t func_length;
 	const char* serialized_func_raw = luaL_checklstring(L, 1, &func_length);
 
-	const char* serialized_param_raw = luaL_checklstring(L, 2, &param_length);
-
 	sanity_check(serialized_func_raw != NULL);
-	sanity_check(serialized_param_raw != NULL);
 
 	std::string serialized_func = std::string(serialized_func_raw, func_length);
-	std::string serialized_param = std::string(serialized_param_raw, param_length);
+	std::string packed_param;
+	script_pack(L, 2, packed_param);
 
-	lua_pushinteger(L, engine->queueAsync(serialized_func, serialized_param));
+	lua_pushinteger(L, engine->queueAsync(std::move(serialized_func),
+			std::move(packed_param)));
 
 	return 1;
 }
@@ -50,6 +50,10 @@ int LuaVoxelManip::l_read_from_map(lua_State *L)
 	v3s16 bp2 = getNodeBlockPos(check_v3s16(L, 3));
 	sortBoxVerticies(bp1, bp2);
 
+	// Read the light of deferred node changes too
+	if (Environment *env = getEnv(L))
+		env->getMap().updatePendingLighting();
+
 	vm->initialEmerge(bp1, bp2);
 
 	push_v3s16(L, vm->m_area.MinEdge);
@@ -94,9 +94,10 @@ void MainMenuScripting::step()
 }
 
 /******************************************************************************/
-unsigned int MainMenuScripting::queueAsync(const std::string &serialized_func,
-		const std::string &serialized_param)
+unsigned int MainMenuScripting::queueAsync(std::string &&serialized_func,
+		std::string &&packed_params)
 {
-	return asyncEngine.queueAsyncJob(serialized_func, serialized_param);
+	return asyncEngine.queueAsyncJob(std::move(serialized_func),
+			std::move(packed_params));
 }
 
@@ -38,8 +38,8 @@ class MainMenuScripting
 	void step();
 
 	// Pass async events from engine to async threads
-	unsigned int queueAsync(const std::string &serialized_func,
-			const std::string &serialized_params);
+	unsigned int queueAsync(std::string &&serialized_func,
+			std::string &&packed_params);
 private:
 	void initializeModApi(lua_State *L, int top);
 	static void registerLuaClasses(lua_State *L, int top);
@@ -20,9 +20,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "serialization.h"
 
 #include "util/serialize.h"
+#include "threading/mutex_auto_lock.h"
 
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <zlib.h>
 #include <zstd.h>
+#include <zdict.h>
 
 /* report a zlib or i/o error */
 void zerr(int ret)
@@ -208,13 +213,20 @@ struct ZSTD_Deleter {
 	}
 };
 
-void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level)
+static void compressZstd(const u8 *data, size_t data_size, std::ostream &os,
+		int level, const ZSTD_CDict *cdict)
 {
 	// reusing the context is recommended for performance
 	// it will destroyed when the thread ends
 	thread_local std::unique_ptr<ZSTD_CStream, ZSTD_Deleter> stream(ZSTD_createCStream());
 
-	ZSTD_initCStream(stream.get(), level);
+	if (cdict) {
+		// the level was chosen when creating the dictionary
+		ZSTD_CCtx_reset(stream.get(), ZSTD_reset_session_and_parameters);
+		ZSTD_CCtx_refCDict(stream.get(), cdict);
+	} else {
+		ZSTD_initCStream(stream.get(), level);
+	}
 
 	const size_t bufsize = 16384;
 	char output_buffer[bufsize];
@@ -222,21 +234,9 @@ void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level)
 	ZSTD_inBuffer input = { data, data_size, 0 };
 	ZSTD_outBuffer output = { output_buffer, bufsize, 0 };
 
-	while (input.pos < input.size) {
-		size_t ret = ZSTD_compressStream(stream.get(), &output, &input);
-		if (ZSTD_isError(ret)) {
-			dstream << ZSTD_getErrorName(ret) << std::endl;
-			throw SerializationError("compressZstd: failed");
-		}
-		if (output.pos) {
-			os.write(output_buffer, output.pos);
-			output.pos = 0;
-		}
-	}
-
 	size_t ret;
 	do {
-		ret = ZSTD_endStream(stream.get(), &output);
+		ret = ZSTD_compressStream2(stream.get(), &output, &input, ZSTD_e_end);
 		if (ZSTD_isError(ret)) {
 			dstream << ZSTD_getErrorName(ret) << std::endl;
 			throw SerializationError("compressZstd: failed");
@@ -246,21 +246,28 @@ void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level)
 			output.pos = 0;
 		}
 	} while (ret != 0);
+}
 
+void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level)
+{
+	compressZstd(data, data_size, os, level, nullptr);
 }
 
 void compressZstd(const std::string &data, std::ostream &os, int level)
 {
-	compressZstd((u8*)data.c_str(), data.size(), os, level);
+	compressZstd((u8*)data.c_str(), data.size(), os, level, nullptr);
 }
 
-void decompressZstd(std::istream &is, std::ostream &os)
+static void decompressZstd(std::istream &is, std::ostream &os,
+		const ZSTD_DDict *ddict)
 {
 	// reusing the context is recommended for performance
 	// it will destroyed when the thread ends
 	thread_local std::unique_ptr<ZSTD_DStream, ZSTD_Deleter> stream(ZSTD_createDStream());
 
 	ZSTD_initDStream(stream.get());
+	if (ddict)
+		ZSTD_DCtx_refDDict(stream.get(), ddict);
 
 	const size_t bufsize = 16384;
 	char output_buffer[bufsize];
@@ -297,6 +304,153 @@ void decompressZstd(std::istream &is, std::ostream &os)
 	}
 }
 
+void decompressZstd(std::istream &is, std::ostream &os)
+{
+	decompressZstd(is, os, nullptr);
+}
+
+struct ZstdDictionary {
+	ZstdDictionary(const std::string &data) :
+		data(data),
+		ddict(ZSTD_createDDict(data.c_str(), data.size()))
+	{}
+
+	~ZstdDictionary()
+	{
+		for (auto &it : cdicts)
+			ZSTD_freeCDict(it.second);
+		ZSTD_freeDDict(ddict);
+	}
+
+	// Digesting the dictionary is expensive, so keep one per level in use
+	const ZSTD_CDict *getCDict(int level)
+	{
+		MutexAutoLock lock(cdicts_mutex);
+		ZSTD_CDict *&cdict = cdicts[level];
+		if (!cdict)
+			cdict = ZSTD_createCDict(data.c_str(), data.size(), level);
+		return cdict;
+	}
+
+	const std::string data;
+	ZSTD_DDict *const ddict;
+
+	std::mutex cdicts_mutex;
+	std::unordered_map<int, ZSTD_CDict *> cdicts;
+};
+
+static std::mutex s_zstd_dictionaries_mutex;
+static std::unordered_map<u32, std::shared_ptr<ZstdDictionary>> s_zstd_dictionaries;
+static u32 s_zstd_active_dictionary = 0;
+
+static std::shared_ptr<ZstdDictionary> findZstdDictionary(u32 id)
+{
+	MutexAutoLock lock(s_zstd_dictionaries_mutex);
+	auto it = s_zstd_dictionaries.find(id);
+	return it == s_zstd_dictionaries.end() ? nullptr : it->second;
+}
+
+// Total compressed size of every 4th sample, using the dictionary if given
+static size_t measureZstdDictionary(const std::vector<std::string> &samples,
+		const std::string &dict)
+{
+	const int level = 3;
+	ZSTD_CCtx *cctx = ZSTD_createCCtx();
+	ZSTD_CDict *cdict = dict.empty() ? nullptr :
+			ZSTD_createCDict(dict.c_str(), dict.size(), level);
+	std::string out;
+	size_t total = 0;
+	for (size_t i = 0; i < samples.size(); i += 4) {
+		const std::string &sample = samples[i];
+		out.resize(ZSTD_compressBound(sample.size()));
+		size_t ret = cdict ?
+			ZSTD_compress_usingCDict(cctx, &out[0], out.size(),
+				sample.c_str(), sample.size(), cdict) :
+			ZSTD_compressCCtx(cctx, &out[0], out.size(),
+				sample.c_str(), sample.size(), level);
+		total += ZSTD_isError(ret) ? sample.size() : ret;
+	}
+	ZSTD_freeCDict(cdict);
+	ZSTD_freeCCtx(cctx);
+	return total;
+}
+
+std::string trainZstdDictionary(const std::vector<std::string> &samples,
+		size_t max_size)
+{
+	std::string buffer;
+	std::vector<size_t> sizes;
+	sizes.reserve(samples.size());
+	for (const std::string &sample : samples) {
+		buffer.append(sample);
+		sizes.push_back(sample.size());
+	}
+
+	// The trainer often does worse with a bigger size on very uniform data,
+	// so try a few sizes and keep the one compressing the samples best
+	std::string best;
+	size_t best_size = measureZstdDictionary(samples, best);
+	for (size_t size = max_size; size >= 4096; size /= 2) {
+		std::string dict(size, '\0');
+		size_t ret = ZDICT_trainFromBuffer(&dict[0], dict.size(), buffer.c_str(),
+				sizes.data(), sizes.size());
+		if (ZDICT_isError(ret)) {
+			dstream << ZDICT_getErrorName(ret) << std::endl;
+			continue;
+		}
+		dict.resize(ret);
+
+		size_t compressed_size = measureZstdDictionary(samples, dict);
+		if (compressed_size < best_size) {
+			best = std::move(dict);
+			best_size = compressed_size;
+		}
+	}
+
+	if (best.empty())
+		throw SerializationError("trainZstdDictionary: no useful dictionary");
+	return best;
+}
+
+u32 registerZstdDictionary(const std::string &dict)
+{
+	u32 id = ZDICT_getDictID(dict.c_str(), dict.size());
+	if (id == 0)
+		return 0;
+
+	auto entry = std::make_shared<ZstdDictionary>(dict);
+	if (!entry->ddict)
+		return 0;
+
+	MutexAutoLock lock(s_zstd_dictionaries_mutex);
+	auto &slot = s_zstd_dictionaries[id];
+	// Keep the existing entry if it is the same, it may be in use
+	if (!slot || slot->data != dict)
+		slot = entry;
+	return id;
+}
+
+bool getZstdDictionary(u32 id, std::string *dict)
+{
+	std::shared_ptr<ZstdDictionary> entry = findZstdDictionary(id);
+	if (!entry)
+		return false;
+	*dict = entry->data;
+	return true;
+}
+
+void setActiveZstdDictionary(u32 id)
+{
+	MutexAutoLock lock(s_zstd_dictionaries_mutex);
+	s_zstd_active_dictionary = id;
+}
+
+u32 getActiveZstdDictionary()
+{
+	MutexAutoLock lock(s_zstd_dictionaries_mutex);
+	return s_zstd_active_dictionary;
+}
+
 void compress(u8 *data, u32 size, std::ostream &os, u8 version, int level)
 {
 	if(version >= 29)
@@ -307,7 +461,17 @@ void compress(u8 *data, u32 size, std::ostream &os, u8 version, int level)
 #else
 			level = 0;
 #endif
-		compressZstd(data, size, os, level);
+		if (version < 30) {
+			compressZstd(data, size, os, level, nullptr);
+			return;
+		}
+
+		u32 id = getActiveZstdDictionary();
+		std::shared_ptr<ZstdDictionary> dict = findZstdDictionary(id);
+		if (!dict)
+			id = 0;
+		writeU32(os, id);
+		compressZstd(data, size, os, level, dict ? dict->getCDict(level) : nullptr);
 		return;
 	}
 
@@ -366,7 +530,20 @@ void decompress(std::istream &is, std::ostream &os, u8 version)
 {
 	if(version >= 29)
 	{
-		decompressZstd(is, os);
+		if (version < 30) {
+			decompressZstd(is, os, nullptr);
+			return;
+		}
+
+		u32 id = readU32(is);
+		if (id == 0) {
+			decompressZstd(is, os, nullptr);
+			return;
+		}
+		std::shared_ptr<ZstdDictionary> dict = findZstdDictionary(id);
+		if (!dict)
+			throw SerializationError("decompress: unknown zstd dictionary");
+		decompressZstd(is, os, dict->ddict);
 		return;
 	}
 
@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "irrlichttypes.h"
 #include "exceptions.h"
 #include <iostream>
+#include <vector>
 #include "util/pointer.h"
 
 /*
@@ -64,16 +65,20 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	27: Added light spreading flags to blocks
 	28: Added "private" flag to NodeMetadata
 	29: Switched compression to zstd, a bit of reorganization
+	30: ID of a shared zstd dictionary written in front of the block data
 */
 // This represents an uninitialized or invalid format
 #define SER_FMT_VER_INVALID 255
 
 // Highest supported serialization version
-#define SER_FMT_VER_HIGHEST_READ 29
+#define SER_FMT_VER_HIGHEST_READ 30
 
 // Saved on disk version
 #define SER_FMT_VER_HIGHEST_WRITE 29
 
+// Used instead of the above when a zstd dictionary is available
+#define SER_FMT_VER_ZSTD_DICTIONARY 30
+
 // Lowest supported serialization version
 #define SER_FMT_VER_LOWEST_READ 0
 // Lowest serialization version for writing
@@ -97,6 +102,24 @@ void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level
 void compressZstd(const std::string &data, std::ostream &os, int level = 0);
 void decompressZstd(std::istream &is, std::ostream &os);
 
+/*
+	Shared zstd dictionaries
+
+	Blocks of version >= 30 are compressed with the active dictionary and
+	can be decompressed wherever a dictionary with the same ID is registered.
+*/
+
+// Throws SerializationError if no dictionary of up to max_size bytes
+// improves the compression of the samples
+std::string trainZstdDictionary(const std::vector<std::string> &samples,
+		size_t max_size);
+// Returns the dictionary ID, or 0 if the data is not a zstd dictionary
+u32 registerZstdDictionary(const std::string &dict);
+bool getZstdDictionary(u32 id, std::string *dict);
+// Dictionary used for compressing, 0 to compress without one
+void setActiveZstdDictionary(u32 id);
+u32 getActiveZstdDictionary();
+
 // These choose between zlib and a self-made one according to version
 void compress(const SharedBuffer<u8> &data, std::ostream &os, u8 version, int level = -1);
 void compress(const std::string &data, std::ostream &os, u8 version, int level = -1);
@@ -283,6 +283,50 @@ Server::Server(
 			"minetest_core_server_packet_recv_processed",
 			"Valid received packets processed");
 
+	m_packet_sent_counter = m_metrics_backend->addCounter(
+			"minetest_core_server_packet_sent",
+			"Packets handed to the connection for sending");
+
+	// The packet buffer pool is shared by the whole process: sent and
+	// received packets, and a client running in the same process
+	m_packet_buffer_alloc_counter = m_metrics_backend->addCounter(
+			"minetest_core_process_packet_buffer_allocations",
+			"Packet buffers allocated in the process, as the pool had none free");
+
+	m_packet_buffer_copy_counter = m_metrics_backend->addCounter(
+			"minetest_core_process_packet_buffer_copies",
+			"Packet data copied in the process to add headers or to change it");
+
+	m_packet_send_alloc_counter = m_metrics_backend->addCounter(
+			"minetest_core_server_packet_send_allocations",
+			"Packet buffers allocated to write and send the server's packets");
+
+	m_packet_send_copy_counter = m_metrics_backend->addCounter(
+			"minetest_core_server_packet_send_copies",
+			"Packet data copied to write and send the server's packets");
+
+	m_packet_send_alloc_gauge = m_metrics_backend->addGauge(
+			"minetest_core_server_packet_send_allocations_per_packet",
+			"Packet buffers allocated to write and send the server's packets "
+			"in the last step, per packet");
+
+	const std::vector<double> &step_bounds = MetricsBackend::getStepTimeBounds();
+	m_step_histogram = m_metrics_backend->addHistogram(
+			"minetest_core_step_seconds",
+			"Duration of a server step, without sending blocks", step_bounds);
+	m_send_blocks_histogram = m_metrics_backend->addHistogram(
+			"minetest_core_step_send_blocks_seconds",
+			"Time spent sending blocks in a server step", step_bounds);
+	m_env_step_histogram = m_metrics_backend->addHistogram(
+			"minetest_core_step_env_seconds",
+			"Time spent stepping the environment in a server step", step_bounds);
+	m_liquid_histogram = m_metrics_backend->addHistogram(
+			"minetest_core_step_liquid_seconds",
+			"Duration of a liquid transform", step_bounds);
+	m_map_save_histogram = m_metrics_backend->addHistogram(
+			"minetest_core_step_map_save_seconds",
+			"Duration of a map save", step_bounds);
+
 	m_lag_gauge->set(g_settings->getFloat("dedicated_server_step"));
 }
 
@@ -412,7 +456,7 @@ void Server::init()
 	}
 
 	// Create emerge manager
-	m_emerge = new EmergeManager(this);
+	m_emerge = new EmergeManager(this, m_metrics_backend.get());
 
 #if BAN_MANAGER
 	// Create ban manager
@@ -475,7 +519,8 @@ void Server::init()
 
 	// Initialize Environment
 	m_startup_server_map = nullptr; // Ownership moved to ServerEnvironment
-	m_env = new ServerEnvironment(servermap, m_script, this, m_path_world);
+	m_env = new ServerEnvironment(servermap, m_script, this, m_path_world,
+		m_metrics_backend.get());
 
 	m_inventory_mgr->setEnv(m_env);
 	m_clients.setEnv(m_env);
@@ -581,8 +626,15 @@ void Server::AsyncRunStep(bool initial_step)
 		dtime = m_step_dtime;
 	}
 
+	{
+		// Light the nodes changed since the last step before sending them
+		MutexAutoLock envlock(m_env_mutex);
+		m_env->getMap().updatePendingLighting();
+	}
+
 	{
 		// Send blocks to clients
+		ScopeMetricTimer timer(m_send_blocks_histogram);
 		SendBlocks(dtime);
 	}
 
@@ -590,6 +642,7 @@ void Server::AsyncRunStep(bool initial_step)
 		return;
 
 	ScopeProfiler sp(g_profiler, "Server::AsyncRunStep()", SPT_AVG);
+	ScopeMetricTimer step_timer(m_step_histogram);
 
 	{
 		MutexAutoLock lock1(m_step_dtime_mutex);
@@ -601,6 +654,32 @@ void Server::AsyncRunStep(bool initial_step)
 	*/
 	m_uptime_counter->increment(dtime);
 
+	/*
+		Update packet buffer metrics
+	*/
+	{
+		u64 packets_sent = m_con->getPacketsSent();
+		u64 sent = packets_sent - m_last_packets_sent;
+		m_packet_sent_counter->increment(sent);
+		m_last_packets_sent = packets_sent;
+
+		PacketBuffer::Stats stats = PacketBuffer::getStats();
+		m_packet_buffer_alloc_counter->increment(
+				stats.allocated - m_last_packet_buffer_stats.allocated);
+		m_packet_buffer_copy_counter->increment(
+				stats.copied - m_last_packet_buffer_stats.copied);
+		m_last_packet_buffer_stats = stats;
+
+		// Only what writing and sending the packets cost
+		PacketBuffer::Stats send_stats = m_con->getSendStats();
+		PacketBuffer::Stats send_diff = send_stats - m_last_send_stats;
+		m_packet_send_alloc_counter->increment(send_diff.allocated);
+		m_packet_send_copy_counter->increment(send_diff.copied);
+		if (sent > 0)
+			m_packet_send_alloc_gauge->set((double)send_diff.allocated / sent);
+		m_last_send_stats = send_stats;
+	}
+
 	handlePeerChanges();
 
 	/*
@@ -635,6 +714,7 @@ void Server::AsyncRunStep(bool initial_step)
 		}
 		m_env->reportMaxLagEstimate(max_lag);
 		// Step environment
+		ScopeMetricTimer timer(m_env_step_histogram);
 		m_env->step(dtime);
 	}
 
@@ -678,6 +758,7 @@ void Server::AsyncRunStep(bool initial_step)
 		MutexAutoLock lock(m_env_mutex);
 
 		ScopeProfiler sp(g_profiler, "Server: liquid transform");
+		ScopeMetricTimer timer(m_liquid_histogram);
 
 		std::map<v3s16, MapBlock*> modified_blocks;
 		m_env->getMap().transformLiquids(modified_blocks, m_env);
@@ -915,11 +996,6 @@ void Server::AsyncRunStep(bool initial_step)
 					node_meta_updates.push_back(event->p);
 				}
 
-				if (MapBlock *block = m_env->getMap().getBlockNoCreateNoEx(
-						getNodeBlockPos(event->p))) {
-					block->raiseModified(MOD_STATE_WRITE_NEEDED,
-						MOD_REASON_REPORT_META_CHANGE);
-				}
 				break;
 			}
 			case MEET_OTHER:
@@ -994,6 +1070,7 @@ void Server::AsyncRunStep(bool initial_step)
 			MutexAutoLock lock(m_env_mutex);
 
 			ScopeProfiler sp(g_profiler, "Server: map saving (sum)");
+			ScopeMetricTimer timer(m_map_save_histogram);
 
 #if BAN_MANAGER
 			// Save ban file
@@ -1013,6 +1090,19 @@ void Server::AsyncRunStep(bool initial_step)
 		}
 	}
 
+	// Write the metrics to a file for external tools
+	static thread_local const float metrics_dump_interval =
+		g_settings->getFloat("metrics_dump_interval");
+	if (metrics_dump_interval > 0.0f) {
+		m_metrics_dump_timer += dtime;
+		if (m_metrics_dump_timer >= metrics_dump_interval) {
+			m_metrics_dump_timer = 0.0f;
+			std::ostringstream os(std::ios_base::binary);
+			m_metrics_backend->dump(os);
+			fs::safeWriteToFile(m_path_world + DIR_DELIM + "metrics.txt", os.str());
+		}
+	}
+
 	m_shutdown_state.tick(dtime, this);
 }
 
@@ -1238,6 +1328,16 @@ void Server::onMapEditEvent(const MapEditEvent &event)
 	if (m_ignore_map_edit_events_area.contains(event.getArea()))
 		return;
 
+	// Metadata is changed in place, so mark the block right away to keep
+	// SendBlocks from using a stale network serialization
+	if (event.type == MEET_BLOCK_NODE_METADATA_CHANGED) {
+		if (MapBlock *block = m_env->getMap().getBlockNoCreateNoEx(
+				getNodeBlockPos(event.p))) {
+			block->raiseModified(MOD_STATE_WRITE_NEEDED,
+				MOD_REASON_REPORT_META_CHANGE);
+		}
+	}
+
 	m_unsent_map_edit_queue.push(new MapEditEvent(event));
 }
 
@@ -1458,6 +1558,21 @@ void Server::SendItemDef(session_t peer_id,
 	Send(&pkt);
 }
 
+void Server::SendZstdDictionary(session_t peer_id)
+{
+	std::string dict;
+	if (!getZstdDictionary(m_env->getServerMap().getZstdDictionary(), &dict))
+		return;
+
+	NetworkPacket pkt(TOCLIENT_ZSTD_DICTIONARY, 4 + dict.size(), peer_id);
+	pkt.putLongString(dict);
+
+	verbosestream << "Server: Sending zstd dictionary to id(" << peer_id
+			<< "): size=" << pkt.getSize() << std::endl;
+
+	Send(&pkt);
+}
+
 void Server::SendNodeDef(session_t peer_id,
 	const NodeDefManager *nodedef, u16 protocol_version)
 {
@@ -2372,10 +2487,9 @@ void Server::SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
 	*/
 	thread_local const int net_compression_level = m_simple_singleplayer_mode ? -1 :
 			rangelim(g_settings->getS16("map_compression_level_net"), ZSTD_minCLevel(), ZSTD_maxCLevel());
-	std::ostringstream os(std::ios_base::binary);
-	block->serialize(os, ver, false, net_compression_level);
-	block->serializeNetworkSpecific(os);
-	std::string s = os.str();
+	// Serialized once and shared by all clients using the same format
+	const std::string &s = block->getNetworkSerialization(ver,
+			net_compression_level);
 
 	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + s.size(), peer_id);
 
@@ -2386,17 +2500,60 @@ void Server::SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
 
 void Server::SendBlocks(float dtime)
 {
-	MutexAutoLock envlock(m_env_mutex);
-	//TODO check if one big lock could be faster then multiple small ones
-
 	std::vector<PrioritySortedBlockTransfer> queue;
 
 	u32 total_sending = 0;
 
+	std::vector<session_t> clients = m_clients.getClientIDs();
+
 	{
-		ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Collect list");
+		MutexAutoLock envlock(m_env_mutex);
 
-		std::vector<session_t> clients = m_clients.getClientIDs();
+		// Let the emerge threads know where the players are looking at,
+		// before the clients request new blocks
+		std::vector<EmergeViewer> viewers;
+		for (RemotePlayer *player : m_env->getPlayers()) {
+			PlayerSAO *sao = player->getPlayerSAO();
+			if (!sao)
+				continue;
+
+			EmergeViewer viewer;
+			viewer.pos = sao->getEyePosition() / (BS * MAP_BLOCKSIZE);
+			viewer.dir = v3f(0, 0, 1);
+			viewer.dir.rotateYZBy(sao->getLookPitch());
+			viewer.dir.rotateXZBy(sao->getRotation().Y);
+			viewers.push_back(viewer);
+		}
+		m_emerge->updateViewers(viewers);
+
+		m_clients.lock();
+		for (const session_t client_id : clients) {
+			RemoteClient *client = m_clients.lockedGetClientNoEx(client_id, CS_Active);
+
+			if (client)
+				client->UpdateSendView(m_env, dtime);
+		}
+		m_clients.unlock();
+	}
+
+	{
+		// The lists of blocks in sight are built without the env lock
+		ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Update frontiers");
+
+		m_clients.lock();
+		for (const session_t client_id : clients) {
+			RemoteClient *client = m_clients.lockedGetClientNoEx(client_id, CS_Active);
+
+			if (client)
+				client->UpdateSendFrontier();
+		}
+		m_clients.unlock();
+	}
+
+	MutexAutoLock envlock(m_env_mutex);
+
+	{
+		ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Collect list");
 
 		m_clients.lock();
 		for (const session_t client_id : clients) {
@@ -2406,7 +2563,7 @@ void Server::SendBlocks(float dtime)
 				continue;
 
 			total_sending += client->getSendingCount();
-			client->GetNextBlocks(m_env,m_emerge, dtime, queue);
+			client->GetNextBlocks(m_env, m_emerge, queue);
 		}
 		m_clients.unlock();
 	}
@@ -31,6 +31,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "particles.h" // ParticleParams
 #include "network/peerhandler.h"
 #include "network/address.h"
+#include "network/packetbuffer.h"
 #include "util/numeric.h"
 #include "util/thread.h"
 #include "util/basic_macros.h"
@@ -417,6 +418,7 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	void SendItemDef(session_t peer_id, IItemDefManager *itemdef, u16 protocol_version);
 	void SendNodeDef(session_t peer_id, const NodeDefManager *nodedef,
 		u16 protocol_version);
+	void SendZstdDictionary(session_t peer_id);
 
 	/* mark blocks not sent for all clients */
 	void SetBlocksNotSent(std::map<v3s16, MapBlock *>& block);
@@ -549,6 +551,7 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	float m_masterserver_timer = 0.0f;
 	float m_emergethread_trigger_timer = 0.0f;
 	float m_savemap_timer = 0.0f;
+	float m_metrics_dump_timer = 0.0f;
 	IntervalLimiter m_map_timer_and_unload_interval;
 
 	// Environment
@@ -691,6 +694,24 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	MetricCounterPtr m_aom_buffer_counter;
 	MetricCounterPtr m_packet_recv_counter;
 	MetricCounterPtr m_packet_recv_processed_counter;
+	MetricCounterPtr m_packet_sent_counter;
+	MetricCounterPtr m_packet_buffer_alloc_counter;
+	MetricCounterPtr m_packet_buffer_copy_counter;
+	MetricCounterPtr m_packet_send_alloc_counter;
+	MetricCounterPtr m_packet_send_copy_counter;
+	// Allocations on the send path since the last step, divided by the
+	// packets the server sent
+	MetricGaugePtr m_packet_send_alloc_gauge;
+	u64 m_last_packets_sent = 0;
+	PacketBuffer::Stats m_last_packet_buffer_stats;
+	PacketBuffer::Stats m_last_send_stats;
+
+	// Durations of AsyncRunStep and its phases
+	MetricHistogramPtr m_step_histogram;
+	MetricHistogramPtr m_send_blocks_histogram;
+	MetricHistogramPtr m_env_step_histogram;
+	MetricHistogramPtr m_liquid_histogram;
+	MetricHistogramPtr m_map_save_histogram;
 };
 
 /*
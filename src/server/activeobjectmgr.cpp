@@ -17,6 +17,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <algorithm>
+#include <cmath>
 #include <log.h>
 #include "mapblock.h"
 #include "profiler.h"
@@ -35,8 +37,15 @@ void ActiveObjectMgr::clear(const std::function<bool(ServerActiveObject *, u16)>
 		}
 	}
 
-	// Remove references from m_active_objects
+	// Remove references from m_active_objects and the spatial index
 	for (u16 i : objects_to_remove) {
+		ServerActiveObject *obj = m_active_objects[i];
+		auto cell_it = m_object_cells.find(i);
+		if (cell_it != m_object_cells.end()) {
+			removeFromCell(obj, cell_it->second);
+			m_object_cells.erase(cell_it);
+		}
+		m_player_ids.erase(i);
 		m_active_objects.erase(i);
 	}
 }
@@ -89,6 +98,12 @@ bool ActiveObjectMgr::registerObject(ServerActiveObject *obj)
 
 	m_active_objects[obj->getId()] = obj;
 
+	v3s16 cell = getCellPos(obj->getBasePosition());
+	addToCell(obj, cell);
+	m_object_cells[obj->getId()] = cell;
+	if (obj->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+		m_player_ids.insert(obj->getId());
+
 	verbosestream << "Server::ActiveObjectMgr::addActiveObjectRaw(): "
 			<< "Added id=" << obj->getId() << "; there are now "
 			<< m_active_objects.size() << " active objects." << std::endl;
@@ -106,40 +121,137 @@ void ActiveObjectMgr::removeObject(u16 id)
 		return;
 	}
 
+	auto cell_it = m_object_cells.find(id);
+	if (cell_it != m_object_cells.end()) {
+		removeFromCell(obj, cell_it->second);
+		m_object_cells.erase(cell_it);
+	}
+	m_player_ids.erase(id);
+
 	m_active_objects.erase(id);
 	delete obj;
 }
 
 // clang-format on
+void ActiveObjectMgr::updateObjectPos(u16 id, const v3f &pos)
+{
+	auto cell_it = m_object_cells.find(id);
+	// Not registered (yet)
+	if (cell_it == m_object_cells.end())
+		return;
+
+	v3s16 cell = getCellPos(pos);
+	if (cell == cell_it->second)
+		return;
+
+	ServerActiveObject *obj = getActiveObject(id);
+	removeFromCell(obj, cell_it->second);
+	addToCell(obj, cell);
+	cell_it->second = cell;
+}
+
+static inline s16 cell_coord(f32 f, f32 cell_size)
+{
+	f32 c = std::floor(f / cell_size);
+	if (std::isnan(c))
+		return 0;
+	return rangelim(c, (f32)S16_MIN, (f32)S16_MAX);
+}
+
+v3s16 ActiveObjectMgr::getCellPos(const v3f &pos)
+{
+	return v3s16(
+		cell_coord(pos.X, CELL_SIZE),
+		cell_coord(pos.Y, CELL_SIZE),
+		cell_coord(pos.Z, CELL_SIZE));
+}
+
+void ActiveObjectMgr::addToCell(ServerActiveObject *obj, const v3s16 &cell)
+{
+	m_cells[cell].push_back(obj);
+}
+
+void ActiveObjectMgr::removeFromCell(ServerActiveObject *obj, const v3s16 &cell)
+{
+	auto it = m_cells.find(cell);
+	if (it == m_cells.end())
+		return;
+
+	std::vector<ServerActiveObject *> &objects = it->second;
+	auto obj_it = std::find(objects.begin(), objects.end(), obj);
+	if (obj_it != objects.end()) {
+		// Order within a cell does not matter
+		*obj_it = objects.back();
+		objects.pop_back();
+	}
+
+	if (objects.empty())
+		m_cells.erase(it);
+}
+
+void ActiveObjectMgr::forEachObjectInCells(const aabb3f &box,
+		const std::function<void(ServerActiveObject *obj)> &cb)
+{
+	v3s16 cmin = getCellPos(box.MinEdge);
+	v3s16 cmax = getCellPos(box.MaxEdge);
+
+	u64 num_cells = (u64)(cmax.X - cmin.X + 1) * (cmax.Y - cmin.Y + 1) *
+			(cmax.Z - cmin.Z + 1);
+
+	if (num_cells > m_cells.size()) {
+		// Huge area: cheaper to go through the occupied cells only
+		for (auto &it : m_cells) {
+			const v3s16 &c = it.first;
+			if (c.X < cmin.X || c.X > cmax.X ||
+					c.Y < cmin.Y || c.Y > cmax.Y ||
+					c.Z < cmin.Z || c.Z > cmax.Z)
+				continue;
+			for (ServerActiveObject *obj : it.second)
+				cb(obj);
+		}
+		return;
+	}
+
+	// Iterate in s32 to not overflow at the end of the s16 range
+	for (s32 x = cmin.X; x <= cmax.X; x++)
+	for (s32 y = cmin.Y; y <= cmax.Y; y++)
+	for (s32 z = cmin.Z; z <= cmax.Z; z++) {
+		auto it = m_cells.find(v3s16(x, y, z));
+		if (it == m_cells.end())
+			continue;
+		for (ServerActiveObject *obj : it->second)
+			cb(obj);
+	}
+}
+
 void ActiveObjectMgr::getObjectsInsideRadius(const v3f &pos, float radius,
 		std::vector<ServerActiveObject *> &result,
 		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
 {
 	float r2 = radius * radius;
-	for (auto &activeObject : m_active_objects) {
-		ServerActiveObject *obj = activeObject.second;
+	aabb3f box(pos - radius, pos + radius);
+	forEachObjectInCells(box, [&](ServerActiveObject *obj) {
 		const v3f &objectpos = obj->getBasePosition();
 		if (objectpos.getDistanceFromSQ(pos) > r2)
-			continue;
+			return;
 
 		if (!include_obj_cb || include_obj_cb(obj))
 			result.push_back(obj);
-	}
+	});
 }
 
 void ActiveObjectMgr::getObjectsInArea(const aabb3f &box,
 		std::vector<ServerActiveObject *> &result,
 		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
 {
-	for (auto &activeObject : m_active_objects) {
-		ServerActiveObject *obj = activeObject.second;
+	forEachObjectInCells(box, [&](ServerActiveObject *obj) {
 		const v3f &objectpos = obj->getBasePosition();
 		if (!box.isPointInside(objectpos))
-			continue;
+			return;
 
 		if (!include_obj_cb || include_obj_cb(obj))
 			result.push_back(obj);
-	}
+	});
 }
 
 void ActiveObjectMgr::getAddedActiveObjectsAroundPos(const v3f &player_pos, f32 radius,
@@ -147,38 +259,40 @@ void ActiveObjectMgr::getAddedActiveObjectsAroundPos(const v3f &player_pos, f32
 		std::queue<u16> &added_objects)
 {
 	/*
-		Go through the object list,
+		Go through the objects around the player and every player object,
 		- discard removed/deactivated objects,
 		- discard objects that are too far away,
 		- discard objects that are found in current_objects.
 		- add remaining objects to added_objects
 	*/
-	for (auto &ao_it : m_active_objects) {
-		u16 id = ao_it.first;
-
-		// Get object
-		ServerActiveObject *object = ao_it.second;
-		if (!object)
-			continue;
-
-		if (object->isGone())
-			continue;
+	// A negative max_distance means unlimited range
+	auto consider = [&](ServerActiveObject *object, f32 max_distance) {
+		if (!object || object->isGone())
+			return;
 
 		f32 distance_f = object->getBasePosition().getDistanceFrom(player_pos);
-		if (object->getType() == ACTIVEOBJECT_TYPE_PLAYER) {
-			// Discard if too far
-			if (distance_f > player_radius && player_radius != 0)
-				continue;
-		} else if (distance_f > radius)
-			continue;
+		// Discard if too far
+		if (max_distance >= 0 && distance_f > max_distance)
+			return;
 
 		// Discard if already on current_objects
-		auto n = current_objects.find(id);
-		if (n != current_objects.end())
-			continue;
+		u16 id = object->getId();
+		if (current_objects.find(id) != current_objects.end())
+			return;
+
 		// Add to added_objects
 		added_objects.push(id);
-	}
+	};
+
+	aabb3f box(player_pos - radius, player_pos + radius);
+	forEachObjectInCells(box, [&](ServerActiveObject *object) {
+		// Players are handled below, their range may differ
+		if (object->getType() != ACTIVEOBJECT_TYPE_PLAYER)
+			consider(object, radius);
+	});
+
+	for (u16 id : m_player_ids)
+		consider(getActiveObject(id), player_radius != 0 ? player_radius : -1);
 }
 
 } // namespace server
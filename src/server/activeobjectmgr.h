@@ -20,8 +20,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include <functional>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include "../activeobjectmgr.h"
+#include "constants.h"
 #include "serveractiveobject.h"
 
 namespace server
@@ -35,6 +38,10 @@ class ActiveObjectMgr : public ::ActiveObjectMgr<ServerActiveObject>
 	bool registerObject(ServerActiveObject *obj) override;
 	void removeObject(u16 id) override;
 
+	// Must be called whenever the base position of a registered object
+	// changes, to keep the spatial index up to date
+	void updateObjectPos(u16 id, const v3f &pos);
+
 	void getObjectsInsideRadius(const v3f &pos, float radius,
 			std::vector<ServerActiveObject *> &result,
 			std::function<bool(ServerActiveObject *obj)> include_obj_cb);
@@ -45,5 +52,31 @@ class ActiveObjectMgr : public ::ActiveObjectMgr<ServerActiveObject>
 	void getAddedActiveObjectsAroundPos(const v3f &player_pos, f32 radius,
 			f32 player_radius, std::set<u16> &current_objects,
 			std::queue<u16> &added_objects);
+
+private:
+	/*
+		Spatial index
+
+		Objects are bucketed into cubic cells of CELL_SIZE, so that area
+		queries only have to visit the cells overlapping the area instead
+		of every active object.
+	*/
+	static constexpr f32 CELL_SIZE = MAP_BLOCKSIZE * BS;
+
+	static v3s16 getCellPos(const v3f &pos);
+
+	void addToCell(ServerActiveObject *obj, const v3s16 &cell);
+	void removeFromCell(ServerActiveObject *obj, const v3s16 &cell);
+
+	// Calls cb for every object within the cells overlapping box.
+	// cb must not move, add or remove objects.
+	void forEachObjectInCells(const aabb3f &box,
+			const std::function<void(ServerActiveObject *obj)> &cb);
+
+	std::unordered_map<v3s16, std::vector<ServerActiveObject *>> m_cells;
+	// Cell each registered object is currently filed under
+	std::unordered_map<u16, v3s16> m_object_cells;
+	// Players are kept apart since they can be sent at unlimited range
+	std::unordered_set<u16> m_player_ids;
 };
 } // namespace server
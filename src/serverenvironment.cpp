@@ -26,6 +26,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodemetadata.h"
 #include "gamedef.h"
 #include "map.h"
+#include "noise.h"
+#include "pathfinder.h"
 #include "porting.h"
 #include "profiler.h"
 #include "raycast.h"
@@ -35,6 +37,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/serialize.h"
 #include "util/basic_macros.h"
 #include "util/pointedthing.h"
+#include "util/workerpool.h"
 #include "threading/mutex_auto_lock.h"
 #include "filesys.h"
 #include "gameparams.h"
@@ -395,7 +398,7 @@ static std::random_device seed;
 
 ServerEnvironment::ServerEnvironment(ServerMap *map,
 	ServerScripting *scriptIface, Server *server,
-	const std::string &path_world):
+	const std::string &path_world, MetricsBackend *mb):
 	Environment(server),
 	m_map(map),
 	m_script(scriptIface),
@@ -403,6 +406,26 @@ ServerEnvironment::ServerEnvironment(ServerMap *map,
 	m_path_world(path_world),
 	m_rgen(seed())
 {
+	u32 abm_threads = g_settings->getU32("abm_threads");
+	if (abm_threads > 0)
+		m_abm_pool.reset(new WorkerPool("ABM", abm_threads));
+
+	float path_cache_time = g_settings->getFloat("pathfinder_cache_time");
+	if (path_cache_time > 0.0f)
+		m_path_cache.reset(new PathCache(path_cache_time));
+
+	const std::vector<double> &step_bounds = MetricsBackend::getStepTimeBounds();
+	m_abm_histogram = mb->addHistogram("minetest_core_step_abm_seconds",
+			"Time spent running ABMs in an environment step", step_bounds);
+	m_lbm_histogram = mb->addHistogram("minetest_core_step_lbm_seconds",
+			"Time spent running LBMs on an activated block", step_bounds);
+	m_node_timer_histogram = mb->addHistogram("minetest_core_step_node_timers_seconds",
+			"Time spent running node timers in an environment step", step_bounds);
+	m_globalstep_histogram = mb->addHistogram("minetest_core_step_globalstep_seconds",
+			"Time spent running globalsteps in an environment step", step_bounds);
+	m_object_step_histogram = mb->addHistogram("minetest_core_step_objects_seconds",
+			"Time spent stepping active objects in an environment step", step_bounds);
+
 	// Determine which database backend to use
 	std::string conf_path = path_world + DIR_DELIM + "world.mt";
 	Settings conf;
@@ -744,13 +767,46 @@ struct ActiveABM
 	bool check_required_neighbors; // false if required_neighbors is known to be empty
 	s16 min_y;
 	s16 max_y;
+	// Index into ABMHandler::m_stats
+	u32 stats_id;
+};
+
+struct ABMStats
+{
+	std::string label;
+	u32 runs = 0;
+	u64 time_us = 0;
 };
 
+// A node an ABM matched during a parallel scan, triggered afterwards
+struct ABMCandidate
+{
+	ActiveABM *aabm;
+	v3s16 p;
+	content_t c;
+};
+
+// Returns a node near a block from the 3x3x3 blocks around it.
+// p is relative to the center block and may be off by one in each direction.
+static MapNode getNodeFromNeighbors(MapBlock *const neighbors[27], v3s16 p)
+{
+	auto offset = [] (s16 c) -> s16 {
+		return c < 0 ? -1 : (c >= MAP_BLOCKSIZE ? 1 : 0);
+	};
+	v3s16 off(offset(p.X), offset(p.Y), offset(p.Z));
+	MapBlock *block = neighbors[(off.X + 1) * 9 + (off.Y + 1) * 3 + off.Z + 1];
+	if (!block)
+		return {CONTENT_IGNORE};
+	bool is_valid_position;
+	return block->getNodeNoCheck(p - off * MAP_BLOCKSIZE, &is_valid_position);
+}
+
 class ABMHandler
 {
 private:
 	ServerEnvironment *m_env;
 	std::vector<std::vector<ActiveABM> *> m_aabms;
+	std::vector<ABMStats> m_stats;
 public:
 	ABMHandler(std::vector<ABMWithState> &abms,
 		float dtime_s, ServerEnvironment *env,
@@ -760,6 +816,7 @@ class ABMHandler
 		if(dtime_s < 0.001)
 			return;
 		const NodeDefManager *ndef = env->getGameDef()->ndef();
+		std::unordered_map<std::string, u32> stats_ids;
 		for (ABMWithState &abmws : abms) {
 			ActiveBlockModifier *abm = abmws.abm;
 			float trigger_interval = abm->getTriggerInterval();
@@ -792,6 +849,16 @@ class ABMHandler
 			aabm.min_y = abm->getMinY();
 			aabm.max_y = abm->getMaxY();
 
+			// Profiler statistics, ABMs with identical labels are listed as one
+			std::string label = abm->getLabel();
+			auto stats_it = stats_ids.find(label);
+			if (stats_it == stats_ids.end()) {
+				stats_it = stats_ids.emplace(label, m_stats.size()).first;
+				m_stats.emplace_back();
+				m_stats.back().label = label;
+			}
+			aabm.stats_id = stats_it->second;
+
 			// Trigger neighbors
 			const std::vector<std::string> &required_neighbors_s =
 				abm->getRequiredNeighbors();
@@ -850,37 +917,36 @@ class ABMHandler
 		return active_object_count;
 
 	}
-	void apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached)
+
+	// Checks the content type cache of the block to see whether there are
+	// any ABMs to be run at all for it
+	bool needsScan(MapBlock *block, int &blocks_cached)
 	{
-		if(m_aabms.empty() || block->isDummy())
-			return;
+		if (block->isDummy())
+			return false;
 
-		// Check the content type cache first
-		// to see whether there are any ABMs
-		// to be run at all for this block.
 		if (block->contents_cached) {
 			blocks_cached++;
-			bool run_abms = false;
 			for (content_t c : block->contents) {
-				if (c < m_aabms.size() && m_aabms[c]) {
-					run_abms = true;
-					break;
-				}
+				if (c < m_aabms.size() && m_aabms[c])
+					return true;
 			}
-			if (!run_abms)
-				return;
-		} else {
-			// Clear any caching
-			block->contents.clear();
+			return false;
 		}
-		blocks_scanned++;
-
-		ServerMap *map = &m_env->getServerMap();
 
-		u32 active_object_count_wider;
-		u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
-		m_env->m_added_objects = 0;
+		// Clear any caching
+		block->contents.clear();
+		return true;
+	}
 
+	// Goes through the nodes of the block and calls on_match(aabm, p, n)
+	// for every node an ABM should be triggered on, filling the content
+	// type cache on the way.
+	// get_outside(p) returns nodes outside the block, rand() drives the chance.
+	template <typename GetOutside, typename Rand, typename OnMatch>
+	void scanBlock(MapBlock *block, GetOutside get_outside, Rand rand,
+		OnMatch on_match)
+	{
 		v3s16 p0;
 		for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
 		for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
@@ -905,8 +971,8 @@ class ABMHandler
 			for (ActiveABM &aabm : *m_aabms[c]) {
 				if ((p.Y < aabm.min_y) || (p.Y > aabm.max_y))
 					continue;
-				
-				if (myrand() % aabm.chance != 0)
+
+				if (rand() % aabm.chance != 0)
 					continue;
 
 				// Check neighbors
@@ -925,9 +991,8 @@ class ABMHandler
 							const MapNode &n = block->getNodeUnsafe(p1);
 							c = n.getContent();
 						} else {
-							// otherwise consult the map
-							MapNode n = map->getNode(p1 + block->getPosRelative());
-							c = n.getContent();
+							// otherwise look outside
+							c = get_outside(p1).getContent();
 						}
 						if (CONTAINS(aabm.required_neighbors, c))
 							goto neighbor_found;
@@ -937,10 +1002,47 @@ class ABMHandler
 				}
 				neighbor_found:
 
+				on_match(aabm, p, n);
+			}
+		}
+		block->contents_cached = !block->do_not_cache_contents;
+	}
+
+	void trigger(ActiveABM &aabm, v3s16 p, MapNode n,
+		u32 active_object_count, u32 active_object_count_wider)
+	{
+		u64 time_start = porting::getTimeUs();
+
+		// Call all the trigger variations
+		aabm.abm->trigger(m_env, p, n);
+		aabm.abm->trigger(m_env, p, n,
+			active_object_count, active_object_count_wider);
+
+		ABMStats &stats = m_stats[aabm.stats_id];
+		stats.runs++;
+		stats.time_us += porting::getTimeUs() - time_start;
+	}
+
+	void apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached)
+	{
+		if (m_aabms.empty() || !needsScan(block, blocks_cached))
+			return;
+		blocks_scanned++;
+
+		ServerMap *map = &m_env->getServerMap();
+
+		u32 active_object_count_wider;
+		u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
+		m_env->m_added_objects = 0;
+
+		scanBlock(block,
+			[&] (v3s16 p1) {
+				return map->getNode(p1 + block->getPosRelative());
+			},
+			myrand,
+			[&] (ActiveABM &aabm, v3s16 p, const MapNode &n) {
 				abms_run++;
-				// Call all the trigger variations
-				aabm.abm->trigger(m_env, p, n);
-				aabm.abm->trigger(m_env, p, n,
+				trigger(aabm, p, n,
 					active_object_count, active_object_count_wider);
 
 				// Count surrounding objects again if the abms added any
@@ -948,9 +1050,112 @@ class ABMHandler
 					active_object_count = countObjects(block, map, active_object_count_wider);
 					m_env->m_added_objects = 0;
 				}
+			});
+	}
+
+	// Scans the blocks on the worker pool, then triggers the matches on
+	// the calling thread. ABMs see the map as it was before the first
+	// trigger; matches whose node has been changed in the meantime are
+	// dropped. The triggers may delete or unload blocks, so the blocks are
+	// looked up again by position for the matches in them.
+	void applyParallel(WorkerPool *pool, const std::vector<v3s16> &positions,
+		int &blocks_scanned, int &abms_run, int &blocks_cached)
+	{
+		if (m_aabms.empty())
+			return;
+
+		ServerMap *map = &m_env->getServerMap();
+
+		struct BlockScan
+		{
+			v3s16 pos;
+			// Only valid until the first trigger
+			MapBlock *block;
+			MapBlock *neighbors[27];
+			u32 seed;
+			std::vector<ABMCandidate> candidates;
+		};
+		std::vector<BlockScan> scans;
+		scans.reserve(positions.size());
+		for (v3s16 pos : positions) {
+			MapBlock *block = map->getBlockNoCreateNoEx(pos);
+			if (!block || !needsScan(block, blocks_cached))
+				continue;
+			blocks_scanned++;
+
+			scans.emplace_back();
+			BlockScan &scan = scans.back();
+			scan.pos = pos;
+			scan.block = block;
+			scan.seed = myrand();
+			// The workers must not touch the map, look up the neighbors here
+			MapBlock **neighbor = scan.neighbors;
+			v3s16 d;
+			for (d.X = -1; d.X <= 1; d.X++)
+			for (d.Y = -1; d.Y <= 1; d.Y++)
+			for (d.Z = -1; d.Z <= 1; d.Z++)
+				*neighbor++ = map->getBlockNoCreateNoEx(pos + d);
+		}
+
+		pool->parallelFor(scans.size(), [&] (size_t i) {
+			BlockScan &scan = scans[i];
+			PcgRandom rand(scan.seed);
+			scanBlock(scan.block,
+				[&] (v3s16 p1) {
+					return getNodeFromNeighbors(scan.neighbors, p1);
+				},
+				[&] () { return rand.next(); },
+				[&] (ActiveABM &aabm, v3s16 p, const MapNode &n) {
+					scan.candidates.push_back({&aabm, p, n.getContent()});
+				});
+		});
+
+		for (BlockScan &scan : scans) {
+			if (scan.candidates.empty())
+				continue;
+
+			MapBlock *block = map->getBlockNoCreateNoEx(scan.pos);
+			if (!block)
+				continue;
+
+			u32 active_object_count_wider;
+			u32 active_object_count = countObjects(block, map,
+				active_object_count_wider);
+			m_env->m_added_objects = 0;
+
+			for (const ABMCandidate &candidate : scan.candidates) {
+				// An earlier trigger may have changed the node
+				MapNode n = map->getNode(candidate.p);
+				if (n.getContent() != candidate.c)
+					continue;
+
+				abms_run++;
+				trigger(*candidate.aabm, candidate.p, n,
+					active_object_count, active_object_count_wider);
+
+				// Count surrounding objects again if the abms added any
+				if(m_env->m_added_objects > 0) {
+					block = map->getBlockNoCreateNoEx(scan.pos);
+					if (!block)
+						break;
+					active_object_count = countObjects(block, map,
+						active_object_count_wider);
+					m_env->m_added_objects = 0;
+				}
 			}
 		}
-		block->contents_cached = !block->do_not_cache_contents;
+	}
+
+	// Reports the time spent in each ABM's triggers to the profiler
+	void reportStats()
+	{
+		for (const ABMStats &stats : m_stats) {
+			if (stats.runs == 0)
+				continue;
+			g_profiler->avg("ABM: " + stats.label + " runs [#]", stats.runs);
+			g_profiler->avg("ABM: " + stats.label + " [ms]",
+				stats.time_us / 1000.0f);
+		}
 	}
 };
 
@@ -990,7 +1195,10 @@ void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
 	activateObjects(block, dtime_s);
 
 	/* Handle LoadingBlockModifiers */
-	m_lbm_mgr.applyLBMs(this, block, stamp);
+	{
+		ScopeMetricTimer metric_timer(m_lbm_histogram);
+		m_lbm_mgr.applyLBMs(this, block, stamp);
+	}
 
 	// Run node timers
 	std::vector<NodeTimer> elapsed_timers =
@@ -1404,6 +1612,7 @@ void ServerEnvironment::step(float dtime)
 	*/
 	if (m_active_blocks_nodemetadata_interval.step(dtime, m_cache_nodetimer_interval)) {
 		ScopeProfiler sp(g_profiler, "ServerEnv: Run node timers", SPT_AVG);
+		ScopeMetricTimer metric_timer(m_node_timer_histogram);
 
 		float dtime = m_cache_nodetimer_interval;
 
@@ -1442,6 +1651,7 @@ void ServerEnvironment::step(float dtime)
 
 	if (m_active_block_modifier_interval.step(dtime, m_cache_abm_interval)) {
 		ScopeProfiler sp(g_profiler, "SEnv: modify in blocks avg per interval", SPT_AVG);
+		ScopeMetricTimer metric_timer(m_abm_histogram);
 		TimeTaker timer("modify in active blocks per interval");
 
 		// Initialize handling of ActiveBlockModifiers
@@ -1461,18 +1671,35 @@ void ServerEnvironment::step(float dtime)
 		int i = 0;
 		// determine the time budget for ABMs
 		u32 max_time_ms = m_cache_abm_interval * 1000 * m_cache_abm_time_budget;
-		for (const v3s16 &p : output) {
-			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
-			if (!block)
-				continue;
-
-			i++;
+		// Blocks scanned in parallel between two checks of the time budget
+		const size_t chunk_size = m_abm_pool ? 8 * (m_abm_pool->getThreadCount() + 1) : 1;
+		// Positions, as the ABMs of one block may remove the others
+		std::vector<v3s16> chunk;
+		chunk.reserve(chunk_size);
+		for (auto it = output.begin(); it != output.end();) {
+			chunk.clear();
+			for (; it != output.end() && chunk.size() < chunk_size; ++it) {
+				MapBlock *block = m_map->getBlockNoCreateNoEx(*it);
+				if (!block)
+					continue;
 
-			// Set current time as timestamp
-			block->setTimestampNoChangedFlag(m_game_time);
+				// Set current time as timestamp
+				block->setTimestampNoChangedFlag(m_game_time);
+				chunk.push_back(*it);
+			}
+			i += chunk.size();
 
 			/* Handle ActiveBlockModifiers */
-			abmhandler.apply(block, blocks_scanned, abms_run, blocks_cached);
+			if (m_abm_pool) {
+				abmhandler.applyParallel(m_abm_pool.get(), chunk,
+					blocks_scanned, abms_run, blocks_cached);
+			} else {
+				for (v3s16 pos : chunk) {
+					MapBlock *block = m_map->getBlockNoCreateNoEx(pos);
+					if (block)
+						abmhandler.apply(block, blocks_scanned, abms_run, blocks_cached);
+				}
+			}
 
 			u32 time_ms = timer.getTimerTime();
 
@@ -1483,6 +1710,7 @@ void ServerEnvironment::step(float dtime)
 				break;
 			}
 		}
+		abmhandler.reportStats();
 		g_profiler->avg("ServerEnv: active blocks", m_active_blocks.m_abm_list.size());
 		g_profiler->avg("ServerEnv: active blocks cached", blocks_cached);
 		g_profiler->avg("ServerEnv: active blocks scanned for ABMs", blocks_scanned);
@@ -1494,13 +1722,17 @@ void ServerEnvironment::step(float dtime)
 	/*
 		Step script environment (run global on_step())
 	*/
-	m_script->environment_Step(dtime);
+	{
+		ScopeMetricTimer metric_timer(m_globalstep_histogram);
+		m_script->environment_Step(dtime);
+	}
 
 	/*
 		Step active objects
 	*/
 	{
 		ScopeProfiler sp(g_profiler, "ServerEnv: Run SAO::step()", SPT_AVG);
+		ScopeMetricTimer metric_timer(m_object_step_histogram);
 
 		// This helps the objects to send data at the same time
 		bool send_recommended = false;
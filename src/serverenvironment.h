@@ -25,6 +25,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "settings.h"
 #include "server/activeobjectmgr.h"
 #include "util/numeric.h"
+#include "util/metricsbackend.h"
+#include <memory>
 #include <set>
 #include <random>
 
@@ -38,6 +40,8 @@ class AuthDatabase;
 class PlayerSAO;
 class ServerEnvironment;
 class ActiveBlockModifier;
+class WorkerPool;
+class PathCache;
 struct StaticObject;
 class ServerActiveObject;
 class Server;
@@ -71,6 +75,8 @@ class ActiveBlockModifier
 	virtual s16 getMinY() = 0;
 	// get max Y for apply abm
 	virtual s16 getMaxY() = 0;
+	// Name shown in the profiler
+	virtual std::string getLabel() { return ""; }
 	// This is called usually at interval for 1/chance of the nodes
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n){};
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n,
@@ -198,13 +204,17 @@ class ServerEnvironment : public Environment
 {
 public:
 	ServerEnvironment(ServerMap *map, ServerScripting *scriptIface,
-		Server *server, const std::string &path_world);
+		Server *server, const std::string &path_world, MetricsBackend *mb);
 	~ServerEnvironment();
 
 	Map & getMap();
 
 	ServerMap & getServerMap();
 
+	// Paths to reuse in later pathfinder searches, null if disabled
+	PathCache *getPathCache()
+	{ return m_path_cache.get(); }
+
 	//TODO find way to remove this fct!
 	ServerScripting* getScriptIface()
 	{ return m_script; }
@@ -321,6 +331,12 @@ class ServerEnvironment : public Environment
 	// Find the daylight value at pos with a Depth First Search
 	u8 findSunlight(v3s16 pos) const;
 
+	// Keep the active object spatial index in sync with object movement
+	void updateActiveObjectPos(u16 id, const v3f &pos)
+	{
+		m_ao_manager.updateObjectPos(id, pos);
+	}
+
 	// Find all active objects inside a radius around a point
 	void getObjectsInsideRadius(std::vector<ServerActiveObject *> &objects, const v3f &pos, float radius,
 			std::function<bool(ServerActiveObject *obj)> include_obj_cb)
@@ -488,6 +504,19 @@ class ServerEnvironment : public Environment
 	// Pseudo random generator for shuffling, etc.
 	std::mt19937 m_rgen;
 
+	// Scans active blocks for ABMs, null if abm_threads is 0
+	std::unique_ptr<WorkerPool> m_abm_pool;
+
+	// Null if pathfinder_cache_time is 0
+	std::unique_ptr<PathCache> m_path_cache;
+
+	// Durations of the phases of step()
+	MetricHistogramPtr m_abm_histogram;
+	MetricHistogramPtr m_lbm_histogram;
+	MetricHistogramPtr m_node_timer_histogram;
+	MetricHistogramPtr m_globalstep_histogram;
+	MetricHistogramPtr m_object_step_histogram;
+
 	// Particles
 	IntervalLimiter m_particle_management_interval;
 	std::unordered_map<u32, float> m_particle_spawners;
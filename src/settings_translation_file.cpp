@@ -445,6 +445,8 @@ fake_function() {
 	gettext("Port to connect to (UDP).\nNote that the port field in the main menu overrides this setting.");
 	gettext("Prometheus listener address");
 	gettext("Prometheus listener address.\nIf minetest is compiled with ENABLE_PROMETHEUS option enabled,\nenable metrics listener for Prometheus on that address.\nMetrics can be fetch on http://127.0.0.1:30000/metrics");
+	gettext("Metrics dump interval");
+	gettext("Interval in seconds of writing the server metrics to metrics.txt\nin the world directory, in the Prometheus text format.\nThis includes the durations of the server step phases.\n0 = disable.");
 	gettext("Saving map received from server");
 	gettext("Save the map received by the client on disk.");
 	gettext("Connect to external media server");
@@ -566,6 +568,8 @@ fake_function() {
 	gettext("Time of day when a new world is started, in millihours (0-23999).");
 	gettext("Map save interval");
 	gettext("Interval of saving important changes in the world, stated in seconds.");
+	gettext("Asynchronous map saving");
+	gettext("Write map blocks to the database on a separate thread, in batches.\nBlocks waiting to be written are kept in memory.");
 	gettext("Chat message max length");
 	gettext("Set the maximum character length of a chat message sent by clients.");
 	gettext("Chat message count limit");
@@ -618,8 +622,12 @@ fake_function() {
 	gettext("Length of time between Active Block Modifier (ABM) execution cycles");
 	gettext("ABM time budget");
 	gettext("The time budget allowed for ABMs to execute on each step\n(as a fraction of the ABM Interval)");
+	gettext("ABM threads");
+	gettext("Number of extra threads used to scan active blocks for ABMs.\nThe ABM actions themselves always run on the server thread.\n0 = scan on the server thread only.");
 	gettext("NodeTimer interval");
 	gettext("Length of time between NodeTimer execution cycles");
+	gettext("Pathfinder cache time");
+	gettext("Time in seconds a path found by minetest.find_path is reused by later\nsearches towards the same destination that start on it, as long as the\nmap along it is unchanged. The mapblock data found by \"A*_hierarchical\"\nsearches is kept as long.\n0 = always search the whole path again.");
 	gettext("Ignore world errors");
 	gettext("If enabled, invalid world data won't cause the server to shut down.\nOnly enable this if you know what you are doing.");
 	gettext("Liquid loop max");
@@ -628,6 +636,10 @@ fake_function() {
 	gettext("The time (in seconds) that the liquids queue may grow beyond processing\ncapacity until an attempt is made to decrease its size by dumping old queue\nitems.  A value of 0 disables the functionality.");
 	gettext("Liquid update tick");
 	gettext("Liquid update interval in seconds.");
+	gettext("Liquid threads");
+	gettext("Number of threads used to compute liquid flow.\nValue 0 processes the queue node by node on the server thread.\nOtherwise queued nodes are evaluated in parallel and applied in queue\norder. Nodes next to an earlier change are evaluated again, so liquids\nflow exactly as with 0.");
+	gettext("Deferred lighting");
+	gettext("Light changed nodes in one batch before their blocks are sent, saved or\nunloaded instead of after every single change.\nSpeeds up mods that set many nodes, but the light levels seen by mods\ncan lag behind until the next server step.");
 	gettext("Block send optimize distance");
 	gettext("At this distance the server will aggressively optimize which blocks are sent to\nclients.\nSmall values potentially improve performance a lot, at the expense of visible\nrendering glitches (some blocks will not be rendered under water and in caves,\nas well as sometimes on land).\nSetting this to a value greater than max_block_send_distance disables this\noptimization.\nStated in mapblocks (16 nodes).");
 	gettext("Server side occlusion culling");
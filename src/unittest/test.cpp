@@ -23,6 +23,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodedef.h"
 #include "itemdef.h"
 #include "gamedef.h"
+#include "mapblock.h"
+#include "mapsector.h"
 #include "modchannels.h"
 #include "content/mods.h"
 #include "util/numeric.h"
@@ -32,6 +34,7 @@ content_t t_CONTENT_STONE;
 content_t t_CONTENT_GRASS;
 content_t t_CONTENT_TORCH;
 content_t t_CONTENT_WATER;
+content_t t_CONTENT_WATER_FLOWING;
 content_t t_CONTENT_LAVA;
 content_t t_CONTENT_BRICK;
 
@@ -182,6 +185,8 @@ void TestGameDef::defineSomeNodes()
 	f.name = itemdef.name;
 	f.alpha = ALPHAMODE_BLEND;
 	f.liquid_type = LIQUID_SOURCE;
+	f.liquid_alternative_flowing = "default:water_flowing";
+	f.liquid_alternative_source = "default:water";
 	f.liquid_viscosity = 4;
 	f.is_ground_content = true;
 	f.groups["liquids"] = 3;
@@ -190,6 +195,27 @@ void TestGameDef::defineSomeNodes()
 	idef->registerItem(itemdef);
 	t_CONTENT_WATER = ndef->set(f.name, f);
 
+	//// Flowing water
+	itemdef = ItemDefinition();
+	itemdef.type = ITEM_NODE;
+	itemdef.name = "default:water_flowing";
+	itemdef.description = "Flowing Water";
+	f = ContentFeatures();
+	f.name = itemdef.name;
+	f.alpha = ALPHAMODE_BLEND;
+	f.drawtype = NDT_FLOWINGLIQUID;
+	f.param_type_2 = CPT2_FLOWINGLIQUID;
+	f.liquid_type = LIQUID_FLOWING;
+	f.liquid_alternative_flowing = "default:water_flowing";
+	f.liquid_alternative_source = "default:water";
+	f.liquid_viscosity = 4;
+	f.is_ground_content = true;
+	f.groups["liquids"] = 3;
+	for (TileDef &tiledef : f.tiledef)
+		tiledef.name = "default_water.png";
+	idef->registerItem(itemdef);
+	t_CONTENT_WATER_FLOWING = ndef->set(f.name, f);
+
 	//// Lava
 	itemdef = ItemDefinition();
 	itemdef.type = ITEM_NODE;
@@ -230,6 +256,8 @@ void TestGameDef::defineSomeNodes()
 	f.is_ground_content = true;
 	idef->registerItem(itemdef);
 	t_CONTENT_BRICK = ndef->set(f.name, f);
+
+	ndef->resolveCrossrefs();
 }
 
 bool TestGameDef::joinModChannel(const std::string &channel)
@@ -251,6 +279,42 @@ bool TestGameDef::sendModChannelMessage(const std::string &channel,
 	return true;
 }
 
+////
+//// TestMapWithSectors
+////
+
+MapSector *TestMapWithSectors::createSector(v2s16 p)
+{
+	MapSector *sector = getSectorNoGenerate(p);
+	if (!sector) {
+		sector = new MapSector(this, p, m_gamedef);
+		m_sectors[p] = sector;
+	}
+	return sector;
+}
+
+void TestMapWithSectors::createAirBlocks(v3s16 bmin, v3s16 bmax,
+	bool underground)
+{
+	for (s16 x = bmin.X; x <= bmax.X; x++)
+	for (s16 z = bmin.Z; z <= bmax.Z; z++) {
+		MapSector *sector = createSector(v2s16(x, z));
+		for (s16 y = bmin.Y; y <= bmax.Y; y++) {
+			MapBlock *block = sector->createBlankBlock(y);
+			block->setIsUnderground(underground);
+			MapNode *data = block->getData();
+			for (u32 i = 0; i < MapBlock::nodecount; i++)
+				data[i] = MapNode(CONTENT_AIR);
+		}
+	}
+}
+
+MapBlock *TestMapWithSectors::getBlockThroughSector(v3s16 p)
+{
+	MapSector *sector = getSectorNoGenerate(v2s16(p.X, p.Z));
+	return sector ? sector->getBlockNoCreateNoEx(p.Y) : nullptr;
+}
+
 ////
 //// run_tests
 ////
@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "irrlichttypes_extrabloated.h"
 #include "porting.h"
 #include "filesys.h"
+#include "map.h"
 #include "mapnode.h"
 
 class TestFailedException : public std::exception {
@@ -136,7 +137,25 @@ extern content_t t_CONTENT_STONE;
 extern content_t t_CONTENT_GRASS;
 extern content_t t_CONTENT_TORCH;
 extern content_t t_CONTENT_WATER;
+extern content_t t_CONTENT_WATER_FLOWING;
 extern content_t t_CONTENT_LAVA;
 extern content_t t_CONTENT_BRICK;
 
+// A map without a world behind it, for adding blocks by hand
+class TestMapWithSectors : public Map
+{
+public:
+	TestMapWithSectors(IGameDef *gamedef) : Map(gamedef) {}
+
+	MapSector *createSector(v2s16 p);
+
+	// Adds blocks full of air from blockpos bmin to bmax
+	void createAirBlocks(v3s16 bmin, v3s16 bmax, bool underground = false);
+
+	// The lookup path used before blocks were indexed
+	MapBlock *getBlockThroughSector(v3s16 p);
+
+	u32 getLiquidQueueSize() { return m_transforming_liquid.size(); }
+};
+
 bool run_tests();
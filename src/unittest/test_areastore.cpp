@@ -19,6 +19,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <algorithm>
+#include "noise.h"
+#include "porting.h"
 #include "util/areastore.h"
 
 class TestAreaStore : public TestBase {
@@ -31,7 +34,11 @@ class TestAreaStore : public TestBase {
 	void genericStoreTest(AreaStore *store);
 	void testVectorStore();
 	void testSpatialStore();
+	void testBVHStore();
+	void testBVHRandomized();
 	void testSerialization();
+	void benchStore(AreaStore *store, const char *name);
+	void benchStores();
 };
 
 static TestAreaStore g_test_instance;
@@ -42,7 +49,10 @@ void TestAreaStore::runTests(IGameDef *gamedef)
 #if USE_SPATIAL
 	TEST(testSpatialStore);
 #endif
+	TEST(testBVHStore);
+	TEST(testBVHRandomized);
 	TEST(testSerialization);
+	TEST(benchStores);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -61,6 +71,76 @@ void TestAreaStore::testSpatialStore()
 #endif
 }
 
+void TestAreaStore::testBVHStore()
+{
+	BVHAreaStore store;
+	genericStoreTest(&store);
+}
+
+static std::vector<u32> area_ids(const std::vector<Area *> &areas)
+{
+	std::vector<u32> ids;
+	for (const Area *a : areas)
+		ids.push_back(a->id);
+	std::sort(ids.begin(), ids.end());
+	return ids;
+}
+
+void TestAreaStore::testBVHRandomized()
+{
+	// Same answers as the plain list, through bulk loads and single changes
+	VectorAreaStore vector_store;
+	BVHAreaStore bvh_store;
+	vector_store.setCacheParams(false, 0, 0);
+
+	PcgRandom pr(2718);
+	std::vector<u32> ids;
+	for (u32 op = 0; op < 20000; op++) {
+		s32 action = pr.range(0, 9);
+		if (action < 4 || ids.empty()) {
+			// Sometimes many at once, like deserialize() does
+			s32 count = pr.range(0, 19) == 0 ? pr.range(2, 300) : 1;
+			for (s32 i = 0; i < count; i++) {
+				v3s16 minedge(pr.range(-300, 300), pr.range(-50, 50),
+					pr.range(-300, 300));
+				v3s16 maxedge = minedge + v3s16(pr.range(-30, 30),
+					pr.range(-10, 10), pr.range(-30, 30));
+				Area a(minedge, maxedge), b(minedge, maxedge);
+				UASSERT(vector_store.insertArea(&a));
+				UASSERT(bvh_store.insertArea(&b));
+				UASSERTEQ(u32, a.id, b.id);
+				ids.push_back(a.id);
+			}
+		} else if (action < 6) {
+			size_t i = pr.range(0, ids.size() - 1);
+			UASSERT(vector_store.removeArea(ids[i]));
+			UASSERT(bvh_store.removeArea(ids[i]));
+			ids.erase(ids.begin() + i);
+		} else if (action < 8) {
+			v3s16 pos(pr.range(-330, 330), pr.range(-60, 60),
+				pr.range(-330, 330));
+			std::vector<Area *> res_vector, res_bvh;
+			vector_store.getAreasForPos(&res_vector, pos);
+			bvh_store.getAreasForPos(&res_bvh, pos);
+			UASSERT(area_ids(res_vector) == area_ids(res_bvh));
+		} else {
+			v3s16 minedge(pr.range(-330, 330), pr.range(-60, 60),
+				pr.range(-330, 330));
+			v3s16 maxedge = minedge + v3s16(pr.range(0, 100),
+				pr.range(0, 30), pr.range(0, 100));
+			bool accept_overlap = pr.range(0, 1);
+			std::vector<Area *> res_vector, res_bvh;
+			vector_store.getAreasInArea(&res_vector, minedge, maxedge,
+				accept_overlap);
+			bvh_store.getAreasInArea(&res_bvh, minedge, maxedge,
+				accept_overlap);
+			UASSERT(area_ids(res_vector) == area_ids(res_bvh));
+		}
+		UASSERTEQ(size_t, vector_store.size(), bvh_store.size());
+	}
+	UASSERT(!bvh_store.removeArea(U32_MAX - 1));
+}
+
 void TestAreaStore::genericStoreTest(AreaStore *store)
 {
 	Area a(v3s16(-10, -3, 5), v3s16(0, 29, 7));
@@ -171,3 +251,68 @@ void TestAreaStore::testSerialization()
 	UASSERTEQ(u32, c.id, 2);
 }
 
+void TestAreaStore::benchStore(AreaStore *store, const char *name)
+{
+	// Protected areas of a busy server, a few dozen nodes across each.
+	// Kept small enough for VectorAreaStore to finish quickly.
+	const u32 count = 10000;
+	const u32 queries = 1000;
+
+	PcgRandom pr(16180);
+	u64 t_start = porting::getTimeUs();
+	for (u32 i = 0; i < count; i++) {
+		v3s16 minedge(pr.range(-20000, 20000), pr.range(-100, 100),
+			pr.range(-20000, 20000));
+		Area a(minedge, minedge + v3s16(pr.range(5, 50), pr.range(5, 50),
+			pr.range(5, 50)));
+		store->insertArea(&a);
+	}
+	u64 t_insert = porting::getTimeUs() - t_start;
+
+	// Digging and placing all over the map
+	std::vector<Area *> res;
+	size_t found = 0;
+	t_start = porting::getTimeUs();
+	for (u32 i = 0; i < queries; i++) {
+		v3s16 pos(pr.range(-20000, 20000), pr.range(-100, 100),
+			pr.range(-20000, 20000));
+		res.clear();
+		store->getAreasForPos(&res, pos);
+		found += res.size();
+	}
+	u64 t_query = porting::getTimeUs() - t_start;
+
+	// Areas being claimed and given up while players build
+	t_start = porting::getTimeUs();
+	for (u32 i = 0; i < 500; i++) {
+		v3s16 minedge(pr.range(-20000, 20000), pr.range(-100, 100),
+			pr.range(-20000, 20000));
+		Area a(minedge, minedge + v3s16(10, 10, 10));
+		store->insertArea(&a);
+		res.clear();
+		store->getAreasForPos(&res, minedge);
+		store->removeArea(a.id);
+	}
+	u64 t_change = porting::getTimeUs() - t_start;
+
+	rawstream << "-------- " << name << ", " << count << " areas: insert "
+			<< t_insert << "us, " << queries << " queries " << t_query
+			<< "us (" << found << " found), 500 changes " << t_change
+			<< "us" << std::endl;
+}
+
+void TestAreaStore::benchStores()
+{
+	// The cache only helps queries that stay close to each other
+	VectorAreaStore vector_store;
+	vector_store.setCacheParams(false, 0, 0);
+	benchStore(&vector_store, "VectorAreaStore");
+
+	BVHAreaStore bvh_store;
+	benchStore(&bvh_store, "BVHAreaStore");
+
+#if USE_SPATIAL
+	SpatialAreaStore spatial_store;
+	benchStore(&spatial_store, "SpatialAreaStore");
+#endif
+}
@@ -19,7 +19,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <cmath>
 #include "collision.h"
+#include "environment.h"
+#include "gamedef.h"
+#include "map.h"
+#include "mapblock.h"
+#include "noise.h"
+#include "porting.h"
 
 class TestCollision : public TestBase {
 public:
@@ -29,6 +36,9 @@ class TestCollision : public TestBase {
 	void runTests(IGameDef *gamedef);
 
 	void testAxisAlignedCollision();
+	void testBlockCollisionBoxes(IGameDef *gamedef);
+	void testCollisionMove(IGameDef *gamedef);
+	void benchCollisionMove(IGameDef *gamedef);
 };
 
 static TestCollision g_test_instance;
@@ -36,6 +46,49 @@ static TestCollision g_test_instance;
 void TestCollision::runTests(IGameDef *gamedef)
 {
 	TEST(testAxisAlignedCollision);
+	TEST(testBlockCollisionBoxes, gamedef);
+	TEST(testCollisionMove, gamedef);
+	TEST(benchCollisionMove, gamedef);
+}
+
+class CollisionTestEnvironment : public Environment
+{
+public:
+	CollisionTestEnvironment(IGameDef *gamedef) :
+		Environment(gamedef), m_map(gamedef)
+	{}
+
+	void step(f32 dtime) {}
+	Map &getMap() { return m_map; }
+	TestMapWithSectors &getTestMap() { return m_map; }
+	void getSelectedActiveObjects(const core::line3d<f32> &shootline_on_map,
+			std::vector<PointedThing> &objects) {}
+
+private:
+	TestMapWithSectors m_map;
+};
+
+static const v3s16 COLLISION_BLOCKS(4, 3, 4);
+
+// Hills of stone with brick pillars, the lowest blocks are at Y = -1
+static void buildCollisionTerrain(TestMapWithSectors &map, bool pillars)
+{
+	map.createAirBlocks(v3s16(0, -1, 0), COLLISION_BLOCKS - v3s16(1, 2, 1));
+
+	s16 size_x = COLLISION_BLOCKS.X * MAP_BLOCKSIZE;
+	s16 size_z = COLLISION_BLOCKS.Z * MAP_BLOCKSIZE;
+	MapNode stone(t_CONTENT_STONE);
+	MapNode brick(t_CONTENT_BRICK);
+	for (s16 x = 0; x < size_x; x++)
+	for (s16 z = 0; z < size_z; z++) {
+		s16 height = pillars ? (s16)(3 * std::sin(x * 0.3f) * std::cos(z * 0.2f)) : 0;
+		for (s16 y = -MAP_BLOCKSIZE; y <= height; y++)
+			map.setNode(v3s16(x, y, z), stone);
+		if (pillars && (x * 7 + z * 13) % 23 == 0) {
+			for (s16 y = height + 1; y <= height + 4; y++)
+				map.setNode(v3s16(x, y, z), brick);
+		}
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -178,3 +231,147 @@ void TestCollision::testAxisAlignedCollision()
 		}
 	}
 }
+
+void TestCollision::testBlockCollisionBoxes(IGameDef *gamedef)
+{
+	const NodeDefManager *ndef = gamedef->getNodeDefManager();
+	TestMapWithSectors map(gamedef);
+	map.createAirBlocks(v3s16(0, 0, 0), v3s16(0, 0, 0));
+	MapBlock *block = map.getBlockNoCreateNoEx(v3s16(0, 0, 0));
+	MapNode stone(t_CONTENT_STONE);
+	MapNode brick(t_CONTENT_BRICK);
+	MapNode air(CONTENT_AIR);
+	MapNode ignore_node(CONTENT_IGNORE);
+	block->setNodeNoCheck(v3s16(1, 2, 3), stone);
+	block->setNodeNoCheck(v3s16(4, 5, 6), ignore_node);
+
+	const u32 stone_i = (3 * MAP_BLOCKSIZE + 2) * MAP_BLOCKSIZE + 1;
+	const u32 ignore_i = (6 * MAP_BLOCKSIZE + 5) * MAP_BLOCKSIZE + 4;
+	const MapBlock::CollisionBoxes *cb = &block->getCollisionBoxes(ndef);
+	UASSERTEQ(size_t, cb->cube.count(), 1);
+	UASSERT(cb->cube[stone_i]);
+	UASSERTEQ(size_t, cb->ignore.count(), 1);
+	UASSERT(cb->ignore[ignore_i]);
+	UASSERT(cb->shaped.none() && cb->connected.none());
+	UASSERT(cb->boxes.empty());
+	UASSERTEQ(size_t, cb->shaped_first.size(), 1);
+
+	// Reused while the block is unchanged, rebuilt after a change
+	UASSERT(&block->getCollisionBoxes(ndef) == cb);
+	block->setNodeNoCheck(v3s16(1, 2, 3), air);
+	block->setNodeNoCheck(v3s16(0, 0, 0), brick);
+	cb = &block->getCollisionBoxes(ndef);
+	UASSERTEQ(size_t, cb->cube.count(), 1);
+	UASSERT(cb->cube[0] && !cb->cube[stone_i]);
+
+	// Dummy blocks collide like unloaded ones
+	MapBlock dummy_block(&map, v3s16(0, 1, 0), gamedef, true);
+	UASSERT(dummy_block.getCollisionBoxes(ndef).ignore.all());
+}
+
+void TestCollision::testCollisionMove(IGameDef *gamedef)
+{
+	CollisionTestEnvironment env(gamedef);
+	TestMapWithSectors &map = env.getTestMap();
+	buildCollisionTerrain(map, false);
+	MapNode stone(t_CONTENT_STONE);
+	MapNode brick(t_CONTENT_BRICK);
+	MapNode air(CONTENT_AIR);
+	for (s16 y = 1; y <= 3; y++)
+	for (s16 z = 0; z < COLLISION_BLOCKS.Z * MAP_BLOCKSIZE; z++)
+		map.setNode(v3s16(12, y, z), brick);
+
+	const aabb3f box(-0.3f * BS, -0.5f * BS, -0.3f * BS,
+			0.3f * BS, 1.2f * BS, 0.3f * BS);
+	const v3f gravity(0, -10 * BS, 0);
+
+	// Falls onto the ground, whose top is at Y = 0.5
+	v3f pos(8 * BS, 5 * BS, 8 * BS);
+	v3f speed;
+	collisionMoveResult res;
+	for (u32 i = 0; i < 100; i++)
+		res = collisionMoveSimple(&env, gamedef, BS * 0.5f, box, 0.6f * BS,
+				0.05f, &pos, &speed, gravity, nullptr, false);
+	UASSERT(res.touching_ground);
+	UASSERT(std::fabs(pos.Y - 1.0f * BS) < 0.01f * BS);
+	UASSERT(std::fabs(pos.X - 8 * BS) < 0.001f && speed.Y == 0);
+
+	// Stopped by the wall, whose side is at X = 11.5
+	for (u32 i = 0; i < 50; i++) {
+		speed.X = 4 * BS;
+		res = collisionMoveSimple(&env, gamedef, BS * 0.5f, box, 0.6f * BS,
+				0.05f, &pos, &speed, gravity, nullptr, false);
+	}
+	UASSERT(res.collides);
+	UASSERT(std::fabs(pos.X - 11.2f * BS) < 0.01f * BS);
+	UASSERT(std::fabs(pos.Y - 1.0f * BS) < 0.01f * BS);
+
+	// Falls into a hole dug under it
+	map.setNode(v3s16(11, 0, 8), air);
+	speed = v3f(0, 0, 0);
+	for (u32 i = 0; i < 50; i++)
+		res = collisionMoveSimple(&env, gamedef, BS * 0.5f, box, 0.6f * BS,
+				0.05f, &pos, &speed, gravity, nullptr, false);
+	UASSERT(res.touching_ground);
+	UASSERT(std::fabs(pos.Y - 0.0f * BS) < 0.01f * BS);
+
+	// Walks up onto a ledge when the step height allows it
+	pos = v3f(4 * BS, 1.0f * BS, 4 * BS);
+	speed = v3f(0, 0, 0);
+	for (s16 x = 5; x <= 9; x++)
+		map.setNode(v3s16(x, 1, 4), stone);
+	for (u32 i = 0; i < 20; i++) {
+		speed.X = 2 * BS;
+		res = collisionMoveSimple(&env, gamedef, BS * 0.5f, box, 1.1f * BS,
+				0.05f, &pos, &speed, gravity, nullptr, false);
+	}
+	UASSERT(pos.X > 5 * BS);
+	UASSERT(std::fabs(pos.Y - 2.0f * BS) < 0.01f * BS);
+
+	// Does not move outside of the loaded area
+	pos = v3f(-100 * BS, 1.0f * BS, -100 * BS);
+	speed = v3f(BS, 0, 0);
+	collisionMoveSimple(&env, gamedef, BS * 0.5f, box, 0.6f * BS,
+			0.05f, &pos, &speed, gravity, nullptr, false);
+	UASSERT(speed == v3f(0, 0, 0));
+	UASSERT(pos == v3f(-100 * BS, 1.0f * BS, -100 * BS));
+}
+
+void TestCollision::benchCollisionMove(IGameDef *gamedef)
+{
+	const u32 count = 10000;
+	const u32 steps = 10;
+
+	CollisionTestEnvironment env(gamedef);
+	buildCollisionTerrain(env.getTestMap(), true);
+
+	const aabb3f box(-0.3f * BS, -0.5f * BS, -0.3f * BS,
+			0.3f * BS, 1.2f * BS, 0.3f * BS);
+	const v3f gravity(0, -10 * BS, 0);
+	const s32 size_x = COLLISION_BLOCKS.X * MAP_BLOCKSIZE - 1;
+	const s32 size_z = COLLISION_BLOCKS.Z * MAP_BLOCKSIZE - 1;
+
+	PcgRandom pr(2718);
+	std::vector<v3f> pos(count), speed(count);
+	for (u32 i = 0; i < count; i++) {
+		pos[i] = v3f(pr.range(0, size_x * 10) * 0.1f * BS,
+				pr.range(10, 60) * 0.1f * BS, pr.range(0, size_z * 10) * 0.1f * BS);
+		speed[i] = v3f(pr.range(-40, 40) * 0.1f * BS, 0,
+				pr.range(-40, 40) * 0.1f * BS);
+	}
+
+	u32 collisions = 0;
+	u64 t_start = porting::getTimeUs();
+	for (u32 step = 0; step < steps; step++)
+	for (u32 i = 0; i < count; i++) {
+		collisionMoveResult res = collisionMoveSimple(&env, gamedef,
+				BS * 0.5f, box, 0.6f * BS, 0.05f, &pos[i], &speed[i],
+				gravity, nullptr, false);
+		collisions += res.collisions.size();
+	}
+	u64 t_total = porting::getTimeUs() - t_start;
+
+	rawstream << "-------- Collision, " << steps << " steps of " << count
+			<< " objects: " << t_total << "us, " << collisions
+			<< " collisions" << std::endl;
+}
@@ -26,6 +26,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "serialization.h"
 #include "nodedef.h"
 #include "noise.h"
+#include "util/serialize.h"
 
 class TestCompression : public TestBase {
 public:
@@ -38,6 +39,7 @@ class TestCompression : public TestBase {
 	void testZlibCompression();
 	void testZlibLargeData();
 	void testZstdLargeData();
+	void testZstdDictionary();
 	void testZlibLimit();
 	void _testZlibLimit(u32 size, u32 limit);
 };
@@ -50,6 +52,7 @@ void TestCompression::runTests(IGameDef *gamedef)
 	TEST(testZlibCompression);
 	TEST(testZlibLargeData);
 	TEST(testZstdLargeData);
+	TEST(testZstdDictionary);
 	TEST(testZlibLimit);
 }
 
@@ -212,6 +215,63 @@ void TestCompression::testZstdLargeData()
 	}
 }
 
+void TestCompression::testZstdDictionary()
+{
+	// Short samples sharing a vocabulary, like node names and metadata
+	PcgRandom pr(1234);
+	std::vector<std::string> words;
+	for (u32 i = 0; i < 64; i++) {
+		std::string word = "mod:";
+		for (u32 j = 0; j < 12; j++)
+			word += (char)pr.range('a', 'z');
+		words.push_back(word);
+	}
+	std::vector<std::string> samples;
+	for (u32 i = 0; i < 1000; i++) {
+		std::string sample;
+		for (u32 j = 0; j < 24; j++)
+			sample += words[pr.range(0, words.size() - 1)];
+		samples.push_back(sample);
+	}
+
+	std::string dict = trainZstdDictionary(samples, 4096);
+	u32 id = registerZstdDictionary(dict);
+	UASSERT(id != 0);
+	UASSERT(registerZstdDictionary("not a dictionary") == 0);
+
+	std::string stored;
+	UASSERT(getZstdDictionary(id, &stored));
+	UASSERT(stored == dict);
+
+	const std::string &data = samples[0];
+	std::ostringstream os_plain(std::ios::binary);
+	compress(data, os_plain, SER_FMT_VER_HIGHEST_WRITE);
+
+	setActiveZstdDictionary(id);
+	std::ostringstream os_dict(std::ios::binary);
+	compress(data, os_dict, SER_FMT_VER_ZSTD_DICTIONARY);
+	setActiveZstdDictionary(0);
+	UASSERT(os_dict.str().size() < os_plain.str().size());
+
+	std::istringstream is_dict(os_dict.str(), std::ios::binary);
+	std::ostringstream os_decompressed(std::ios::binary);
+	decompress(is_dict, os_decompressed, SER_FMT_VER_ZSTD_DICTIONARY);
+	UASSERT(os_decompressed.str() == data);
+
+	// Without an active dictionary the ID is 0
+	std::ostringstream os_nodict(std::ios::binary);
+	compress(data, os_nodict, SER_FMT_VER_ZSTD_DICTIONARY);
+	UASSERTEQ(u32, readU32((const u8 *)os_nodict.str().c_str()), 0);
+
+	// Data from an unknown dictionary can't be read
+	std::string unknown = os_dict.str();
+	writeU32((u8 *)&unknown[0], id + 1);
+	std::istringstream is_unknown(unknown, std::ios::binary);
+	std::ostringstream os_unknown(std::ios::binary);
+	EXCEPTION_CHECK(SerializationError,
+		decompress(is_unknown, os_unknown, SER_FMT_VER_ZSTD_DICTIONARY));
+}
+
 void TestCompression::testZlibLimit()
 {
 	// edge cases
@@ -0,0 +1,488 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include "log.h"
+#include "noise.h"
+#include "porting.h"
+#include "settings.h"
+#include "network/congestion.h"
+#include "network/mt_connection.h"
+#include "network/networkpacket.h"
+#include "network/socket.h"
+#include "threading/mutex_auto_lock.h"
+#include "threading/thread.h"
+
+class TestCongestion : public TestBase {
+public:
+	TestCongestion()
+	{
+		if (INTERNET_SIMULATOR == false)
+			TestManager::registerTestModule(this);
+	}
+
+	const char *getName() { return "TestCongestion"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testCreate();
+	void testCubicWindow();
+	void testResendTimeout();
+	void testSimulatedLink();
+	void testLossyLoopback();
+};
+
+static TestCongestion g_test_instance;
+
+void TestCongestion::runTests(IGameDef *gamedef)
+{
+	TEST(testCreate);
+	TEST(testCubicWindow);
+	TEST(testResendTimeout);
+	TEST(testSimulatedLink);
+	TEST(testLossyLoopback);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+typedef std::unique_ptr<con::CongestionController> ControllerPtr;
+
+// Any nonzero start, controllers take 0 as "never"
+static const u64 sim_start = 1000000;
+
+void TestCongestion::testCreate()
+{
+	UASSERT(ControllerPtr(con::CongestionController::create("legacy")) == nullptr);
+	UASSERT(ControllerPtr(con::CongestionController::create("foo")) == nullptr);
+
+	ControllerPtr cubic(con::CongestionController::create("cubic"));
+	ControllerPtr bbr(con::CongestionController::create("bbr"));
+	UASSERT(cubic && std::string(cubic->getName()) == "cubic");
+	UASSERT(bbr && std::string(bbr->getName()) == "bbr");
+
+	// Nothing is paced before the first round trip is known
+	UASSERTEQ(u32, cubic->getWindow(), CONGESTION_WINDOW_INITIAL);
+	UASSERT(cubic->getPacingRate() == 0.0f);
+	UASSERT(bbr->getPacingRate() == 0.0f);
+	UASSERTEQ(u32, cubic->getPacingBudget(sim_start), U32_MAX);
+	UASSERTEQ(u32, cubic->getPacingDelayMs(sim_start), 0);
+}
+
+void TestCongestion::testCubicWindow()
+{
+	ControllerPtr cc(con::CongestionController::create("cubic"));
+	u64 now = sim_start;
+
+	// Slow start, one more packet for every acknowledged one
+	UASSERT(cc->canSend(now, CONGESTION_WINDOW_INITIAL - 1));
+	UASSERT(!cc->canSend(now, CONGESTION_WINDOW_INITIAL));
+	for (u32 i = 0; i < CONGESTION_WINDOW_INITIAL; i++) {
+		now += 1000;
+		cc->onAck(now, 0.05f);
+	}
+	UASSERTEQ(u32, cc->getWindow(), CONGESTION_WINDOW_INITIAL * 2);
+
+	// A window that isn't used doesn't grow
+	cc->canSend(now, 10);
+	for (u32 i = 0; i < 100; i++)
+		cc->onAck(now, 0.05f);
+	UASSERTEQ(u32, cc->getWindow(), CONGESTION_WINDOW_INITIAL * 2);
+
+	// The timeouts of a round trip are a single loss
+	u32 before = cc->getWindow();
+	cc->onLoss(now, 5);
+	u32 reduced = cc->getWindow();
+	UASSERT(reduced >= before * 0.7f - 1 && reduced <= before * 0.7f + 1);
+	cc->onLoss(now + 10000, 3);
+	UASSERTEQ(u32, cc->getWindow(), reduced);
+	cc->onLoss(now + 100000, 1);
+	UASSERT(cc->getWindow() < reduced);
+
+	// Paced at a bit more than a window per round trip
+	float rate = cc->getPacingRate();
+	UASSERT(rate > cc->getWindow() / 0.05f && rate < 2.0f * cc->getWindow() / 0.05f);
+
+	// Never below the minimum
+	for (u32 i = 0; i < 20; i++)
+		cc->onLoss(now + 200000 * (i + 1), 1);
+	UASSERTEQ(u32, cc->getWindow(), CONGESTION_WINDOW_MIN);
+}
+
+void TestCongestion::testResendTimeout()
+{
+	ControllerPtr cc(con::CongestionController::create("cubic"));
+	UASSERT(cc->getResendTimeout() == 0.5f);
+
+	u64 now = sim_start;
+	for (u32 i = 0; i < 50; i++)
+		cc->onAck(now += 1000, 0.2f);
+	// A steady round trip time, the timeout is just above it
+	UASSERT(cc->getResendTimeout() > 0.2f && cc->getResendTimeout() < 0.25f);
+
+	// Resent packets don't tell anything
+	for (u32 i = 0; i < 50; i++)
+		cc->onAck(now += 1000, -1.0f);
+	UASSERT(cc->getResendTimeout() < 0.25f);
+
+	for (u32 i = 0; i < 50; i++)
+		cc->onAck(now += 1000, i % 2 ? 0.1f : 0.5f);
+	UASSERT(cc->getResendTimeout() > 0.5f);
+	UASSERT(cc->getResendTimeout() <= RESEND_TIMEOUT_MAX);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct LinkResult
+{
+	u32 delivered = 0;
+	u32 resent = 0;
+	u32 max_queue = 0;
+};
+
+/*
+	A bottleneck of rate packets per second with a queue of queue_limit
+	packets in front of it, delay_ms to each side and random loss, stepped
+	in milliseconds like the send thread. The receiver acks every packet.
+*/
+static LinkResult simulateLink(con::CongestionController *cc, u32 rate,
+		u32 delay_ms, u32 queue_limit, float loss, u32 duration_ms, u64 seed)
+{
+	struct Unacked
+	{
+		u64 sent;
+		bool resent;
+	};
+	std::map<u32, Unacked> unacked;
+	std::deque<u32> queue;
+	std::deque<std::pair<u64, u32>> acks;
+	std::vector<bool> received;
+	PcgRandom pr(seed);
+	LinkResult result;
+	u32 next_seqnum = 0;
+	float credit = 0.0f;
+
+	auto enqueue = [&] (u32 seqnum) {
+		if (queue.size() < queue_limit)
+			queue.push_back(seqnum);
+		result.max_queue = MYMAX(result.max_queue, (u32)queue.size());
+	};
+
+	for (u32 t = 0; t < duration_ms; t++) {
+		u64 now = sim_start + t * 1000ULL;
+
+		while (!acks.empty() && acks.front().first <= now) {
+			auto it = unacked.find(acks.front().second);
+			acks.pop_front();
+			if (it == unacked.end())
+				continue;
+			float rtt = it->second.resent ? -1.0f :
+				(now - it->second.sent) / 1e6f;
+			unacked.erase(it);
+			cc->onAck(now, rtt);
+		}
+
+		// Timed out packets go first, as in ConnectionSendThread
+		u64 timeout = cc->getResendTimeout() * 1e6f;
+		u32 budget = cc->getPacingBudget(now);
+		std::vector<u32> timed_outs;
+		for (auto &it : unacked) {
+			if (timed_outs.size() >= budget)
+				break;
+			if (now - it.second.sent < timeout)
+				continue;
+			it.second.sent = now;
+			it.second.resent = true;
+			timed_outs.push_back(it.first);
+		}
+		if (!timed_outs.empty()) {
+			cc->onLoss(now, timed_outs.size());
+			cc->onSend(timed_outs.size());
+			for (u32 seqnum : timed_outs)
+				enqueue(seqnum);
+			result.resent += timed_outs.size();
+		}
+
+		while (cc->canSend(now, unacked.size())) {
+			unacked[next_seqnum] = {now, false};
+			enqueue(next_seqnum++);
+			cc->onSend();
+		}
+
+		credit += rate / 1000.0f;
+		while (credit >= 1.0f && !queue.empty()) {
+			u32 seqnum = queue.front();
+			queue.pop_front();
+			credit -= 1.0f;
+			if (pr.range(0, 9999) < loss * 10000)
+				continue;
+			if (seqnum >= received.size())
+				received.resize(seqnum + 1, false);
+			if (!received[seqnum]) {
+				received[seqnum] = true;
+				result.delivered++;
+			}
+			acks.emplace_back(now + delay_ms * 2000ULL, seqnum);
+		}
+		if (queue.empty())
+			credit = MYMIN(credit, 1.0f);
+	}
+	return result;
+}
+
+void TestCongestion::testSimulatedLink()
+{
+	// 1000 packets per second of map blocks, 100 ms round trip
+	const u32 rate = 1000;
+	const u32 duration_ms = 20000;
+	const u32 capacity = rate * duration_ms / 1000;
+
+	struct {
+		const char *name;
+		float loss;
+		float min_utilization;
+	} cases[] = {
+		{"cubic", 0.0f, 0.8f},
+		{"bbr", 0.0f, 0.8f},
+		// Random loss is no congestion, BBR keeps the link busy
+		{"bbr", 0.01f, 0.75f},
+		{"bbr", 0.05f, 0.7f},
+	};
+
+	for (const auto &c : cases) {
+		ControllerPtr cc(con::CongestionController::create(c.name));
+		LinkResult result = simulateLink(cc.get(), rate, 50, 100, c.loss,
+			duration_ms, 42);
+		float utilization = (float)result.delivered / capacity;
+		infostream << c.name << " at " << c.loss * 100 << "% loss: "
+			<< utilization * 100 << "% used, " << result.resent
+			<< " resent, queue up to " << result.max_queue << std::endl;
+		UASSERT(utilization >= c.min_utilization);
+		// Not one long burst of resends
+		UASSERT(result.resent < result.delivered * (c.loss + 0.1f));
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static Address loopbackAddress(u16 port)
+{
+	Address address(127, 0, 0, 1, port);
+	try {
+		Address bind_addr(0, 0, 0, 0, port);
+		bind_addr.Resolve(g_settings->get("bind_address").c_str());
+		if (!bind_addr.isIPv6() && !bind_addr.isZero())
+			address = bind_addr;
+		address.setPort(port);
+	} catch (ResolveError &e) {
+	}
+	return address;
+}
+
+/*
+	Forwards the datagrams of one client to a server and back, losing and
+	delaying them like a bad link. The test changes the link while the
+	connection is running with setLink().
+*/
+class LossyRelay : public Thread
+{
+public:
+	LossyRelay(const Address &address, const Address &server) :
+		Thread("LossyRelay"),
+		m_socket(false),
+		m_server(server),
+		m_random(1234)
+	{
+		m_socket.Bind(address);
+		m_socket.setTimeoutMs(1);
+	}
+
+	// Also when a failed assertion leaves the test
+	~LossyRelay()
+	{
+		stop();
+		wait();
+	}
+
+	void setLink(float loss, u32 delay_ms)
+	{
+		MutexAutoLock lock(m_mutex);
+		m_loss = loss;
+		m_delay_ms = delay_ms;
+	}
+
+	u32 getDropped()
+	{
+		MutexAutoLock lock(m_mutex);
+		return m_dropped;
+	}
+
+private:
+	struct Delayed
+	{
+		u64 due;
+		Address destination;
+		std::string data;
+	};
+
+	void *run()
+	{
+		char buf[2048];
+		while (!stopRequested()) {
+			Address sender;
+			int size = m_socket.Receive(sender, buf, sizeof(buf));
+			u64 now = porting::getTimeMs();
+			if (size >= 0)
+				forward(now, sender, buf, size);
+
+			// The link is a queue, a smaller delay doesn't reorder
+			while (!m_delayed.empty() && m_delayed.front().due <= now) {
+				const Delayed &d = m_delayed.front();
+				m_socket.Send(d.destination, d.data.c_str(), d.data.size());
+				m_delayed.pop_front();
+			}
+		}
+		return nullptr;
+	}
+
+	void forward(u64 now, Address &sender, const char *data, int size)
+	{
+		Address destination = m_server;
+		if (sender == m_server)
+			destination = m_client;
+		else
+			m_client = sender;
+
+		MutexAutoLock lock(m_mutex);
+		if (m_random.range(0, 9999) < m_loss * 10000) {
+			m_dropped++;
+			return;
+		}
+		m_delayed.push_back({now + m_delay_ms, destination,
+			std::string(data, size)});
+	}
+
+	UDPSocket m_socket;
+	Address m_server;
+	Address m_client;
+	std::deque<Delayed> m_delayed;
+
+	std::mutex m_mutex;
+	PcgRandom m_random;
+	float m_loss = 0.0f;
+	u32 m_delay_ms = 0;
+	u32 m_dropped = 0;
+};
+
+struct LoopbackHandler : public con::PeerHandler
+{
+	void peerAdded(con::Peer *peer) { peer_id = peer->id; }
+	void deletingPeer(con::Peer *peer, bool timeout) { peer_id = 0; }
+
+	session_t peer_id = 0;
+};
+
+static bool receiveAny(con::Connection &connection, NetworkPacket *pkt)
+{
+	try {
+		connection.Receive(pkt);
+		return true;
+	} catch (con::NoIncomingDataException &e) {
+		return false;
+	}
+}
+
+void TestCongestion::testLossyLoopback()
+{
+	// Map blocks sent to a client over a link that gets worse and recovers
+	const u32 proto_id = 0xad26846a;
+	const u32 count = 300;
+	const std::string old_setting = g_settings->get("congestion_control");
+	const char *names[] = {"legacy", "cubic", "bbr"};
+
+	Address server_address = loopbackAddress(30004);
+	Address relay_address = loopbackAddress(30005);
+
+	try {
+		for (const char *name : names) {
+			g_settings->set("congestion_control", name);
+			LossyRelay relay(relay_address, server_address);
+			relay.setLink(0.05f, 20);
+			relay.start();
+
+			LoopbackHandler hand_server, hand_client;
+			con::Connection server(proto_id, 512, 5.0, false, &hand_server);
+			con::Connection client(proto_id, 512, 5.0, false, &hand_client);
+			server.SetTimeoutMs(10);
+			client.SetTimeoutMs(10);
+			server.Serve(server_address);
+			client.Connect(relay_address);
+
+			u64 t_start = porting::getTimeMs();
+			while (!client.Connected() || hand_server.peer_id == 0) {
+				UASSERT(porting::getTimeMs() - t_start < 10000);
+				NetworkPacket pkt_server, pkt_client;
+				receiveAny(server, &pkt_server);
+				receiveAny(client, &pkt_client);
+			}
+
+			t_start = porting::getTimeMs();
+			for (u32 i = 0; i < count; i++) {
+				NetworkPacket data(0x42, 1000);
+				data << i;
+				server.Send(hand_server.peer_id, 2, &data, true);
+			}
+
+			u32 received = 0;
+			while (received < count) {
+				UASSERT(porting::getTimeMs() - t_start < 60000);
+				NetworkPacket pkt_server, pkt;
+				receiveAny(server, &pkt_server);
+				if (!receiveAny(client, &pkt))
+					continue;
+				UASSERTEQ(u16, pkt.getCommand(), 0x42);
+				UASSERTEQ(u32, pkt.getSize(), 1000);
+				u32 index;
+				pkt >> index;
+				UASSERTEQ(u32, index, received);
+				received++;
+
+				if (received == count / 3)
+					relay.setLink(0.2f, 50);
+				else if (received == count * 2 / 3)
+					relay.setLink(0.0f, 5);
+			}
+			u64 t_total = porting::getTimeMs() - t_start;
+
+			rawstream << "-------- Lossy loopback, " << name << ": " << count
+					<< " packets in " << t_total << "ms, " << relay.getDropped()
+					<< " datagrams lost" << std::endl;
+
+			client.Disconnect();
+		}
+	} catch (...) {
+		g_settings->set("congestion_control", old_setting);
+		throw;
+	}
+
+	g_settings->set("congestion_control", old_setting);
+}
@@ -19,9 +19,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <algorithm>
+#include <functional>
 #include "log.h"
+#include "noise.h"
 #include "porting.h"
 #include "settings.h"
+#include "threading/semaphore.h"
+#include "threading/thread.h"
 #include "util/serialize.h"
 #include "network/mt_connection.h"
 #include "network/networkpacket.h"
@@ -41,7 +46,16 @@ class TestConnection : public TestBase {
 
 	void testNetworkPacketSerialize();
 	void testHelpers();
+	void testPacketBuffer();
+	void benchPacketConstruction();
 	void testConnectSendReceive();
+	void testSocketBatch();
+	void benchLoopbackThroughput();
+	void testReliablePacketBuffer();
+	void testIncomingSplitBuffer();
+	void benchLossyReliableWindow();
+	void testPeerTable();
+	void benchPeerTableContention();
 };
 
 static TestConnection g_test_instance;
@@ -50,7 +64,16 @@ void TestConnection::runTests(IGameDef *gamedef)
 {
 	TEST(testNetworkPacketSerialize);
 	TEST(testHelpers);
+	TEST(testPacketBuffer);
+	TEST(benchPacketConstruction);
 	TEST(testConnectSendReceive);
+	TEST(testSocketBatch);
+	TEST(benchLoopbackThroughput);
+	TEST(testReliablePacketBuffer);
+	TEST(testIncomingSplitBuffer);
+	TEST(benchLossyReliableWindow);
+	TEST(testPeerTable);
+	TEST(benchPeerTableContention);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -119,7 +142,7 @@ void TestConnection::testHelpers()
 	u32 proto_id = 0x12345678;
 	session_t peer_id = 123;
 	u8 channel = 2;
-	SharedBuffer<u8> data1(1);
+	PacketBuffer data1(1);
 	data1[0] = 100;
 	Address a(127,0,0,1, 10);
 	const u16 seqnum = 34352;
@@ -142,7 +165,7 @@ void TestConnection::testHelpers()
 
 	//infostream<<"initial data1[0]="<<((u32)data1[0]&0xff)<<std::endl;
 
-	SharedBuffer<u8> p2 = con::makeReliablePacket(data1, seqnum);
+	PacketBuffer p2 = con::makeReliablePacket(data1, seqnum);
 
 	/*infostream<<"p2.getSize()="<<p2.getSize()<<", data1.getSize()="
 			<<data1.getSize()<<std::endl;
@@ -156,6 +179,122 @@ void TestConnection::testHelpers()
 	UASSERT(readU8(&p2[3]) == data1[0]);
 }
 
+void TestConnection::testPacketBuffer()
+{
+	NetworkPacket pkt(0x1234, 0);
+	pkt << (u32)0xdeadbeef;
+	PacketBuffer data = pkt.forgePacket();
+	UASSERTEQ(u32, data.getSize(), 6);
+	UASSERT(readU16(&data[0]) == 0x1234);
+	UASSERT(readU32(&data[2]) == 0xdeadbeef);
+
+	// The headers go in front of the data of the packet, without a copy
+	PacketBuffer::Stats before = PacketBuffer::getStats();
+	Address a(127, 0, 0, 1, 10);
+	PacketBuffer reliable = con::makeReliablePacket(data, 7);
+	con::BufferedPacket p = con::makePacket(a, reliable, 1, 2, 3);
+	UASSERT(*p.data + BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE == *data);
+	UASSERTEQ(u64, PacketBuffer::getStats().copied, before.copied);
+	UASSERT(readU16(&p.data[BASE_HEADER_SIZE + 1]) == 7);
+
+	// Another copy can't write its headers there too
+	PacketBuffer reliable2 = con::makeReliablePacket(data, 8);
+	UASSERT(*reliable2 + RELIABLE_HEADER_SIZE != *data);
+	UASSERTEQ(u64, PacketBuffer::getStats().copied, before.copied + 1);
+	UASSERT(readU16(&reliable2[1]) == 8);
+	UASSERT(readU16(&p.data[BASE_HEADER_SIZE + 1]) == 7);
+	UASSERT(readU32(&reliable2[5]) == 0xdeadbeef);
+
+	// Writing to the packet doesn't change what was queued
+	pkt << (u8)1;
+	UASSERTEQ(u32, p.data.getSize(),
+		BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE + 6);
+	UASSERT(readU32(&p.data[BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE + 2])
+		== 0xdeadbeef);
+	UASSERT(pkt.forgePacket().getSize() == 7);
+
+	// Large packets are split in chunks with room for the other headers
+	NetworkPacket big(0x10, 3000);
+	std::list<PacketBuffer> chunks;
+	u16 split_seqnum = 5;
+	con::makeAutoSplitPacket(big.forgePacket(), 1000, split_seqnum, &chunks);
+	UASSERTEQ(u16, split_seqnum, 6);
+	UASSERTEQ(size_t, chunks.size(), 4);
+	for (PacketBuffer &chunk : chunks) {
+		UASSERT(readU8(&chunk[0]) == con::PACKET_TYPE_SPLIT);
+		UASSERT(readU16(&chunk[3]) == 4);
+		const u8 *front = *chunk;
+		con::makePacket(a, con::makeReliablePacket(chunk, 1), 1, 2, 3);
+		UASSERT(*chunk == front);
+	}
+
+	// Freed buffers are used again
+	before = PacketBuffer::getStats();
+	for (int i = 0; i < 100; i++) {
+		NetworkPacket pkt2(0x20, 500);
+		con::makePacket(a, pkt2.forgePacket(), 1, 2, 3);
+	}
+	PacketBuffer::Stats after = PacketBuffer::getStats();
+	UASSERTEQ(u64, after.acquired - before.acquired, 100);
+	UASSERT(after.allocated - before.allocated <= 1);
+
+	// Writing a packet bit by bit is counted for it, and only once
+	PacketBuffer::Stats thread_before = PacketBuffer::getThreadStats();
+	NetworkPacket written(0x30, 0);
+	for (int i = 0; i < 1000; i++)
+		written << (u8)i;
+	PacketBuffer::Stats thread_diff =
+		PacketBuffer::getThreadStats() - thread_before;
+	PacketBuffer::Stats written_stats = written.takeBufferStats();
+	UASSERT(written_stats.copied > 0);
+	UASSERTEQ(u64, written_stats.acquired, thread_diff.acquired);
+	UASSERTEQ(u64, written_stats.copied, thread_diff.copied);
+	UASSERTEQ(u64, written.takeBufferStats().acquired, 0);
+}
+
+void TestConnection::benchPacketConstruction()
+{
+	const u32 count = 100000;
+	const u32 size = 200;
+	Address a(127, 0, 0, 1, 10);
+
+	// Like the send path used to do: one copy per header
+	u64 t_start = porting::getTimeUs();
+	for (u32 i = 0; i < count; i++) {
+		NetworkPacket pkt(0x20, size);
+		Buffer<u8> data = pkt.oldForgePacket();
+		SharedBuffer<u8> original(data.getSize() + ORIGINAL_HEADER_SIZE);
+		writeU8(&original[0], con::PACKET_TYPE_ORIGINAL);
+		memcpy(&original[ORIGINAL_HEADER_SIZE], *data, data.getSize());
+		SharedBuffer<u8> reliable(original.getSize() + RELIABLE_HEADER_SIZE);
+		writeU8(&reliable[0], con::PACKET_TYPE_RELIABLE);
+		writeU16(&reliable[1], i);
+		memcpy(&reliable[RELIABLE_HEADER_SIZE], *original, original.getSize());
+		con::makePacket(a, reliable, 1, 2, 3);
+	}
+	u64 t_copy = porting::getTimeUs() - t_start;
+
+	PacketBuffer::Stats before = PacketBuffer::getStats();
+	t_start = porting::getTimeUs();
+	for (u32 i = 0; i < count; i++) {
+		NetworkPacket pkt(0x20, size);
+		std::list<PacketBuffer> originals;
+		u16 split_seqnum = 0;
+		con::makeAutoSplitPacket(pkt.forgePacket(), 1000, split_seqnum,
+			&originals);
+		con::makePacket(a, con::makeReliablePacket(originals.front(), i),
+			1, 2, 3);
+	}
+	u64 t_pooled = porting::getTimeUs() - t_start;
+	PacketBuffer::Stats after = PacketBuffer::getStats();
+
+	rawstream << "-------- " << count << " reliable packets of " << size
+			<< " bytes: copied headers " << t_copy << "us, in place "
+			<< t_pooled << "us (" << after.allocated - before.allocated
+			<< " allocations, " << after.copied - before.copied
+			<< " copies)" << std::endl;
+}
+
 
 void TestConnection::testConnectSendReceive()
 {
@@ -326,7 +465,10 @@ void TestConnection::testConnectSendReceive()
 
 		auto sentdata = pkt.oldForgePacket();
 
+		PacketBuffer::Stats send_before = server.getSendStats();
 		server.Send(peer_id_client, 0, &pkt, true);
+		// At least the buffer the packet was written to
+		UASSERT(server.getSendStats().acquired > send_before.acquired);
 
 		//sleep_ms(3000);
 
@@ -376,3 +518,508 @@ void TestConnection::testConnectSendReceive()
 	UASSERT(hand_server.count == 1);
 	UASSERT(hand_server.last_id == 2);
 }
+
+// Binds to 127.0.0.1, or to bind_address when there is no localhost
+static Address bindLoopback(UDPSocket &socket, u16 port)
+{
+	Address address(127, 0, 0, 1, port);
+	try {
+		Address bind_addr(0, 0, 0, 0, port);
+		bind_addr.Resolve(g_settings->get("bind_address").c_str());
+		if (!bind_addr.isIPv6() && !bind_addr.isZero())
+			address = bind_addr;
+		address.setPort(port);
+	} catch (ResolveError &e) {
+	}
+
+	socket.Bind(address);
+	socket.setTimeoutMs(100);
+	return address;
+}
+
+static void fillDatagrams(std::vector<UDPDatagram> &datagrams, Buffer<u8> &data,
+		const Address &address, int size, u32 first)
+{
+	for (u32 i = 0; i < datagrams.size(); i++) {
+		datagrams[i].address = address;
+		datagrams[i].data = &data[i * size];
+		datagrams[i].size = size - i % 7;
+		writeU32(datagrams[i].data, first + i);
+	}
+}
+
+void TestConnection::testSocketBatch()
+{
+	const int size = 500;
+	UDPSocket socket(false);
+	Address address = bindLoopback(socket, 30002);
+
+	std::vector<UDPDatagram> sent(UDP_BATCH_SIZE + 10);
+	Buffer<u8> sent_data(sent.size() * size);
+	fillDatagrams(sent, sent_data, address, size, 0);
+	UASSERTEQ(u32, socket.SendBatch(sent.data(), sent.size()), sent.size());
+
+	std::vector<UDPDatagram> received(UDP_BATCH_SIZE);
+	Buffer<u8> received_data(received.size() * size);
+	for (u32 i = 0; i < received.size(); i++)
+		received[i].data = &received_data[i * size];
+
+	// The datagrams arrive in order, in one or more batches
+	u32 next = 0;
+	while (next < sent.size()) {
+		u32 count = socket.ReceiveBatch(received.data(), received.size(), size);
+		UASSERT(count > 0);
+		for (u32 i = 0; i < count; i++, next++) {
+			UASSERT(received[i].address == address);
+			UASSERTEQ(int, received[i].size, sent[next].size);
+			UASSERT(memcmp(received[i].data, sent[next].data,
+				sent[next].size) == 0);
+		}
+	}
+	UASSERTEQ(u32, socket.ReceiveBatch(received.data(), received.size(), size), 0);
+}
+
+void TestConnection::benchLoopbackThroughput()
+{
+	const int size = 1024;
+	const u32 rounds = 500;
+
+	UDPSocket socket(false);
+	Address address = bindLoopback(socket, 30002);
+
+	std::vector<UDPDatagram> datagrams(UDP_BATCH_SIZE);
+	Buffer<u8> data(datagrams.size() * size);
+	fillDatagrams(datagrams, data, address, size, 0);
+	Buffer<u8> recv_data(size);
+	Address sender;
+
+	// One system call per datagram, as the connection threads used to do
+	u32 received_single = 0;
+	u64 t_start = porting::getTimeUs();
+	for (u32 round = 0; round < rounds; round++) {
+		for (const UDPDatagram &datagram : datagrams)
+			socket.Send(datagram.address, datagram.data, datagram.size);
+		for (u32 i = 0; i < datagrams.size(); i++) {
+			if (socket.Receive(sender, *recv_data, size) < 0)
+				break;
+			received_single++;
+		}
+	}
+	u64 t_single = porting::getTimeUs() - t_start;
+
+	std::vector<UDPDatagram> received(UDP_BATCH_SIZE);
+	Buffer<u8> received_data(received.size() * size);
+	for (u32 i = 0; i < received.size(); i++)
+		received[i].data = &received_data[i * size];
+
+	u32 received_batch = 0;
+	t_start = porting::getTimeUs();
+	for (u32 round = 0; round < rounds; round++) {
+		socket.SendBatch(datagrams.data(), datagrams.size());
+		for (u32 left = datagrams.size(); left > 0;) {
+			u32 count = socket.ReceiveBatch(received.data(), left, size);
+			if (count == 0)
+				break;
+			received_batch += count;
+			left -= count;
+		}
+	}
+	u64 t_batch = porting::getTimeUs() - t_start;
+
+	rawstream << "-------- Loopback UDP, " << rounds * datagrams.size()
+			<< " datagrams of " << size << " bytes: single " << t_single
+			<< "us (" << received_single << " received), batched " << t_batch
+			<< "us (" << received_batch << " received)" << std::endl;
+}
+
+static con::BufferedPacket reliablePacket(u16 seqnum, u32 size = 16)
+{
+	con::BufferedPacket p(BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE + size);
+	memset(*p.data, 0, p.data.getSize());
+	writeU8(&p.data[BASE_HEADER_SIZE], con::PACKET_TYPE_RELIABLE);
+	writeU16(&p.data[BASE_HEADER_SIZE + 1], seqnum);
+	p.address = Address(127, 0, 0, 1, 30000);
+	return p;
+}
+
+static u16 seqnumOf(const con::BufferedPacket &p)
+{
+	return readU16(&p.data[BASE_HEADER_SIZE + 1]);
+}
+
+void TestConnection::testReliablePacketBuffer()
+{
+	// Incoming packets out of order, across the wrap around
+	con::ReliablePacketBuffer buf;
+	const u16 next_expected = 65530;
+	for (u16 seqnum : {65533, 2, 65531, 65535, 0, 65533})
+		buf.insert(reliablePacket(seqnum), next_expected);
+	// The next expected one is never buffered
+	buf.insert(reliablePacket(next_expected), next_expected);
+	UASSERTEQ(u32, buf.size(), 5);
+
+	// A different packet with the same seqnum
+	try {
+		buf.insert(reliablePacket(0, 100), next_expected);
+		UASSERT(false);
+	} catch (con::IncomingDataCorruption &e) {
+	}
+
+	u16 first = 0;
+	UASSERT(buf.getFirstSeqnum(first));
+	UASSERTEQ(u16, first, 65531);
+	UASSERTEQ(u16, seqnumOf(buf.popSeqnum(65535)), 65535);
+	try {
+		buf.popSeqnum(65535);
+		UASSERT(false);
+	} catch (con::NotFoundException &e) {
+	}
+	for (u16 seqnum : {65531, 65533, 0, 2})
+		UASSERTEQ(u16, seqnumOf(buf.popFirst()), seqnum);
+	UASSERT(buf.empty());
+	UASSERT(!buf.getFirstSeqnum(first));
+
+	// Outgoing packets acknowledged in any order, more than fit at first
+	const u16 start = 65000;
+	for (u32 i = 0; i < 2000; i++) {
+		u16 seqnum = start + i;
+		buf.insert(reliablePacket(seqnum),
+			seqnum + 1 - MAX_RELIABLE_WINDOW_SIZE);
+	}
+	UASSERTEQ(u32, buf.size(), 2000);
+	for (u32 i = 0; i < 2000; i += 2)
+		buf.popSeqnum(start + 1999 - i);
+	UASSERTEQ(u32, buf.size(), 1000);
+	UASSERT(buf.getFirstSeqnum(first));
+	UASSERTEQ(u16, first, start);
+
+	buf.incrementTimeouts(1.0f);
+	// Without a budget nothing is resent
+	UASSERT(buf.getTimedOuts(0.5f, 0).empty());
+	auto timed_outs = buf.getTimedOuts(0.5f, 10);
+	UASSERTEQ(size_t, timed_outs.size(), 10);
+	for (u32 i = 0; i < 10; i++) {
+		UASSERTEQ(u16, seqnumOf(timed_outs[i]), (u16)(start + i * 2));
+		UASSERTEQ(u32, timed_outs[i].resend_count, 1);
+	}
+	// Resending restarts their timeout
+	timed_outs = buf.getTimedOuts(0.5f, 2000);
+	UASSERTEQ(size_t, timed_outs.size(), 990);
+
+	for (u32 i = 0; i < 1000; i++)
+		UASSERTEQ(u16, seqnumOf(buf.popFirst()), (u16)(start + i * 2));
+	UASSERT(buf.empty());
+
+	// Two packets at the ends of the window take little more than their
+	// own space, and nothing is kept once they are gone
+	const size_t empty_usage = buf.memoryUsage();
+	buf.insert(reliablePacket(next_expected + 1), next_expected);
+	buf.insert(reliablePacket(next_expected + MAX_RELIABLE_WINDOW_SIZE - 1),
+		next_expected);
+	UASSERT(buf.memoryUsage() <= MAX_RELIABLE_WINDOW_SIZE * sizeof(u16) +
+		empty_usage + 4 * sizeof(con::BufferedPacket));
+	buf.popFirst();
+	buf.popFirst();
+	UASSERT(buf.empty());
+	UASSERT(buf.memoryUsage() <=
+		empty_usage + 4 * sizeof(con::BufferedPacket));
+}
+
+static con::BufferedPacket splitPacket(u16 seqnum, u16 chunk_count,
+		u16 chunk_num, const std::string &data)
+{
+	con::BufferedPacket p(BASE_HEADER_SIZE + 7 + data.size());
+	writeU8(&p.data[BASE_HEADER_SIZE], con::PACKET_TYPE_SPLIT);
+	writeU16(&p.data[BASE_HEADER_SIZE + 1], seqnum);
+	writeU16(&p.data[BASE_HEADER_SIZE + 3], chunk_count);
+	writeU16(&p.data[BASE_HEADER_SIZE + 5], chunk_num);
+	memcpy(&p.data[BASE_HEADER_SIZE + 7], data.c_str(), data.size());
+	return p;
+}
+
+static std::string bufferString(const SharedBuffer<u8> &buf)
+{
+	return std::string((const char *)*buf, buf.getSize());
+}
+
+void TestConnection::testIncomingSplitBuffer()
+{
+	con::IncomingSplitBuffer buf;
+
+	// Two packets with their chunks mixed, one chunk sent twice
+	UASSERTEQ(u32, buf.insert(splitPacket(7, 3, 2, "ghi"), true).getSize(), 0);
+	UASSERTEQ(u32, buf.insert(splitPacket(8, 2, 1, "world"), true).getSize(), 0);
+	UASSERTEQ(u32, buf.insert(splitPacket(7, 3, 0, "abc"), true).getSize(), 0);
+	UASSERTEQ(u32, buf.insert(splitPacket(7, 3, 0, "abc"), true).getSize(), 0);
+	// A chunk count not matching the first chunk
+	UASSERTEQ(u32, buf.insert(splitPacket(7, 4, 1, "def"), true).getSize(), 0);
+	UASSERT(bufferString(buf.insert(splitPacket(7, 3, 1, "de"), true)) ==
+		"abcdeghi");
+	UASSERT(bufferString(buf.insert(splitPacket(8, 2, 0, "hello "), true)) ==
+		"hello world");
+
+	// The same seqnum again, in the arena of a finished packet
+	UASSERTEQ(u32, buf.insert(splitPacket(7, 2, 1, "y"), false).getSize(), 0);
+	UASSERT(bufferString(buf.insert(splitPacket(7, 2, 0, "x"), false)) == "xy");
+
+	// Only unreliable packets time out
+	buf.insert(splitPacket(9, 2, 0, "lost"), false);
+	buf.insert(splitPacket(10, 2, 0, "kept "), true);
+	buf.removeUnreliableTimedOuts(1.0f, 0.5f);
+	UASSERTEQ(u32, buf.insert(splitPacket(9, 2, 1, "!"), false).getSize(), 0);
+	UASSERT(bufferString(buf.insert(splitPacket(10, 2, 1, "data"), true)) ==
+		"kept data");
+
+	// The chunk count is not trusted for allocating
+	const std::string chunk(500, 'x');
+	buf.insert(splitPacket(11, 65535, 0, chunk), true);
+	UASSERT(buf.memoryUsage() < 4 * chunk.size());
+	// Nor is the chunk number
+	buf.insert(splitPacket(12, 65535, 65534, chunk), true);
+	UASSERT(buf.memoryUsage() < 16 * 1024);
+}
+
+void TestConnection::benchLossyReliableWindow()
+{
+	// A download over a mobile link losing 5% of the packets, with acks
+	// and resends going through the buffers like in the connection threads
+	const u32 packets = 200000;
+	const u32 window = 2048;
+	const u32 per_step = 256;
+
+	con::ReliablePacketBuffer sent, received;
+	u16 next_outgoing = SEQNUM_INITIAL;
+	u16 next_incoming = SEQNUM_INITIAL;
+	u32 queued = 0, delivered = 0, lost = 0, resent = 0;
+	PcgRandom pr(5);
+
+	auto transmit = [&] (const con::BufferedPacket &p) {
+		if (pr.range(0, 99) < 5) {
+			lost++;
+			return;
+		}
+		u16 seqnum = seqnumOf(p);
+		try {
+			sent.popSeqnum(seqnum);
+		} catch (con::NotFoundException &e) {
+		}
+
+		if (seqnum == next_incoming) {
+			next_incoming++;
+			delivered++;
+		} else if (con::seqnum_higher(seqnum, next_incoming)) {
+			received.insert(p, next_incoming);
+		}
+		u16 first;
+		while (received.getFirstSeqnum(first) && first == next_incoming) {
+			received.popFirst();
+			next_incoming++;
+			delivered++;
+		}
+	};
+
+	u64 t_start = porting::getTimeUs();
+	while (delivered < packets) {
+		for (u32 i = 0; i < per_step && queued < packets &&
+				sent.size() < window; i++, queued++) {
+			con::BufferedPacket p = reliablePacket(next_outgoing++, 512);
+			sent.insert(p, next_outgoing - MAX_RELIABLE_WINDOW_SIZE);
+			transmit(p);
+		}
+
+		sent.incrementTimeouts(0.05f);
+		for (const con::BufferedPacket &p : sent.getTimedOuts(0.2f, per_step)) {
+			resent++;
+			transmit(p);
+		}
+	}
+	u64 t_total = porting::getTimeUs() - t_start;
+
+	UASSERT(sent.empty() && received.empty());
+	rawstream << "-------- Reliable window of " << window << ", " << packets
+			<< " packets with 5% loss: " << t_total << "us, " << lost
+			<< " lost, " << resent << " resent" << std::endl;
+}
+
+// A connection that doesn't serve, with its peer table made public
+class PeerTableConnection : public con::Connection
+{
+public:
+	PeerTableConnection() :
+		con::Connection(0x12345678, 512, 30.0f, false, nullptr)
+	{
+	}
+
+	using con::Connection::createPeer;
+	using con::Connection::deletePeer;
+	using con::Connection::getPeerIDs;
+	using con::Connection::getPeerNoEx;
+};
+
+static std::vector<session_t> createPeers(PeerTableConnection &con, u16 count)
+{
+	std::vector<session_t> peer_ids;
+	// The port of testConnectSendReceive, the test server is gone by now
+	Address address(127, 0, 0, 1, 30001);
+	for (u16 i = 0; i < count; i++)
+		peer_ids.push_back(con.createPeer(address, con::MTP_MINETEST_RELIABLE_UDP, 0));
+	return peer_ids;
+}
+
+// Takes PeerHelpers of random peers, like the connection threads do
+class PeerLookupThread : public Thread
+{
+public:
+	PeerLookupThread(const std::function<bool(session_t)> &lookup,
+			const std::vector<session_t> &peer_ids, u32 lookups,
+			Semaphore &start, u32 seed) :
+		Thread("PeerLookup"),
+		m_lookup(lookup),
+		m_peer_ids(peer_ids),
+		m_lookups(lookups),
+		m_start(start),
+		m_seed(seed)
+	{
+	}
+
+	u32 found = 0;
+
+private:
+	void *run()
+	{
+		PcgRandom pr(m_seed);
+		m_start.wait();
+		// Until stopped, if no number of lookups is given
+		for (u32 i = 0; m_lookups ? i < m_lookups : !stopRequested(); i++) {
+			if (m_lookup(m_peer_ids[pr.range(0, m_peer_ids.size() - 1)]))
+				found++;
+		}
+		return nullptr;
+	}
+
+	std::function<bool(session_t)> m_lookup;
+	std::vector<session_t> m_peer_ids;
+	u32 m_lookups;
+	Semaphore &m_start;
+	u32 m_seed;
+};
+
+void TestConnection::testPeerTable()
+{
+	PeerTableConnection con;
+	std::vector<session_t> peer_ids = createPeers(con, 300);
+	UASSERTEQ(size_t, con.getPeerIDs().size(), 300);
+	for (session_t peer_id : peer_ids) {
+		con::PeerHelper peer = con.getPeerNoEx(peer_id);
+		UASSERT(!!peer && peer->id == peer_id);
+	}
+	UASSERT(!con.getPeerNoEx(PEER_ID_SERVER));
+
+	// A peer in use is deleted when the last user lets it go
+	{
+		con::PeerHelper peer = con.getPeerNoEx(peer_ids[0]);
+		UASSERT(con.deletePeer(peer_ids[0], false));
+		UASSERT(!con.deletePeer(peer_ids[0], false));
+		UASSERT(!con.getPeerNoEx(peer_ids[0]));
+		UASSERT(peer->isPendingDeletion() && peer->id == peer_ids[0]);
+	}
+	UASSERTEQ(size_t, con.getPeerIDs().size(), 299);
+
+	// Peers come and go while other threads look them up
+	auto lookup = [&con] (session_t peer_id) {
+		con::PeerHelper peer = con.getPeerNoEx(peer_id);
+		return !!peer && peer->id == peer_id;
+	};
+	Semaphore start;
+	std::vector<std::unique_ptr<PeerLookupThread>> threads;
+	for (u32 i = 0; i < 4; i++) {
+		threads.emplace_back(new PeerLookupThread(lookup, peer_ids, 0, start, i));
+		threads.back()->start();
+	}
+	start.post(threads.size());
+
+	for (u32 i = 1; i < peer_ids.size(); i += 2)
+		UASSERT(con.deletePeer(peer_ids[i], false));
+	std::vector<session_t> new_ids = createPeers(con, 150);
+
+	for (auto &thread : threads) {
+		thread->stop();
+		thread->wait();
+		UASSERT(thread->found > 0);
+	}
+
+	std::vector<session_t> current = con.getPeerIDs();
+	UASSERTEQ(size_t, current.size(), 299);
+	for (session_t peer_id : new_ids) {
+		UASSERT(peer_id != PEER_ID_INEXISTENT);
+		UASSERT(std::find(current.begin(), current.end(), peer_id) != current.end());
+	}
+}
+
+void TestConnection::benchPeerTableContention()
+{
+	const u16 peer_count = 256;
+	const u32 thread_count = 4;
+	const u32 lookups = 200000;
+
+	PeerTableConnection con;
+	std::vector<session_t> peer_ids = createPeers(con, peer_count);
+
+	// The peer table as it was: one lock for all lookups, and one for the
+	// usage count of the peer
+	std::mutex global_mutex;
+	std::map<session_t, std::unique_ptr<std::mutex>> global_peers;
+	std::map<session_t, u32> global_usage;
+	for (session_t peer_id : peer_ids) {
+		global_peers[peer_id].reset(new std::mutex());
+		global_usage[peer_id] = 0;
+	}
+	auto global_lookup = [&] (session_t peer_id) {
+		std::mutex *peer_mutex;
+		{
+			MutexAutoLock lock(global_mutex);
+			auto it = global_peers.find(peer_id);
+			if (it == global_peers.end())
+				return false;
+			peer_mutex = it->second.get();
+			MutexAutoLock usage_lock(*peer_mutex);
+			global_usage[peer_id]++;
+		}
+		MutexAutoLock usage_lock(*peer_mutex);
+		global_usage[peer_id]--;
+		return true;
+	};
+
+	auto sharded_lookup = [&con] (session_t peer_id) {
+		con::PeerHelper peer = con.getPeerNoEx(peer_id);
+		return !!peer;
+	};
+
+	u64 times[2];
+	u32 found[2] = {};
+	std::function<bool(session_t)> lookup_fns[2] = {global_lookup, sharded_lookup};
+	for (u32 k = 0; k < 2; k++) {
+		Semaphore start;
+		std::vector<std::unique_ptr<PeerLookupThread>> threads;
+		for (u32 i = 0; i < thread_count; i++) {
+			threads.emplace_back(new PeerLookupThread(lookup_fns[k], peer_ids,
+				lookups, start, i));
+			threads.back()->start();
+		}
+
+		u64 t_start = porting::getTimeUs();
+		start.post(thread_count);
+		for (auto &thread : threads) {
+			thread->wait();
+			found[k] += thread->found;
+		}
+		times[k] = porting::getTimeUs() - t_start;
+	}
+
+	UASSERTEQ(u32, found[0], thread_count * lookups);
+	UASSERTEQ(u32, found[1], thread_count * lookups);
+	rawstream << "-------- Peer table with " << peer_count << " peers, "
+			<< thread_count << " threads doing " << lookups
+			<< " lookups each: global lock " << times[0] << "us, sharded "
+			<< times[1] << "us" << std::endl;
+}
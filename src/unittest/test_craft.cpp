@@ -0,0 +1,228 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <memory>
+#include "craftdef.h"
+#include "noise.h"
+#include "porting.h"
+#include "util/basic_macros.h"
+
+class TestCraft : public TestBase {
+public:
+	TestCraft() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestCraft"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testGroupRecipes(IGameDef *gamedef);
+	void testSameAsUnhashed(IGameDef *gamedef);
+	void benchGetCraftResult(IGameDef *gamedef);
+};
+
+static TestCraft g_test_instance;
+
+void TestCraft::runTests(IGameDef *gamedef)
+{
+	TEST(testGroupRecipes, gamedef);
+	TEST(testSameAsUnhashed, gamedef);
+	TEST(benchGetCraftResult, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Items of the test game definitions, cracky: stone and brick, crumbly: grass
+static const char *const craft_items[] = {
+	"default:stone",
+	"default:brick",
+	"default:dirt_with_grass",
+	"default:torch",
+};
+
+static const char *const craft_recipe_items[] = {
+	"",
+	"default:stone",
+	"default:brick",
+	"default:dirt_with_grass",
+	"default:torch",
+	"group:cracky",
+	"group:crumbly",
+};
+
+static std::string craftResult(IWritableCraftDefManager *craftdef,
+		CraftMethod method, const std::vector<std::string> &names,
+		IGameDef *gamedef, float *time = nullptr)
+{
+	std::vector<ItemStack> items;
+	for (const std::string &name : names) {
+		if (name.empty())
+			items.emplace_back();
+		else
+			items.emplace_back(name, 1, 0, gamedef->idef());
+	}
+	CraftInput input(method, 2, items);
+	CraftOutput output;
+	std::vector<ItemStack> replacements;
+	if (!craftdef->getCraftResult(input, output, replacements, false, gamedef))
+		return "none";
+	if (time)
+		*time = output.time;
+	return output.item;
+}
+
+void TestCraft::testGroupRecipes(IGameDef *gamedef)
+{
+	std::unique_ptr<IWritableCraftDefManager> craftdef(createCraftDefManager());
+	CraftReplacements none;
+	craftdef->registerCraft(new CraftDefinitionShaped("default:torch 4", 2,
+		{"group:cracky", "group:cracky"}, none), gamedef);
+	craftdef->registerCraft(new CraftDefinitionShaped("default:brick", 2,
+		{"default:stone", "default:stone"}, none), gamedef);
+	craftdef->registerCraft(new CraftDefinitionShapeless("default:stone 3",
+		{"group:crumbly", "default:brick"}, none), gamedef);
+	craftdef->registerCraft(new CraftDefinitionCooking("default:stone",
+		"group:crumbly", 3.0f, none), gamedef);
+	craftdef->registerCraft(new CraftDefinitionFuel("group:cracky", 5.0f, none),
+		gamedef);
+	// Same priority as the first one, so it wins when both match
+	craftdef->registerCraft(new CraftDefinitionShaped("default:torch 2", 2,
+		{"group:cracky", "default:brick"}, none), gamedef);
+	craftdef->initHashes(gamedef);
+
+	// Exact names beat groups
+	UASSERT(craftResult(craftdef.get(), CRAFT_METHOD_NORMAL,
+		{"default:stone", "default:stone"}, gamedef) == "default:brick");
+	UASSERT(craftResult(craftdef.get(), CRAFT_METHOD_NORMAL,
+		{"default:brick", "default:stone"}, gamedef) == "default:torch 4");
+	UASSERT(craftResult(craftdef.get(), CRAFT_METHOD_NORMAL,
+		{"default:stone", "default:brick"}, gamedef) == "default:torch 2");
+	UASSERT(craftResult(craftdef.get(), CRAFT_METHOD_NORMAL,
+		{"", "", "default:brick", "default:brick"}, gamedef) == "default:torch 2");
+	UASSERT(craftResult(craftdef.get(), CRAFT_METHOD_NORMAL,
+		{"default:brick", "", "default:dirt_with_grass"}, gamedef) ==
+		"default:stone 3");
+	UASSERT(craftResult(craftdef.get(), CRAFT_METHOD_NORMAL,
+		{"default:torch", "default:torch"}, gamedef) == "none");
+	UASSERT(craftResult(craftdef.get(), CRAFT_METHOD_NORMAL,
+		{"default:stone", "default:stone", "default:stone"}, gamedef) == "none");
+
+	float time = 0.0f;
+	UASSERT(craftResult(craftdef.get(), CRAFT_METHOD_COOKING,
+		{"default:dirt_with_grass"}, gamedef, &time) == "default:stone");
+	UASSERT(time == 3.0f);
+	UASSERT(craftResult(craftdef.get(), CRAFT_METHOD_FUEL,
+		{"default:brick"}, gamedef, &time) == "");
+	UASSERT(time == 5.0f);
+	UASSERT(craftResult(craftdef.get(), CRAFT_METHOD_FUEL,
+		{"default:torch"}, gamedef) == "none");
+}
+
+static void registerRandomRecipes(IWritableCraftDefManager *craftdef,
+		u32 count, u64 seed, IGameDef *gamedef)
+{
+	const s32 num_items = ARRLEN(craft_recipe_items);
+	PcgRandom pr(seed);
+	CraftReplacements none;
+	for (u32 i = 0; i < count; i++) {
+		std::string output = std::string(craft_items[pr.range(0, 3)]) + " " +
+			std::to_string(pr.range(1, 9));
+		s32 type = pr.range(0, 9);
+		if (type < 5) {
+			u32 width = pr.range(1, 3);
+			std::vector<std::string> recipe(width * pr.range(1, 3));
+			for (std::string &name : recipe)
+				name = craft_recipe_items[pr.range(0, num_items - 1)];
+			craftdef->registerCraft(new CraftDefinitionShaped(output, width,
+				recipe, none), gamedef);
+		} else if (type < 8) {
+			std::vector<std::string> recipe(pr.range(1, 4));
+			for (std::string &name : recipe)
+				name = craft_recipe_items[pr.range(1, num_items - 1)];
+			craftdef->registerCraft(new CraftDefinitionShapeless(output,
+				recipe, none), gamedef);
+		} else if (type < 9) {
+			craftdef->registerCraft(new CraftDefinitionCooking(output,
+				craft_recipe_items[pr.range(1, num_items - 1)],
+				pr.range(1, 10), none), gamedef);
+		} else {
+			craftdef->registerCraft(new CraftDefinitionFuel(
+				craft_recipe_items[pr.range(1, num_items - 1)],
+				pr.range(1, 10), none), gamedef);
+		}
+	}
+}
+
+static std::vector<std::string> randomCraftInput(PcgRandom &pr, CraftMethod method)
+{
+	std::vector<std::string> names(method == CRAFT_METHOD_NORMAL ? 4 : 1);
+	for (std::string &name : names) {
+		if (pr.range(0, 2) != 0)
+			name = craft_items[pr.range(0, 3)];
+	}
+	return names;
+}
+
+void TestCraft::testSameAsUnhashed(IGameDef *gamedef)
+{
+	// Without initHashes() every recipe is tried one by one
+	std::unique_ptr<IWritableCraftDefManager> indexed(createCraftDefManager());
+	std::unique_ptr<IWritableCraftDefManager> unhashed(createCraftDefManager());
+	registerRandomRecipes(indexed.get(), 300, 4242, gamedef);
+	registerRandomRecipes(unhashed.get(), 300, 4242, gamedef);
+	indexed->initHashes(gamedef);
+
+	PcgRandom pr(777);
+	for (u32 i = 0; i < 5000; i++) {
+		CraftMethod method = (CraftMethod)pr.range(0, 2);
+		std::vector<std::string> names = randomCraftInput(pr, method);
+		float time_indexed = -1.0f, time_unhashed = -1.0f;
+		UASSERT(craftResult(indexed.get(), method, names, gamedef, &time_indexed) ==
+			craftResult(unhashed.get(), method, names, gamedef, &time_unhashed));
+		UASSERT(time_indexed == time_unhashed);
+	}
+}
+
+void TestCraft::benchGetCraftResult(IGameDef *gamedef)
+{
+	// A craft guide going through every grid a player could fill
+	const u32 recipes = 2000;
+	const u32 lookups = 20000;
+
+	std::unique_ptr<IWritableCraftDefManager> craftdef(createCraftDefManager());
+	registerRandomRecipes(craftdef.get(), recipes, 99, gamedef);
+	u64 t_start = porting::getTimeUs();
+	craftdef->initHashes(gamedef);
+	u64 t_init = porting::getTimeUs() - t_start;
+
+	PcgRandom pr(1);
+	u32 found = 0;
+	t_start = porting::getTimeUs();
+	for (u32 i = 0; i < lookups; i++) {
+		CraftMethod method = (CraftMethod)pr.range(0, 2);
+		if (craftResult(craftdef.get(), method, randomCraftInput(pr, method),
+				gamedef) != "none")
+			found++;
+	}
+	u64 t_lookup = porting::getTimeUs() - t_start;
+
+	rawstream << "-------- Craft recipes, " << recipes << " registered: index "
+			<< t_init << "us, " << lookups << " lookups " << t_lookup
+			<< "us (" << found << " found)" << std::endl;
+}
@@ -0,0 +1,220 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+#include "common/c_packer.h"
+#include "common/c_types.h"
+#include "porting.h"
+
+class TestLuaPacker : public TestBase {
+public:
+	TestLuaPacker() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestLuaPacker"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testRoundTrip();
+	void testUnsupported();
+	void testFailedJob();
+	void benchVoxelData();
+};
+
+static TestLuaPacker g_test_instance;
+
+void TestLuaPacker::runTests(IGameDef *gamedef)
+{
+	TEST(testRoundTrip);
+	TEST(testUnsupported);
+	TEST(testFailedJob);
+	TEST(benchVoxelData);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Runs code that leaves one value on the stack
+static void run(lua_State *L, const char *code)
+{
+	if (luaL_loadstring(L, code) != 0 || lua_pcall(L, 0, 1, 0) != 0)
+		throw LuaError(lua_tostring(L, -1));
+}
+
+// Moves the value on top of the stack of from to the stack of to
+static std::string transfer(lua_State *from, lua_State *to)
+{
+	std::string packed;
+	script_pack(from, -1, packed);
+	lua_pop(from, 1);
+	script_unpack(to, packed);
+	return packed;
+}
+
+void TestLuaPacker::testRoundTrip()
+{
+	lua_State *L = luaL_newstate();
+	lua_State *L2 = luaL_newstate();
+
+	run(L, "return {1, 2.5, 'three', true, {x = -4, y = {false}},"
+			" [10] = 'ten', name = 'a\\0b', [0.5] = 6}");
+	transfer(L, L2);
+	UASSERT(lua_istable(L2, -1));
+	lua_setglobal(L2, "t");
+	run(L2, "return t[1] == 1 and t[2] == 2.5 and t[3] == 'three' and"
+			" t[4] == true and t[5].x == -4 and t[5].y[1] == false and"
+			" t[10] == 'ten' and t.name == 'a\\0b' and t[0.5] == 6 and"
+			" t[6] == nil");
+	UASSERT(lua_toboolean(L2, -1));
+	lua_pop(L2, 1);
+
+	// Plain values
+	lua_pushnil(L);
+	transfer(L, L2);
+	UASSERT(lua_isnil(L2, -1));
+	lua_pushnumber(L, 1e300);
+	transfer(L, L2);
+	UASSERT(lua_tonumber(L2, -1) == 1e300);
+	lua_pop(L2, 2);
+
+	// Arrays of numbers are packed as one block
+	run(L, "local t = {} for i = 1, 1000 do t[i] = i * 3 end return t");
+	std::string packed = transfer(L, L2);
+	UASSERT(packed.size() < 1000 * sizeof(lua_Number) + 16);
+	lua_setglobal(L2, "t");
+	run(L2, "for i = 1, 1000 do if t[i] ~= i * 3 then return false end end"
+			" return #t == 1000");
+	UASSERT(lua_toboolean(L2, -1));
+	lua_pop(L2, 1);
+
+	UASSERTEQ(int, lua_gettop(L), 0);
+	UASSERTEQ(int, lua_gettop(L2), 0);
+	lua_close(L);
+	lua_close(L2);
+}
+
+void TestLuaPacker::testUnsupported()
+{
+	lua_State *L = luaL_newstate();
+	luaL_openlibs(L);
+	std::string packed;
+
+	const char *unsupported[] = {
+		"return print",
+		"return {f = print}",
+		"local t = {} t.self = t return t",
+		"local t = {} t[{}] = coroutine.create(function() end) return t",
+	};
+	for (const char *code : unsupported) {
+		run(L, code);
+		try {
+			script_pack(L, -1, packed);
+			UASSERT(false);
+		} catch (LuaError &e) {
+		}
+		// Nothing is left behind by the failed attempt
+		UASSERTEQ(int, lua_gettop(L), 1);
+		UASSERT(packed.empty());
+		lua_settop(L, 0);
+	}
+
+	// A table that appears twice is copied
+	run(L, "local t = {1} return {t, t}");
+	packed.clear();
+	script_pack(L, -1, packed);
+	script_unpack(L, packed);
+	lua_rawgeti(L, -1, 1);
+	lua_rawgeti(L, -2, 2);
+	UASSERT(lua_istable(L, -1) && !lua_rawequal(L, -1, -2));
+	lua_settop(L, 0);
+
+	// Damaged data
+	const std::string truncated = packed.substr(0, packed.size() - 1);
+	try {
+		script_unpack(L, truncated);
+		UASSERT(false);
+	} catch (LuaError &e) {
+	}
+	UASSERTEQ(int, lua_gettop(L), 0);
+	lua_close(L);
+}
+
+void TestLuaPacker::testFailedJob()
+{
+	// Runs jobs on one state the way an async worker does
+	lua_State *L = luaL_newstate();
+	luaL_openlibs(L);
+	lua_newtable(L);  // Stands in for core
+	const int top = lua_gettop(L);
+
+	const char *jobs[] = {
+		"return {1, 2, {x = 3, f = print}}",
+		"return {a = {b = {c = {1, 2, 3}}}, n = 4}",
+	};
+	std::string results[2];
+	for (int i = 0; i < 2; i++) {
+		run(L, jobs[i]);
+		try {
+			script_pack(L, -1, results[i]);
+		} catch (LuaError &e) {
+			results[i].clear();
+		}
+		lua_pop(L, 1);  // Pop retval
+		UASSERTEQ(int, lua_gettop(L), top);
+	}
+	UASSERT(results[0].empty());
+	UASSERT(lua_istable(L, top));
+
+	// The second job is not affected by the first one
+	lua_State *L2 = luaL_newstate();
+	script_unpack(L2, results[1]);
+	lua_setglobal(L2, "t");
+	run(L2, "return t.a.b.c[3] == 3 and t.n == 4");
+	UASSERT(lua_toboolean(L2, -1));
+	lua_close(L);
+	lua_close(L2);
+}
+
+void TestLuaPacker::benchVoxelData()
+{
+	// The node data of a VoxelManip over 5x5x5 map blocks
+	const u32 count = 80 * 80 * 80;
+	lua_State *L = luaL_newstate();
+	lua_State *L2 = luaL_newstate();
+	lua_createtable(L, count, 0);
+	for (u32 i = 1; i <= count; i++) {
+		lua_pushinteger(L, i % 4096);
+		lua_rawseti(L, -2, i);
+	}
+
+	u64 t_start = porting::getTimeUs();
+	std::string packed;
+	script_pack(L, -1, packed);
+	script_unpack(L2, packed);
+	u64 t_total = porting::getTimeUs() - t_start;
+
+	rawstream << "-------- Lua packer, table of " << count << " numbers: "
+			<< t_total << "us, " << packed.size() << " bytes" << std::endl;
+	lua_close(L);
+	lua_close(L2);
+}
@@ -0,0 +1,552 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <algorithm>
+#include <map>
+#include "gamedef.h"
+#include "map.h"
+#include "settings.h"
+#include "mapblock.h"
+#include "mapblockindex.h"
+#include "mapsector.h"
+#include "noise.h"
+#include "pathfinder.h"
+#include "serialization.h"
+
+class TestMap : public TestBase
+{
+public:
+	TestMap() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMap"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testBlockIndex(IGameDef *gamedef);
+	void testSectorBlocks(IGameDef *gamedef);
+	void testNetworkCache(IGameDef *gamedef);
+	void testDeferredLighting(IGameDef *gamedef);
+	void testPathfinder(IGameDef *gamedef);
+	void testPathCache(IGameDef *gamedef);
+	void benchGetNode(IGameDef *gamedef);
+	void benchLiquidDamBreak(IGameDef *gamedef);
+	void benchPathfinder(IGameDef *gamedef);
+};
+
+static TestMap g_test_instance;
+
+void TestMap::runTests(IGameDef *gamedef)
+{
+	TEST(testBlockIndex, gamedef);
+	TEST(testSectorBlocks, gamedef);
+	TEST(testNetworkCache, gamedef);
+	TEST(testDeferredLighting, gamedef);
+	TEST(testPathfinder, gamedef);
+	TEST(testPathCache, gamedef);
+	TEST(benchGetNode, gamedef);
+	TEST(benchLiquidDamBreak, gamedef);
+	TEST(benchPathfinder, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestMap::testBlockIndex(IGameDef *gamedef)
+{
+	MapBlockIndex index;
+	std::map<v3s16, MapBlock *> reference;
+	PcgRandom pr(42);
+
+	// Mixed inserts and removals in a small area to force collisions,
+	// growth and backward shifts
+	for (u32 i = 0; i < 20000; i++) {
+		v3s16 p(pr.range(-20, 20), pr.range(-5, 5), pr.range(-20, 20));
+		auto it = reference.find(p);
+		if (it == reference.end()) {
+			MapBlock *block = new MapBlock(nullptr, p, gamedef, true);
+			index.insert(block);
+			reference[p] = block;
+		} else {
+			UASSERT(index.get(p) == it->second);
+			UASSERT(index.remove(p));
+			delete it->second;
+			reference.erase(it);
+		}
+	}
+
+	UASSERTEQ(size_t, index.size(), reference.size());
+	for (s16 x = -21; x <= 21; x++)
+	for (s16 y = -6; y <= 6; y++)
+	for (s16 z = -21; z <= 21; z++) {
+		v3s16 p(x, y, z);
+		auto it = reference.find(p);
+		UASSERT(index.get(p) == (it == reference.end() ? nullptr : it->second));
+	}
+
+	UASSERT(!index.remove(v3s16(100, 100, 100)));
+
+	for (auto &it : reference)
+		delete it.second;
+	index.clear();
+	UASSERTEQ(size_t, index.size(), 0);
+	UASSERT(index.get(v3s16(0, 0, 0)) == nullptr);
+}
+
+void TestMap::testSectorBlocks(IGameDef *gamedef)
+{
+	TestMapWithSectors map(gamedef);
+
+	MapSector *sector = map.createSector(v2s16(1, -1));
+	MapBlock *block = sector->createBlankBlock(3);
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(1, 3, -1)) == block);
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(1, 2, -1)) == nullptr);
+
+	MapBlock *block2 = sector->createBlankBlockNoInsert(2);
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(1, 2, -1)) == nullptr);
+	sector->insertBlock(block2);
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(1, 2, -1)) == block2);
+
+	sector->deleteBlock(block);
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(1, 3, -1)) == nullptr);
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(1, 2, -1)) == block2);
+
+	sector->deleteBlocks();
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(1, 2, -1)) == nullptr);
+}
+
+void TestMap::testNetworkCache(IGameDef *gamedef)
+{
+	MapBlock block(nullptr, v3s16(0, 0, 0), gamedef);
+	const u8 ver = SER_FMT_VER_HIGHEST_WRITE;
+
+	const std::string &s1 = block.getNetworkSerialization(ver, 0);
+	const std::string &s2 = block.getNetworkSerialization(ver, 0);
+	UASSERT(&s1 == &s2);
+	std::string data = s1;
+
+	// Another compression level is cached separately
+	const std::string &s3 = block.getNetworkSerialization(ver, -1);
+	UASSERT(&s3 != &s1);
+	UASSERT(block.getNetworkSerialization(ver, 0) == data);
+
+	u32 count = block.getModificationCount();
+	MapNode n(t_CONTENT_STONE);
+	block.setNode(v3s16(1, 2, 3), n);
+	UASSERT(block.getModificationCount() != count);
+
+	std::string modified = block.getNetworkSerialization(ver, 0);
+	UASSERT(modified != data);
+
+	std::ostringstream os(std::ios_base::binary);
+	block.serialize(os, ver, false, 0);
+	block.serializeNetworkSpecific(os);
+	UASSERT(os.str() == modified);
+}
+
+// Dark underground area, so only the placed torches give light
+static void buildDarkArea(TestMapWithSectors &map, v3s16 size)
+{
+	map.createAirBlocks(v3s16(0, 0, 0), size - v3s16(1, 1, 1), true);
+}
+
+void TestMap::testDeferredLighting(IGameDef *gamedef)
+{
+	const v3s16 size(3, 2, 3); // in blocks
+	const v3s16 nmax = size * MAP_BLOCKSIZE - v3s16(1, 1, 1);
+	TestMapWithSectors map_direct(gamedef);
+	TestMapWithSectors map_deferred(gamedef);
+	buildDarkArea(map_direct, size);
+	buildDarkArea(map_deferred, size);
+	map_deferred.setDeferredLighting(true);
+
+	// Torches and walls, some of them replacing each other
+	PcgRandom pr(42);
+	std::map<v3s16, MapBlock *> modified_blocks;
+	for (u32 i = 0; i < 400; i++) {
+		v3s16 p(pr.range(0, nmax.X), pr.range(0, nmax.Y), pr.range(0, nmax.Z));
+		MapNode n(pr.range(0, 3) == 0 ? t_CONTENT_TORCH : t_CONTENT_STONE);
+		map_direct.addNodeAndUpdate(p, n, modified_blocks);
+		map_deferred.addNodeAndUpdate(p, n, modified_blocks);
+	}
+
+	UASSERT(map_deferred.hasPendingLighting());
+	map_deferred.updatePendingLighting();
+	UASSERT(!map_deferred.hasPendingLighting());
+
+	v3s16 p;
+	for (p.Z = 0; p.Z <= nmax.Z; p.Z++)
+	for (p.Y = 0; p.Y <= nmax.Y; p.Y++)
+	for (p.X = 0; p.X <= nmax.X; p.X++) {
+		UASSERTEQ(int, map_deferred.getNode(p).param1,
+				map_direct.getNode(p).param1);
+	}
+}
+
+// Terraced ground split by walls, with a few gaps to pass through
+static const v3s16 PATH_BLOCKS(6, 2, 6);
+
+static s16 pathGroundHeight(s16 x, s16 z)
+{
+	return (x / 8 + z / 8) % 3;
+}
+
+static void buildPathTerrain(TestMapWithSectors &map)
+{
+	map.createAirBlocks(v3s16(0, -1, 0), PATH_BLOCKS - v3s16(1, 2, 1));
+
+	const s16 nmax = PATH_BLOCKS.X * MAP_BLOCKSIZE - 1;
+	MapNode stone(t_CONTENT_STONE);
+	for (s16 x = 0; x <= nmax; x++)
+	for (s16 z = 0; z <= nmax; z++) {
+		s16 height = pathGroundHeight(x, z);
+		bool wall = (x % 24 == 12 && z % 40 > 2) || (z % 28 == 20 && x % 33 > 3);
+		if (wall)
+			height += 4;
+		for (s16 y = -MAP_BLOCKSIZE; y <= height; y++)
+			map.setNode(v3s16(x, y, z), stone);
+	}
+}
+
+static v3s16 pathSurface(s16 x, s16 z)
+{
+	return v3s16(x, pathGroundHeight(x, z) + 1, z);
+}
+
+// Every step goes to a neighbor, at most a jump up or a drop down
+static bool isWalkablePath(const std::vector<v3s16> &path, v3s16 source,
+		v3s16 destination, int max_jump, int max_drop)
+{
+	if (path.front() != source || path.back() != destination)
+		return false;
+	for (size_t i = 1; i < path.size(); i++) {
+		v3s16 d = path[i] - path[i - 1];
+		int horizontal = std::abs(d.X) + std::abs(d.Z);
+		if (horizontal > 1 || (horizontal == 0 && d.Y == 0) ||
+				d.Y > max_jump || -d.Y > max_drop)
+			return false;
+	}
+	return true;
+}
+
+void TestMap::testPathfinder(IGameDef *gamedef)
+{
+	TestMapWithSectors map(gamedef);
+	buildPathTerrain(map);
+	const NodeDefManager *ndef = gamedef->ndef();
+
+	// The hierarchical search finds a path exactly when the plain one does
+	const s16 nmax = PATH_BLOCKS.X * MAP_BLOCKSIZE - 1;
+	PcgRandom pr(42);
+	u32 found = 0;
+	for (u32 i = 0; i < 60; i++) {
+		v3s16 source = pathSurface(pr.range(1, nmax - 1), pr.range(1, nmax - 1));
+		v3s16 destination = pathSurface(pr.range(1, nmax - 1), pr.range(1, nmax - 1));
+		std::vector<v3s16> plain = get_path(&map, ndef, source, destination,
+				32, 1, 3, PA_PLAIN_NP);
+		std::vector<v3s16> hierarchical = get_path(&map, ndef, source,
+				destination, 32, 1, 3, PA_HIERARCHICAL);
+
+		UASSERTEQ(bool, hierarchical.empty(), plain.empty());
+		if (plain.empty())
+			continue;
+		found++;
+		UASSERT(isWalkablePath(plain, source, destination, 1, 3));
+		UASSERT(isWalkablePath(hierarchical, source, destination, 1, 3));
+	}
+	UASSERT(found > 5);
+
+	// Closed off by walls all around
+	MapNode stone(t_CONTENT_STONE);
+	for (s16 x = 30; x <= 40; x++)
+	for (s16 z = 30; z <= 40; z++) {
+		if (x == 30 || x == 40 || z == 30 || z == 40) {
+			for (s16 y = 1; y <= 6; y++)
+				map.setNode(v3s16(x, y, z), stone);
+		}
+	}
+	v3s16 inside = pathSurface(35, 35);
+	v3s16 outside = pathSurface(50, 35);
+	UASSERT(get_path(&map, ndef, outside, inside, 32, 1, 3,
+			PA_PLAIN_NP).empty());
+	UASSERT(get_path(&map, ndef, outside, inside, 32, 1, 3,
+			PA_HIERARCHICAL).empty());
+}
+
+void TestMap::testPathCache(IGameDef *gamedef)
+{
+	TestMapWithSectors map(gamedef);
+	buildPathTerrain(map);
+	const NodeDefManager *ndef = gamedef->ndef();
+	PathCache cache(60.0f);
+
+	for (PathAlgorithm algo : {PA_PLAIN_NP, PA_HIERARCHICAL}) {
+		v3s16 source = pathSurface(2, 5);
+		v3s16 destination = pathSurface(30, 5);
+		std::vector<v3s16> path = get_path(&map, ndef, source, destination,
+				32, 1, 3, algo, &cache);
+		UASSERT(path.size() > 20);
+
+		// Starting further along the path gives the rest of it
+		std::vector<v3s16> rest = get_path(&map, ndef, path[10], destination,
+				32, 1, 3, algo, &cache);
+		UASSERTEQ(size_t, rest.size(), path.size() - 10);
+		UASSERT(std::equal(rest.begin(), rest.end(), path.begin() + 10));
+
+		// Blocking the path makes the search run again
+		v3s16 blocked = path[15];
+		MapNode stone(t_CONTENT_STONE);
+		map.setNode(blocked, stone);
+		map.setNode(blocked + v3s16(0, 1, 0), stone);
+		rest = get_path(&map, ndef, path[10], destination, 32, 1, 3, algo,
+				&cache);
+		UASSERT(!rest.empty());
+		UASSERT(std::find(rest.begin(), rest.end(), blocked) == rest.end());
+		UASSERT(isWalkablePath(rest, path[10], destination, 1, 3));
+
+		MapNode air(CONTENT_AIR);
+		map.setNode(blocked, air);
+		map.setNode(blocked + v3s16(0, 1, 0), air);
+		cache.clear();
+		UASSERT(get_path(&map, ndef, source, destination, 32, 1, 3, algo,
+				&cache) == path);
+
+		// So does a block that was loaded again with other nodes, even if
+		// it has the modification count of the old one
+		v3s16 blockpos = getNodeBlockPos(blocked);
+		MapBlock *block = map.getBlockNoCreateNoEx(blockpos);
+		u32 modification_count = block->getModificationCount();
+		std::vector<MapNode> nodes(block->getData(),
+				block->getData() + MapBlock::nodecount);
+		MapSector *sector = map.getSectorNoGenerate(v2s16(blockpos.X, blockpos.Z));
+		sector->deleteBlock(block);
+		block = sector->createBlankBlock(blockpos.Y);
+		v3s16 rel = blocked - blockpos * MAP_BLOCKSIZE;
+		nodes[rel.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE +
+				rel.Y * MAP_BLOCKSIZE + rel.X] = stone;
+		std::copy(nodes.begin(), nodes.end(), block->getData());
+		while (block->getModificationCount() < modification_count)
+			block->raiseModified(MOD_STATE_WRITE_NEEDED);
+		UASSERTEQ(u32, block->getModificationCount(), modification_count);
+		rest = get_path(&map, ndef, path[10], destination, 32, 1, 3, algo,
+				&cache);
+		UASSERT(!rest.empty());
+		UASSERT(std::find(rest.begin(), rest.end(), blocked) == rest.end());
+
+		map.setNode(blocked, air);
+		cache.clear();
+	}
+}
+
+void TestMap::benchGetNode(IGameDef *gamedef)
+{
+	const s16 radius = 6; // in blocks
+	const u32 num_random = 1000000;
+
+	TestMapWithSectors map(gamedef);
+	for (s16 x = -radius; x < radius; x++)
+	for (s16 z = -radius; z < radius; z++) {
+		MapSector *sector = map.createSector(v2s16(x, z));
+		for (s16 y = -radius / 2; y < radius / 2; y++)
+			sector->createBlankBlock(y);
+	}
+
+	const s16 nmin = -radius * MAP_BLOCKSIZE;
+	const s16 nmax = radius * MAP_BLOCKSIZE - 1;
+	PcgRandom pr(1337);
+	std::vector<v3s16> positions;
+	positions.reserve(num_random);
+	for (u32 i = 0; i < num_random; i++) {
+		positions.emplace_back(pr.range(nmin, nmax),
+				pr.range(nmin / 2, nmax / 2), pr.range(nmin, nmax));
+	}
+
+	// Old two-level lookup through the sector, as reference
+	u32 found = 0;
+	u64 t_start = porting::getTimeUs();
+	for (const v3s16 &p : positions) {
+		v3s16 blockpos = getNodeBlockPos(p);
+		MapBlock *block = map.getBlockThroughSector(blockpos);
+		bool valid;
+		if (block && block->getNodeNoCheck(p - blockpos * MAP_BLOCKSIZE,
+				&valid).getContent() != CONTENT_AIR)
+			found++;
+	}
+	u64 t_sector = porting::getTimeUs() - t_start;
+
+	u32 found_indexed = 0;
+	t_start = porting::getTimeUs();
+	for (const v3s16 &p : positions) {
+		if (map.getNode(p).getContent() != CONTENT_AIR)
+			found_indexed++;
+	}
+	u64 t_random = porting::getTimeUs() - t_start;
+	UASSERTEQ(u32, found_indexed, found);
+
+	u32 num_sequential = 0;
+	t_start = porting::getTimeUs();
+	for (s16 z = nmin; z <= nmax; z++)
+	for (s16 y = nmin / 2; y <= nmax / 2; y++)
+	for (s16 x = nmin; x <= nmax; x++) {
+		if (map.getNode(v3s16(x, y, z)).getContent() != CONTENT_AIR)
+			num_sequential++;
+	}
+	u64 t_sequential = porting::getTimeUs() - t_start;
+
+	rawstream << "-------- getNode: " << num_random << " random in " << t_random
+			<< "us (through sectors " << t_sector << "us), "
+			<< num_sequential << " sequential in " << t_sequential << "us"
+			<< std::endl;
+}
+
+// Reservoir held back by a wall, the wall is removed and every liquid
+// node is queued as if the area had just been generated
+static const s16 DAM_X = 40;
+static const v3s16 DAM_BLOCKS(6, 3, 4);
+
+static void buildDamBreak(TestMapWithSectors &map)
+{
+	map.createAirBlocks(v3s16(0, -1, 0), DAM_BLOCKS - v3s16(1, 2, 1));
+
+	const v3s16 nmax = DAM_BLOCKS * MAP_BLOCKSIZE - v3s16(1, MAP_BLOCKSIZE + 1, 1);
+	MapNode stone(t_CONTENT_STONE);
+	MapNode water(t_CONTENT_WATER);
+	for (s16 z = 0; z <= nmax.Z; z++)
+	for (s16 y = 0; y <= nmax.Y; y++)
+	for (s16 x = 0; x <= nmax.X; x++) {
+		bool border = x == 0 || z == 0 || x == nmax.X || z == nmax.Z;
+		if (y == 0 || (border && y <= 12))
+			map.setNode(v3s16(x, y, z), stone);
+		else if (x < DAM_X && y <= 10)
+			map.setNode(v3s16(x, y, z), water);
+	}
+
+	for (s16 z = 1; z < nmax.Z; z++)
+	for (s16 y = 1; y <= 10; y++) {
+		for (s16 x = 1; x <= DAM_X; x++)
+			map.transforming_liquid_add(v3s16(x, y, z));
+	}
+}
+
+// Returns the number of steps until the liquid queue ran empty
+static u32 runDamBreak(TestMapWithSectors &map, u32 max_steps)
+{
+	std::map<v3s16, MapBlock *> modified_blocks;
+	u32 steps = 0;
+	while (map.getLiquidQueueSize() > 0 && steps < max_steps) {
+		map.transformLiquids(modified_blocks, nullptr);
+		steps++;
+	}
+	return steps;
+}
+
+static bool sameNodes(Map &a, Map &b)
+{
+	const v3s16 nmax = DAM_BLOCKS * MAP_BLOCKSIZE - v3s16(1, MAP_BLOCKSIZE + 1, 1);
+	for (s16 z = 0; z <= nmax.Z; z++)
+	for (s16 y = 0; y <= nmax.Y; y++)
+	for (s16 x = 0; x <= nmax.X; x++) {
+		MapNode na = a.getNode(v3s16(x, y, z));
+		MapNode nb = b.getNode(v3s16(x, y, z));
+		if (na.getContent() != nb.getContent() || na.param2 != nb.param2)
+			return false;
+	}
+	return true;
+}
+
+void TestMap::benchLiquidDamBreak(IGameDef *gamedef)
+{
+	const u32 max_steps = 500;
+	const u32 thread_counts[] = {0, 1, 4};
+	std::unique_ptr<TestMapWithSectors> maps[3];
+	u64 times[3];
+	u32 steps[3];
+
+	for (int i = 0; i < 3; i++) {
+		maps[i].reset(new TestMapWithSectors(gamedef));
+		TestMapWithSectors &map = *maps[i];
+		buildDamBreak(map);
+		map.setLiquidThreads(thread_counts[i]);
+
+		u64 t_start = porting::getTimeUs();
+		steps[i] = runDamBreak(map, max_steps);
+		times[i] = porting::getTimeUs() - t_start;
+		UASSERT(steps[i] < max_steps);
+
+		// The flood spreads out of the reservoir up to the liquid range
+		UASSERT(map.getNode(v3s16(DAM_X + 3, 1, 20)).getContent() ==
+				t_CONTENT_WATER_FLOWING);
+		UASSERT(map.getNode(v3s16(DAM_X + 20, 1, 20)).getContent() ==
+				CONTENT_AIR);
+		UASSERT(map.getNode(v3s16(DAM_X - 1, 10, 20)).getContent() ==
+				t_CONTENT_WATER);
+	}
+
+	// Threads don't change how the liquid flows
+	for (int i = 1; i < 3; i++) {
+		UASSERTEQ(u32, steps[i], steps[0]);
+		UASSERT(sameNodes(*maps[i], *maps[0]));
+	}
+
+	rawstream << "-------- Liquid dam break: serial " << times[0] << "us in "
+			<< steps[0] << " steps, 1 thread " << times[1] << "us, 4 threads "
+			<< times[2] << "us in " << steps[2] << " steps" << std::endl;
+}
+
+void TestMap::benchPathfinder(IGameDef *gamedef)
+{
+	const u32 num_searches = 100;
+
+	TestMapWithSectors map(gamedef);
+	buildPathTerrain(map);
+	const NodeDefManager *ndef = gamedef->ndef();
+
+	const s16 nmax = PATH_BLOCKS.X * MAP_BLOCKSIZE - 1;
+	PcgRandom pr(1337);
+	std::vector<std::pair<v3s16, v3s16> > searches;
+	for (u32 i = 0; i < num_searches; i++) {
+		s16 x = pr.range(1, nmax / 2);
+		s16 z = pr.range(1, nmax / 2);
+		searches.emplace_back(pathSurface(x, z),
+				pathSurface(x + pr.range(20, nmax / 2 - 1),
+				z + pr.range(20, nmax / 2 - 1)));
+	}
+
+	const PathAlgorithm algos[] = {PA_PLAIN_NP, PA_HIERARCHICAL, PA_HIERARCHICAL};
+	u64 times[3];
+	u32 found[3];
+	for (int i = 0; i < 3; i++) {
+		// The last run keeps the regions of the map blocks between searches
+		std::unique_ptr<PathCache> cache(i == 2 ? new PathCache(60.0f) : nullptr);
+		found[i] = 0;
+		u64 t_start = porting::getTimeUs();
+		for (const auto &search : searches) {
+			if (!get_path(&map, ndef, search.first, search.second, 40, 1, 3,
+					algos[i], cache.get()).empty())
+				found[i]++;
+		}
+		times[i] = porting::getTimeUs() - t_start;
+	}
+	UASSERTEQ(u32, found[1], found[0]);
+	UASSERTEQ(u32, found[2], found[0]);
+
+	rawstream << "-------- Pathfinder: " << num_searches << " searches, "
+			<< found[0] << " found, A* " << times[0] << "us, hierarchical "
+			<< times[1] << "us, with cached regions " << times[2] << "us"
+			<< std::endl;
+}
@@ -0,0 +1,265 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include "database/database-async.h"
+#include "database/database-dummy.h"
+#include "database/database-sqlite3.h"
+#include "exceptions.h"
+#include "filesys.h"
+#include "porting.h"
+
+class TestMapDatabase : public TestBase
+{
+public:
+	TestMapDatabase() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapDatabase"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testBatch(MapDatabase *db);
+	void testAsync(MapDatabase *db);
+	void testAsyncPersistence(const std::string &dir);
+	void testAsyncFailure();
+};
+
+static TestMapDatabase g_test_instance;
+
+void TestMapDatabase::runTests(IGameDef *gamedef)
+{
+	std::string test_dir = getTestTempDirectory();
+
+	Database_Dummy *dummy = new Database_Dummy();
+	TEST(testBatch, dummy);
+	delete dummy;
+
+	Database_Async *async = new Database_Async(new Database_Dummy());
+	TEST(testBatch, async);
+	TEST(testAsync, async);
+	delete async;
+
+	TEST(testAsyncPersistence, test_dir);
+	TEST(testAsyncFailure);
+}
+
+static std::string blockData(v3s16 pos, int version)
+{
+	std::ostringstream os;
+	os << "block " << PP(pos) << " v" << version;
+	return os.str();
+}
+
+void TestMapDatabase::testBatch(MapDatabase *db)
+{
+	std::vector<std::pair<v3s16, std::string>> blocks;
+	for (s16 i = 0; i < 100; i++) {
+		v3s16 pos(i, -i, i * 2);
+		blocks.emplace_back(pos, blockData(pos, 1));
+	}
+
+	db->beginSave();
+	UASSERT(db->saveBlocks(blocks));
+	db->endSave();
+
+	std::vector<v3s16> positions;
+	for (const auto &block : blocks)
+		positions.push_back(block.first);
+	positions.emplace_back(1000, 1000, 1000);
+
+	std::vector<std::string> loaded;
+	db->loadBlocks(positions, &loaded);
+	UASSERTEQ(size_t, loaded.size(), positions.size());
+	for (size_t i = 0; i < blocks.size(); i++)
+		UASSERTEQ(std::string, loaded[i], blocks[i].second);
+	UASSERT(loaded.back().empty());
+}
+
+void TestMapDatabase::testAsync(MapDatabase *db)
+{
+	Database_Async *async = static_cast<Database_Async *>(db);
+	v3s16 pos(7, 8, 9);
+	std::string data;
+
+	// Queued blocks are readable before and after they are written
+	db->beginSave();
+	db->saveBlock(pos, blockData(pos, 1));
+	db->loadBlock(pos, &data);
+	UASSERTEQ(std::string, data, blockData(pos, 1));
+	db->endSave();
+
+	async->flush();
+	db->loadBlock(pos, &data);
+	UASSERTEQ(std::string, data, blockData(pos, 1));
+
+	// The latest queued version wins
+	db->saveBlock(pos, blockData(pos, 2));
+	db->saveBlock(pos, blockData(pos, 3));
+	db->loadBlock(pos, &data);
+	UASSERTEQ(std::string, data, blockData(pos, 3));
+	async->flush();
+	db->loadBlock(pos, &data);
+	UASSERTEQ(std::string, data, blockData(pos, 3));
+
+	// Deleting a queued block drops it
+	db->saveBlock(pos, blockData(pos, 4));
+	UASSERT(db->deleteBlock(pos));
+	db->loadBlock(pos, &data);
+	UASSERT(data.empty());
+	async->flush();
+	db->loadBlock(pos, &data);
+	UASSERT(data.empty());
+
+	// Queued blocks are listed
+	db->saveBlock(pos, blockData(pos, 5));
+	std::vector<v3s16> list;
+	db->listAllLoadableBlocks(list);
+	UASSERT(std::find(list.begin(), list.end(), pos) != list.end());
+}
+
+void TestMapDatabase::testAsyncPersistence(const std::string &dir)
+{
+	std::string world_dir = dir + DIR_DELIM + "async_map";
+	fs::CreateAllDirs(world_dir);
+
+	// Everything queued is written when the database is closed
+	Database_Async *db = new Database_Async(new MapDatabaseSQLite3(world_dir));
+	db->beginSave();
+	for (s16 i = 0; i < 2000; i++)
+		db->saveBlock(v3s16(i, 0, 0), blockData(v3s16(i, 0, 0), 1));
+	db->endSave();
+	delete db;
+
+	MapDatabaseSQLite3 *sqlite = new MapDatabaseSQLite3(world_dir);
+	std::vector<v3s16> list;
+	sqlite->listAllLoadableBlocks(list);
+	UASSERTEQ(size_t, list.size(), 2000);
+	std::string data;
+	sqlite->loadBlock(v3s16(1234, 0, 0), &data);
+	UASSERTEQ(std::string, data, blockData(v3s16(1234, 0, 0), 1));
+	delete sqlite;
+
+	fs::RecursiveDelete(world_dir);
+}
+
+enum class FailureMode { None, SaveFalse, SaveThrows, BeginThrows };
+
+struct FailureState
+{
+	std::atomic<FailureMode> mode{FailureMode::None};
+	std::atomic<int> begins{0};
+	std::atomic<int> ends{0};
+	// Called while a block is being saved
+	std::function<void()> on_save;
+};
+
+class FailingDatabase : public Database_Dummy
+{
+public:
+	FailingDatabase(FailureState &state) : m_state(state) {}
+
+	bool saveBlock(const v3s16 &pos, const std::string &data)
+	{
+		if (m_state.on_save)
+			m_state.on_save();
+		if (m_state.mode == FailureMode::SaveThrows)
+			throw DatabaseException("injected save failure");
+		if (m_state.mode == FailureMode::SaveFalse)
+			return false;
+		return Database_Dummy::saveBlock(pos, data);
+	}
+
+	void beginSave()
+	{
+		if (m_state.mode == FailureMode::BeginThrows)
+			throw DatabaseException("injected begin failure");
+		m_state.begins++;
+	}
+
+	void endSave() { m_state.ends++; }
+
+private:
+	FailureState &m_state;
+};
+
+void TestMapDatabase::testAsyncFailure()
+{
+	FailureState state;
+	Database_Async *db = new Database_Async(new FailingDatabase(state));
+	v3s16 pos(1, 2, 3);
+	std::string data;
+
+	const FailureMode modes[] = {FailureMode::SaveFalse,
+		FailureMode::SaveThrows, FailureMode::BeginThrows};
+	int version = 0;
+	for (FailureMode mode : modes) {
+		// A failed commit keeps the block queued and readable
+		state.mode = mode;
+		db->saveBlock(pos, blockData(pos, ++version));
+		UASSERT(!db->flush());
+		db->loadBlock(pos, &data);
+		UASSERTEQ(std::string, data, blockData(pos, version));
+
+		// and it is written once the backend works again
+		state.mode = FailureMode::None;
+		UASSERT(db->flush());
+		db->loadBlock(pos, &data);
+		UASSERTEQ(std::string, data, blockData(pos, version));
+		UASSERT(db->deleteBlock(pos));
+	}
+
+	// A version queued during a failed commit is not replaced by the old one
+	state.mode = FailureMode::SaveFalse;
+	db->saveBlock(pos, blockData(pos, 1));
+	state.on_save = [&] { db->saveBlock(pos, blockData(pos, 2)); };
+	UASSERT(!db->flush());
+	state.on_save = nullptr;
+	state.mode = FailureMode::None;
+	UASSERT(db->flush());
+	db->loadBlock(pos, &data);
+	UASSERTEQ(std::string, data, blockData(pos, 2));
+
+	// A block read while its commit fails is the queued version, not the
+	// one in the backend
+	state.mode = FailureMode::SaveFalse;
+	db->saveBlock(pos, blockData(pos, 3));
+	std::thread reader;
+	state.on_save = [&] {
+		if (reader.joinable())
+			return;
+		reader = std::thread([&] { db->loadBlock(pos, &data); });
+		// Let it miss the queue and wait for the commit
+		sleep_ms(50);
+	};
+	UASSERT(!db->flush());
+	state.on_save = nullptr;
+	reader.join();
+	UASSERTEQ(std::string, data, blockData(pos, 3));
+	state.mode = FailureMode::None;
+	UASSERT(db->flush());
+
+	delete db;
+	// Every transaction that was begun was also ended
+	UASSERTEQ(int, state.begins, state.ends);
+}
@@ -0,0 +1,351 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "gamedef.h"
+#include "map.h"
+#include "nodedef.h"
+#include "porting.h"
+#include "mapgen/mapgen.h"
+#include "mapgen/mg_decoration.h"
+#include "mapgen/mg_ore.h"
+#include "util/workerpool.h"
+
+class TestMapgen : public TestBase {
+public:
+	TestMapgen() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapgen"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testRunPasses();
+	void testParallelOres(IGameDef *gamedef);
+	void testParallelDecorations(IGameDef *gamedef);
+	void benchPlaceAllOres(IGameDef *gamedef);
+	void benchConcurrentEmerge(IGameDef *gamedef);
+};
+
+static TestMapgen g_test_instance;
+
+void TestMapgen::runTests(IGameDef *gamedef)
+{
+	TEST(testRunPasses);
+	TEST(testParallelOres, gamedef);
+	TEST(testParallelDecorations, gamedef);
+	TEST(benchPlaceAllOres, gamedef);
+	TEST(benchConcurrentEmerge, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// One mapchunk and the block of overgeneration around it, as in emerge
+static const v3s16 chunk_min(-40, -40, -40);
+static const v3s16 chunk_max(39, 39, 39);
+
+static s16 terrainHeight(s16 x, s16 z)
+{
+	return (x * 3 + z * 5) % 20 - 10;
+}
+
+static void makeTerrain(MMVManip *vm, s16 *heightmap)
+{
+	VoxelArea area(chunk_min - v3s16(1, 1, 1) * MAP_BLOCKSIZE,
+		chunk_max + v3s16(1, 1, 1) * MAP_BLOCKSIZE);
+	vm->clear();
+	vm->addArea(area);
+
+	for (s16 z = area.MinEdge.Z; z <= area.MaxEdge.Z; z++)
+	for (s16 y = area.MinEdge.Y; y <= area.MaxEdge.Y; y++)
+	for (s16 x = area.MinEdge.X; x <= area.MaxEdge.X; x++) {
+		// Caves for the all_floors decorations
+		bool cave = y >= -30 && y <= -25 && (x + z) % 7 < 3;
+		bool solid = y <= terrainHeight(x, z) && !cave;
+		vm->m_data[area.index(x, y, z)] =
+			MapNode(solid ? t_CONTENT_STONE : CONTENT_AIR);
+	}
+
+	u32 index = 0;
+	for (s16 z = chunk_min.Z; z <= chunk_max.Z; z++)
+	for (s16 x = chunk_min.X; x <= chunk_max.X; x++, index++)
+		heightmap[index] = terrainHeight(x, z);
+}
+
+static bool sameNodes(const MMVManip &a, const MMVManip &b)
+{
+	s32 volume = a.m_area.getVolume();
+	if (b.m_area.getVolume() != volume)
+		return false;
+	for (s32 i = 0; i < volume; i++) {
+		if (!(a.m_data[i] == b.m_data[i]))
+			return false;
+	}
+	return true;
+}
+
+static Ore *addOre(OreManager *oremgr, OreType type, content_t c_ore,
+	s16 y_min, s16 y_max)
+{
+	Ore *ore = OreManager::create(type);
+	ore->name = "ore" + std::to_string(oremgr->getNumObjects());
+	ore->c_ore = c_ore;
+	ore->c_wherein.push_back(t_CONTENT_STONE);
+	ore->clust_scarcity = 8 * 8 * 8;
+	ore->clust_num_ores = 8;
+	ore->clust_size = 3;
+	ore->y_min = y_min;
+	ore->y_max = y_max;
+	ore->ore_param2 = 0;
+	ore->nthresh = 0.0f;
+	ore->np = NoiseParams(0, 1, v3f(20, 20, 20), oremgr->getNumObjects(),
+		3, 0.5, 2.0);
+	oremgr->add(ore);
+	return ore;
+}
+
+static void addOres(OreManager *oremgr)
+{
+	// Disjoint layers that can be placed at the same time
+	for (s16 y = -40; y < 40; y += 10) {
+		addOre(oremgr, ORE_SCATTER, t_CONTENT_BRICK, y, y + 9);
+		addOre(oremgr, ORE_SCATTER, t_CONTENT_LAVA, y + 5, y + 9);
+	}
+
+	// Ones overlapping the layers, which have to keep their order
+	OreSheet *sheet = (OreSheet *)addOre(oremgr, ORE_SHEET, t_CONTENT_WATER,
+		-40, 39);
+	sheet->column_height_min = 1;
+	sheet->column_height_max = 3;
+	sheet->column_midpoint_factor = 0.5f;
+
+	Ore *blob = addOre(oremgr, ORE_BLOB, t_CONTENT_GRASS, -30, -10);
+	blob->clust_size = 5;
+	blob->clust_scarcity = 16 * 16 * 16;
+
+	OreVein *vein = (OreVein *)addOre(oremgr, ORE_VEIN, t_CONTENT_TORCH,
+		-20, 20);
+	vein->random_factor = 0.5f;
+	vein->nthresh = 0.3f;
+
+	OrePuff *puff = (OrePuff *)addOre(oremgr, ORE_PUFF, t_CONTENT_BRICK,
+		20, 30);
+	puff->np_puff_top = NoiseParams(4, 2, v3f(20, 20, 20), 7, 2, 0.5, 2.0);
+	puff->np_puff_bottom = NoiseParams(4, 2, v3f(20, 20, 20), 8, 2, 0.5, 2.0);
+
+	OreStratum *stratum = (OreStratum *)addOre(oremgr, ORE_STRATUM,
+		t_CONTENT_LAVA, -40, -35);
+	stratum->stratum_thickness = 3;
+	stratum->clust_scarcity = 2;
+
+	addOre(oremgr, ORE_SCATTER, t_CONTENT_WATER, -40, 39);
+}
+
+void TestMapgen::testRunPasses()
+{
+	WorkerPool pool("Test", 3);
+	Mapgen mg;
+	mg.pool = &pool;
+
+	const std::vector<std::pair<s32, s32>> yranges = {
+		{0, 10}, {20, 30}, {5, 25}, {40, 50}, {11, 19}, {-5, 60}, {45, 45},
+	};
+	std::mutex order_mutex;
+	std::vector<size_t> order;
+	mg.runPasses(yranges, [&] (size_t i) {
+		std::lock_guard<std::mutex> lock(order_mutex);
+		order.push_back(i);
+	});
+
+	UASSERTEQ(size_t, order.size(), yranges.size());
+	std::vector<size_t> position(yranges.size());
+	for (size_t k = 0; k < order.size(); k++)
+		position[order[k]] = k;
+	for (size_t i = 0; i < yranges.size(); i++)
+	for (size_t j = i + 1; j < yranges.size(); j++) {
+		if (yranges[i].first <= yranges[j].second &&
+				yranges[j].first <= yranges[i].second)
+			UASSERT(position[i] < position[j]);
+	}
+}
+
+void TestMapgen::testParallelOres(IGameDef *gamedef)
+{
+	OreManager oremgr(gamedef);
+	addOres(&oremgr);
+
+	std::vector<s16> heightmap(80 * 80);
+	MMVManip vm_serial(nullptr), vm_parallel(nullptr);
+	WorkerPool pool("Test", 3);
+
+	for (u32 blockseed = 1; blockseed <= 3; blockseed++) {
+		Mapgen mg;
+		mg.seed = 42;
+		mg.vm = &vm_serial;
+		makeTerrain(&vm_serial, heightmap.data());
+		size_t placed_serial = oremgr.placeAllOres(&mg, blockseed,
+			chunk_min, chunk_max);
+
+		mg.vm = &vm_parallel;
+		mg.pool = &pool;
+		makeTerrain(&vm_parallel, heightmap.data());
+		size_t placed_parallel = oremgr.placeAllOres(&mg, blockseed,
+			chunk_min, chunk_max);
+
+		UASSERTEQ(size_t, placed_serial, placed_parallel);
+		UASSERT(sameNodes(vm_serial, vm_parallel));
+	}
+}
+
+void TestMapgen::testParallelDecorations(IGameDef *gamedef)
+{
+	DecorationManager decomgr(gamedef);
+	std::set<u32> deco_ids;
+	for (s16 i = 0; i < 8; i++) {
+		DecoSimple *deco = (DecoSimple *)DecorationManager::create(DECO_SIMPLE);
+		deco->name = "deco" + std::to_string(i);
+		deco->c_place_on.push_back(t_CONTENT_STONE);
+		deco->c_decos.push_back(i % 2 ? t_CONTENT_GRASS : t_CONTENT_BRICK);
+		deco->sidelen = 8;
+		deco->fill_ratio = 0.05f;
+		deco->nspawnby = -1;
+		deco->deco_height = 1;
+		deco->deco_height_max = 3;
+		deco->deco_param2 = 0;
+		deco->deco_param2_max = 0;
+		// Heightmap decorations, two on each layer
+		deco->y_min = -10 + (i / 2) * 5;
+		deco->y_max = deco->y_min + 4;
+		if (i == 5) {
+			deco->flags = DECO_ALL_FLOORS;
+			deco->y_min = -40;
+		}
+		decomgr.add(deco);
+		deco_ids.insert(deco->index);
+	}
+
+	std::vector<s16> heightmap(80 * 80);
+	MMVManip vm_serial(nullptr), vm_parallel(nullptr);
+	WorkerPool pool("Test", 3);
+	const u32 notify_on = 1 << GENNOTIFY_DECORATION;
+
+	Mapgen mg;
+	mg.ndef = gamedef->getNodeDefManager();
+	mg.heightmap = heightmap.data();
+	mg.vm = &vm_serial;
+	mg.gennotify = GenerateNotifier(notify_on, &deco_ids);
+	makeTerrain(&vm_serial, heightmap.data());
+	decomgr.placeAllDecos(&mg, 1234, chunk_min, chunk_max);
+	std::map<std::string, std::vector<v3s16>> events_serial;
+	mg.gennotify.getEvents(events_serial);
+
+	mg.vm = &vm_parallel;
+	mg.pool = &pool;
+	mg.gennotify = GenerateNotifier(notify_on, &deco_ids);
+	makeTerrain(&vm_parallel, heightmap.data());
+	decomgr.placeAllDecos(&mg, 1234, chunk_min, chunk_max);
+	std::map<std::string, std::vector<v3s16>> events_parallel;
+	mg.gennotify.getEvents(events_parallel);
+
+	UASSERT(!events_serial.empty());
+	UASSERT(events_serial == events_parallel);
+	UASSERT(sameNodes(vm_serial, vm_parallel));
+}
+
+void TestMapgen::benchPlaceAllOres(IGameDef *gamedef)
+{
+	const u32 chunks = 10;
+
+	OreManager oremgr(gamedef);
+	for (u32 i = 0; i < 10; i++)
+		addOres(&oremgr);
+
+	std::vector<s16> heightmap(80 * 80);
+	MMVManip vm(nullptr);
+	WorkerPool pool("Test", 3);
+	Mapgen mg;
+	mg.seed = 42;
+	mg.vm = &vm;
+
+	u64 t_serial = 0, t_parallel = 0;
+	for (u32 i = 0; i < chunks; i++) {
+		mg.pool = nullptr;
+		makeTerrain(&vm, heightmap.data());
+		u64 t_start = porting::getTimeUs();
+		oremgr.placeAllOres(&mg, i, chunk_min, chunk_max);
+		t_serial += porting::getTimeUs() - t_start;
+
+		mg.pool = &pool;
+		makeTerrain(&vm, heightmap.data());
+		t_start = porting::getTimeUs();
+		oremgr.placeAllOres(&mg, i, chunk_min, chunk_max);
+		t_parallel += porting::getTimeUs() - t_start;
+	}
+
+	rawstream << "-------- Ores, " << oremgr.getNumObjects() << " in "
+			<< chunks << " mapchunks: serial " << t_serial << "us, "
+			<< pool.getThreadCount() + 1 << " threads " << t_parallel
+			<< "us" << std::endl;
+}
+
+void TestMapgen::benchConcurrentEmerge(IGameDef *gamedef)
+{
+	const u32 num_emerge = 4;
+	const u32 chunks = 3;
+
+	OreManager oremgr(gamedef);
+	for (u32 i = 0; i < 5; i++)
+		addOres(&oremgr);
+
+	// Shared by all emerge threads, like the pool of EmergeManager
+	WorkerPool pool("Test", 3);
+
+	u64 times[2];
+	for (int shared = 0; shared < 2; shared++) {
+		u64 t_start = porting::getTimeUs();
+		std::vector<std::thread> threads;
+		for (u32 t = 0; t < num_emerge; t++) {
+			threads.emplace_back([&, t] {
+				// Each emerge thread has its own copy of the ores
+				std::unique_ptr<OreManager> ores(oremgr.clone());
+				std::vector<s16> heightmap(80 * 80);
+				MMVManip vm(nullptr);
+				Mapgen mg;
+				mg.seed = 42;
+				mg.vm = &vm;
+				mg.pool = shared ? &pool : nullptr;
+				for (u32 i = 0; i < chunks; i++) {
+					makeTerrain(&vm, heightmap.data());
+					ores->placeAllOres(&mg, t * chunks + i, chunk_min, chunk_max);
+				}
+			});
+		}
+		for (std::thread &thread : threads)
+			thread.join();
+		times[shared] = porting::getTimeUs() - t_start;
+	}
+
+	rawstream << "-------- Ores, " << num_emerge << " emerge threads of "
+			<< chunks << " mapchunks: without pool " << times[0]
+			<< "us, sharing " << pool.getThreadCount() << " workers "
+			<< times[1] << "us" << std::endl;
+}
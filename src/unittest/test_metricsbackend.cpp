@@ -0,0 +1,83 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <sstream>
+#include "util/metricsbackend.h"
+#include "util/workerpool.h"
+
+class TestMetricsBackend : public TestBase {
+public:
+	TestMetricsBackend() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMetricsBackend"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testConcurrentUpdates();
+};
+
+static TestMetricsBackend g_test_instance;
+
+void TestMetricsBackend::runTests(IGameDef *gamedef)
+{
+	TEST(testConcurrentUpdates);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestMetricsBackend::testConcurrentUpdates()
+{
+	MetricsBackend backend;
+	MetricCounterPtr counter = backend.addCounter("test_counter", "Counter");
+	MetricGaugePtr gauge = backend.addGauge("test_gauge", "Gauge");
+	MetricHistogramPtr histogram = backend.addHistogram("test_histogram",
+			"Histogram", {1.0, 2.0, 4.0});
+
+	// Concurrent updates from threads using different shards are not lost
+	WorkerPool pool("MetricsTest", 4);
+	pool.parallelFor(20000, [&] (size_t i) {
+		counter->increment();
+		gauge->increment(2.0);
+		histogram->observe(i % 5);
+	});
+
+	UASSERTEQ(double, counter->get(), 20000.0);
+	UASSERTEQ(double, gauge->get(), 40000.0);
+	gauge->set(3.0);
+	UASSERTEQ(double, gauge->get(), 3.0);
+
+	// 0, 1 | 2 | 3, 4 | -
+	auto simple = std::static_pointer_cast<SimpleMetricHistogram>(histogram);
+	std::vector<u64> counts = simple->getCounts();
+	UASSERTEQ(size_t, counts.size(), 4);
+	UASSERTEQ(u64, counts[0], 8000);
+	UASSERTEQ(u64, counts[1], 12000);
+	UASSERTEQ(u64, counts[2], 20000);
+	UASSERTEQ(u64, counts[3], 20000);
+	UASSERTEQ(double, simple->getSum(), 40000.0);
+
+	std::ostringstream os;
+	backend.dump(os);
+	std::string dump = os.str();
+	UASSERT(dump.find("# TYPE test_counter counter\ntest_counter 20000\n") != std::string::npos);
+	UASSERT(dump.find("test_gauge 3\n") != std::string::npos);
+	UASSERT(dump.find("test_histogram_bucket{le=\"2\"} 12000\n") != std::string::npos);
+	UASSERT(dump.find("test_histogram_count 20000\n") != std::string::npos);
+}
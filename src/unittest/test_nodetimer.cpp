@@ -0,0 +1,237 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <cmath>
+#include <sstream>
+#include "constants.h"
+#include "nodetimer.h"
+#include "noise.h"
+#include "porting.h"
+#include "util/serialize.h"
+
+class TestNodeTimer : public TestBase {
+public:
+	TestNodeTimer() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestNodeTimer"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testStep();
+	void testOrder();
+	void testLongTimeouts();
+	void testRandomized();
+	void testSerialization();
+	void benchStep();
+};
+
+static TestNodeTimer g_test_instance;
+
+void TestNodeTimer::runTests(IGameDef *gamedef)
+{
+	TEST(testStep);
+	TEST(testOrder);
+	TEST(testLongTimeouts);
+	TEST(testRandomized);
+	TEST(testSerialization);
+	TEST(benchStep);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestNodeTimer::testStep()
+{
+	NodeTimerList timers;
+	timers.set(NodeTimer(1.0f, 0.0f, v3s16(1, 2, 3)));
+	timers.set(NodeTimer(2.5f, 0.5f, v3s16(4, 5, 6)));
+
+	UASSERT(timers.step(0.5f).empty());
+	NodeTimer t = timers.get(v3s16(1, 2, 3));
+	UASSERT(std::fabs(t.elapsed - 0.5f) < 0.001f);
+	UASSERT(std::fabs(t.timeout - 1.0f) < 0.001f);
+
+	std::vector<NodeTimer> elapsed = timers.step(0.6f);
+	UASSERTEQ(size_t, elapsed.size(), 1);
+	UASSERT(elapsed[0].position == v3s16(1, 2, 3));
+	UASSERT(std::fabs(elapsed[0].elapsed - 1.1f) < 0.001f);
+	// An expired timer is gone
+	UASSERT(timers.get(v3s16(1, 2, 3)).timeout == 0.0f);
+
+	// Replacing a timer restarts it
+	timers.set(NodeTimer(2.5f, 0.0f, v3s16(4, 5, 6)));
+	UASSERT(timers.step(2.0f).empty());
+	timers.remove(v3s16(4, 5, 6));
+	UASSERT(timers.step(10.0f).empty());
+}
+
+void TestNodeTimer::testOrder()
+{
+	NodeTimerList timers;
+	timers.set(NodeTimer(3.0f, 0.0f, v3s16(0, 0, 3)));
+	timers.set(NodeTimer(1.0f, 0.0f, v3s16(0, 0, 1)));
+	timers.set(NodeTimer(2.0f, 0.0f, v3s16(0, 0, 2)));
+	// Due at the same time as the one above, so it fires after it
+	timers.set(NodeTimer(2.0f, 0.0f, v3s16(0, 0, 0)));
+
+	std::vector<NodeTimer> elapsed = timers.step(5.0f);
+	UASSERTEQ(size_t, elapsed.size(), 4);
+	UASSERT(elapsed[0].position == v3s16(0, 0, 1));
+	UASSERT(elapsed[1].position == v3s16(0, 0, 2));
+	UASSERT(elapsed[2].position == v3s16(0, 0, 0));
+	UASSERT(elapsed[3].position == v3s16(0, 0, 3));
+	UASSERT(std::fabs(elapsed[0].elapsed - 5.0f) < 0.001f);
+	UASSERT(std::fabs(elapsed[3].elapsed - 5.0f) < 0.001f);
+}
+
+void TestNodeTimer::testLongTimeouts()
+{
+	// Past the last level of the wheel and across the cascades
+	NodeTimerList timers;
+	timers.set(NodeTimer(100000.0f, 0.0f, v3s16(1, 1, 1)));
+	timers.set(NodeTimer(500.0f, 0.0f, v3s16(2, 2, 2)));
+
+	u32 fired_short = 0;
+	for (u32 i = 0; i < 5000; i++) {
+		std::vector<NodeTimer> elapsed = timers.step(0.2f);
+		for (const NodeTimer &t : elapsed) {
+			UASSERT(t.position == v3s16(2, 2, 2));
+			UASSERT(t.elapsed >= 500.0f && t.elapsed < 500.3f);
+			fired_short++;
+		}
+	}
+	UASSERTEQ(u32, fired_short, 1);
+
+	// A single huge step, as when a block is activated after a long time
+	UASSERT(timers.step(50000.0f).empty());
+	std::vector<NodeTimer> elapsed = timers.step(100000.0f);
+	UASSERTEQ(size_t, elapsed.size(), 1);
+	UASSERT(elapsed[0].position == v3s16(1, 1, 1));
+	UASSERT(elapsed[0].elapsed > 150000.0f);
+}
+
+void TestNodeTimer::testRandomized()
+{
+	// Compares the timer list with a plain array of trigger times
+	const u32 count = MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE;
+	std::vector<double> trigger(count, -1.0);
+	double time = 0.0;
+
+	PcgRandom pr(814538);
+	NodeTimerList timers;
+	for (u32 op = 0; op < 20000; op++) {
+		u32 i = pr.range(0, count - 1);
+		v3s16 p(i % MAP_BLOCKSIZE, (i / MAP_BLOCKSIZE) % MAP_BLOCKSIZE,
+			i / MAP_BLOCKSIZE / MAP_BLOCKSIZE);
+
+		s32 action = pr.range(0, 9);
+		if (action < 4) {
+			float timeout = pr.range(1, 600) * 0.1f;
+			if (pr.range(0, 9) == 0)
+				timeout = pr.range(1000, 30000);
+			timers.set(NodeTimer(timeout, 0.0f, p));
+			trigger[i] = time + timeout;
+		} else if (action < 5) {
+			timers.remove(p);
+			trigger[i] = -1.0;
+		} else {
+			float dtime = pr.range(0, 50) * 0.01f;
+			if (pr.range(0, 199) == 0)
+				dtime = pr.range(100, 20000);
+			time += dtime;
+
+			std::vector<NodeTimer> elapsed = timers.step(dtime);
+			double last = -1.0;
+			for (const NodeTimer &t : elapsed) {
+				u32 j = (t.position.Z * MAP_BLOCKSIZE + t.position.Y) *
+					MAP_BLOCKSIZE + t.position.X;
+				UASSERT(trigger[j] >= 0.0 && trigger[j] <= time + 0.01);
+				UASSERT(trigger[j] >= last);
+				last = trigger[j];
+				trigger[j] = -1.0;
+			}
+			for (u32 j = 0; j < count; j++)
+				UASSERT(trigger[j] < 0.0 || trigger[j] > time - 0.01);
+		}
+	}
+}
+
+void TestNodeTimer::testSerialization()
+{
+	NodeTimerList timers;
+	timers.set(NodeTimer(10.0f, 2.0f, v3s16(0, 0, 0)));
+	timers.set(NodeTimer(5000.0f, 0.0f, v3s16(15, 15, 15)));
+	timers.set(NodeTimer(3.0f, 0.0f, v3s16(7, 8, 9)));
+	timers.step(1.0f);
+
+	std::ostringstream os(std::ios_base::binary);
+	timers.serialize(os, 25);
+
+	// Data length, count, then the timers in the order they trigger
+	std::string s = os.str();
+	UASSERTEQ(size_t, s.size(), 1 + 2 + 3 * 10);
+	UASSERTEQ(u8, (u8)s[0], 10);
+	UASSERTEQ(u16, readU16((u8 *)&s[1]), 3);
+	UASSERTEQ(u16, readU16((u8 *)&s[3]), (9 * 16 + 8) * 16 + 7);
+	UASSERTEQ(u16, readU16((u8 *)&s[13]), 0);
+	UASSERTEQ(u16, readU16((u8 *)&s[23]), 4095);
+
+	NodeTimerList timers2;
+	std::istringstream is(s, std::ios_base::binary);
+	timers2.deSerialize(is, 25);
+	NodeTimer t = timers2.get(v3s16(0, 0, 0));
+	UASSERT(std::fabs(t.timeout - 10.0f) < 0.001f);
+	UASSERT(std::fabs(t.elapsed - 3.0f) < 0.001f);
+	t = timers2.get(v3s16(15, 15, 15));
+	UASSERT(std::fabs(t.elapsed - 1.0f) < 0.001f);
+
+	std::vector<NodeTimer> elapsed = timers2.step(2.5f);
+	UASSERTEQ(size_t, elapsed.size(), 1);
+	UASSERT(elapsed[0].position == v3s16(7, 8, 9));
+}
+
+void TestNodeTimer::benchStep()
+{
+	// A block full of machines with short timers, as in a factory
+	const u32 count = MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE;
+	const u32 steps = 2000;
+
+	PcgRandom pr(1337);
+	NodeTimerList timers;
+	for (u32 i = 0; i < count; i++) {
+		timers.set(NodeTimer(pr.range(10, 100) * 0.1f, 0.0f,
+			v3s16(i % MAP_BLOCKSIZE, (i / MAP_BLOCKSIZE) % MAP_BLOCKSIZE,
+				i / MAP_BLOCKSIZE / MAP_BLOCKSIZE)));
+	}
+
+	u32 fired = 0;
+	u64 t_start = porting::getTimeUs();
+	for (u32 i = 0; i < steps; i++) {
+		std::vector<NodeTimer> elapsed = timers.step(0.05f);
+		// Restart them like on_timer returning true does
+		for (const NodeTimer &t : elapsed)
+			timers.set(NodeTimer(t.timeout, 0.0f, t.position));
+		fired += elapsed.size();
+	}
+	u64 t_total = porting::getTimeUs() - t_start;
+
+	rawstream << "-------- Node timers, " << steps << " steps of " << count
+			<< " timers: " << t_total << "us, " << fired << " fired"
+			<< std::endl;
+}
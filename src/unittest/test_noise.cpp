@@ -20,8 +20,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include <cmath>
+#include <cstring>
 #include "exceptions.h"
 #include "noise.h"
+#include "porting.h"
 
 class TestNoise : public TestBase {
 public:
@@ -35,6 +37,8 @@ class TestNoise : public TestBase {
 	void testNoise3dPoint();
 	void testNoise3dBulk();
 	void testNoiseInvalidParams();
+	void testNoiseSimd();
+	void benchNoiseMaps();
 
 	static const float expected_2d_results[10 * 10];
 	static const float expected_3d_results[10 * 10 * 10];
@@ -49,6 +53,8 @@ void TestNoise::runTests(IGameDef *gamedef)
 	TEST(testNoise3dPoint);
 	TEST(testNoise3dBulk);
 	TEST(testNoiseInvalidParams);
+	TEST(testNoiseSimd);
+	TEST(benchNoiseMaps);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -121,6 +127,89 @@ void TestNoise::testNoiseInvalidParams()
 	UASSERT(exception_thrown);
 }
 
+static const char *noise_simd_names[] = {"scalar", "SSE2", "AVX2"};
+
+// Every vectorized level must reproduce the scalar maps bit by bit
+void TestNoise::testNoiseSimd()
+{
+	NoiseParams params[] = {
+		NoiseParams(20, 40, v3f(50, 50, 50), 9, 5, 0.6, 2.0),
+		NoiseParams(0, 1, v3f(250, 250, 250), 5, 6, 0.7, 2.0,
+				NOISE_FLAG_EASED),
+		NoiseParams(0, 1, v3f(600, 300, 600), 42, 5, 0.63, 2.0,
+				NOISE_FLAG_ABSVALUE),
+	};
+	// Sizes which do and don't fill whole vectors
+	const v3s16 sizes[] = {v3s16(80, 80, 80), v3s16(17, 5, 9), v3s16(1, 1, 2)};
+	const v3f origins[] = {v3f(0, 0, 0), v3f(-1234.5f, 77.25f, 999),
+			v3f(31000, -31000, 5)};
+
+	NoiseSimd best = getNoiseSimd();
+	for (int level = NOISE_SIMD_SSE2; level <= NOISE_SIMD_AVX2; level++) {
+		if (!setNoiseSimd((NoiseSimd)level))
+			continue;
+
+		for (const NoiseParams &np : params)
+		for (const v3s16 &size : sizes)
+		for (const v3f &p : origins) {
+			NoiseParams np_copy = np;
+			Noise noise_2d(&np_copy, 1337, size.X, size.Y);
+			Noise noise_3d(&np_copy, -99, size.X, size.Y, size.Z);
+			u32 len_2d = size.X * size.Y;
+			u32 len_3d = len_2d * size.Z;
+
+			std::vector<float> result_2d(len_2d), result_3d(len_3d);
+			setNoiseSimd((NoiseSimd)level);
+			memcpy(&result_2d[0], noise_2d.perlinMap2D(p.X, p.Z),
+					len_2d * sizeof(float));
+			memcpy(&result_3d[0], noise_3d.perlinMap3D(p.X, p.Y, p.Z),
+					len_3d * sizeof(float));
+
+			setNoiseSimd(NOISE_SIMD_SCALAR);
+			UASSERT(memcmp(&result_2d[0], noise_2d.perlinMap2D(p.X, p.Z),
+					len_2d * sizeof(float)) == 0);
+			UASSERT(memcmp(&result_3d[0], noise_3d.perlinMap3D(p.X, p.Y, p.Z),
+					len_3d * sizeof(float)) == 0);
+		}
+	}
+	setNoiseSimd(best);
+}
+
+void TestNoise::benchNoiseMaps()
+{
+	// Typical mapgen terrain noise over one mapchunk
+	NoiseParams np(0, 1, v3f(250, 250, 250), 5, 6, 0.7, 2.0);
+	const u32 csize = 80;
+	const u32 runs_2d = 200;
+	const u32 runs_3d = 10;
+
+	NoiseSimd best = getNoiseSimd();
+	rawstream << "-------- Noise maps, " << runs_2d << " 2D and " << runs_3d
+			<< " 3D chunks of " << csize << " nodes:";
+	for (int level = NOISE_SIMD_SCALAR; level <= NOISE_SIMD_AVX2; level++) {
+		if (!setNoiseSimd((NoiseSimd)level))
+			continue;
+
+		Noise noise_2d(&np, 1337, csize, csize);
+		Noise noise_3d(&np, 1337, csize, csize, csize);
+
+		u64 t_start = porting::getTimeUs();
+		for (u32 i = 0; i < runs_2d; i++)
+			noise_2d.perlinMap2D(i * csize, 0);
+		u64 t_2d = porting::getTimeUs() - t_start;
+
+		t_start = porting::getTimeUs();
+		for (u32 i = 0; i < runs_3d; i++)
+			noise_3d.perlinMap3D(i * csize, 0, 0);
+		u64 t_3d = porting::getTimeUs() - t_start;
+
+		rawstream << " " << noise_simd_names[level] << " " << t_2d
+				<< "us/" << t_3d << "us";
+	}
+	rawstream << std::endl;
+	setNoiseSimd(best);
+}
+
 const float TestNoise::expected_2d_results[10 * 10] = {
 	19.11726, 18.49626, 16.48476, 15.02135, 14.75713, 16.26008, 17.54822,
 	18.06860, 18.57016, 18.48407, 18.49649, 17.89160, 15.94162, 14.54901,
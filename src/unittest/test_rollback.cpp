@@ -0,0 +1,185 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include "filesys.h"
+#include "noise.h"
+#include "porting.h"
+#include "rollback.h"
+#include "util/string.h"
+
+class TestRollback : public TestBase {
+public:
+	TestRollback() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestRollback"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testJournal(IGameDef *gamedef);
+	void testNodeActors(IGameDef *gamedef);
+	void benchAddAction(IGameDef *gamedef);
+};
+
+static TestRollback g_test_instance;
+
+void TestRollback::runTests(IGameDef *gamedef)
+{
+	TEST(testJournal, gamedef);
+	TEST(testNodeActors, gamedef);
+	TEST(benchAddAction, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static RollbackAction makeSetNode(const std::string &actor, v3s16 p,
+		time_t t, const std::string &node)
+{
+	RollbackNode n_old, n_new;
+	n_old.name = "air";
+	n_new.name = node;
+	RollbackAction action;
+	action.setSetNode(p, n_old, n_new);
+	action.actor = actor;
+	action.unix_time = t;
+	return action;
+}
+
+static std::string makeWorldDir(TestBase *test, const char *name)
+{
+	std::string dir = test->getTestTempDirectory() + DIR_DELIM + name;
+	// Start from an empty database every run
+	fs::RecursiveDelete(dir);
+	fs::CreateAllDirs(dir);
+	return dir;
+}
+
+void TestRollback::testJournal(IGameDef *gamedef)
+{
+	std::string world = makeWorldDir(this, "rollback_journal");
+	time_t now = time(0);
+
+	{
+		RollbackManager rollback(world, gamedef);
+		for (s16 i = 0; i < 600; i++) {
+			rollback.addAction(makeSetNode(i % 3 ? "alice" : "bob",
+					v3s16(i, 0, 0), now - 600 + i, "default:stone"));
+		}
+
+		// Queries see the journal even before the writer got to it
+		std::list<RollbackAction> actions =
+				rollback.getRevertActions("bob", 1000);
+		UASSERTEQ(size_t, actions.size(), 200);
+		UASSERT(actions.front().p == v3s16(597, 0, 0));
+		UASSERT(actions.back().p == v3s16(0, 0, 0));
+		UASSERT(actions.front().n_new.name == "default:stone");
+
+		actions = rollback.getRevertActions("alice", 1000);
+		UASSERTEQ(size_t, actions.size(), 400);
+
+		// The last one is left for the destructor to write
+		rollback.addAction(makeSetNode("carol", v3s16(1, 2, 3), now,
+				"default:dirt"));
+	}
+
+	// Actors and nodes are looked up by the ids stored before
+	RollbackManager rollback(world, gamedef);
+	std::list<RollbackAction> actions = rollback.getRevertActions("", 1000);
+	UASSERTEQ(size_t, actions.size(), 601);
+	UASSERT(actions.front().actor == "carol");
+	UASSERT(actions.front().n_new.name == "default:dirt");
+	UASSERT(actions.front().n_old.name == "air");
+}
+
+void TestRollback::testNodeActors(IGameDef *gamedef)
+{
+	std::string world = makeWorldDir(this, "rollback_range");
+	time_t now = time(0);
+
+	RollbackManager rollback(world, gamedef);
+	std::vector<RollbackAction> all;
+	PcgRandom pr(31337);
+	for (u32 i = 0; i < 2000; i++) {
+		v3s16 p(pr.range(-20, 20), pr.range(-20, 20), pr.range(-20, 20));
+		// Clear of the limit of the query, which may start a second later
+		time_t age = pr.range(0, 1) ? pr.range(0, 900) : pr.range(1100, 2000);
+		all.push_back(makeSetNode("player" + itos(pr.range(0, 9)), p,
+				now - age, "default:wood"));
+		rollback.addAction(all.back());
+	}
+
+	// Column lookups for small ranges, one scan for large ones
+	for (int range : {0, 1, 3, 7, 8, 15}) {
+		v3s16 center(pr.range(-5, 5), pr.range(-5, 5), pr.range(-5, 5));
+		std::list<RollbackAction> actions =
+				rollback.getNodeActors(center, range, 1000, 10);
+
+		std::vector<time_t> expected;
+		for (const RollbackAction &a : all) {
+			if (a.unix_time >= now - 1000 &&
+					std::abs(a.p.X - center.X) <= range &&
+					std::abs(a.p.Y - center.Y) <= range &&
+					std::abs(a.p.Z - center.Z) <= range)
+				expected.push_back(a.unix_time);
+		}
+		std::sort(expected.rbegin(), expected.rend());
+		if (expected.size() > 10)
+			expected.resize(10);
+
+		UASSERTEQ(size_t, actions.size(), expected.size());
+		size_t i = 0;
+		for (const RollbackAction &a : actions) {
+			UASSERT(a.unix_time == expected[i++]);
+			UASSERT(std::abs(a.p.X - center.X) <= range);
+			UASSERT(std::abs(a.p.Y - center.Y) <= range);
+			UASSERT(std::abs(a.p.Z - center.Z) <= range);
+		}
+	}
+}
+
+void TestRollback::benchAddAction(IGameDef *gamedef)
+{
+	// Griefers placing nodes all over the place
+	const u32 count = 100000;
+	std::string world = makeWorldDir(this, "rollback_bench");
+	time_t now = time(0);
+
+	RollbackManager rollback(world, gamedef);
+	PcgRandom pr(42);
+	u64 t_start = porting::getTimeUs();
+	for (u32 i = 0; i < count; i++) {
+		v3s16 p(pr.range(-500, 500), pr.range(-20, 50), pr.range(-500, 500));
+		rollback.addAction(makeSetNode("griefer" + itos(i % 20), p, now,
+				"default:tnt"));
+	}
+	u64 t_add = porting::getTimeUs() - t_start;
+
+	t_start = porting::getTimeUs();
+	std::list<RollbackAction> actions =
+			rollback.getNodeActors(v3s16(0, 10, 0), 5, 3600, 100);
+	u64 t_query = porting::getTimeUs() - t_start;
+
+	rawstream << "-------- Rollback, " << count << " actions: " << t_add
+			<< "us on the server thread, " << t_query
+			<< "us to finish writing and query " << actions.size()
+			<< " actions" << std::endl;
+}
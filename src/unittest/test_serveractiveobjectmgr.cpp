@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <queue>
 #include "test.h"
 
+#include "noise.h"
 #include "profiler.h"
 
 class TestServerActiveObject : public ServerActiveObject
@@ -48,6 +49,9 @@ class TestServerActiveObjectMgr : public TestBase
 	void testRemoveObject();
 	void testGetObjectsInsideRadius();
 	void testGetAddedActiveObjectsAroundPos();
+	void testGetObjectsInArea();
+	void testUpdateObjectPos();
+	void benchGetObjectsInsideRadius();
 };
 
 static TestServerActiveObjectMgr g_test_instance;
@@ -59,6 +63,9 @@ void TestServerActiveObjectMgr::runTests(IGameDef *gamedef)
 	TEST(testRemoveObject)
 	TEST(testGetObjectsInsideRadius);
 	TEST(testGetAddedActiveObjectsAroundPos);
+	TEST(testGetObjectsInArea);
+	TEST(testUpdateObjectPos);
+	TEST(benchGetObjectsInsideRadius);
 }
 
 void clearSAOMgr(server::ActiveObjectMgr *saomgr)
@@ -198,3 +205,119 @@ void TestServerActiveObjectMgr::testGetAddedActiveObjectsAroundPos()
 
 	clearSAOMgr(&saomgr);
 }
+
+void TestServerActiveObjectMgr::testGetObjectsInArea()
+{
+	server::ActiveObjectMgr saomgr;
+	static const v3f sao_pos[] = {
+			v3f(10, 40, 10),
+			v3f(740, 100, -304),
+			v3f(-200, 100, -304),
+			v3f(740, -740, -304),
+			v3f(1500, -740, -304),
+	};
+
+	for (const auto &p : sao_pos) {
+		saomgr.registerObject(new TestServerActiveObject(p));
+	}
+
+	std::vector<ServerActiveObject *> result;
+	saomgr.getObjectsInArea(aabb3f(v3f(-50), v3f(50)), result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	result.clear();
+	saomgr.getObjectsInArea(aabb3f(v3f(-300, 0, -400), v3f(800, 200, 0)),
+			result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 2);
+
+	result.clear();
+	saomgr.getObjectsInArea(aabb3f(v3f(-750000), v3f(750000)), result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 5);
+
+	clearSAOMgr(&saomgr);
+}
+
+void TestServerActiveObjectMgr::testUpdateObjectPos()
+{
+	server::ActiveObjectMgr saomgr;
+	auto tsao = new TestServerActiveObject(v3f(10, 40, 10));
+	UASSERT(saomgr.registerObject(tsao));
+
+	std::vector<ServerActiveObject *> result;
+	saomgr.getObjectsInsideRadius(v3f(), 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	// Objects without an environment do not report their movement,
+	// so do it by hand
+	tsao->setBasePosition(v3f(2000, 40, 10));
+	saomgr.updateObjectPos(tsao->getId(), tsao->getBasePosition());
+
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(), 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(2000, 40, 10), 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+	UASSERT(result[0] == tsao);
+
+	saomgr.removeObject(tsao->getId());
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(2000, 40, 10), 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	clearSAOMgr(&saomgr);
+}
+
+void TestServerActiveObjectMgr::benchGetObjectsInsideRadius()
+{
+	const u32 num_objects = 5000;
+	const u32 num_queries = 2000;
+	const s32 extent = 1000 * BS;
+	const f32 radius = 16 * BS;
+
+	server::ActiveObjectMgr saomgr;
+	PcgRandom pr(1234);
+	auto rand_pos = [&]() {
+		return v3f(pr.range(-extent, extent), pr.range(-extent / 4, extent / 4),
+				pr.range(-extent, extent));
+	};
+
+	for (u32 i = 0; i < num_objects; i++)
+		saomgr.registerObject(new TestServerActiveObject(rand_pos()));
+
+	std::vector<v3f> query_pos;
+	for (u32 i = 0; i < num_queries; i++)
+		query_pos.push_back(rand_pos());
+
+	// Linear scan, as done before the spatial index existed
+	std::vector<ServerActiveObject *> result;
+	size_t found_linear = 0;
+	u64 t_start = porting::getTimeUs();
+	for (const v3f &pos : query_pos) {
+		result.clear();
+		for (auto &it : saomgr.m_active_objects) {
+			if (it.second->getBasePosition().getDistanceFromSQ(pos) <= radius * radius)
+				result.push_back(it.second);
+		}
+		found_linear += result.size();
+	}
+	u64 t_linear = porting::getTimeUs() - t_start;
+
+	size_t found_indexed = 0;
+	t_start = porting::getTimeUs();
+	for (const v3f &pos : query_pos) {
+		result.clear();
+		saomgr.getObjectsInsideRadius(pos, radius, result, nullptr);
+		found_indexed += result.size();
+	}
+	u64 t_indexed = porting::getTimeUs() - t_start;
+
+	UASSERTEQ(size_t, found_indexed, found_linear);
+
+	rawstream << "-------- " << num_queries << " radius queries over "
+			<< num_objects << " objects: linear " << t_linear << "us, indexed "
+			<< t_indexed << "us" << std::endl;
+
+	clearSAOMgr(&saomgr);
+}
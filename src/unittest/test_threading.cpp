@@ -29,6 +29,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "threading/semaphore.h"
 #include "threading/thread.h"
 #endif
+#include "util/workerpool.h"
+#include <thread>
 
 
 class TestThreading : public TestBase {
@@ -39,6 +41,7 @@ class TestThreading : public TestBase {
 
 	void testStartStopWait();
 	void testAtomicSemaphoreThread();
+	void testWorkerPool();
 };
 
 static TestThreading g_test_instance;
@@ -47,6 +50,7 @@ void TestThreading::runTests(IGameDef *gamedef)
 {
 	TEST(testStartStopWait);
 	TEST(testAtomicSemaphoreThread);
+	TEST(testWorkerPool);
 }
 
 class SimpleTestThread : public Thread {
@@ -163,3 +167,53 @@ void TestThreading::testAtomicSemaphoreThread()
 	UASSERT(val == num_threads * 0x10000);
 }
 
+
+
+void TestThreading::testWorkerPool()
+{
+	for (u32 num_threads : {0, 1, 4}) {
+		WorkerPool pool("WorkerPoolTest", num_threads);
+		UASSERTEQ(u32, pool.getThreadCount(), num_threads);
+
+		// Every index is processed exactly once, over several runs
+		std::vector<std::atomic<u32>> hits(1000);
+		for (int run = 0; run < 3; run++) {
+			pool.parallelFor(hits.size(), [&] (size_t i) {
+				++hits[i];
+			});
+		}
+		for (std::atomic<u32> &hit : hits)
+			UASSERT(hit == 3);
+
+		// Exceptions are passed to the caller
+		bool caught = false;
+		try {
+			pool.parallelFor(100, [] (size_t i) {
+				if (i == 42)
+					throw BaseException("expected");
+			});
+		} catch (BaseException &e) {
+			caught = true;
+		}
+		UASSERT(caught);
+
+		// The pool is still usable afterwards
+		std::atomic<u32> count(0);
+		pool.parallelFor(100, [&] (size_t i) { ++count; });
+		UASSERT(count == 100);
+
+		// Concurrent callers do not wait for each other and all finish
+		std::vector<std::atomic<u32>> counts(4);
+		std::vector<std::thread> callers;
+		for (std::atomic<u32> &caller_count : counts) {
+			callers.emplace_back([&] {
+				for (int run = 0; run < 50; run++)
+					pool.parallelFor(100, [&] (size_t i) { ++caller_count; });
+			});
+		}
+		for (std::thread &caller : callers)
+			caller.join();
+		for (std::atomic<u32> &caller_count : counts)
+			UASSERT(caller_count == 50 * 100);
+	}
+}
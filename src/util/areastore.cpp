@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/areastore.h"
 #include "util/serialize.h"
 #include "util/container.h"
+#include <algorithm>
 
 #if USE_SPATIAL
 	#include <spatialindex/SpatialIndex.h>
@@ -44,14 +45,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	AST_OVERLAPS_IN_DIMENSION((amine), (amaxe), (b), Y) &&  \
 	AST_OVERLAPS_IN_DIMENSION((amine), (amaxe), (b), Z))
 
+// Areas that can be inserted into the BVH one by one before it is rebuilt,
+// in addition to half the areas it already holds
+#define BVH_INCREMENTAL_INSERTS 16
+
 
 AreaStore *AreaStore::getOptimalImplementation()
 {
-#if USE_SPATIAL
-	return new SpatialAreaStore();
-#else
-	return new VectorAreaStore();
-#endif
+	return new BVHAreaStore();
 }
 
 const Area *AreaStore::getArea(u32 id) const
@@ -125,6 +126,12 @@ void AreaStore::invalidateCache()
 
 u32 AreaStore::getNextId() const
 {
+	// There are no gaps if the highest ID is one below the count
+	if (areas_map.empty())
+		return 0;
+	if (areas_map.rbegin()->first == areas_map.size() - 1)
+		return areas_map.size();
+
 	u32 free_id = 0;
 	for (const auto &area : areas_map) {
 		if (area.first > free_id)
@@ -241,6 +248,324 @@ void VectorAreaStore::getAreasInArea(std::vector<Area *> *result,
 	}
 }
 
+
+////
+// BVHAreaStore
+////
+
+
+static inline void bvh_include(v3s16 &minedge, v3s16 &maxedge,
+		const v3s16 &mine, const v3s16 &maxe)
+{
+	minedge.X = MYMIN(minedge.X, mine.X);
+	minedge.Y = MYMIN(minedge.Y, mine.Y);
+	minedge.Z = MYMIN(minedge.Z, mine.Z);
+	maxedge.X = MYMAX(maxedge.X, maxe.X);
+	maxedge.Y = MYMAX(maxedge.Y, maxe.Y);
+	maxedge.Z = MYMAX(maxedge.Z, maxe.Z);
+}
+
+// Half the surface area, which is what the chance of a query hitting a box
+// depends on
+static inline s64 bvh_surface(const v3s16 &minedge, const v3s16 &maxedge)
+{
+	s64 dx = maxedge.X - minedge.X + 1;
+	s64 dy = maxedge.Y - minedge.Y + 1;
+	s64 dz = maxedge.Z - minedge.Z + 1;
+	return dx * dy + dy * dz + dz * dx;
+}
+
+BVHAreaStore::BVHAreaStore()
+{
+	// Walking the tree costs about as much as a cache lookup, and unlike
+	// the cache it doesn't need to be thrown away on every change
+	setCacheParams(false, 0, 0);
+}
+
+bool BVHAreaStore::insertArea(Area *a)
+{
+	if (a->id == U32_MAX)
+		a->id = getNextId();
+	std::pair<AreaMap::iterator, bool> res =
+			areas_map.insert(std::make_pair(a->id, *a));
+	if (!res.second)
+		// ID is not unique
+		return false;
+
+	if (!m_needs_rebuild) {
+		// Many areas at once, e.g. when loading, are bulk loaded instead
+		if (m_incremental_inserts < BVH_INCREMENTAL_INSERTS + m_leaves.size() / 2) {
+			insertLeaf(&res.first->second);
+			m_incremental_inserts++;
+		} else {
+			m_needs_rebuild = true;
+		}
+	}
+	invalidateCache();
+	return true;
+}
+
+bool BVHAreaStore::removeArea(u32 id)
+{
+	AreaMap::iterator it = areas_map.find(id);
+	if (it == areas_map.end())
+		return false;
+
+	if (!m_needs_rebuild) {
+		std::unordered_map<u32, u32>::iterator leaf = m_leaves.find(id);
+		removeLeaf(leaf->second);
+		m_leaves.erase(leaf);
+	}
+	areas_map.erase(it);
+	invalidateCache();
+	return true;
+}
+
+void BVHAreaStore::getAreasForPosImpl(std::vector<Area *> *result, v3s16 pos)
+{
+	update();
+	if (m_root == NONE)
+		return;
+
+	m_stack.clear();
+	m_stack.push_back(m_root);
+	while (!m_stack.empty()) {
+		const Node &node = m_nodes[m_stack.back()];
+		m_stack.pop_back();
+		if (!AST_CONTAINS_PT(&node, pos))
+			continue;
+
+		if (node.left == NONE) {
+			result->push_back(node.area);
+		} else {
+			m_stack.push_back(node.left);
+			m_stack.push_back(node.right);
+		}
+	}
+}
+
+void BVHAreaStore::getAreasInArea(std::vector<Area *> *result,
+		v3s16 minedge, v3s16 maxedge, bool accept_overlap)
+{
+	update();
+	if (m_root == NONE)
+		return;
+
+	// Areas contained in the queried one overlap it too
+	m_stack.clear();
+	m_stack.push_back(m_root);
+	while (!m_stack.empty()) {
+		const Node &node = m_nodes[m_stack.back()];
+		m_stack.pop_back();
+		if (!AST_AREAS_OVERLAP(minedge, maxedge, &node))
+			continue;
+
+		if (node.left != NONE) {
+			m_stack.push_back(node.left);
+			m_stack.push_back(node.right);
+		} else if (accept_overlap ||
+				AST_CONTAINS_AREA(minedge, maxedge, node.area)) {
+			result->push_back(node.area);
+		}
+	}
+}
+
+void BVHAreaStore::update()
+{
+	if (!m_needs_rebuild)
+		return;
+
+	m_nodes.clear();
+	m_free_nodes.clear();
+	m_leaves.clear();
+	m_root = NONE;
+	m_needs_rebuild = false;
+	m_incremental_inserts = 0;
+	if (areas_map.empty())
+		return;
+
+	std::vector<Area *> areas;
+	areas.reserve(areas_map.size());
+	for (auto &it : areas_map)
+		areas.push_back(&it.second);
+
+	m_nodes.reserve(2 * areas.size() - 1);
+	m_root = allocNode();
+	buildNode(m_root, areas, 0, areas.size(), NONE);
+}
+
+void BVHAreaStore::buildNode(u32 index, std::vector<Area *> &areas,
+		size_t begin, size_t end, u32 parent)
+{
+	v3s16 minedge = areas[begin]->minedge;
+	v3s16 maxedge = areas[begin]->maxedge;
+	v3s32 cmin(S32_MAX, S32_MAX, S32_MAX);
+	v3s32 cmax(S32_MIN, S32_MIN, S32_MIN);
+	for (size_t i = begin; i < end; i++) {
+		const Area *a = areas[i];
+		bvh_include(minedge, maxedge, a->minedge, a->maxedge);
+		// Twice the center
+		v3s32 c(a->minedge.X + a->maxedge.X, a->minedge.Y + a->maxedge.Y,
+			a->minedge.Z + a->maxedge.Z);
+		cmin.X = MYMIN(cmin.X, c.X);
+		cmin.Y = MYMIN(cmin.Y, c.Y);
+		cmin.Z = MYMIN(cmin.Z, c.Z);
+		cmax.X = MYMAX(cmax.X, c.X);
+		cmax.Y = MYMAX(cmax.Y, c.Y);
+		cmax.Z = MYMAX(cmax.Z, c.Z);
+	}
+
+	Node &node = m_nodes[index];
+	node.minedge = minedge;
+	node.maxedge = maxedge;
+	node.parent = parent;
+	if (end - begin == 1) {
+		node.left = node.right = NONE;
+		node.area = areas[begin];
+		m_leaves[node.area->id] = index;
+		return;
+	}
+
+	// Split at the median along the axis the centers are spread most on
+	v3s32 spread = cmax - cmin;
+	size_t mid = begin + (end - begin) / 2;
+	std::nth_element(areas.begin() + begin, areas.begin() + mid,
+		areas.begin() + end,
+		[&spread] (const Area *a, const Area *b) {
+			if (spread.X >= spread.Y && spread.X >= spread.Z)
+				return a->minedge.X + a->maxedge.X < b->minedge.X + b->maxedge.X;
+			if (spread.Y >= spread.Z)
+				return a->minedge.Y + a->maxedge.Y < b->minedge.Y + b->maxedge.Y;
+			return a->minedge.Z + a->maxedge.Z < b->minedge.Z + b->maxedge.Z;
+		});
+
+	// Siblings next to each other, the nodes are reserved up front
+	u32 left = allocNode();
+	u32 right = allocNode();
+	node.left = left;
+	node.right = right;
+	node.area = nullptr;
+	buildNode(left, areas, begin, mid, index);
+	buildNode(right, areas, mid, end, index);
+}
+
+u32 BVHAreaStore::allocNode()
+{
+	if (!m_free_nodes.empty()) {
+		u32 index = m_free_nodes.back();
+		m_free_nodes.pop_back();
+		return index;
+	}
+	m_nodes.emplace_back();
+	return m_nodes.size() - 1;
+}
+
+void BVHAreaStore::insertLeaf(Area *a)
+{
+	u32 leaf = allocNode();
+	Node &node = m_nodes[leaf];
+	node.minedge = a->minedge;
+	node.maxedge = a->maxedge;
+	node.parent = NONE;
+	node.left = node.right = NONE;
+	node.area = a;
+	m_leaves[a->id] = leaf;
+
+	if (m_root == NONE) {
+		m_root = leaf;
+		return;
+	}
+
+	// Cost of pairing the new leaf with a child of the current node
+	auto child_cost = [this, a] (u32 index) -> s64 {
+		const Node &child = m_nodes[index];
+		v3s16 mine = child.minedge, maxe = child.maxedge;
+		bvh_include(mine, maxe, a->minedge, a->maxedge);
+		s64 cost = bvh_surface(mine, maxe);
+		if (child.left != NONE)
+			cost -= bvh_surface(child.minedge, child.maxedge);
+		return cost;
+	};
+
+	// Walk down to the sibling that makes the tree grow the least
+	u32 sibling = m_root;
+	while (m_nodes[sibling].left != NONE) {
+		const Node &n = m_nodes[sibling];
+		v3s16 mine = n.minedge, maxe = n.maxedge;
+		bvh_include(mine, maxe, a->minedge, a->maxedge);
+		s64 combined = bvh_surface(mine, maxe);
+
+		// A new parent of this node and the leaf
+		s64 cost = 2 * combined;
+		// This node grows when going further down
+		s64 inherited = 2 * (combined - bvh_surface(n.minedge, n.maxedge));
+		s64 cost_left = child_cost(n.left) + inherited;
+		s64 cost_right = child_cost(n.right) + inherited;
+
+		if (cost <= cost_left && cost <= cost_right)
+			break;
+		sibling = cost_left <= cost_right ? n.left : n.right;
+	}
+
+	u32 old_parent = m_nodes[sibling].parent;
+	u32 parent = allocNode();
+	Node &p = m_nodes[parent];
+	p.parent = old_parent;
+	p.left = sibling;
+	p.right = leaf;
+	p.area = nullptr;
+	m_nodes[sibling].parent = parent;
+	m_nodes[leaf].parent = parent;
+
+	if (old_parent == NONE)
+		m_root = parent;
+	else if (m_nodes[old_parent].left == sibling)
+		m_nodes[old_parent].left = parent;
+	else
+		m_nodes[old_parent].right = parent;
+	refit(parent);
+}
+
+void BVHAreaStore::removeLeaf(u32 leaf)
+{
+	u32 parent = m_nodes[leaf].parent;
+	m_free_nodes.push_back(leaf);
+	if (parent == NONE) {
+		m_root = NONE;
+		return;
+	}
+
+	// The sibling takes the place of the parent
+	const Node &p = m_nodes[parent];
+	u32 sibling = p.left == leaf ? p.right : p.left;
+	u32 grandparent = p.parent;
+	m_nodes[sibling].parent = grandparent;
+	m_free_nodes.push_back(parent);
+	if (grandparent == NONE) {
+		m_root = sibling;
+		return;
+	}
+
+	Node &g = m_nodes[grandparent];
+	if (g.left == parent)
+		g.left = sibling;
+	else
+		g.right = sibling;
+	refit(grandparent);
+}
+
+void BVHAreaStore::refit(u32 index)
+{
+	while (index != NONE) {
+		Node &node = m_nodes[index];
+		node.minedge = m_nodes[node.left].minedge;
+		node.maxedge = m_nodes[node.left].maxedge;
+		bvh_include(node.minedge, node.maxedge,
+			m_nodes[node.right].minedge, m_nodes[node.right].maxedge);
+		index = node.parent;
+	}
+}
+
 #if USE_SPATIAL
 
 static inline SpatialIndex::Region get_spatial_region(const v3s16 minedge,
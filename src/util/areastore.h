@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "irr_v3d.h"
 #include "noise.h" // for PcgRandom
 #include <map>
+#include <unordered_map>
 #include <list>
 #include <vector>
 #include <istream>
@@ -144,6 +145,57 @@ class VectorAreaStore : public AreaStore {
 };
 
 
+/// Bounding volume hierarchy over the areas, built in one go from all areas
+/// and updated incrementally until enough areas were added to rebuild it.
+class BVHAreaStore : public AreaStore {
+public:
+	BVHAreaStore();
+
+	virtual void reserve(size_t count) { m_nodes.reserve(2 * count); }
+	virtual bool insertArea(Area *a);
+	virtual bool removeArea(u32 id);
+	virtual void getAreasInArea(std::vector<Area *> *result,
+		v3s16 minedge, v3s16 maxedge, bool accept_overlap);
+
+protected:
+	virtual void getAreasForPosImpl(std::vector<Area *> *result, v3s16 pos);
+
+private:
+	static const u32 NONE = U32_MAX;
+
+	// Leaves have no children and point to one area each
+	struct Node {
+		v3s16 minedge, maxedge;
+		u32 parent;
+		u32 left, right;
+		Area *area;
+	};
+
+	/// Rebuilds the tree from all areas if it is out of date.
+	void update();
+	void buildNode(u32 index, std::vector<Area *> &areas,
+		size_t begin, size_t end, u32 parent);
+
+	u32 allocNode();
+	void insertLeaf(Area *a);
+	void removeLeaf(u32 leaf);
+	void refit(u32 index);
+
+	std::vector<Node> m_nodes;
+	std::vector<u32> m_free_nodes;
+	u32 m_root = NONE;
+	/// Leaf node of every area, by area ID.
+	std::unordered_map<u32, u32> m_leaves;
+
+	/// Whether the tree must be rebuilt before the next query
+	bool m_needs_rebuild = false;
+	/// Areas inserted into the tree one by one since the last rebuild
+	size_t m_incremental_inserts = 0;
+	/// Traversal stack, kept to avoid allocating it for every query
+	std::vector<u32> m_stack;
+};
+
+
 #if USE_SPATIAL
 
 class SpatialAreaStore : public AreaStore {
@@ -29,10 +29,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #else
 #include "threading/semaphore.h"
 #endif
+#include <deque>
 #include <list>
 #include <vector>
 #include <map>
 #include <set>
+#include <unordered_set>
 #include <queue>
 
 /*
@@ -54,7 +56,7 @@ class UniqueQueue
 	{
 		if (m_set.insert(value).second)
 		{
-			m_queue.push(value);
+			m_queue.push_back(value);
 			return true;
 		}
 		return false;
@@ -63,7 +65,7 @@ class UniqueQueue
 	void pop_front()
 	{
 		m_set.erase(m_queue.front());
-		m_queue.pop();
+		m_queue.pop_front();
 	}
 
 	const Value& front() const
@@ -71,14 +73,20 @@ class UniqueQueue
 		return m_queue.front();
 	}
 
+	// The i-th value from the front
+	const Value& operator[](u32 i) const
+	{
+		return m_queue[i];
+	}
+
 	u32 size() const
 	{
 		return m_queue.size();
 	}
 
 private:
-	std::set<Value> m_set;
-	std::queue<Value> m_queue;
+	std::unordered_set<Value> m_set;
+	std::deque<Value> m_queue;
 };
 
 template<typename Key, typename Value>
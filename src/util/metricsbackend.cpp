@@ -18,25 +18,144 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "metricsbackend.h"
+#include <algorithm>
 #if USE_PROMETHEUS
 #include <prometheus/exposer.h>
 #include <prometheus/registry.h>
 #include <prometheus/counter.h>
 #include <prometheus/gauge.h>
+#include <prometheus/histogram.h>
+#include <prometheus/text_serializer.h>
 #include "log.h"
 #include "settings.h"
 #endif
 
+size_t getMetricShard()
+{
+	// Threads get the shards in turn
+	static std::atomic<size_t> next_shard(0);
+	thread_local const size_t shard = next_shard++ % METRIC_SHARDS;
+	return shard;
+}
+
+static void dumpHeader(std::ostream &os, const std::string &name,
+		const std::string &help_str, const char *type)
+{
+	os << "# HELP " << name << " " << help_str << "\n";
+	os << "# TYPE " << name << " " << type << "\n";
+}
+
+void SimpleMetricCounter::dump(std::ostream &os) const
+{
+	dumpHeader(os, m_name, m_help_str, "counter");
+	os << m_name << " " << get() << "\n";
+}
+
+void SimpleMetricGauge::dump(std::ostream &os) const
+{
+	dumpHeader(os, m_name, m_help_str, "gauge");
+	os << m_name << " " << get() << "\n";
+}
+
+SimpleMetricHistogram::SimpleMetricHistogram(const std::string &name,
+		const std::string &help_str, const std::vector<double> &bounds) :
+		MetricHistogram(), m_name(name), m_help_str(help_str),
+		m_bounds(bounds)
+{
+	// Round up to whole cache lines
+	const size_t per_line = 64 / sizeof(std::atomic<u64>);
+	m_stride = (m_bounds.size() + 1 + per_line - 1) / per_line * per_line;
+	m_counts.reset(new std::atomic<u64>[m_stride * METRIC_SHARDS]);
+	for (size_t i = 0; i < m_stride * METRIC_SHARDS; i++)
+		m_counts[i].store(0, std::memory_order_relaxed);
+}
+
+void SimpleMetricHistogram::observe(double value)
+{
+	size_t bucket = std::lower_bound(m_bounds.begin(), m_bounds.end(), value) -
+			m_bounds.begin();
+	size_t shard = getMetricShard();
+	m_counts[shard * m_stride + bucket].fetch_add(1, std::memory_order_relaxed);
+	metricAtomicAdd(m_sums[shard].value, value);
+}
+
+std::vector<u64> SimpleMetricHistogram::getCounts() const
+{
+	std::vector<u64> counts(m_bounds.size() + 1, 0);
+	for (size_t shard = 0; shard < METRIC_SHARDS; shard++) {
+		for (size_t i = 0; i < counts.size(); i++)
+			counts[i] += m_counts[shard * m_stride + i].load(std::memory_order_relaxed);
+	}
+	for (size_t i = 1; i < counts.size(); i++)
+		counts[i] += counts[i - 1];
+	return counts;
+}
+
+double SimpleMetricHistogram::getSum() const
+{
+	double sum = 0.0;
+	for (const MetricShard &shard : m_sums)
+		sum += shard.value.load(std::memory_order_relaxed);
+	return sum;
+}
+
+void SimpleMetricHistogram::dump(std::ostream &os) const
+{
+	dumpHeader(os, m_name, m_help_str, "histogram");
+	std::vector<u64> counts = getCounts();
+	for (size_t i = 0; i < m_bounds.size(); i++)
+		os << m_name << "_bucket{le=\"" << m_bounds[i] << "\"} " << counts[i] << "\n";
+	os << m_name << "_bucket{le=\"+Inf\"} " << counts.back() << "\n";
+	os << m_name << "_sum " << getSum() << "\n";
+	os << m_name << "_count " << counts.back() << "\n";
+}
+
 MetricCounterPtr MetricsBackend::addCounter(
 		const std::string &name, const std::string &help_str)
 {
-	return std::make_shared<SimpleMetricCounter>(name, help_str);
+	auto counter = std::make_shared<SimpleMetricCounter>(name, help_str);
+	MutexAutoLock lock(m_mutex);
+	m_counters.push_back(counter);
+	return counter;
 }
 
 MetricGaugePtr MetricsBackend::addGauge(
 		const std::string &name, const std::string &help_str)
 {
-	return std::make_shared<SimpleMetricGauge>(name, help_str);
+	auto gauge = std::make_shared<SimpleMetricGauge>(name, help_str);
+	MutexAutoLock lock(m_mutex);
+	m_gauges.push_back(gauge);
+	return gauge;
+}
+
+MetricHistogramPtr MetricsBackend::addHistogram(
+		const std::string &name, const std::string &help_str,
+		const std::vector<double> &bounds)
+{
+	auto histogram = std::make_shared<SimpleMetricHistogram>(name, help_str, bounds);
+	MutexAutoLock lock(m_mutex);
+	m_histograms.push_back(histogram);
+	return histogram;
+}
+
+void MetricsBackend::dump(std::ostream &os)
+{
+	MutexAutoLock lock(m_mutex);
+	for (const auto &counter : m_counters)
+		counter->dump(os);
+	for (const auto &gauge : m_gauges)
+		gauge->dump(os);
+	for (const auto &histogram : m_histograms)
+		histogram->dump(os);
+}
+
+const std::vector<double> &MetricsBackend::getStepTimeBounds()
+{
+	static const std::vector<double> bounds = {
+		0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005,
+		0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0
+	};
+	return bounds;
 }
 
 #if USE_PROMETHEUS
@@ -95,6 +214,33 @@ class PrometheusMetricGauge : public MetricGauge
 	prometheus::Gauge &m_gauge;
 };
 
+class PrometheusMetricHistogram : public MetricHistogram
+{
+public:
+	PrometheusMetricHistogram() = delete;
+
+	PrometheusMetricHistogram(const std::string &name, const std::string &help_str,
+			const std::vector<double> &bounds,
+			std::shared_ptr<prometheus::Registry> registry) :
+			MetricHistogram(),
+			m_family(prometheus::BuildHistogram()
+							.Name(name)
+							.Help(help_str)
+							.Register(*registry)),
+			m_histogram(m_family.Add({}, prometheus::Histogram::BucketBoundaries(
+							bounds.begin(), bounds.end())))
+	{
+	}
+
+	virtual ~PrometheusMetricHistogram() {}
+
+	virtual void observe(double value) { m_histogram.Observe(value); }
+
+private:
+	prometheus::Family<prometheus::Histogram> &m_family;
+	prometheus::Histogram &m_histogram;
+};
+
 class PrometheusMetricsBackend : public MetricsBackend
 {
 public:
@@ -112,6 +258,11 @@ class PrometheusMetricsBackend : public MetricsBackend
 			const std::string &name, const std::string &help_str);
 	virtual MetricGaugePtr addGauge(
 			const std::string &name, const std::string &help_str);
+	virtual MetricHistogramPtr addHistogram(
+			const std::string &name, const std::string &help_str,
+			const std::vector<double> &bounds);
+
+	virtual void dump(std::ostream &os);
 
 private:
 	std::unique_ptr<prometheus::Exposer> m_exposer;
@@ -130,6 +281,19 @@ MetricGaugePtr PrometheusMetricsBackend::addGauge(
 	return std::make_shared<PrometheusMetricGauge>(name, help_str, m_registry);
 }
 
+MetricHistogramPtr PrometheusMetricsBackend::addHistogram(
+		const std::string &name, const std::string &help_str,
+		const std::vector<double> &bounds)
+{
+	return std::make_shared<PrometheusMetricHistogram>(name, help_str, bounds,
+			m_registry);
+}
+
+void PrometheusMetricsBackend::dump(std::ostream &os)
+{
+	os << prometheus::TextSerializer().Serialize(m_registry->Collect());
+}
+
 MetricsBackend *createPrometheusMetricsBackend()
 {
 	std::string addr;
@@ -18,10 +18,38 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #pragma once
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <ostream>
+#include <vector>
 #include "config.h"
 #include "util/thread.h"
 
+/*
+	The simple metrics are lock-free. Counters and histograms are split in
+	shards, every thread adds to its own one and reading sums them up.
+*/
+#define METRIC_SHARDS 16
+
+// Index of the shard used by the calling thread
+size_t getMetricShard();
+
+inline void metricAtomicAdd(std::atomic<double> &value, double number)
+{
+	double old = value.load(std::memory_order_relaxed);
+	while (!value.compare_exchange_weak(old, old + number,
+			std::memory_order_relaxed))
+		;
+}
+
+// Padded to a cache line so that threads don't write to the same line
+struct MetricShard
+{
+	std::atomic<double> value{0.0};
+	char padding[64 - sizeof(std::atomic<double>)];
+};
+
 class MetricCounter
 {
 public:
@@ -43,28 +71,29 @@ class SimpleMetricCounter : public MetricCounter
 	virtual ~SimpleMetricCounter() {}
 
 	SimpleMetricCounter(const std::string &name, const std::string &help_str) :
-			MetricCounter(), m_name(name), m_help_str(help_str),
-			m_counter(0.0)
+			MetricCounter(), m_name(name), m_help_str(help_str)
 	{
 	}
 
 	virtual void increment(double number)
 	{
-		MutexAutoLock lock(m_mutex);
-		m_counter += number;
+		metricAtomicAdd(m_shards[getMetricShard()].value, number);
 	}
 	virtual double get() const
 	{
-		MutexAutoLock lock(m_mutex);
-		return m_counter;
+		double sum = 0.0;
+		for (const MetricShard &shard : m_shards)
+			sum += shard.value.load(std::memory_order_relaxed);
+		return sum;
 	}
 
+	void dump(std::ostream &os) const;
+
 private:
 	std::string m_name;
 	std::string m_help_str;
 
-	mutable std::mutex m_mutex;
-	double m_counter;
+	MetricShard m_shards[METRIC_SHARDS];
 };
 
 class MetricGauge
@@ -95,31 +124,94 @@ class SimpleMetricGauge : public MetricGauge
 
 	virtual void increment(double number)
 	{
-		MutexAutoLock lock(m_mutex);
-		m_gauge += number;
+		metricAtomicAdd(m_gauge, number);
 	}
 	virtual void decrement(double number)
 	{
-		MutexAutoLock lock(m_mutex);
-		m_gauge -= number;
+		metricAtomicAdd(m_gauge, -number);
 	}
 	virtual void set(double number)
 	{
-		MutexAutoLock lock(m_mutex);
-		m_gauge = number;
+		m_gauge.store(number, std::memory_order_relaxed);
 	}
 	virtual double get() const
 	{
-		MutexAutoLock lock(m_mutex);
-		return m_gauge;
+		return m_gauge.load(std::memory_order_relaxed);
 	}
 
+	void dump(std::ostream &os) const;
+
 private:
 	std::string m_name;
 	std::string m_help_str;
 
-	mutable std::mutex m_mutex;
-	double m_gauge;
+	// A gauge can be set, so it is not sharded
+	std::atomic<double> m_gauge;
+};
+
+class MetricHistogram
+{
+public:
+	MetricHistogram() = default;
+	virtual ~MetricHistogram() {}
+
+	virtual void observe(double value) = 0;
+};
+
+typedef std::shared_ptr<MetricHistogram> MetricHistogramPtr;
+
+class SimpleMetricHistogram : public MetricHistogram
+{
+public:
+	SimpleMetricHistogram() = delete;
+
+	// bounds are the ascending upper bounds of the buckets,
+	// a last bucket for everything above is added
+	SimpleMetricHistogram(const std::string &name, const std::string &help_str,
+			const std::vector<double> &bounds);
+
+	virtual ~SimpleMetricHistogram() {}
+
+	virtual void observe(double value);
+
+	const std::vector<double> &getBounds() const { return m_bounds; }
+	// Cumulative count of every bucket, the last one is the total count
+	std::vector<u64> getCounts() const;
+	double getSum() const;
+
+	void dump(std::ostream &os) const;
+
+private:
+	std::string m_name;
+	std::string m_help_str;
+
+	std::vector<double> m_bounds;
+	// Bucket counts of each shard, m_stride apart to avoid sharing cache lines
+	size_t m_stride;
+	std::unique_ptr<std::atomic<u64>[]> m_counts;
+	MetricShard m_sums[METRIC_SHARDS];
+};
+
+// Observes the lifetime of the object in seconds
+class ScopeMetricTimer
+{
+public:
+	ScopeMetricTimer(const MetricHistogramPtr &histogram) :
+			m_histogram(histogram.get()),
+			m_start(std::chrono::steady_clock::now())
+	{
+	}
+
+	~ScopeMetricTimer()
+	{
+		std::chrono::duration<double> elapsed =
+				std::chrono::steady_clock::now() - m_start;
+		m_histogram->observe(elapsed.count());
+	}
+
+private:
+	MetricHistogram *m_histogram;
+	std::chrono::steady_clock::time_point m_start;
 };
 
 class MetricsBackend
@@ -133,6 +225,21 @@ class MetricsBackend
 			const std::string &name, const std::string &help_str);
 	virtual MetricGaugePtr addGauge(
 			const std::string &name, const std::string &help_str);
+	virtual MetricHistogramPtr addHistogram(
+			const std::string &name, const std::string &help_str,
+			const std::vector<double> &bounds);
+
+	// Writes every metric in the Prometheus text format
+	virtual void dump(std::ostream &os);
+
+	// Bucket bounds for durations of (parts of) a server step, in seconds
+	static const std::vector<double> &getStepTimeBounds();
+
+private:
+	std::mutex m_mutex;
+	std::vector<std::shared_ptr<SimpleMetricCounter>> m_counters;
+	std::vector<std::shared_ptr<SimpleMetricGauge>> m_gauges;
+	std::vector<std::shared_ptr<SimpleMetricHistogram>> m_histograms;
 };
 
 #if USE_PROMETHEUS
@@ -0,0 +1,119 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "workerpool.h"
+#include <algorithm>
+#include "debug.h"
+#include "thread.h"
+
+class WorkerPool::WorkerThread : public Thread
+{
+public:
+	WorkerThread(WorkerPool *pool, const std::string &name) :
+		Thread(name), m_pool(pool)
+	{}
+
+	void *run()
+	{
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		while (true) {
+			m_pool->m_start.wait();
+			if (stopRequested())
+				break;
+			m_pool->work();
+			m_pool->m_done.post();
+		}
+
+		END_DEBUG_EXCEPTION_HANDLER
+		return nullptr;
+	}
+
+private:
+	WorkerPool *m_pool;
+};
+
+WorkerPool::WorkerPool(const std::string &name, u32 num_threads) :
+	m_next(0)
+{
+	for (u32 i = 0; i < num_threads; i++) {
+		WorkerThread *thread = new WorkerThread(this, name + "Worker");
+		m_threads.push_back(thread);
+		thread->start();
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	MutexAutoLock lock(m_run_mutex);
+
+	if (m_threads.empty())
+		return;
+
+	for (WorkerThread *thread : m_threads)
+		thread->stop();
+	m_start.post(m_threads.size());
+
+	for (WorkerThread *thread : m_threads) {
+		thread->wait();
+		delete thread;
+	}
+}
+
+void WorkerPool::work()
+{
+	size_t i;
+	while ((i = m_next++) < m_count) {
+		try {
+			(*m_fn)(i);
+		} catch (...) {
+			MutexAutoLock lock(m_error_mutex);
+			if (!m_error)
+				m_error = std::current_exception();
+			// Skip the remaining work
+			m_next = m_count;
+		}
+	}
+}
+
+void WorkerPool::parallelFor(size_t count, const std::function<void(size_t)> &fn)
+{
+	MutexAutoLock lock(m_run_mutex, std::defer_lock);
+	if (m_threads.empty() || count < 2 || !lock.try_lock()) {
+		for (size_t i = 0; i < count; i++)
+			fn(i);
+		return;
+	}
+
+	m_fn = &fn;
+	m_count = count;
+	m_next = 0;
+	m_error = nullptr;
+
+	// Don't wake more threads than there is work for
+	u32 num_woken = std::min<size_t>(m_threads.size(), count - 1);
+	m_start.post(num_woken);
+	work();
+	for (u32 i = 0; i < num_woken; i++)
+		m_done.wait();
+
+	m_fn = nullptr;
+	if (m_error)
+		std::rethrow_exception(m_error);
+}
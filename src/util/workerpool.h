@@ -0,0 +1,79 @@
+/*
+MultiCraft
+Copyright (C) 2026 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "IrrCompileConfig.h"
+#include "irrlichttypes.h"
+#include "util/basic_macros.h"
+#ifdef _IRR_COMPILE_WITH_SDL_DEVICE_
+#include "threading/sdl_semaphore.h"
+#else
+#include "threading/semaphore.h"
+#endif
+
+/*
+	A fixed set of worker threads for data-parallel loops.
+
+	parallelFor() hands out indices to the workers and to the calling
+	thread, and returns once every index has been processed. Only one
+	loop runs on the workers at a time; a caller that finds them busy,
+	e.g. one of several emerge threads, runs its loop by itself instead
+	of waiting for the other one to finish.
+*/
+class WorkerPool
+{
+public:
+	// A pool with zero threads runs everything on the calling thread
+	WorkerPool(const std::string &name, u32 num_threads);
+	~WorkerPool();
+	DISABLE_CLASS_COPY(WorkerPool);
+
+	u32 getThreadCount() const { return m_threads.size(); }
+
+	// Calls fn(i) for every i in [0, count). fn must be thread-safe.
+	// The first exception thrown by fn is rethrown here.
+	void parallelFor(size_t count, const std::function<void(size_t)> &fn);
+
+private:
+	class WorkerThread;
+	friend class WorkerThread;
+
+	// Processes indices until none are left
+	void work();
+
+	std::vector<WorkerThread *> m_threads;
+
+	std::mutex m_run_mutex;
+	Semaphore m_start;
+	Semaphore m_done;
+
+	const std::function<void(size_t)> *m_fn = nullptr;
+	size_t m_count = 0;
+	std::atomic<size_t> m_next;
+
+	std::mutex m_error_mutex;
+	std::exception_ptr m_error;
+};